@@ -0,0 +1,1074 @@
+/* limhamn_bench - Microbenchmarks and load tests for the limhamn headers.
+ *
+ * Writes the results as JSON, to stdout or to the file given with --output, so runs can be compared
+ * between releases. Progress is written to stderr. Run with --help for the options.
+ *
+ * Input data is generated from --seed with the raw std::mt19937 output, which is the same on every
+ * standard library, so two runs with the same seed measure the same work.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <future>
+#include <unistd.h>
+
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#define LIMHAMN_ARGUMENT_MANAGER_IMPL
+#define LIMHAMN_DATABASE_SQLITE3
+#define LIMHAMN_DATABASE_ICONV
+#define LIMHAMN_DATABASE_IMPL
+#define LIMHAMN_HTTP_CLIENT_IMPL
+#define LIMHAMN_HTTP_SERVER_IMPL
+#define LIMHAMN_HTTP_UTILS_IMPL
+#define LIMHAMN_INI_PARSER_IMPL
+#define LIMHAMN_LOGGER_IMPL
+
+#include <limhamn/argument_manager/argument_manager.hpp>
+#include <limhamn/database/database.hpp>
+#include <limhamn/http/http_server.hpp>
+#include <limhamn/http/http_client.hpp>
+#include <limhamn/http/http_utils.hpp>
+#include <limhamn/ini/ini_parser.hpp>
+#include <limhamn/logger/logger.hpp>
+
+// both need libraries the other headers do not; CMakeLists.txt defines these when it finds them
+#ifdef LIMHAMN_BENCH_UDS
+#define LIMHAMN_SOCKET_UDS_IMPL
+#include <limhamn/socket/socket_uds.hpp>
+#endif
+#ifdef LIMHAMN_BENCH_PRIMITIVE
+#define LIMHAMN_PRIMITIVE_IMPL
+#include <limhamn/primitive/primitive.hpp>
+#endif
+
+#ifndef LIMHAMN_VERSION
+#define LIMHAMN_VERSION "unknown"
+#endif
+#ifndef LIMHAMN_BENCH_BUILD_TYPE
+#define LIMHAMN_BENCH_BUILD_TYPE "unknown"
+#endif
+
+namespace bench {
+    using clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Settings for a run, set from the command line
+     */
+    struct settings {
+        std::vector<std::string> filters{}; // benchmarks whose name contains one of these are run, all if empty
+        std::string output{}; // file the JSON is written to, stdout if empty
+        std::uint32_t seed{42};
+        int repetitions{5}; // timed batches per microbenchmark; the median is reported
+        int64_t min_time{100}; // milliseconds each batch runs for at least
+        int connections{4}; // concurrent clients in the load tests
+        int requests{2000}; // requests per client in the load tests, after the warmup
+        int warmup{100}; // untimed requests per client before the load tests start
+        int server_threads{1};
+        int port{18080};
+        bool list{false};
+    };
+
+    /**
+     * @brief One benchmark result
+     * @note  Latencies are only filled in by the load tests; bytes only when the benchmark processes a known amount of data.
+     */
+    struct result {
+        std::string name{};
+        std::string kind{}; // "micro" or "load"
+        std::uint64_t iterations{}; // per batch for micro, in total for load
+        double ns_per_op{}; // median over the batches
+        double ns_per_op_min{};
+        double ns_per_op_max{};
+        double ops_per_sec{};
+        double bytes_per_sec{};
+        std::uint64_t errors{};
+        int connections{};
+        std::vector<std::pair<std::string, double>> latency_us{}; // p50, p90, p99, p999, max
+        std::vector<std::pair<std::string, std::string>> parameters{};
+    };
+
+    /**
+     * @brief Keep the compiler from optimizing away a value that is otherwise unused
+     */
+    template <typename T>
+    inline void keep(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+        asm volatile("" : : "r"(&value) : "memory");
+#else
+        static volatile const void* sink;
+        sink = &value;
+#endif
+    }
+
+    class runner {
+        settings config{};
+        std::vector<result> results{};
+    public:
+        explicit runner(settings config) : config(std::move(config)) {}
+
+        [[nodiscard]] const settings& get_settings() const {
+            return config;
+        }
+
+        [[nodiscard]] bool enabled(const std::string& name) const {
+            if (config.list) {
+                std::cout << name << "\n";
+                return false;
+            }
+            if (config.filters.empty()) {
+                return true;
+            }
+            return std::any_of(config.filters.begin(), config.filters.end(), [&name](const std::string& it) {
+                return name.find(it) != std::string::npos;
+            });
+        }
+
+        /**
+         * @brief Time a function, calling it in batches that each take at least min_time
+         * @param name The name of the benchmark
+         * @param bytes The bytes processed by one call, 0 if not meaningful
+         * @param f The function; it should pass what it computes to keep()
+         */
+        template <typename F>
+        void micro(const std::string& name, const std::size_t bytes, F&& f) {
+            if (!enabled(name)) {
+                return;
+            }
+
+            const auto batch = [&f](const std::uint64_t iterations) {
+                const auto start = clock::now();
+                for (std::uint64_t i{0}; i < iterations; ++i) {
+                    f();
+                }
+                return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+            };
+
+            // calibrating doubles as the warmup
+            const double target = static_cast<double>(config.min_time) * 1e6;
+            std::uint64_t iterations{1};
+            for (double elapsed = batch(iterations); elapsed < target; elapsed = batch(iterations)) {
+                const double scale = elapsed > 0 ? target / elapsed * 1.2 : 10.0;
+                iterations = static_cast<std::uint64_t>(std::ceil(static_cast<double>(iterations) * std::clamp(scale, 1.5, 10.0)));
+            }
+
+            std::vector<double> samples{};
+            for (int i{0}; i < std::max(config.repetitions, 1); ++i) {
+                samples.push_back(batch(iterations) / static_cast<double>(iterations));
+            }
+            std::sort(samples.begin(), samples.end());
+
+            result ret{};
+            ret.name = name;
+            ret.kind = "micro";
+            ret.iterations = iterations;
+            ret.ns_per_op = samples.at(samples.size() / 2);
+            ret.ns_per_op_min = samples.front();
+            ret.ns_per_op_max = samples.back();
+            ret.ops_per_sec = 1e9 / ret.ns_per_op;
+            ret.bytes_per_sec = static_cast<double>(bytes) * ret.ops_per_sec;
+
+            report(std::move(ret));
+        }
+
+        /**
+         * @brief Run a load test with one thread per client
+         * @param name The name of the benchmark
+         * @param clients Number of clients
+         * @param requests Requests per client, after the warmup
+         * @param make_client Called on each client's thread, returns a function that makes one request and returns
+         *        false on failure. Errors are counted, not retried.
+         * @param ops_per_request Operations one request stands for, e.g. the depth of a pipelined batch
+         */
+        void load(const std::string& name, const int clients, const int requests, const std::function<std::function<bool()>(int)>& make_client,
+                  const std::vector<std::pair<std::string, std::string>>& parameters = {}, const int ops_per_request = 1) {
+            if (!enabled(name)) {
+                return;
+            }
+
+            std::atomic<int> ready{0};
+            std::atomic<bool> go{false};
+            std::atomic<std::uint64_t> errors{0};
+            std::vector<std::vector<double>> latencies(static_cast<std::size_t>(clients));
+            std::vector<std::exception_ptr> failures(static_cast<std::size_t>(clients));
+            std::vector<std::thread> threads{};
+
+            for (int i{0}; i < clients; ++i) {
+                threads.emplace_back([&, i]() {
+                    std::function<bool()> request{};
+                    try {
+                        request = make_client(i);
+                        for (int j{0}; j < config.warmup; ++j) {
+                            static_cast<void>(request());
+                        }
+                    } catch (...) {
+                        failures.at(static_cast<std::size_t>(i)) = std::current_exception();
+                    }
+
+                    ++ready;
+                    while (!go.load()) {
+                        std::this_thread::yield();
+                    }
+                    if (!request) {
+                        return;
+                    }
+
+                    auto& it = latencies.at(static_cast<std::size_t>(i));
+                    it.reserve(static_cast<std::size_t>(requests));
+                    for (int j{0}; j < requests; ++j) {
+                        const auto start = clock::now();
+                        bool ok{false};
+                        try {
+                            ok = request();
+                        } catch (const std::exception&) {}
+                        it.push_back(std::chrono::duration<double, std::micro>(clock::now() - start).count());
+                        if (!ok) {
+                            ++errors;
+                        }
+                    }
+                });
+            }
+
+            while (ready.load() != clients) {
+                std::this_thread::yield();
+            }
+            const auto start = clock::now();
+            go = true;
+            for (auto& it : threads) {
+                it.join();
+            }
+            const double elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+
+            for (const auto& it : failures) {
+                if (it) {
+                    std::rethrow_exception(it);
+                }
+            }
+
+            std::vector<double> all{};
+            for (const auto& it : latencies) {
+                all.insert(all.end(), it.begin(), it.end());
+            }
+            std::sort(all.begin(), all.end());
+
+            const auto percentile = [&all](const double p) {
+                if (all.empty()) {
+                    return 0.0;
+                }
+                const auto index = static_cast<std::size_t>(std::ceil(p / 100.0 * static_cast<double>(all.size()))) ;
+                return all.at(std::min(index == 0 ? 0 : index - 1, all.size() - 1));
+            };
+
+            result ret{};
+            ret.name = name;
+            ret.kind = "load";
+            ret.iterations = all.size() * static_cast<std::uint64_t>(ops_per_request);
+            ret.ns_per_op = ret.iterations ? elapsed / static_cast<double>(ret.iterations) : 0.0;
+            ret.ns_per_op_min = ret.ns_per_op;
+            ret.ns_per_op_max = ret.ns_per_op;
+            ret.ops_per_sec = elapsed > 0 ? static_cast<double>(ret.iterations) / elapsed * 1e9 : 0.0;
+            ret.errors = errors.load();
+            ret.connections = clients;
+            ret.latency_us = {{"p50", percentile(50)}, {"p90", percentile(90)}, {"p99", percentile(99)}, {"p999", percentile(99.9)},
+                              {"max", all.empty() ? 0.0 : all.back()}};
+            ret.parameters = parameters;
+
+            report(std::move(ret));
+        }
+
+        /**
+         * @brief Write the results as JSON
+         */
+        void write(std::ostream& out) const;
+    private:
+        void report(result ret) {
+            std::cerr << std::left << std::setw(48) << ret.name << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(14) << ret.ns_per_op << " ns/op" << std::setw(14) << ret.ops_per_sec << " ops/s";
+            if (ret.bytes_per_sec > 0) {
+                std::cerr << std::setw(10) << ret.bytes_per_sec / (1024 * 1024) << " MiB/s";
+            }
+            for (const auto& it : ret.latency_us) {
+                if (it.first == "p50" || it.first == "p99") {
+                    std::cerr << "  " << it.first << " " << it.second << " us";
+                }
+            }
+            if (ret.errors) {
+                std::cerr << "  errors " << ret.errors;
+            }
+            std::cerr << std::endl;
+
+            results.push_back(std::move(ret));
+        }
+    };
+
+    inline std::string json_string(const std::string_view str) {
+        std::string ret{"\""};
+        for (const char c : str) {
+            switch (c) {
+                case '"': ret += "\\\""; break;
+                case '\\': ret += "\\\\"; break;
+                case '\n': ret += "\\n"; break;
+                case '\t': ret += "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char buf[8];
+                        std::snprintf(buf, sizeof(buf), "\\u%04x", static_cast<unsigned char>(c));
+                        ret += buf;
+                    } else {
+                        ret += c;
+                    }
+            }
+        }
+        return ret + "\"";
+    }
+
+    inline void runner::write(std::ostream& out) const {
+        const auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+        out << std::setprecision(6) << std::defaultfloat;
+        out << "{\n";
+        out << "  \"version\": " << json_string(LIMHAMN_VERSION) << ",\n";
+        out << "  \"build_type\": " << json_string(LIMHAMN_BENCH_BUILD_TYPE) << ",\n";
+#ifdef NDEBUG
+        out << "  \"assertions\": false,\n";
+#else
+        out << "  \"assertions\": true,\n";
+#endif
+#ifdef __VERSION__
+        out << "  \"compiler\": " << json_string(__VERSION__) << ",\n";
+#endif
+        out << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+        out << "  \"timestamp\": " << timestamp << ",\n";
+        out << "  \"settings\": {\"seed\": " << config.seed << ", \"repetitions\": " << config.repetitions
+            << ", \"min_time_ms\": " << config.min_time << ", \"connections\": " << config.connections
+            << ", \"requests\": " << config.requests << ", \"warmup\": " << config.warmup
+            << ", \"server_threads\": " << config.server_threads << "},\n";
+        out << "  \"benchmarks\": [";
+
+        for (std::size_t i{0}; i < results.size(); ++i) {
+            const auto& it = results.at(i);
+
+            out << (i ? ",\n" : "\n") << "    {\"name\": " << json_string(it.name) << ", \"kind\": " << json_string(it.kind)
+                << ", \"iterations\": " << it.iterations << ", \"ns_per_op\": " << it.ns_per_op
+                << ", \"ns_per_op_min\": " << it.ns_per_op_min << ", \"ns_per_op_max\": " << it.ns_per_op_max
+                << ", \"ops_per_sec\": " << it.ops_per_sec;
+            if (it.bytes_per_sec > 0) {
+                out << ", \"bytes_per_sec\": " << it.bytes_per_sec;
+            }
+            if (it.kind == "load") {
+                out << ", \"connections\": " << it.connections << ", \"errors\": " << it.errors << ", \"latency_us\": {";
+                for (std::size_t j{0}; j < it.latency_us.size(); ++j) {
+                    out << (j ? ", " : "") << json_string(it.latency_us.at(j).first) << ": " << it.latency_us.at(j).second;
+                }
+                out << "}";
+            }
+            if (!it.parameters.empty()) {
+                out << ", \"parameters\": {";
+                for (std::size_t j{0}; j < it.parameters.size(); ++j) {
+                    out << (j ? ", " : "") << json_string(it.parameters.at(j).first) << ": " << json_string(it.parameters.at(j).second);
+                }
+                out << "}";
+            }
+            out << "}";
+        }
+
+        out << "\n  ]\n}\n";
+    }
+
+    /**
+     * @brief Deterministic input data
+     * @note  Uses the engine's output directly, since the standard distributions differ between implementations.
+     */
+    class generator {
+        std::mt19937 rng;
+    public:
+        explicit generator(const std::uint32_t seed) : rng(seed) {}
+
+        std::uint32_t next(const std::uint32_t bound) {
+            return static_cast<std::uint32_t>(rng() % bound);
+        }
+
+        std::string text(const std::size_t size, const std::string_view alphabet) {
+            std::string ret{};
+            ret.reserve(size);
+            for (std::size_t i{0}; i < size; ++i) {
+                ret += alphabet[next(static_cast<std::uint32_t>(alphabet.size()))];
+            }
+            return ret;
+        }
+
+        std::string word(const std::size_t min, const std::size_t max) {
+            return text(min + next(static_cast<std::uint32_t>(max - min + 1)), "abcdefghijklmnopqrstuvwxyz_");
+        }
+    };
+
+    /**
+     * @brief A temporary directory, removed with its contents when destroyed
+     */
+    class temporary_directory {
+        std::filesystem::path path{};
+    public:
+        temporary_directory() {
+            path = std::filesystem::temp_directory_path() / ("limhamn_bench_" + std::to_string(::getpid()));
+            std::filesystem::create_directories(path);
+        }
+        ~temporary_directory() {
+            std::error_code ec;
+            std::filesystem::remove_all(path, ec);
+        }
+        temporary_directory(const temporary_directory&) = delete;
+        temporary_directory& operator=(const temporary_directory&) = delete;
+
+        [[nodiscard]] std::string get(const std::string& name) const {
+            return (path / name).string();
+        }
+    };
+
+    void http_utils(runner& run);
+    void ini(runner& run, const temporary_directory& dir);
+    void logger(runner& run, const temporary_directory& dir);
+    void sqlite3(runner& run);
+    void primitive(runner& run);
+    void http_server(runner& run, const temporary_directory& dir);
+    void http_client(runner& run, const temporary_directory& dir);
+    void uds(runner& run, const temporary_directory& dir);
+}
+
+void bench::http_utils(runner& run) {
+    generator gen{run.get_settings().seed};
+
+    // mostly plain text, with the occasional character that needs escaping
+    const std::string plain = gen.text(64 * 1024, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .,-_");
+    std::string mixed = plain;
+    for (std::size_t i{0}; i < mixed.size(); i += 20 + gen.next(40)) {
+        mixed[i] = "<>&\"'/ ?=%"[gen.next(10)];
+    }
+    const std::string escaped = limhamn::http::utils::htmlspecialchars(mixed);
+    const std::string encoded = limhamn::http::utils::urlencode(mixed);
+
+    std::string query{};
+    for (int i{0}; i < 32; ++i) {
+        query += (i ? "&" : "") + gen.word(3, 12) + "=" + limhamn::http::utils::urlencode(gen.word(0, 40));
+    }
+
+    std::string out{};
+    out.reserve(4 * mixed.size());
+
+    run.micro("http_utils/htmlspecialchars/plain_64k", plain.size(), [&]() {
+        out.clear();
+        limhamn::http::utils::htmlspecialchars(plain, out);
+        keep(out);
+    });
+    run.micro("http_utils/htmlspecialchars/mixed_64k", mixed.size(), [&]() {
+        out.clear();
+        limhamn::http::utils::htmlspecialchars(mixed, out);
+        keep(out);
+    });
+    run.micro("http_utils/htmlspecialchars_decode/mixed_64k", escaped.size(), [&]() {
+        out.clear();
+        limhamn::http::utils::htmlspecialchars_decode(escaped, out);
+        keep(out);
+    });
+    run.micro("http_utils/urlencode/mixed_64k", mixed.size(), [&]() {
+        out.clear();
+        limhamn::http::utils::urlencode(mixed, out);
+        keep(out);
+    });
+    run.micro("http_utils/urldecode/mixed_64k", encoded.size(), [&]() {
+        out.clear();
+        limhamn::http::utils::urldecode(encoded, out);
+        keep(out);
+    });
+    run.micro("http_utils/to_hex/64k", plain.size(), [&]() {
+        out.clear();
+        limhamn::http::utils::to_hex(plain, out);
+        keep(out);
+    });
+    run.micro("http_utils/parse_fields/32_fields", query.size(), [&]() {
+        const auto fields = limhamn::http::utils::parse_fields(query);
+        keep(fields);
+    });
+    run.micro("http_utils/for_each_field/32_fields", query.size(), [&]() {
+        std::size_t size{0};
+        limhamn::http::utils::for_each_field(query, [&size](const std::string_view key, const std::string_view value) {
+            size += key.size() + value.size();
+        });
+        keep(size);
+    });
+    run.micro("http_utils/sha256hash/64k", plain.size(), [&]() {
+        const auto hash = limhamn::http::utils::sha256hash(plain);
+        keep(hash);
+    });
+}
+
+void bench::ini(runner& run, const temporary_directory& dir) {
+    generator gen{run.get_settings().seed};
+
+    std::string data{};
+    std::vector<std::pair<std::string, std::string>> keys{};
+    for (int i{0}; i < 500; ++i) {
+        const std::string header = gen.word(4, 16) + "_" + std::to_string(i);
+        data += "[" + header + "]\n";
+        if (i % 10 == 0) {
+            data += "; " + gen.text(40, "abcdefghijklmnopqrstuvwxyz ") + "\n";
+        }
+        for (int j{0}; j < 40; ++j) {
+            const std::string key = gen.word(3, 12) + std::to_string(j);
+            data += key + (j % 2 ? " = " : "=") + gen.text(4 + gen.next(40), "abcdefghijklmnopqrstuvwxyz0123456789 ._/") + "\n";
+            if (j % 8 == 0) {
+                keys.emplace_back(header, key);
+            }
+        }
+        data += "\n";
+    }
+
+    const std::string path = dir.get("bench.ini");
+    std::ofstream(path, std::ios::binary) << data;
+
+    run.micro("ini/ini_parser/parse_20k_keys", data.size(), [&]() {
+        const limhamn::ini::ini_parser parser{data, false};
+        keep(parser);
+    });
+    run.micro("ini/ini_table/parse_20k_keys", data.size(), [&]() {
+        const limhamn::ini::ini_table table{data, false};
+        keep(table);
+    });
+    run.micro("ini/ini_table/parse_file_20k_keys", data.size(), [&]() {
+        const limhamn::ini::ini_table table{path, true};
+        keep(table);
+    });
+
+    const limhamn::ini::ini_table table{data, false};
+    std::size_t index{0};
+    run.micro("ini/ini_table/find", 0, [&]() {
+        const auto& it = keys[index++ % keys.size()];
+        const auto value = table.find(it.first, it.second);
+        keep(value);
+    });
+}
+
+void bench::logger(runner& run, const temporary_directory& dir) {
+    generator gen{run.get_settings().seed};
+    const std::string message = gen.text(120, "abcdefghijklmnopqrstuvwxyz0123456789 ");
+
+    const auto make = [&dir](const std::string& name, const bool async) {
+        limhamn::logger::logger_properties prop{};
+        prop.output_to_std = false;
+        prop.output_to_file = true;
+        prop.access_log_file = dir.get(name + "_access.log");
+        prop.error_log_file = dir.get(name + "_error.log");
+        prop.warning_log_file = dir.get(name + "_warning.log");
+        prop.notice_log_file = dir.get(name + "_notice.log");
+        prop.async = async;
+        prop.async_overflow = limhamn::logger::overflow::block;
+        return prop;
+    };
+
+    if (run.enabled("logger/write_to_log/sync")) {
+        const limhamn::logger::logger log{make("sync", false)};
+        run.micro("logger/write_to_log/sync", message.size(), [&]() {
+            log.write_to_log(limhamn::logger::type::notice, message);
+        });
+    }
+    if (run.enabled("logger/write_to_log/async")) {
+        // includes the time the queue blocks for once it fills, so this is the sustained rate rather than the enqueue cost
+        const limhamn::logger::logger log{make("async", true)};
+        run.micro("logger/write_to_log/async", message.size(), [&]() {
+            log.write_to_log(limhamn::logger::type::notice, message);
+        });
+    }
+    if (run.enabled("logger/log/async_format")) {
+        const limhamn::logger::logger log{make("format", true)};
+        int i{0};
+        run.micro("logger/log/async_format", 0, [&]() {
+            log.log(limhamn::logger::type::notice, "request {} took {} us", ++i, 42.5);
+        });
+    }
+}
+
+void bench::sqlite3(runner& run) {
+    generator gen{run.get_settings().seed};
+
+    limhamn::database::sqlite3_database db{":memory:"};
+    if (!db.exec("CREATE TABLE bench (id INTEGER PRIMARY KEY, name TEXT, email TEXT, score REAL, created INTEGER);")) {
+        throw std::runtime_error{"failed to create the sqlite3 table"};
+    }
+
+    std::vector<std::tuple<int64_t, std::string, std::string, double, int64_t>> rows{};
+    std::size_t bytes{0};
+    for (int64_t i{0}; i < 10000; ++i) {
+        rows.emplace_back(i, gen.word(4, 24), gen.word(4, 16) + "@example.com", static_cast<double>(gen.next(100000)) / 100.0,
+                          1700000000 + gen.next(100000000));
+        bytes += std::get<1>(rows.back()).size() + std::get<2>(rows.back()).size() + 3 * 8;
+    }
+    static_cast<void>(db.bulk_insert("bench", {"id", "name", "email", "score", "created"}, rows));
+
+    run.micro("sqlite3/query/10k_rows", bytes, [&]() {
+        const auto result = db.query("SELECT id, name, email, score, created FROM bench;");
+        keep(result);
+    });
+    run.micro("sqlite3/query/10k_rows_parameterized", bytes, [&]() {
+        const auto result = db.query("SELECT id, name, email, score, created FROM bench WHERE id >= $1;", 0);
+        keep(result);
+    });
+    run.micro("sqlite3/for_each/10k_rows", bytes, [&]() {
+        std::size_t size{0};
+        static_cast<void>(db.for_each("SELECT id, name, email, score, created FROM bench WHERE id >= $1;", [&size](const limhamn::database::sqlite3_row& row) {
+            size += static_cast<std::size_t>(row.get<int64_t>(0)) + row.get<std::string_view>(1).size() + row.get<std::string_view>(2).size();
+        }, 0));
+        keep(size);
+    });
+    run.micro("sqlite3/query/point_lookup", 0, [&]() {
+        const auto result = db.query("SELECT name, email FROM bench WHERE id = $1;", static_cast<int64_t>(gen.next(10000)));
+        keep(result);
+    });
+}
+
+void bench::primitive(runner& run) {
+#ifdef LIMHAMN_BENCH_PRIMITIVE
+    generator gen{run.get_settings().seed};
+
+    std::vector<std::string> words{};
+    for (int i{0}; i < 4096; ++i) {
+        words.push_back(gen.text(4 + gen.next(28), "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 "));
+    }
+    const std::string line = gen.text(512, "abcdefghijklmnopqrstuvwxyz ");
+    const std::string markup = "<b>" + line.substr(0, 64) + "</b> " + line.substr(64, 64);
+
+    const auto measure = [&](const std::string& name, const std::size_t cache_size, const bool ascii_fast_path, const bool use_markup) {
+        if (!run.enabled(name)) {
+            return;
+        }
+
+        limhamn::primitive::font_manager font{};
+        font.init_font("Sans 12");
+        font.set_cache_size(cache_size);
+        font.set_ascii_fast_path(ascii_fast_path);
+
+        std::size_t index{0};
+        run.micro(name, 0, [&]() {
+            const auto size = font.estimate_length(use_markup ? markup : words[index++ % words.size()], -1, use_markup);
+            keep(size);
+        });
+    };
+
+    measure("primitive/estimate_length/pango", 0, false, false);
+    measure("primitive/estimate_length/ascii_fast_path", 0, true, false);
+    measure("primitive/estimate_length/cached", 8192, false, false);
+    measure("primitive/estimate_length/markup", 0, false, true);
+
+    if (run.enabled("primitive/fit_length/512")) {
+        limhamn::primitive::font_manager font{};
+        font.init_font("Sans 12");
+        font.set_cache_size(0);
+        font.set_ascii_fast_path(false);
+
+        run.micro("primitive/fit_length/512", line.size(), [&]() {
+            const auto length = font.fit_length(line, 300, false);
+            keep(length);
+        });
+    }
+#else
+    static_cast<void>(run);
+#endif
+}
+
+namespace bench {
+    /**
+     * @brief A blocking keep-alive HTTP/1.1 client for the load tests
+     * @note  Kept separate from limhamn::http::client so the server is measured with a client whose cost does not change between releases.
+     */
+    class http_connection {
+        boost::asio::io_context ioc{};
+        boost::beast::tcp_stream stream{ioc};
+        boost::beast::flat_buffer buffer{};
+        boost::asio::ip::tcp::endpoint endpoint{};
+        std::string cookie{};
+        bool open{false};
+        bool keep_alive{true};
+        bool session{false};
+    public:
+        http_connection(const int port, const bool keep_alive, const bool session)
+            : endpoint(boost::asio::ip::make_address("127.0.0.1"), static_cast<unsigned short>(port)), keep_alive(keep_alive), session(session) {}
+
+        ~http_connection() {
+            close();
+        }
+
+        void close() {
+            if (open) {
+                boost::beast::error_code ec;
+                stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec);
+                stream.close();
+                open = false;
+            }
+        }
+
+        bool request(const std::string& target) {
+            if (!open) {
+                stream.connect(endpoint);
+                stream.socket().set_option(boost::asio::ip::tcp::no_delay(true));
+                buffer.clear();
+                open = true;
+            }
+
+            boost::beast::http::request<boost::beast::http::empty_body> req{boost::beast::http::verb::get, target, 11};
+            req.set(boost::beast::http::field::host, "127.0.0.1");
+            req.keep_alive(keep_alive);
+            if (!cookie.empty()) {
+                req.set(boost::beast::http::field::cookie, cookie);
+            }
+
+            boost::beast::http::response<boost::beast::http::string_body> res{};
+            try {
+                boost::beast::http::write(stream, req);
+                boost::beast::http::read(stream, buffer, res);
+            } catch (const std::exception&) {
+                open = true;
+                close();
+                throw;
+            }
+
+            // keep the session the server gave us, so every request loads and stores an existing one
+            if (session && cookie.empty()) {
+                const auto range = res.base().equal_range(boost::beast::http::field::set_cookie);
+                for (auto it = range.first; it != range.second; ++it) {
+                    const std::string value{it->value()};
+                    if (value.rfind("session_id=", 0) == 0) {
+                        cookie = value.substr(0, value.find(';'));
+                    }
+                }
+            }
+
+            if (!keep_alive || !res.keep_alive()) {
+                close();
+            }
+
+            return res.result_int() == 200;
+        }
+    };
+
+    /**
+     * @brief Runs a limhamn::http::server on a background thread for as long as it exists
+     */
+    class server_thread {
+        std::thread thread{};
+        std::atomic<bool> failed{false};
+    public:
+        server_thread(const limhamn::http::server::server_settings& settings, const std::function<limhamn::http::server::response(const limhamn::http::server::request&)>& callback) {
+            thread = std::thread([this, settings, callback]() {
+                try {
+                    limhamn::http::server::server{settings, callback};
+                } catch (const std::exception& e) {
+                    std::cerr << "limhamn_bench: server failed: " << e.what() << std::endl;
+                }
+                failed = true;
+            });
+
+            // the server only becomes stoppable once it accepts
+            const auto deadline = clock::now() + std::chrono::seconds(10);
+            for (;;) {
+                try {
+                    http_connection connection{settings.port, false, false};
+                    static_cast<void>(connection.request("/"));
+                    return;
+                } catch (const std::exception&) {}
+
+                if (failed || clock::now() > deadline) {
+                    thread.join();
+                    throw std::runtime_error{"the server did not start on port " + std::to_string(settings.port)};
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        ~server_thread() {
+            limhamn::http::server::server::stop();
+            thread.join();
+        }
+        server_thread(const server_thread&) = delete;
+        server_thread& operator=(const server_thread&) = delete;
+    };
+
+    inline limhamn::http::server::server_settings server_settings(const settings& config, const temporary_directory& dir) {
+        limhamn::http::server::server_settings ret{};
+        ret.port = config.port;
+        ret.threads = config.server_threads;
+        ret.enable_session = false;
+        ret.session_directory = dir.get("sessions");
+        ret.default_rate_limit = -1;
+        ret.max_keep_alive_requests = -1;
+        return ret;
+    }
+
+    inline limhamn::http::server::response server_callback(const limhamn::http::server::request& req) {
+        limhamn::http::server::response response{};
+        response.content_type = "text/plain";
+        response.body = "Hello, world!";
+
+        if (!req.session_id.empty()) {
+            const auto it = req.session.find("count");
+            response.session["count"] = std::to_string(it == req.session.end() ? 1 : std::stoll(it->second) + 1);
+        }
+
+        return response;
+    }
+}
+
+void bench::http_server(runner& run, const temporary_directory& dir) {
+    const auto& config = run.get_settings();
+
+    struct scenario {
+        std::string name{};
+        bool keep_alive{true};
+        std::string session{}; // "", "memory" or "file"
+    };
+    const std::vector<scenario> scenarios{
+        {"http_server/keep_alive", true, ""},
+        {"http_server/close", false, ""},
+        {"http_server/keep_alive/memory_session", true, "memory"},
+        {"http_server/close/memory_session", false, "memory"},
+        {"http_server/keep_alive/file_session", true, "file"},
+    };
+
+    for (const auto& it : scenarios) {
+        if (!run.enabled(it.name)) {
+            continue;
+        }
+
+        auto settings = server_settings(config, dir);
+        if (!it.session.empty()) {
+            std::filesystem::create_directories(settings.session_directory);
+            settings.enable_session = true;
+            if (it.session == "memory") {
+                settings.session_store = std::make_shared<limhamn::http::server::memory_session_store>();
+            }
+        }
+
+        const server_thread server{settings, server_callback};
+        run.load(it.name, config.connections, config.requests, [&](int) {
+            auto connection = std::make_shared<http_connection>(config.port, it.keep_alive, !it.session.empty());
+            return [connection]() {
+                return connection->request("/bench");
+            };
+        }, {{"server_threads", std::to_string(config.server_threads)}});
+    }
+}
+
+void bench::http_client(runner& run, const temporary_directory& dir) {
+    const auto& config = run.get_settings();
+
+    const std::vector<std::string> names{"http_client/sequential", "http_client/pooled", "http_client/pooled_concurrent"};
+    if (std::none_of(names.begin(), names.end(), [&run](const std::string& it) { return run.enabled(it); })) {
+        return;
+    }
+
+    const server_thread server{server_settings(config, dir), server_callback};
+
+    limhamn::http::client::request request{};
+    request.host = "127.0.0.1";
+    request.endpoint = "/bench";
+    request.port = static_cast<unsigned int>(config.port);
+
+    // one connection per request
+    run.load(names.at(0), 1, config.requests, [&](int) {
+        return [&request]() {
+            auto copy = request;
+            return limhamn::http::client::client{copy}.make_request().http_status == 200;
+        };
+    });
+
+    limhamn::http::client::client_pool pool{{static_cast<std::size_t>(config.connections), static_cast<std::size_t>(config.connections)}};
+    run.load(names.at(1), 1, config.requests, [&](int) {
+        return [&]() {
+            return pool.make_request(request).http_status == 200;
+        };
+    });
+    run.load(names.at(2), config.connections, config.requests, [&](int) {
+        return [&]() {
+            return pool.make_request(request).http_status == 200;
+        };
+    });
+}
+
+void bench::uds(runner& run, const temporary_directory& dir) {
+#ifdef LIMHAMN_BENCH_UDS
+    const auto& config = run.get_settings();
+    generator gen{config.seed};
+
+    struct scenario {
+        std::string name{};
+        std::size_t size{};
+        int depth{1}; // requests sent before waiting for the replies
+        bool shared_memory{false};
+    };
+    const std::vector<scenario> scenarios{
+        {"uds/round_trip/64b", 64, 1, false},
+        {"uds/round_trip/64k", 64 * 1024, 1, false},
+        {"uds/pipelined_32/64b", 64, 32, false},
+        {"uds/round_trip/64k/shared_memory", 64 * 1024, 1, true},
+    };
+
+    for (const auto& it : scenarios) {
+        if (!run.enabled(it.name)) {
+            continue;
+        }
+
+        limhamn::socket::uds_server_settings settings{};
+        settings.framing = limhamn::socket::uds_framing::length_prefixed;
+        settings.threads = config.server_threads;
+        settings.shared_memory = it.shared_memory;
+
+        const std::string path = dir.get("bench.sock");
+        limhamn::socket::uds_server server{path, [](const std::string& data) { return data; }, settings, false};
+        std::thread thread{[&server]() {
+            server.run();
+        }};
+
+        const std::string payload = gen.text(it.size, "abcdefghijklmnopqrstuvwxyz0123456789");
+        try {
+            run.load(it.name, config.connections, config.requests / it.depth, [&](int) {
+                auto client = std::make_shared<limhamn::socket::uds_client>(path, settings);
+                if (it.shared_memory && !client->enable_shared_memory()) {
+                    throw std::runtime_error{"the uds_server did not accept shared memory"};
+                }
+                return [client, &payload, &it]() {
+                    for (int i{0}; i < it.depth; ++i) {
+                        client->send(payload);
+                    }
+                    bool ok{true};
+                    for (int i{0}; i < it.depth; ++i) {
+                        ok = client->receive().size() == payload.size() && ok;
+                    }
+                    return ok;
+                };
+            }, {{"payload_bytes", std::to_string(it.size)}, {"depth", std::to_string(it.depth)}}, it.depth);
+        } catch (...) {
+            server.stop();
+            thread.join();
+            throw;
+        }
+
+        server.stop();
+        thread.join();
+    }
+#else
+    static_cast<void>(run);
+    static_cast<void>(dir);
+#endif
+}
+
+int main(int argc, char** argv) {
+    bench::settings config{};
+
+    const auto value = [](limhamn::argument_manager::collection& c) -> std::string {
+        if (c.index + 1 >= c.arguments.size()) {
+            throw std::invalid_argument{c.arguments.at(c.index) + " needs a value"};
+        }
+        return c.arguments.at(++c.index);
+    };
+    const auto number = [&value](limhamn::argument_manager::collection& c, const int64_t min) -> int64_t {
+        const std::string str = value(c);
+        std::size_t end{0};
+        int64_t ret{0};
+        try {
+            ret = std::stoll(str, &end);
+        } catch (const std::exception&) {
+            end = 0;
+        }
+        if (end != str.size() || ret < min) {
+            throw std::invalid_argument{c.arguments.at(c.index - 1) + " needs an integer of at least " + std::to_string(min) + ", not '" + str + "'"};
+        }
+        return ret;
+    };
+
+    limhamn::argument_manager::argument_manager args{argc, argv};
+    args.push_back("-h|--help", [](limhamn::argument_manager::collection&) {
+        std::cout << "usage: limhamn_bench [options]\n"
+                     "  -f, --filter NAME       run only benchmarks whose name contains NAME; may be repeated\n"
+                     "  -l, --list              list the benchmarks instead of running them\n"
+                     "  -o, --output FILE       write the JSON results to FILE instead of stdout\n"
+                     "  -r, --repetitions N     timed batches per microbenchmark, the median is reported (5)\n"
+                     "  -t, --min-time MS       milliseconds each microbenchmark batch runs for at least (100)\n"
+                     "  -c, --connections N     concurrent clients in the load tests (4)\n"
+                     "  -n, --requests N        requests per client in the load tests (2000)\n"
+                     "  -w, --warmup N          untimed requests per client before each load test (100)\n"
+                     "  -s, --server-threads N  threads the servers run on, 0 for one per core (1)\n"
+                     "  -p, --port N            port the HTTP server listens on (18080)\n"
+                     "      --seed N            seed for the generated input data (42)\n";
+        std::exit(EXIT_SUCCESS);
+    });
+    args.push_back("-f|--filter", [&](limhamn::argument_manager::collection& c) { config.filters.push_back(value(c)); });
+    args.push_back("-l|--list", [&](limhamn::argument_manager::collection&) { config.list = true; });
+    args.push_back("-o|--output", [&](limhamn::argument_manager::collection& c) { config.output = value(c); });
+    args.push_back("-r|--repetitions", [&](limhamn::argument_manager::collection& c) { config.repetitions = static_cast<int>(number(c, 1)); });
+    args.push_back("-t|--min-time", [&](limhamn::argument_manager::collection& c) { config.min_time = number(c, 1); });
+    args.push_back("-c|--connections", [&](limhamn::argument_manager::collection& c) { config.connections = static_cast<int>(number(c, 1)); });
+    args.push_back("-n|--requests", [&](limhamn::argument_manager::collection& c) { config.requests = static_cast<int>(number(c, 1)); });
+    args.push_back("-w|--warmup", [&](limhamn::argument_manager::collection& c) { config.warmup = static_cast<int>(number(c, 0)); });
+    args.push_back("-s|--server-threads", [&](limhamn::argument_manager::collection& c) { config.server_threads = static_cast<int>(number(c, 0)); });
+    args.push_back("-p|--port", [&](limhamn::argument_manager::collection& c) { config.port = static_cast<int>(number(c, 1)); });
+    args.push_back("--seed", [&](limhamn::argument_manager::collection& c) { config.seed = static_cast<std::uint32_t>(number(c, 0)); });
+
+    try {
+        args.execute([](const std::string& arg) {
+            throw std::invalid_argument{"unknown argument '" + arg + "', see --help"};
+        });
+    } catch (const std::exception& e) {
+        std::cerr << "limhamn_bench: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+#ifndef NDEBUG
+    if (!config.list) {
+        std::cerr << "limhamn_bench: built without NDEBUG; configure with -DCMAKE_BUILD_TYPE=Release for numbers worth comparing" << std::endl;
+    }
+#endif
+
+    bench::runner run{config};
+    try {
+        const bench::temporary_directory dir{};
+
+        bench::http_utils(run);
+        bench::ini(run, dir);
+        bench::logger(run, dir);
+        bench::sqlite3(run);
+        bench::primitive(run);
+        bench::http_server(run, dir);
+        bench::http_client(run, dir);
+        bench::uds(run, dir);
+    } catch (const std::exception& e) {
+        std::cerr << "limhamn_bench: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (config.list) {
+        return EXIT_SUCCESS;
+    }
+
+    if (config.output.empty()) {
+        run.write(std::cout);
+    } else {
+        std::ofstream file{config.output};
+        if (!file) {
+            std::cerr << "limhamn_bench: cannot open " << config.output << std::endl;
+            return EXIT_FAILURE;
+        }
+        run.write(file);
+    }
+}
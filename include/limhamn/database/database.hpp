@@ -17,11 +17,21 @@
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
+#include <algorithm>
+#include <optional>
+#include <tuple>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <array>
 #endif
 #include <string>
+#include <string_view>
 #include <vector>
+#include <list>
 #include <unordered_map>
 #include <cstdint>
+#include <type_traits>
 
 #ifndef LIMHAMN_DATABASE_SQLITE3
 #ifndef LIMHAMN_DATABASE_POSTGRESQL
@@ -37,6 +47,14 @@
 #endif
 #ifdef LIMHAMN_DATABASE_POSTGRESQL
 #include <libpq-fe.h>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#if defined(LIMHAMN_DATABASE_IMPL) && !defined(_WIN32)
+#include <cerrno>
+#include <poll.h>
+#endif
 #endif
 #ifdef LIMHAMN_DATABASE_ICONV
 #include <iconv.h>
@@ -53,7 +71,91 @@ namespace limhamn::database {
     */
     std::string remove_non_utf8(const std::string& input);
 
+    /**
+     * @brief Transaction that is rolled back unless it is committed.
+     * @note Works with both sqlite3_database and postgresql_database. Transactions cannot be nested.
+     */
+    template <typename Database>
+    class transaction {
+            Database& db;
+            bool done{false};
+        public:
+            /**
+             * @brief Begin a transaction.
+             * @param db Database to begin the transaction on.
+             * @throws std::runtime_error if the transaction cannot be started.
+             */
+            explicit transaction(Database& db);
+            /**
+             * @brief Commit the transaction.
+             * @throws std::runtime_error if the commit fails. The transaction is over either way.
+             */
+            void commit();
+            /**
+             * @brief Roll back the transaction.
+             */
+            void rollback();
+            /**
+             * @brief Destructor, rolls back the transaction if it has not been committed.
+             */
+            ~transaction();
+            transaction(const transaction&) = delete;
+            transaction& operator=(const transaction&) = delete;
+    };
+
 #ifdef LIMHAMN_DATABASE_SQLITE3
+    class sqlite3_cursor;
+
+    /**
+     * @brief View of the current row of a statement.
+     * @note Only valid until the statement is stepped again. Text and blob views point into SQLite's own buffers.
+     */
+    class sqlite3_row {
+            sqlite3_stmt* stmt{};
+
+            friend class sqlite3_cursor;
+        public:
+            /**
+             * @brief Get the number of columns.
+             * @return int Number of columns.
+             */
+            [[nodiscard]] int size() const;
+            /**
+             * @brief Get the name of a column.
+             * @param index Index of the column, starting at 0.
+             * @return std::string_view Name.
+             */
+            [[nodiscard]] std::string_view name(int index) const;
+            /**
+             * @brief Get the index of a column.
+             * @param name Name of the column.
+             * @return int Index, or -1 if there is no such column.
+             */
+            [[nodiscard]] int index(std::string_view name) const;
+            /**
+             * @brief Check if a column is NULL.
+             * @param index Index of the column, starting at 0.
+             * @return bool True if NULL.
+             */
+            [[nodiscard]] bool is_null(int index) const;
+            /**
+             * @brief Get the value of a column.
+             * @param index Index of the column, starting at 0.
+             * @return T Value. One of int, int64_t, double, bool, std::string or std::string_view.
+             * @note NULL is returned as 0 or an empty string.
+             */
+            template <typename T>
+            [[nodiscard]] T get(int index) const;
+            /**
+             * @brief Get the value of a column.
+             * @param name Name of the column.
+             * @return T Value.
+             * @throws std::out_of_range if there is no such column.
+             */
+            template <typename T>
+            [[nodiscard]] T get(std::string_view name) const;
+    };
+
     /**
      * @brief Class for database operations with SQLite3.
      */
@@ -62,6 +164,39 @@ namespace limhamn::database {
             std::string database{};
             bool is_good{false};
 
+            /**
+             * @brief Prepared statement kept in the statement cache.
+             */
+            struct cached_statement {
+                std::string query{};
+                sqlite3_stmt* stmt{};
+                bool in_use{false};
+            };
+
+            std::list<cached_statement> statements{};
+            std::unordered_map<std::string_view, std::list<cached_statement>::iterator> statement_index{};
+            std::size_t statement_cache_size{64};
+
+            /**
+             * @brief Get a prepared statement for a query, from the statement cache if possible.
+             * @param query Query, with $N placeholders.
+             * @param entry Set to the cache entry, or nullptr if the statement is not cached.
+             * @return sqlite3_stmt* Statement, or nullptr if the query is invalid.
+             */
+            sqlite3_stmt* acquire(const std::string& query, cached_statement*& entry);
+            /**
+             * @brief Return a statement from acquire(), resetting it for the next use.
+             * @param stmt Statement.
+             * @param entry Cache entry from acquire().
+             */
+            static void release(sqlite3_stmt* stmt, cached_statement* entry);
+            /**
+             * @brief Finalize every cached statement.
+             */
+            void clear_statements();
+
+            friend class sqlite3_cursor;
+
             /**
              * @brief Bind parameters to a prepared statement.
              *
@@ -73,14 +208,10 @@ namespace limhamn::database {
             template<typename T, typename... Args>
             void bind_parameters(sqlite3_stmt* stmt, int index, T value, Args... args);
 
-            /**
-             * @brief Temporary storage for data. Do not use this directly.
-             */
-            static std::vector<std::unordered_map<std::string, std::string>> tmp;
             /**
              * @brief Callback function for sqlite3_exec.
              *
-             * @param data Pointer to data.
+             * @param data Pointer to the vector to add the row to.
              * @param argc Number of columns.
              * @param argv Column values.
              * @param name Column names.
@@ -135,6 +266,15 @@ namespace limhamn::database {
              * @param value Value to bind.
              */
             static void bind_parameter(sqlite3_stmt* stmt, int index, const char* value);
+            /**
+             * @brief Bind a value of any supported type, NULL for nullptr or an empty std::optional.
+             *
+             * @param stmt Statement to bind to.
+             * @param index Index of the parameter.
+             * @param value Value to bind.
+             */
+            template <typename T>
+            static void bind_value(sqlite3_stmt* stmt, int index, const T& value);
         public:
             /**
              * @brief Query the database, returning data.
@@ -152,6 +292,37 @@ namespace limhamn::database {
              */
             template <typename... Args>
             std::vector<std::unordered_map<std::string, std::string>> query(const std::string& query, Args... args);
+            /**
+             * @brief Query the database, returning a cursor that steps through the rows one at a time.
+             * @param query Query to execute.
+             * @param args Arguments.
+             * @return sqlite3_cursor Cursor.
+             * @throws std::runtime_error if the query is invalid.
+             */
+            template <typename... Args>
+            sqlite3_cursor cursor(const std::string& query, Args... args);
+            /**
+             * @brief Query the database, calling a function for each row without storing the result.
+             * @param query Query to execute.
+             * @param callback Function taking a const sqlite3_row&. It may return false to stop early.
+             * @param args Arguments.
+             * @return std::size_t Number of rows passed to the callback.
+             * @throws std::runtime_error if the query is invalid or fails.
+             */
+            template <typename F, typename... Args>
+            std::size_t for_each(const std::string& query, F&& callback, Args... args);
+            /**
+             * @brief Insert many rows with one prepared statement, inside a transaction unless one is already open.
+             * @param table Table to insert into. Not escaped.
+             * @param columns Columns to insert. Not escaped.
+             * @param rows Range of rows, each either a tuple or a container with one value per column.
+             *             Values may be integers, floating point numbers, strings, std::optional or nullptr for NULL.
+             * @return std::size_t Number of rows inserted.
+             * @throws std::runtime_error if a row fails to insert. Rows inserted in the implicit transaction are rolled back.
+             * @throws std::invalid_argument if columns is empty.
+             */
+            template <typename Range>
+            std::size_t bulk_insert(const std::string& table, const std::vector<std::string>& columns, const Range& rows);
             /**
              * @brief Query the database, returning data.
              * @param query Query to execute.
@@ -179,6 +350,11 @@ namespace limhamn::database {
              * @param database Database to open.
              */
             void open(const std::string& database);
+            /**
+             * @brief Set the number of prepared statements kept for the parameterized exec, query, cursor and for_each.
+             * @param size Number of statements, 0 to disable the cache. Defaults to 64.
+             */
+            void set_statement_cache_size(std::size_t size);
             /**
              * @brief Close the open database.
              */
@@ -212,12 +388,150 @@ namespace limhamn::database {
              * @brief Destructor.
              */
             ~sqlite3_database();
+            sqlite3_database(const sqlite3_database&) = delete;
+            sqlite3_database& operator=(const sqlite3_database&) = delete;
+    };
+
+    /**
+     * @brief Steps through the rows of a query.
+     * @note The statement goes back to the statement cache when the cursor is destroyed, so the cursor
+     *       must not outlive the database.
+     */
+    class sqlite3_cursor {
+            sqlite3_database* db{};
+            sqlite3_stmt* stmt{};
+            sqlite3_database::cached_statement* entry{};
+            sqlite3_row current{};
+
+            sqlite3_cursor(sqlite3_database* db, sqlite3_stmt* stmt, sqlite3_database::cached_statement* entry);
+
+            friend class sqlite3_database;
+        public:
+            /**
+             * @brief Step to the next row.
+             * @return bool True if there is a row, false at the end of the result.
+             * @throws std::runtime_error if stepping fails.
+             */
+            bool next();
+            /**
+             * @brief Get the current row.
+             * @return const sqlite3_row& Row, valid until next() is called.
+             */
+            [[nodiscard]] const sqlite3_row& row() const;
+
+            sqlite3_cursor(sqlite3_cursor&& other) noexcept;
+            sqlite3_cursor& operator=(sqlite3_cursor&& other) noexcept;
+            sqlite3_cursor(const sqlite3_cursor&) = delete;
+            sqlite3_cursor& operator=(const sqlite3_cursor&) = delete;
+            ~sqlite3_cursor();
     };
 #endif
 
 #ifdef LIMHAMN_DATABASE_POSTGRESQL
+    /**
+     * @brief How postgresql_database::bulk_insert sends rows.
+     */
+    enum class bulk_insert_mode {
+        copy, // COPY FROM STDIN, the fastest
+        values, // multi-row INSERT ... VALUES in batches, for when COPY is not allowed
+    };
+
+    /**
+     * @brief Result of a PostgreSQL query, with values decoded in place.
+     * @note Results from query_binary() are in binary format, so numbers, timestamps and bytea are read
+     *       without parsing text. Strings and bytea can be read as std::string_view, which points into the result.
+     */
+    class postgresql_result {
+            PGresult* res{};
+        public:
+            postgresql_result() = default;
+            /**
+             * @brief Take ownership of a libpq result.
+             * @param res Result.
+             */
+            explicit postgresql_result(PGresult* res);
+            postgresql_result(postgresql_result&& other) noexcept;
+            postgresql_result& operator=(postgresql_result&& other) noexcept;
+            postgresql_result(const postgresql_result&) = delete;
+            postgresql_result& operator=(const postgresql_result&) = delete;
+            ~postgresql_result();
+
+            /**
+             * @brief Check if the query succeeded.
+             * @return bool True if successful.
+             */
+            [[nodiscard]] bool ok() const;
+            /**
+             * @brief Get the error message of a failed query.
+             * @return std::string Error message, or an empty string.
+             */
+            [[nodiscard]] std::string error() const;
+            /**
+             * @brief Get the number of rows.
+             * @return int Number of rows.
+             */
+            [[nodiscard]] int size() const;
+            /**
+             * @brief Get the number of columns.
+             * @return int Number of columns.
+             */
+            [[nodiscard]] int columns() const;
+            /**
+             * @brief Get the number of rows affected by a command.
+             * @return std::int64_t Number of rows.
+             */
+            [[nodiscard]] std::int64_t affected_rows() const;
+            /**
+             * @brief Get the name of a column.
+             * @param column Index of the column, starting at 0.
+             * @return std::string_view Name.
+             */
+            [[nodiscard]] std::string_view name(int column) const;
+            /**
+             * @brief Get the index of a column.
+             * @param name Name of the column.
+             * @return int Index, or -1 if there is no such column.
+             */
+            [[nodiscard]] int index(std::string_view name) const;
+            /**
+             * @brief Check if a value is NULL.
+             * @param row Index of the row, starting at 0.
+             * @param column Index of the column, starting at 0.
+             * @return bool True if NULL.
+             */
+            [[nodiscard]] bool is_null(int row, int column) const;
+            /**
+             * @brief Get a value.
+             * @param row Index of the row, starting at 0.
+             * @param column Index of the column, starting at 0.
+             * @return T Value. An integer or floating point type, bool, std::string, std::string_view,
+             *         std::vector<std::uint8_t> (bytea), std::chrono::system_clock::time_point (timestamp)
+             *         or std::optional of one of those.
+             * @note NULL is returned as a default constructed value, or an empty std::optional.
+             * @throws std::runtime_error if the column's type does not fit T, or a binary value does not have the length of its type.
+             */
+            template <typename T>
+            [[nodiscard]] T get(int row, int column) const;
+            /**
+             * @brief Get a value.
+             * @param row Index of the row, starting at 0.
+             * @param name Name of the column.
+             * @return T Value.
+             * @throws std::out_of_range if there is no such column.
+             */
+            template <typename T>
+            [[nodiscard]] T get(int row, std::string_view name) const;
+            /**
+             * @brief Get the libpq result.
+             * @return PGresult* Result, still owned by this object.
+             */
+            [[nodiscard]] PGresult* native_handle() const;
+    };
+
     /**
      * @brief Class for database operations with PostgreSQL.
+     * @note The templated exec() and query() prepare each distinct query once per connection and
+     *       reuse the named statement afterwards.
      */
     class postgresql_database {
             PGconn* pg_conn{};
@@ -227,6 +541,9 @@ namespace limhamn::database {
             std::string database{};
             bool is_good{false};
             int port{5432};
+            std::unordered_map<std::string, std::string> prepared{};
+            std::size_t prepared_count{0};
+            std::size_t statement_cache_size{64};
 
             /**
              * @brief Convert a value to a string.
@@ -235,6 +552,33 @@ namespace limhamn::database {
              */
             template <typename T>
             std::string to_string(const T& value);
+            /**
+             * @brief Execute a query with parameters through the prepared statement cache.
+             * @return PGresult* Result, owned by the caller.
+             */
+            template <typename... Args>
+            PGresult* exec_params(const std::string& query, Args... args);
+            /**
+             * @brief Execute a query through the prepared statement cache.
+             * @param query Query, with ? placeholders.
+             * @param types Parameter types, empty to let the server infer them.
+             * @return PGresult* Result, owned by the caller.
+             */
+            PGresult* execute(const std::string& query, const std::vector<Oid>& types, int nparams, const char* const* values,
+                const int* lengths, const int* formats, int result_format);
+            /**
+             * @brief Send prepared rows with COPY FROM STDIN.
+             */
+            template <typename Range>
+            std::size_t copy_rows(const std::string& table, const std::string& column_list, std::size_t columns, const Range& rows);
+            /**
+             * @brief Send prepared rows with multi-row INSERT statements.
+             */
+            template <typename Range>
+            std::size_t insert_rows(const std::string& table, const std::string& column_list, std::size_t columns, const Range& rows, std::size_t batch_size);
+
+            friend class postgresql_pool;
+            friend class postgresql_pipeline;
         public:
             /**
              * @brief Query the database, returning data.
@@ -259,6 +603,30 @@ namespace limhamn::database {
              * @return std::vector<std::unordered_map<std::string, std::string>> Data.
              */
             [[nodiscard]] std::vector<std::unordered_map<std::string, std::string>> query(const std::string& query) const;
+            /**
+             * @brief Query the database with parameters and results in binary format.
+             * @param query Query, with ? as parameter placeholders.
+             * @param args Arguments. Integers, floating point numbers, bool, strings, std::vector<std::uint8_t> (bytea),
+             *             std::chrono::system_clock::time_point (timestamptz), std::optional or nullptr for NULL.
+             * @return postgresql_result Result, check ok() for errors.
+             * @note The parameter types are sent along with the query, so integers are int2, int4 or int8 by size.
+             */
+            template <typename... Args>
+            postgresql_result query_binary(const std::string& query, const Args&... args);
+            /**
+             * @brief Insert many rows in as few round trips as possible.
+             * @param table Table to insert into. Not escaped.
+             * @param columns Columns to insert. Not escaped.
+             * @param rows Range of rows, each either a tuple or a container with one value per column.
+             *             Values may be integers, floating point numbers, booleans, strings, std::optional or nullptr for NULL.
+             * @param mode Whether to use COPY or batched INSERT statements.
+             * @param batch_size Rows per INSERT statement in bulk_insert_mode::values.
+             * @return std::size_t Number of rows inserted.
+             * @throws std::runtime_error if the insert fails. No rows are inserted in that case, unless a transaction was already open.
+             * @throws std::invalid_argument if columns is empty.
+             */
+            template <typename Range>
+            std::size_t bulk_insert(const std::string& table, const std::vector<std::string>& columns, const Range& rows, bulk_insert_mode mode = bulk_insert_mode::copy, std::size_t batch_size = 1000);
             /**
              * @brief Execute an SQL command.
              * @param query Query to execute.
@@ -299,6 +667,15 @@ namespace limhamn::database {
              * @return bool True if valid.
              */
             [[nodiscard]] bool validate(const std::string& query) const;
+            /**
+             * @brief Set the number of prepared statements kept per connection.
+             * @param size Maximum number of statements. Queries beyond it are sent unprepared.
+             */
+            void set_statement_cache_size(std::size_t size);
+            /**
+             * @brief Deallocate all cached prepared statements.
+             */
+            void clear_statements();
             /**
              * @brief Get the last insertion.
              * @return std::int64_t Last insertion.
@@ -321,11 +698,305 @@ namespace limhamn::database {
              * @brief Destructor.
              */
             ~postgresql_database();
+            postgresql_database(const postgresql_database&) = delete;
+            postgresql_database& operator=(const postgresql_database&) = delete;
+    };
+
+    /**
+     * @brief Settings for postgresql_pool.
+     */
+    struct postgresql_pool_settings {
+        std::string host{};
+        std::string user{};
+        std::string password{};
+        std::string database{};
+        int port{5432};
+        std::size_t max_connections{8}; // connections open at most, acquire() waits when all are in use
+        int64_t health_check_interval{30000}; // milliseconds a connection may sit idle before it is checked on acquire
+        int64_t acquire_timeout{10000}; // milliseconds acquire() waits for a free connection
+    };
+
+    /**
+     * @brief Bounded, thread safe pool of PostgreSQL connections.
+     * @note Connections are opened on demand. A connection that is returned with an open transaction is
+     *       rolled back, and broken connections are replaced.
+     * @note Each connection keeps its own prepared statements, so the same query stays prepared across requests.
+     */
+    class postgresql_pool {
+        public:
+            /**
+             * @brief Connection borrowed from the pool, returned when it is destroyed.
+             * @note Must not outlive the pool.
+             */
+            class connection {
+                    postgresql_pool* pool{};
+                    std::unique_ptr<postgresql_database> db{};
+
+                    connection(postgresql_pool* pool, std::unique_ptr<postgresql_database> db);
+
+                    friend class postgresql_pool;
+                public:
+                    connection() = default;
+                    connection(connection&& other) noexcept;
+                    connection& operator=(connection&& other) noexcept;
+                    connection(const connection&) = delete;
+                    connection& operator=(const connection&) = delete;
+                    ~connection();
+
+                    postgresql_database* operator->() const;
+                    postgresql_database& operator*() const;
+                    /**
+                     * @brief Return the connection to the pool before the handle is destroyed.
+                     */
+                    void release();
+            };
+
+            explicit postgresql_pool(const postgresql_pool_settings& settings);
+            ~postgresql_pool();
+            postgresql_pool(const postgresql_pool&) = delete;
+            postgresql_pool& operator=(const postgresql_pool&) = delete;
+
+            /**
+             * @brief Borrow a connection, opening one if none are idle and the pool is not full.
+             * @return connection Connection.
+             * @throws std::runtime_error if no connection can be opened or none is freed within the acquire timeout.
+             */
+            connection acquire();
+            /**
+             * @brief Run a function with a borrowed connection.
+             * @param f Function taking a postgresql_database&.
+             * @return Whatever the function returns.
+             */
+            template <typename F>
+            decltype(auto) run(F&& f);
+            /**
+             * @brief Get the number of open connections, borrowed or idle.
+             * @return std::size_t Number of connections.
+             */
+            [[nodiscard]] std::size_t size() const;
+            /**
+             * @brief Get the number of idle connections.
+             * @return std::size_t Number of connections.
+             */
+            [[nodiscard]] std::size_t idle() const;
+        private:
+            struct idle_connection {
+                std::unique_ptr<postgresql_database> db{};
+                std::chrono::steady_clock::time_point last_used{};
+            };
+
+            postgresql_pool_settings settings{};
+            mutable std::mutex mutex{};
+            std::condition_variable available{};
+            std::vector<idle_connection> connections{};
+            std::size_t open_connections{0};
+            bool closed{false};
+
+            void release(std::unique_ptr<postgresql_database> db);
+    };
+
+#ifdef LIBPQ_HAS_PIPELINING
+    /**
+     * @brief Sends many queries on one connection without waiting for each result.
+     * @note While the pipeline exists the connection cannot be used for anything else.
+     * @note When a query fails, the queries sent after it up to the next sync() are skipped by the server.
+     */
+    class postgresql_pipeline {
+        public:
+            /**
+             * @brief Result of one query in a pipeline.
+             */
+            struct result {
+                bool ok{false};
+                std::string error{};
+                std::int64_t affected_rows{0};
+                std::vector<std::unordered_map<std::string, std::string>> rows{};
+            };
+
+            /**
+             * @brief Put a connection in pipeline mode.
+             * @param db Database to use. Must be open and idle.
+             * @throws std::runtime_error if the connection cannot enter pipeline mode.
+             */
+            explicit postgresql_pipeline(postgresql_database& db);
+            /**
+             * @brief Destructor, waits for outstanding queries and leaves pipeline mode.
+             */
+            ~postgresql_pipeline();
+            postgresql_pipeline(const postgresql_pipeline&) = delete;
+            postgresql_pipeline& operator=(const postgresql_pipeline&) = delete;
+
+            /**
+             * @brief Send a query without waiting for its result.
+             * @param query Query, with ? as parameter placeholders.
+             * @param args Arguments.
+             * @return std::size_t Index of the query's result in the next sync().
+             * @throws std::runtime_error if the query cannot be sent. If only flushing it failed, the query still
+             *         counts as pending and has a result in the next sync().
+             */
+            template <typename... Args>
+            std::size_t send(const std::string& query, Args... args);
+            /**
+             * @brief Wait for the results of every query sent since the last sync().
+             * @return std::vector<result> Results, in the order the queries were sent.
+             * @throws std::runtime_error if the connection fails.
+             */
+            std::vector<result> sync();
+            /**
+             * @brief Get the number of queries sent since the last sync().
+             * @return std::size_t Number of queries.
+             */
+            [[nodiscard]] std::size_t pending() const;
+        private:
+            postgresql_database& db;
+            std::size_t sent{0};
+
+            void flush();
     };
 #endif
+#endif
 }
 
 #ifdef LIMHAMN_DATABASE_IMPL
+namespace _limhamn_database_impl {
+    template <typename T, typename = void>
+    struct is_tuple_like : std::false_type {};
+    template <typename T>
+    struct is_tuple_like<T, std::void_t<decltype(std::tuple_size<T>::value)>> : std::true_type {};
+
+    template <typename T>
+    struct is_optional : std::false_type {};
+    template <typename T>
+    struct is_optional<std::optional<T>> : std::true_type {};
+
+    /**
+     * @brief Call a function with each value of a row, which is either a tuple or a container.
+     */
+    template <typename Row, typename F>
+    inline void for_each_value(const Row& row, F&& f) {
+        if constexpr (is_tuple_like<Row>::value) {
+            std::apply([&f](const auto&... values) { (f(values), ...); }, row);
+        } else {
+            for (const auto& value : row) {
+                f(value);
+            }
+        }
+    }
+
+    /**
+     * @brief Count the values of a row.
+     */
+    template <typename Row>
+    inline std::size_t row_size(const Row& row) {
+        if constexpr (is_tuple_like<Row>::value) {
+            return std::tuple_size<Row>::value;
+        } else {
+            return static_cast<std::size_t>(std::distance(std::begin(row), std::end(row)));
+        }
+    }
+
+    /**
+     * @brief Join column names for an INSERT or COPY statement.
+     */
+    inline std::string join_columns(const std::vector<std::string>& columns) {
+        std::string ret{};
+        for (const auto& it : columns) {
+            if (!ret.empty()) {
+                ret += ", ";
+            }
+            ret += it;
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Append the text representation of a value, as PostgreSQL expects it.
+     * @return bool False if the value is NULL, in which case nothing is appended.
+     */
+    template <typename T>
+    inline bool append_text(std::string& out, const T& value) {
+        if constexpr (is_optional<T>::value) {
+            return value.has_value() ? append_text(out, *value) : false;
+        } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+            return false;
+        } else if constexpr (std::is_same_v<T, bool>) {
+            out += value ? 't' : 'f';
+        } else if constexpr (std::is_floating_point_v<T>) {
+            char buffer[32];
+            const int len = std::snprintf(buffer, sizeof(buffer), "%.17g", static_cast<double>(value));
+            out.append(buffer, static_cast<std::size_t>(len));
+        } else if constexpr (std::is_integral_v<T>) {
+            out += std::to_string(value);
+        } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+            const std::string_view view{value};
+            out += limhamn::database::remove_non_utf8(std::string{view});
+        } else {
+            static_assert(!sizeof(T), "unsupported value type");
+        }
+        return true;
+    }
+
+    /**
+     * @brief Append a value to a COPY text format line, escaping it.
+     */
+    template <typename T>
+    inline void append_copy_value(std::string& out, std::string& scratch, const T& value) {
+        scratch.clear();
+        if (!append_text(scratch, value)) {
+            out += "\\N";
+            return;
+        }
+
+        for (const char c : scratch) {
+            switch (c) {
+                case '\\': out += "\\\\"; break;
+                case '\t': out += "\\t"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                default: out += c; break;
+            }
+        }
+    }
+}
+
+template <typename Database>
+inline limhamn::database::transaction<Database>::transaction(Database& db) : db(db) {
+    if (!this->db.exec("BEGIN;")) {
+        throw std::runtime_error{"Failed to begin transaction"};
+    }
+}
+
+template <typename Database>
+inline void limhamn::database::transaction<Database>::commit() {
+    if (this->done) {
+        return;
+    }
+
+    this->done = true;
+    if (!this->db.exec("COMMIT;")) {
+        static_cast<void>(this->db.exec("ROLLBACK;"));
+        throw std::runtime_error{"Failed to commit transaction"};
+    }
+}
+
+template <typename Database>
+inline void limhamn::database::transaction<Database>::rollback() {
+    if (this->done) {
+        return;
+    }
+
+    this->done = true;
+    static_cast<void>(this->db.exec("ROLLBACK;"));
+}
+
+template <typename Database>
+inline limhamn::database::transaction<Database>::~transaction() {
+    try {
+        this->rollback();
+    } catch (...) {
+    }
+}
+
 inline std::string limhamn::database::remove_non_utf8(const std::string& input) {
 #ifdef LIMHAMN_DATABASE_ICONV
     iconv_t cd = iconv_open("UTF-8//IGNORE", "UTF-8");
@@ -427,14 +1098,14 @@ inline void limhamn::database::sqlite3_database::bind_parameter(sqlite3_stmt* st
 }
 
 inline int limhamn::database::sqlite3_database::callback(void* data, int argc, char** argv, char** name) {
-    static_cast<void>(static_cast<void*>(data));
+    auto* result = static_cast<std::vector<std::unordered_map<std::string, std::string>>*>(data);
 
     std::unordered_map<std::string, std::string> map{};
     for (int i{0}; i < argc; i++) {
         map[name[i]] = argv[i] ? argv[i] : "";
     }
 
-    tmp.push_back(std::move(map));
+    result->push_back(std::move(map));
 
     return 0;
 }
@@ -513,15 +1184,16 @@ inline std::vector<std::unordered_map<std::string, std::string>> limhamn::databa
     }
 
     char* err{};
+    std::vector<std::unordered_map<std::string, std::string>> result{};
 
-    int status = sqlite3_exec(sqlite3_db, query.c_str(), limhamn::database::sqlite3_database::callback, nullptr, &err);
+    int status = sqlite3_exec(sqlite3_db, query.c_str(), limhamn::database::sqlite3_database::callback, &result, &err);
 
     if (status != SQLITE_OK) {
         sqlite3_free(err);
         return {};
     }
 
-    return std::move(tmp);
+    return result;
 }
 
 inline bool limhamn::database::sqlite3_database::good() const {
@@ -534,6 +1206,7 @@ inline bool limhamn::database::sqlite3_database::is_open() const {
 
 inline void limhamn::database::sqlite3_database::close() {
     if (this->is_good) {
+        this->clear_statements();
         sqlite3_close(this->sqlite3_db);
         this->is_good = false;
     }
@@ -557,11 +1230,48 @@ inline std::int64_t limhamn::database::sqlite3_database::get_last_insertion() co
     return sqlite3_last_insert_rowid(this->sqlite3_db);
 }
 
-template <typename... Args>
-inline bool limhamn::database::sqlite3_database::exec(const std::string& query, Args... args) {
-    sqlite3_stmt* stmt;
+inline void limhamn::database::sqlite3_database::set_statement_cache_size(const std::size_t size) {
+    this->statement_cache_size = size;
+
+    auto it = this->statements.end();
+    while (this->statements.size() > this->statement_cache_size && it != this->statements.begin()) {
+        --it;
+        if (it->in_use) {
+            continue;
+        }
+
+        sqlite3_finalize(it->stmt);
+        this->statement_index.erase(it->query);
+        it = this->statements.erase(it);
+    }
+}
+
+inline void limhamn::database::sqlite3_database::clear_statements() {
+    for (auto& it : this->statements) {
+        sqlite3_finalize(it.stmt);
+    }
+
+    this->statement_index.clear();
+    this->statements.clear();
+}
+
+inline sqlite3_stmt* limhamn::database::sqlite3_database::acquire(const std::string& query, cached_statement*& entry) {
+    entry = nullptr;
+
+    if (!this->is_good) {
+        return nullptr;
+    }
+
+    auto found = this->statement_index.find(query);
+    if (found != this->statement_index.end() && !found->second->in_use) {
+        this->statements.splice(this->statements.begin(), this->statements, found->second);
+        entry = &*found->second;
+        entry->in_use = true;
+        return entry->stmt;
+    }
 
     std::string nq{};
+    nq.reserve(query.size());
     for (size_t i = 0; i < query.size(); ++i) {
         if (query[i] == '$' && i + 1 < query.size() && isdigit(query[i + 1])) {
             nq += '?';
@@ -573,61 +1283,600 @@ inline bool limhamn::database::sqlite3_database::exec(const std::string& query,
         }
     }
 
-    if (sqlite3_prepare_v2(sqlite3_db, nq.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "Failed to prepare statement\n";
-        return false;
+    sqlite3_stmt* stmt{};
+    if (sqlite3_prepare_v3(sqlite3_db, nq.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_finalize(stmt);
+        return nullptr;
     }
 
-    bind_parameters(stmt, 1, args...);
+    // a statement that is already in use, e.g. by a cursor still open over the same query, gets a temporary copy
+    if (found != this->statement_index.end() || this->statement_cache_size == 0) {
+        return stmt;
+    }
+
+    this->statements.push_front({query, stmt, true});
+    this->statement_index.emplace(this->statements.front().query, this->statements.begin());
+    entry = &this->statements.front();
+
+    this->set_statement_cache_size(this->statement_cache_size);
+
+    return stmt;
+}
+
+inline void limhamn::database::sqlite3_database::release(sqlite3_stmt* stmt, cached_statement* entry) {
+    if (stmt == nullptr) {
+        return;
+    }
+
+    if (entry == nullptr) {
+        sqlite3_finalize(stmt);
+        return;
+    }
+
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    entry->in_use = false;
+}
+
+template <typename... Args>
+inline bool limhamn::database::sqlite3_database::exec(const std::string& query, Args... args) {
+    cached_statement* entry{};
+    sqlite3_stmt* stmt = this->acquire(query, entry);
+
+    if (stmt == nullptr) {
+        std::cerr << "Failed to prepare statement\n";
+        return false;
+    }
+
+    bind_parameters(stmt, 1, args...);
 
     if (sqlite3_step(stmt) != SQLITE_DONE) {
         std::cerr << "Failed to step statement" << sqlite3_errmsg(sqlite3_db) << "\n";
+        release(stmt, entry);
         return false;
     }
 
-    sqlite3_finalize(stmt);
+    release(stmt, entry);
 
     return true;
 }
+
 template <typename... Args>
 std::vector<std::unordered_map<std::string, std::string>> limhamn::database::sqlite3_database::query(const std::string& query, Args... args) {
     if (!this->is_good) {
         return {};
     }
 
-    std::string nq{};
-    for (size_t i = 0; i < query.size(); ++i) {
-        if (query[i] == '$' && i + 1 < query.size() && isdigit(query[i + 1])) {
-            nq += '?';
-            while (i + 1 < query.size() && isdigit(query[i + 1])) {
-                ++i;
-            }
-        } else {
-            nq += query[i];
-        }
-    }
-
-    sqlite3_stmt* stmt;
-    if (sqlite3_prepare_v2(sqlite3_db, nq.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+    cached_statement* entry{};
+    sqlite3_stmt* stmt = this->acquire(query, entry);
+    if (stmt == nullptr) {
         return {};
     }
 
+    sqlite3_cursor cursor{this, stmt, entry};
     bind_parameters(stmt, 1, args...);
 
     std::vector<std::unordered_map<std::string, std::string>> result;
-    while ((sqlite3_step(stmt)) == SQLITE_ROW) {
+    std::vector<std::string> names{};
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const int count = sqlite3_column_count(stmt);
+        if (names.empty()) {
+            for (int i = 0; i < count; ++i) {
+                names.emplace_back(sqlite3_column_name(stmt, i));
+            }
+        }
+
         std::unordered_map<std::string, std::string> row;
-        for (int i = 0; i < sqlite3_column_count(stmt); ++i) {
-            row[sqlite3_column_name(stmt, i)] = reinterpret_cast<const char*>(sqlite3_column_text(stmt, i));
+        row.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            const auto* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, i));
+            row.emplace(names[i], text ? std::string(text, sqlite3_column_bytes(stmt, i)) : std::string{});
         }
         result.push_back(std::move(row));
     }
 
-    sqlite3_finalize(stmt);
     return result;
 }
+
+template <typename... Args>
+inline limhamn::database::sqlite3_cursor limhamn::database::sqlite3_database::cursor(const std::string& query, Args... args) {
+    cached_statement* entry{};
+    sqlite3_stmt* stmt = this->acquire(query, entry);
+
+    if (stmt == nullptr) {
+        throw std::runtime_error{"Invalid SQL statement: " + query + "\n"};
+    }
+
+    sqlite3_cursor ret{this, stmt, entry};
+    bind_parameters(stmt, 1, args...);
+
+    return ret;
+}
+
+template <typename F, typename... Args>
+inline std::size_t limhamn::database::sqlite3_database::for_each(const std::string& query, F&& callback, Args... args) {
+    sqlite3_cursor c = this->cursor(query, args...);
+
+    std::size_t count{0};
+    while (c.next()) {
+        ++count;
+        if constexpr (std::is_same_v<std::invoke_result_t<F, const sqlite3_row&>, bool>) {
+            if (!callback(c.row())) {
+                break;
+            }
+        } else {
+            callback(c.row());
+        }
+    }
+
+    return count;
+}
+
+inline limhamn::database::sqlite3_cursor::sqlite3_cursor(sqlite3_database* db, sqlite3_stmt* stmt, sqlite3_database::cached_statement* entry) : db(db), stmt(stmt), entry(entry) {
+    this->current.stmt = stmt;
+}
+
+inline limhamn::database::sqlite3_cursor::sqlite3_cursor(sqlite3_cursor&& other) noexcept : db(other.db), stmt(other.stmt), entry(other.entry) {
+    this->current.stmt = this->stmt;
+    other.stmt = nullptr;
+    other.entry = nullptr;
+    other.current.stmt = nullptr;
+}
+
+inline limhamn::database::sqlite3_cursor& limhamn::database::sqlite3_cursor::operator=(sqlite3_cursor&& other) noexcept {
+    if (this != &other) {
+        sqlite3_database::release(this->stmt, this->entry);
+        this->db = other.db;
+        this->stmt = other.stmt;
+        this->entry = other.entry;
+        this->current.stmt = this->stmt;
+        other.stmt = nullptr;
+        other.entry = nullptr;
+        other.current.stmt = nullptr;
+    }
+
+    return *this;
+}
+
+inline limhamn::database::sqlite3_cursor::~sqlite3_cursor() {
+    sqlite3_database::release(this->stmt, this->entry);
+}
+
+inline bool limhamn::database::sqlite3_cursor::next() {
+    if (this->stmt == nullptr) {
+        return false;
+    }
+
+    const int ret = sqlite3_step(this->stmt);
+    if (ret == SQLITE_ROW) {
+        return true;
+    }
+    if (ret == SQLITE_DONE) {
+        return false;
+    }
+
+    throw std::runtime_error{"Failed to step statement: " + std::string(sqlite3_errmsg(this->db->sqlite3_db)) + "\n"};
+}
+
+inline const limhamn::database::sqlite3_row& limhamn::database::sqlite3_cursor::row() const {
+    return this->current;
+}
+
+inline int limhamn::database::sqlite3_row::size() const {
+    return sqlite3_column_count(this->stmt);
+}
+
+inline std::string_view limhamn::database::sqlite3_row::name(const int index) const {
+    const char* ret = sqlite3_column_name(this->stmt, index);
+    return ret ? std::string_view{ret} : std::string_view{};
+}
+
+inline int limhamn::database::sqlite3_row::index(const std::string_view name) const {
+    const int count = sqlite3_column_count(this->stmt);
+    for (int i = 0; i < count; ++i) {
+        if (this->name(i) == name) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+inline bool limhamn::database::sqlite3_row::is_null(const int index) const {
+    return sqlite3_column_type(this->stmt, index) == SQLITE_NULL;
+}
+
+template <typename T>
+inline T limhamn::database::sqlite3_row::get(const int index) const {
+    if constexpr (std::is_same_v<T, int>) {
+        return sqlite3_column_int(this->stmt, index);
+    } else if constexpr (std::is_same_v<T, int64_t>) {
+        return sqlite3_column_int64(this->stmt, index);
+    } else if constexpr (std::is_same_v<T, double>) {
+        return sqlite3_column_double(this->stmt, index);
+    } else if constexpr (std::is_same_v<T, bool>) {
+        return sqlite3_column_int64(this->stmt, index) != 0;
+    } else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>) {
+        // blobs are returned as they are, everything else as text
+        const void* data = sqlite3_column_type(this->stmt, index) == SQLITE_BLOB ?
+            sqlite3_column_blob(this->stmt, index) : static_cast<const void*>(sqlite3_column_text(this->stmt, index));
+        if (data == nullptr) {
+            return T{};
+        }
+        return T{static_cast<const char*>(data), static_cast<std::size_t>(sqlite3_column_bytes(this->stmt, index))};
+    } else {
+        static_assert(!sizeof(T), "sqlite3_row::get: unsupported type");
+    }
+}
+
+template <typename T>
+inline T limhamn::database::sqlite3_row::get(const std::string_view name) const {
+    const int i = this->index(name);
+    if (i == -1) {
+        throw std::out_of_range{"No column named '" + std::string(name) + "'"};
+    }
+
+    return this->get<T>(i);
+}
+
+template <typename Range>
+inline std::size_t limhamn::database::sqlite3_database::bulk_insert(const std::string& table, const std::vector<std::string>& columns, const Range& rows) {
+    if (!this->is_good) {
+        return 0;
+    }
+
+    if (columns.empty()) {
+        throw std::invalid_argument{"bulk_insert() needs at least one column"};
+    }
+
+    std::string query = "INSERT INTO " + table + " (" + _limhamn_database_impl::join_columns(columns) + ") VALUES (";
+    for (std::size_t i = 0; i < columns.size(); ++i) {
+        query += i == 0 ? "?" : ", ?";
+    }
+    query += ");";
+
+    // without a transaction every row would be its own commit and fsync
+    std::optional<transaction<sqlite3_database>> implicit{};
+    if (sqlite3_get_autocommit(this->sqlite3_db)) {
+        implicit.emplace(*this);
+    }
+
+    cached_statement* entry{};
+    sqlite3_stmt* stmt = this->acquire(query, entry);
+    if (stmt == nullptr) {
+        throw std::runtime_error{"Invalid SQL statement: " + query + "\n"};
+    }
+    sqlite3_cursor guard{this, stmt, entry};
+
+    std::size_t count{0};
+    for (const auto& row : rows) {
+        if (_limhamn_database_impl::row_size(row) != columns.size()) {
+            throw std::runtime_error{"Row has the wrong number of values for " + table + "\n"};
+        }
+
+        int index{1};
+        _limhamn_database_impl::for_each_value(row, [&](const auto& value) {
+            bind_value(stmt, index++, value);
+        });
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            throw std::runtime_error{"Failed to insert row: " + std::string(sqlite3_errmsg(this->sqlite3_db)) + "\n"};
+        }
+
+        sqlite3_reset(stmt);
+        ++count;
+    }
+
+    if (implicit) {
+        implicit->commit();
+    }
+
+    return count;
+}
+
+template <typename T>
+inline void limhamn::database::sqlite3_database::bind_value(sqlite3_stmt* stmt, int index, const T& value) {
+    if constexpr (_limhamn_database_impl::is_optional<T>::value) {
+        if (value.has_value()) {
+            bind_value(stmt, index, *value);
+        } else {
+            sqlite3_bind_null(stmt, index);
+        }
+    } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+        sqlite3_bind_null(stmt, index);
+    } else if constexpr (std::is_floating_point_v<T>) {
+        sqlite3_bind_double(stmt, index, static_cast<double>(value));
+    } else if constexpr (std::is_integral_v<T>) {
+        sqlite3_bind_int64(stmt, index, static_cast<sqlite3_int64>(value));
+    } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+        const std::string cleaned = remove_non_utf8(std::string{std::string_view{value}});
+        sqlite3_bind_text(stmt, index, cleaned.data(), static_cast<int>(cleaned.size()), SQLITE_TRANSIENT);
+    } else {
+        static_assert(!sizeof(T), "sqlite3_database::bind_value: unsupported type");
+    }
+}
 #endif
 #ifdef LIMHAMN_DATABASE_POSTGRESQL
+namespace _limhamn_database_impl {
+    /**
+     * @brief Turn ? placeholders into $1, $2, ... and terminate the statement.
+     */
+    inline std::string number_placeholders(const std::string& query) {
+        int i{1};
+        std::string nq{};
+        nq.reserve(query.size() + 16);
+        for (char ch : query) {
+            if (ch == '?') {
+                nq += "$" + std::to_string(i++);
+            } else {
+                nq += ch;
+            }
+        }
+
+        if (nq.empty() || nq.back() != ';') {
+            nq += ';';
+        }
+
+        return nq;
+    }
+
+    /**
+     * @brief Check whether a failed result was a syntax error or access rule violation (SQLSTATE class 42).
+     */
+    inline bool is_invalid_statement(const PGresult* res) {
+        const char* state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+        return state != nullptr && state[0] == '4' && state[1] == '2';
+    }
+
+    /**
+     * @brief Copy the rows of a result.
+     */
+    inline std::vector<std::unordered_map<std::string, std::string>> get_rows(const PGresult* res) {
+        std::vector<std::unordered_map<std::string, std::string>> result;
+        int nrows = PQntuples(res);
+        int nfields = PQnfields(res);
+        result.reserve(static_cast<std::size_t>(nrows));
+
+        for (int i = 0; i < nrows; ++i) {
+            std::unordered_map<std::string, std::string> row;
+            for (int j = 0; j < nfields; ++j) {
+                row[PQfname(res, j)] = PQgetvalue(res, i, j);
+            }
+            result.push_back(std::move(row));
+        }
+
+        return result;
+    }
+
+    inline void write_be(std::string& out, const std::uint64_t value, const int len) {
+        for (int i = len - 1; i >= 0; --i) {
+            out += static_cast<char>((value >> (8 * i)) & 0xff);
+        }
+    }
+
+    inline std::uint64_t read_be(const char* data, const int len) {
+        std::uint64_t value{0};
+        for (int i = 0; i < len; ++i) {
+            value = (value << 8) | static_cast<unsigned char>(data[i]);
+        }
+        return value;
+    }
+
+    inline std::int64_t read_be_signed(const char* data, const int len) {
+        const int shift = 64 - 8 * len;
+        return static_cast<std::int64_t>(read_be(data, len) << shift) >> shift;
+    }
+
+    // binary timestamps count microseconds from 2000-01-01
+    constexpr std::int64_t pg_epoch_offset{946684800LL * 1000000LL};
+
+    /**
+     * @brief Get the size of a fixed size binary value of a PostgreSQL type.
+     * @return int Size in bytes, or -1 if the type has no fixed size.
+     */
+    inline int pg_binary_size(const Oid type) {
+        switch (type) {
+            case 16: case 18: return 1; // bool, char
+            case 21: return 2; // int2
+            case 23: case 26: case 700: case 1082: return 4; // int4, oid, float4, date
+            case 20: case 701: case 1114: case 1184: return 8; // int8, float8, timestamp, timestamptz
+            default: return -1;
+        }
+    }
+
+    /**
+     * @brief Check that a binary value has the size of its type, before it is read.
+     */
+    inline void check_binary_size(const int len, const Oid type, const char* what) {
+        if (len != pg_binary_size(type)) {
+            throw std::runtime_error{std::string{"Column does not hold "} + what + ": unexpected length " + std::to_string(len)};
+        }
+    }
+
+    /**
+     * @brief Maps a C++ type to a PostgreSQL type and its binary format.
+     */
+    template <typename T, typename = void>
+    struct pg_binary {
+        static constexpr bool supported{false};
+    };
+
+    template <>
+    struct pg_binary<bool> {
+        static constexpr bool supported{true};
+        static constexpr Oid oid{16}; // bool
+
+        static void encode(std::string& out, const bool value) {
+            out += static_cast<char>(value ? 1 : 0);
+        }
+        static bool decode(const char* data, const int len, const Oid type) {
+            if (type != 16 || len != 1) {
+                throw std::runtime_error{"Column does not hold a bool"};
+            }
+            return data[0] != 0;
+        }
+    };
+
+    template <typename T>
+    struct pg_binary<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>> {
+        // unsigned types get the next wider type so that every value fits
+        static constexpr int width = sizeof(T) == 1 ? 2 : (std::is_unsigned_v<T> && sizeof(T) < 8) ? static_cast<int>(sizeof(T)) * 2 : static_cast<int>(sizeof(T));
+        static constexpr bool supported{true};
+        static constexpr Oid oid = width == 2 ? 21 : width == 4 ? 23 : 20; // int2, int4, int8
+
+        static void encode(std::string& out, const T value) {
+            write_be(out, static_cast<std::uint64_t>(static_cast<std::int64_t>(value)), width);
+        }
+        static T decode(const char* data, const int len, const Oid type) {
+            switch (type) {
+                case 21: case 23: case 20: // int2, int4, int8
+                    check_binary_size(len, type, "an integer");
+                    return static_cast<T>(read_be_signed(data, len));
+                case 26: // oid
+                    check_binary_size(len, type, "an integer");
+                    return static_cast<T>(read_be(data, len));
+                case 16: // bool
+                    check_binary_size(len, type, "an integer");
+                    return static_cast<T>(data[0] != 0);
+                default:
+                    throw std::runtime_error{"Column does not hold an integer"};
+            }
+        }
+    };
+
+    template <typename T>
+    struct pg_binary<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+        static constexpr bool supported{true};
+        static constexpr Oid oid = sizeof(T) == 4 ? 700 : 701; // float4, float8
+
+        static void encode(std::string& out, const T value) {
+            if constexpr (sizeof(T) == 4) {
+                std::uint32_t bits{};
+                std::memcpy(&bits, &value, sizeof(bits));
+                write_be(out, bits, 4);
+            } else {
+                const double d = static_cast<double>(value);
+                std::uint64_t bits{};
+                std::memcpy(&bits, &d, sizeof(bits));
+                write_be(out, bits, 8);
+            }
+        }
+        static T decode(const char* data, const int len, const Oid type) {
+            switch (type) {
+                case 700: {
+                    check_binary_size(len, type, "a floating point number");
+                    const auto bits = static_cast<std::uint32_t>(read_be(data, 4));
+                    float f{};
+                    std::memcpy(&f, &bits, sizeof(f));
+                    return static_cast<T>(f);
+                }
+                case 701: {
+                    check_binary_size(len, type, "a floating point number");
+                    const std::uint64_t bits = read_be(data, 8);
+                    double d{};
+                    std::memcpy(&d, &bits, sizeof(d));
+                    return static_cast<T>(d);
+                }
+                case 21: case 23: case 20:
+                    check_binary_size(len, type, "a floating point number");
+                    return static_cast<T>(read_be_signed(data, len));
+                default:
+                    throw std::runtime_error{"Column does not hold a floating point number"};
+            }
+        }
+    };
+
+    template <typename T>
+    struct pg_binary<T, std::enable_if_t<std::is_convertible_v<const T&, std::string_view> && !std::is_same_v<T, std::nullptr_t>>> {
+        static constexpr bool supported{true};
+        static constexpr Oid oid{25}; // text
+
+        static void encode(std::string& out, const T& value) {
+            const std::string_view view{value};
+            out += limhamn::database::remove_non_utf8(std::string{view});
+        }
+        // the binary format of text, varchar, bytea and friends is the bytes themselves, other types need decoding
+        static std::string_view decode(const char* data, const int len, const Oid type) {
+            switch (type) {
+                case 25: case 1043: case 1042: case 19: case 18: // text, varchar, bpchar, name, char
+                case 114: case 142: case 705: case 17: // json, xml, unknown, bytea
+                    return {data, static_cast<std::size_t>(len)};
+                default:
+                    throw std::runtime_error{"Column does not hold a string"};
+            }
+        }
+    };
+
+    template <>
+    struct pg_binary<std::vector<std::uint8_t>> {
+        static constexpr bool supported{true};
+        static constexpr Oid oid{17}; // bytea
+
+        static void encode(std::string& out, const std::vector<std::uint8_t>& value) {
+            out.append(reinterpret_cast<const char*>(value.data()), value.size());
+        }
+        static std::vector<std::uint8_t> decode(const char* data, const int len, const Oid) {
+            const auto* begin = reinterpret_cast<const std::uint8_t*>(data);
+            return {begin, begin + len};
+        }
+    };
+
+    template <>
+    struct pg_binary<std::chrono::system_clock::time_point> {
+        static constexpr bool supported{true};
+        static constexpr Oid oid{1184}; // timestamptz
+
+        static void encode(std::string& out, const std::chrono::system_clock::time_point& value) {
+            const auto us = std::chrono::duration_cast<std::chrono::microseconds>(value.time_since_epoch()).count();
+            write_be(out, static_cast<std::uint64_t>(us - pg_epoch_offset), 8);
+        }
+        static std::chrono::system_clock::time_point decode(const char* data, const int len, const Oid type) {
+            std::int64_t us{};
+            switch (type) {
+                case 1114: case 1184: // timestamp, timestamptz
+                    check_binary_size(len, type, "a timestamp");
+                    us = read_be_signed(data, len);
+                    break;
+                case 1082: // date, in days
+                    check_binary_size(len, type, "a timestamp");
+                    us = read_be_signed(data, len) * 86400LL * 1000000LL;
+                    break;
+                default:
+                    throw std::runtime_error{"Column does not hold a timestamp"};
+            }
+            return std::chrono::system_clock::time_point{std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::microseconds{us + pg_epoch_offset})};
+        }
+    };
+
+    template <typename T>
+    inline Oid binary_oid() {
+        if constexpr (is_optional<T>::value) {
+            return binary_oid<typename T::value_type>();
+        } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+            return 0; // let the server infer it
+        } else {
+            static_assert(pg_binary<T>::supported, "postgresql_database::query_binary: unsupported type");
+            return pg_binary<T>::oid;
+        }
+    }
+
+    /**
+     * @brief Append the binary representation of a value.
+     * @return bool False if the value is NULL, in which case nothing is appended.
+     */
+    template <typename T>
+    inline bool append_binary(std::string& out, const T& value) {
+        if constexpr (is_optional<T>::value) {
+            return value.has_value() ? append_binary(out, *value) : false;
+        } else if constexpr (std::is_same_v<T, std::nullptr_t>) {
+            return false;
+        } else {
+            pg_binary<T>::encode(out, value);
+            return true;
+        }
+    }
+}
+
 inline limhamn::database::postgresql_database::postgresql_database(const std::string& host,
     const std::string& user, const std::string& password, const std::string& database, int port) {
 
@@ -676,14 +1925,19 @@ inline bool limhamn::database::postgresql_database::exec(const std::string& quer
         throw std::runtime_error{"Connection to database failed: " + std::string(PQerrorMessage(pg_conn))};
     }
 
-    if (!this->validate(query) || query.empty() || query.back() != ';') {
+    if (query.empty() || query.back() != ';') {
         throw std::runtime_error{"Invalid SQL statement in database '" + this->database + "': " + query + "\n"};
     }
 
+    // the server reports invalid statements itself, validating first would cost another round trip
     PGresult* res = PQexec(pg_conn, query.c_str());
 
     if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        const bool invalid = _limhamn_database_impl::is_invalid_statement(res);
         PQclear(res);
+        if (invalid) {
+            throw std::runtime_error{"Invalid SQL statement in database '" + this->database + "': " + query + "\n"};
+        }
         return false;
     }
 
@@ -712,32 +1966,22 @@ inline std::vector<std::unordered_map<std::string, std::string>> limhamn::databa
         return {};
     }
 
-    if (!this->validate(query)) {
-        throw std::runtime_error{"Invalid SQL statement: " + query + "\n"};
-    }
-
-    if (query.back() != ';') {
+    if (query.empty() || query.back() != ';') {
 		throw std::runtime_error{"Query must end with a semicolon: " + query + "\n"};
 	}
 
     PGresult* res = PQexec(pg_conn, query.c_str());
 
     if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        const bool invalid = _limhamn_database_impl::is_invalid_statement(res);
         PQclear(res);
+        if (invalid) {
+            throw std::runtime_error{"Invalid SQL statement: " + query + "\n"};
+        }
         return {};
     }
 
-    std::vector<std::unordered_map<std::string, std::string>> result;
-    int nrows = PQntuples(res);
-    int nfields = PQnfields(res);
-
-    for (int i = 0; i < nrows; ++i) {
-        std::unordered_map<std::string, std::string> row;
-        for (int j = 0; j < nfields; ++j) {
-            row[PQfname(res, j)] = PQgetvalue(res, i, j);
-        }
-        result.push_back(std::move(row));
-    }
+    auto result = _limhamn_database_impl::get_rows(res);
 
     PQclear(res);
     return result;
@@ -754,37 +1998,189 @@ inline bool limhamn::database::postgresql_database::is_open() const {
 inline void limhamn::database::postgresql_database::close() {
     if (this->is_good) {
         PQfinish(this->pg_conn);
+        this->pg_conn = nullptr;
         this->is_good = false;
     }
+
+    this->prepared.clear();
 }
 
-inline bool limhamn::database::postgresql_database::empty() const {
-    if (!this->is_good) {
-        return true;
+inline void limhamn::database::postgresql_database::set_statement_cache_size(const std::size_t size) {
+    this->statement_cache_size = size;
+    if (this->prepared.size() > size) {
+        this->clear_statements();
     }
+}
 
-    const char* query = "SELECT COUNT(*) FROM information_schema.tables WHERE table_schema = 'public';";
-    PGresult* res = PQexec(pg_conn, query);
-
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+inline void limhamn::database::postgresql_database::clear_statements() {
+    if (this->is_good && !this->prepared.empty()) {
+        PGresult* res = PQexec(pg_conn, "DEALLOCATE ALL;");
         PQclear(res);
-        return true;
     }
 
-    bool is_empty = std::stoi(PQgetvalue(res, 0, 0)) == 0;
-    PQclear(res);
-    return is_empty;
+    this->prepared.clear();
 }
 
-inline std::int64_t limhamn::database::postgresql_database::get_last_insertion() const {
-    if (!this->is_good) {
-        return -1;
+inline PGresult* limhamn::database::postgresql_database::execute(const std::string& query, const std::vector<Oid>& types, const int nparams,
+        const char* const* values, const int* lengths, const int* formats, const int result_format) {
+    // the same query with other parameter types is another statement
+    std::string key = query;
+    if (!types.empty()) {
+        key += '\0';
+        key.append(reinterpret_cast<const char*>(types.data()), types.size() * sizeof(Oid));
     }
+    const Oid* type_data = types.empty() ? nullptr : types.data();
 
-    const char* query = "SELECT LASTVAL();";
-    PGresult* res = PQexec(pg_conn, query);
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        auto it = this->prepared.find(key);
 
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        if (it == this->prepared.end()) {
+            const std::string nq = _limhamn_database_impl::number_placeholders(query);
+
+            // inside a failed transaction nothing can be prepared, and a full cache takes no more
+            if (this->prepared.size() >= this->statement_cache_size || PQtransactionStatus(pg_conn) == PQTRANS_INERROR) {
+                return PQexecParams(pg_conn, nq.c_str(), nparams, type_data, values, lengths, formats, result_format);
+            }
+
+            std::string name = "limhamn_" + std::to_string(++this->prepared_count);
+            PGresult* res = PQprepare(pg_conn, name.c_str(), nq.c_str(), static_cast<int>(types.size()), type_data);
+            if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+                return res;
+            }
+            PQclear(res);
+
+            it = this->prepared.emplace(std::move(key), std::move(name)).first;
+        }
+
+        PGresult* res = PQexecPrepared(pg_conn, it->second.c_str(), nparams, values, lengths, formats, result_format);
+
+        // 26000: the statement was deallocated behind our back, 0A000: its cached plan no longer fits the schema
+        const char* state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+        if (attempt == 0 && state != nullptr && (std::string_view{state} == "26000" || std::string_view{state} == "0A000")) {
+            if (PQtransactionStatus(pg_conn) != PQTRANS_IDLE) {
+                // the error aborted the caller's transaction, so a retry would fail too. forget the statement
+                // so that it is prepared again after the rollback. the server drops it with DEALLOCATE ALL or the connection
+                this->prepared.erase(it);
+                return res;
+            }
+            PQclear(res);
+            if (std::string_view{state} == "0A000") {
+                const std::string deallocate = "DEALLOCATE " + it->second + ";";
+                PQclear(PQexec(pg_conn, deallocate.c_str()));
+            }
+            key = it->first;
+            this->prepared.erase(it);
+            continue;
+        }
+
+        return res;
+    }
+
+    return nullptr;
+}
+
+inline limhamn::database::postgresql_result::postgresql_result(PGresult* res) : res(res) {}
+
+inline limhamn::database::postgresql_result::postgresql_result(postgresql_result&& other) noexcept : res(other.res) {
+    other.res = nullptr;
+}
+
+inline limhamn::database::postgresql_result& limhamn::database::postgresql_result::operator=(postgresql_result&& other) noexcept {
+    if (this != &other) {
+        PQclear(this->res);
+        this->res = other.res;
+        other.res = nullptr;
+    }
+    return *this;
+}
+
+inline limhamn::database::postgresql_result::~postgresql_result() {
+    PQclear(this->res);
+}
+
+inline bool limhamn::database::postgresql_result::ok() const {
+    if (this->res == nullptr) {
+        return false;
+    }
+
+    const ExecStatusType status = PQresultStatus(this->res);
+    return status == PGRES_TUPLES_OK || status == PGRES_COMMAND_OK;
+}
+
+inline std::string limhamn::database::postgresql_result::error() const {
+    if (this->res == nullptr) {
+        return "no result";
+    }
+    return PQresultErrorMessage(this->res);
+}
+
+inline int limhamn::database::postgresql_result::size() const {
+    return this->res ? PQntuples(this->res) : 0;
+}
+
+inline int limhamn::database::postgresql_result::columns() const {
+    return this->res ? PQnfields(this->res) : 0;
+}
+
+inline std::int64_t limhamn::database::postgresql_result::affected_rows() const {
+    if (this->res == nullptr) {
+        return 0;
+    }
+
+    const char* affected = PQcmdTuples(this->res);
+    return affected[0] != '\0' ? std::strtoll(affected, nullptr, 10) : 0;
+}
+
+inline std::string_view limhamn::database::postgresql_result::name(const int column) const {
+    const char* name = PQfname(this->res, column);
+    return name ? std::string_view{name} : std::string_view{};
+}
+
+inline int limhamn::database::postgresql_result::index(const std::string_view name) const {
+    // PQfnumber would fold the case of unquoted names, match them exactly instead
+    for (int i = 0; i < this->columns(); ++i) {
+        if (this->name(i) == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+inline bool limhamn::database::postgresql_result::is_null(const int row, const int column) const {
+    return PQgetisnull(this->res, row, column) == 1;
+}
+
+inline PGresult* limhamn::database::postgresql_result::native_handle() const {
+    return this->res;
+}
+
+inline bool limhamn::database::postgresql_database::empty() const {
+    if (!this->is_good) {
+        return true;
+    }
+
+    const char* query = "SELECT COUNT(*) FROM information_schema.tables WHERE table_schema = 'public';";
+    PGresult* res = PQexec(pg_conn, query);
+
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        PQclear(res);
+        return true;
+    }
+
+    bool is_empty = std::stoi(PQgetvalue(res, 0, 0)) == 0;
+    PQclear(res);
+    return is_empty;
+}
+
+inline std::int64_t limhamn::database::postgresql_database::get_last_insertion() const {
+    if (!this->is_good) {
+        return -1;
+    }
+
+    const char* query = "SELECT LASTVAL();";
+    PGresult* res = PQexec(pg_conn, query);
+
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
         PQclear(res);
         return -1;
     }
@@ -811,20 +2207,38 @@ inline bool limhamn::database::postgresql_database::exec(const std::string& quer
         return false;
     }
 
-    int i{1};
-    std::string nq{};
-    for (char ch : query) {
-        if (ch == '?') {
-            nq += "$" + std::to_string(i++);
-        } else {
-            nq += ch;
-        }
+    PGresult* res = this->exec_params(query, args...);
+
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+        PQclear(res);
+        return false;
     }
 
-    if (nq.back() != ';') {
-		nq += ';';
-	}
+    PQclear(res);
+    return true;
+}
+
+template <typename... Args>
+inline std::vector<std::unordered_map<std::string, std::string>> limhamn::database::postgresql_database::query(const std::string& query, Args... args) {
+    if (!this->is_good) {
+        return {};
+    }
+
+    PGresult* res = this->exec_params(query, args...);
 
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        PQclear(res);
+        return {};
+    }
+
+    auto result = _limhamn_database_impl::get_rows(res);
+
+    PQclear(res);
+    return result;
+}
+
+template <typename... Args>
+inline PGresult* limhamn::database::postgresql_database::exec_params(const std::string& query, Args... args) {
     std::vector<std::string> str{remove_non_utf8(to_string(args))...};
     std::vector<const char*> param_v{};
     param_v.reserve(str.size());
@@ -835,65 +2249,563 @@ inline bool limhamn::database::postgresql_database::exec(const std::string& quer
         param_v.push_back(s.c_str());
     }
 
-    PGresult* res = PQexecParams(pg_conn, nq.c_str(), static_cast<int>(param_v.size()), nullptr, param_v.data(), nullptr, nullptr, 0);
+    return this->execute(query, {}, static_cast<int>(param_v.size()), param_v.data(), nullptr, nullptr, 0);
+}
 
-    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-        PQclear(res);
-        return false;
+template <typename... Args>
+inline limhamn::database::postgresql_result limhamn::database::postgresql_database::query_binary(const std::string& query, const Args&... args) {
+    if (!this->is_good) {
+        return postgresql_result{};
     }
 
-    PQclear(res);
-    return true;
+    constexpr std::size_t nparams = sizeof...(Args);
+    const std::vector<Oid> types{_limhamn_database_impl::binary_oid<Args>()...};
+
+    // every value goes into one buffer, the pointers are taken once it is complete
+    std::string buffer{};
+    std::array<int, nparams> offsets{};
+    std::array<int, nparams> lengths{};
+    std::array<int, nparams> formats{};
+    std::array<const char*, nparams> values{};
+
+    std::size_t i{0};
+    const auto append = [&](const auto& value) {
+        const std::size_t start = buffer.size();
+        const bool present = _limhamn_database_impl::append_binary(buffer, value);
+        offsets[i] = present ? static_cast<int>(start) : -1;
+        lengths[i] = static_cast<int>(buffer.size() - start);
+        formats[i] = 1;
+        ++i;
+    };
+    (append(args), ...);
+    static_cast<void>(append);
+
+    for (std::size_t j = 0; j < nparams; ++j) {
+        values[j] = offsets[j] < 0 ? nullptr : buffer.data() + offsets[j];
+    }
+
+    return postgresql_result{this->execute(query, types, static_cast<int>(nparams), values.data(), lengths.data(), formats.data(), 1)};
 }
 
-template <typename... Args>
-inline std::vector<std::unordered_map<std::string, std::string>> limhamn::database::postgresql_database::query(const std::string& query, Args... args) {
+template <typename T>
+inline T limhamn::database::postgresql_result::get(const int row, const int column) const {
+    if constexpr (_limhamn_database_impl::is_optional<T>::value) {
+        if (this->is_null(row, column)) {
+            return std::nullopt;
+        }
+        return this->get<typename T::value_type>(row, column);
+    } else {
+        static_assert(_limhamn_database_impl::pg_binary<T>::supported, "postgresql_result::get: unsupported type");
+
+        if (this->is_null(row, column)) {
+            return T{};
+        }
+
+        const char* data = PQgetvalue(this->res, row, column);
+        const int len = PQgetlength(this->res, row, column);
+
+        if (PQfformat(this->res, column) == 0) {
+            // text format, from queries that did not ask for binary results
+            if constexpr (std::is_same_v<T, bool>) {
+                return data[0] == 't';
+            } else if constexpr (std::is_integral_v<T>) {
+                return static_cast<T>(std::strtoll(data, nullptr, 10));
+            } else if constexpr (std::is_floating_point_v<T>) {
+                return static_cast<T>(std::strtod(data, nullptr));
+            } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+                return T{data, static_cast<std::size_t>(len)};
+            } else {
+                throw std::runtime_error{"postgresql_result::get: type needs a binary result"};
+            }
+        } else {
+            return T(_limhamn_database_impl::pg_binary<T>::decode(data, len, PQftype(this->res, column)));
+        }
+    }
+}
+
+template <typename T>
+inline T limhamn::database::postgresql_result::get(const int row, const std::string_view name) const {
+    const int i = this->index(name);
+    if (i == -1) {
+        throw std::out_of_range{"No column named '" + std::string(name) + "'"};
+    }
+
+    return this->get<T>(row, i);
+}
+
+template <typename Range>
+inline std::size_t limhamn::database::postgresql_database::bulk_insert(const std::string& table, const std::vector<std::string>& columns, const Range& rows, const bulk_insert_mode mode, const std::size_t batch_size) {
     if (!this->is_good) {
-        return {};
+        return 0;
     }
 
-    int n{1};
-    std::string nq{};
-    for (char ch : query) {
-        if (ch == '?') {
-            nq += "$" + std::to_string(n++);
+    if (columns.empty()) {
+        throw std::invalid_argument{"bulk_insert() needs at least one column"};
+    }
+
+    const std::string column_list = _limhamn_database_impl::join_columns(columns);
+
+    if (mode == bulk_insert_mode::copy) {
+        return this->copy_rows(table, column_list, columns.size(), rows);
+    }
+
+    // a single statement is atomic already, several need a transaction to be
+    std::optional<transaction<postgresql_database>> implicit{};
+    if (PQtransactionStatus(this->pg_conn) == PQTRANS_IDLE) {
+        implicit.emplace(*this);
+    }
+
+    const std::size_t count = this->insert_rows(table, column_list, columns.size(), rows, batch_size);
+
+    if (implicit) {
+        implicit->commit();
+    }
+
+    return count;
+}
+
+template <typename Range>
+inline std::size_t limhamn::database::postgresql_database::copy_rows(const std::string& table, const std::string& column_list, const std::size_t columns, const Range& rows) {
+    const std::string query = "COPY " + table + " (" + column_list + ") FROM STDIN;";
+
+    PGresult* res = PQexec(this->pg_conn, query.c_str());
+    if (PQresultStatus(res) != PGRES_COPY_IN) {
+        const std::string error = PQerrorMessage(this->pg_conn);
+        PQclear(res);
+        throw std::runtime_error{"Failed to start COPY: " + error};
+    }
+    PQclear(res);
+
+    static constexpr std::size_t flush_size{1 << 16};
+    std::string buffer{};
+    std::string scratch{};
+    buffer.reserve(flush_size * 2);
+
+    const auto abort = [this](const std::string& error) {
+        PQputCopyEnd(this->pg_conn, error.c_str());
+        while (PGresult* r = PQgetResult(this->pg_conn)) {
+            PQclear(r);
+        }
+        throw std::runtime_error{"COPY failed: " + error};
+    };
+
+    std::size_t count{0};
+    for (const auto& row : rows) {
+        if (_limhamn_database_impl::row_size(row) != columns) {
+            abort("row has the wrong number of values");
+        }
+
+        bool first{true};
+        _limhamn_database_impl::for_each_value(row, [&](const auto& value) {
+            if (!first) {
+                buffer += '\t';
+            }
+            first = false;
+            _limhamn_database_impl::append_copy_value(buffer, scratch, value);
+        });
+        buffer += '\n';
+        ++count;
+
+        if (buffer.size() >= flush_size) {
+            if (PQputCopyData(this->pg_conn, buffer.data(), static_cast<int>(buffer.size())) != 1) {
+                abort(PQerrorMessage(this->pg_conn));
+            }
+            buffer.clear();
+        }
+    }
+
+    if (!buffer.empty() && PQputCopyData(this->pg_conn, buffer.data(), static_cast<int>(buffer.size())) != 1) {
+        abort(PQerrorMessage(this->pg_conn));
+    }
+    if (PQputCopyEnd(this->pg_conn, nullptr) != 1) {
+        abort(PQerrorMessage(this->pg_conn));
+    }
+
+    bool ok{true};
+    std::string error{};
+    while (PGresult* r = PQgetResult(this->pg_conn)) {
+        if (PQresultStatus(r) != PGRES_COMMAND_OK) {
+            ok = false;
+            error = PQresultErrorMessage(r);
+        }
+        PQclear(r);
+    }
+
+    if (!ok) {
+        throw std::runtime_error{"COPY failed: " + error};
+    }
+
+    return count;
+}
+
+template <typename Range>
+inline std::size_t limhamn::database::postgresql_database::insert_rows(const std::string& table, const std::string& column_list, const std::size_t columns, const Range& rows, std::size_t batch_size) {
+    // the protocol allows at most 65535 parameters per statement
+    batch_size = std::max<std::size_t>(1, std::min(batch_size, 65535 / std::max<std::size_t>(columns, 1)));
+
+    std::vector<std::string> values{};
+    std::vector<bool> nulls{};
+    std::vector<const char*> params{};
+    std::string query{};
+    std::size_t batch{0};
+    std::size_t count{0};
+
+    const auto flush = [&]() {
+        if (batch == 0) {
+            return;
+        }
+
+        query = "INSERT INTO " + table + " (" + column_list + ") VALUES ";
+        std::size_t param{1};
+        for (std::size_t i = 0; i < batch; ++i) {
+            query += i == 0 ? "(" : ", (";
+            for (std::size_t j = 0; j < columns; ++j) {
+                query += (j == 0 ? "$" : ", $") + std::to_string(param++);
+            }
+            query += ")";
+        }
+        query += ";";
+
+        params.clear();
+        for (std::size_t i = 0; i < values.size(); ++i) {
+            params.push_back(nulls[i] ? nullptr : values[i].c_str());
+        }
+
+        PGresult* res = PQexecParams(this->pg_conn, query.c_str(), static_cast<int>(params.size()), nullptr, params.data(), nullptr, nullptr, 0);
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            const std::string error = PQresultErrorMessage(res);
+            PQclear(res);
+            throw std::runtime_error{"Failed to insert rows: " + error};
+        }
+        PQclear(res);
+
+        count += batch;
+        batch = 0;
+        values.clear();
+        nulls.clear();
+    };
+
+    for (const auto& row : rows) {
+        if (_limhamn_database_impl::row_size(row) != columns) {
+            throw std::runtime_error{"Row has the wrong number of values for " + table + "\n"};
+        }
+
+        _limhamn_database_impl::for_each_value(row, [&](const auto& value) {
+            std::string text{};
+            nulls.push_back(!_limhamn_database_impl::append_text(text, value));
+            values.push_back(std::move(text));
+        });
+
+        if (++batch == batch_size) {
+            flush();
+        }
+    }
+    flush();
+
+    return count;
+}
+
+inline limhamn::database::postgresql_pool::connection::connection(postgresql_pool* pool, std::unique_ptr<postgresql_database> db) : pool(pool), db(std::move(db)) {}
+
+inline limhamn::database::postgresql_pool::connection::connection(connection&& other) noexcept : pool(other.pool), db(std::move(other.db)) {
+    other.pool = nullptr;
+}
+
+inline limhamn::database::postgresql_pool::connection& limhamn::database::postgresql_pool::connection::operator=(connection&& other) noexcept {
+    if (this != &other) {
+        this->release();
+        this->pool = other.pool;
+        this->db = std::move(other.db);
+        other.pool = nullptr;
+    }
+    return *this;
+}
+
+inline limhamn::database::postgresql_pool::connection::~connection() {
+    this->release();
+}
+
+inline limhamn::database::postgresql_database* limhamn::database::postgresql_pool::connection::operator->() const {
+    return this->db.get();
+}
+
+inline limhamn::database::postgresql_database& limhamn::database::postgresql_pool::connection::operator*() const {
+    return *this->db;
+}
+
+inline void limhamn::database::postgresql_pool::connection::release() {
+    if (this->pool != nullptr && this->db) {
+        this->pool->release(std::move(this->db));
+    }
+    this->pool = nullptr;
+    this->db.reset();
+}
+
+inline limhamn::database::postgresql_pool::postgresql_pool(const postgresql_pool_settings& settings) : settings(settings) {
+    if (this->settings.max_connections == 0) {
+        throw std::runtime_error{"postgresql_pool: max_connections must be at least 1"};
+    }
+    this->connections.reserve(this->settings.max_connections);
+}
+
+inline limhamn::database::postgresql_pool::~postgresql_pool() {
+    std::vector<idle_connection> to_close{};
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->closed = true;
+        to_close.swap(this->connections);
+    }
+    this->available.notify_all();
+}
+
+inline limhamn::database::postgresql_pool::connection limhamn::database::postgresql_pool::acquire() {
+    std::unique_ptr<postgresql_database> db{};
+    std::chrono::steady_clock::time_point last_used{};
+
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(this->settings.acquire_timeout);
+
+        const auto ready = [this]() {
+            return this->closed || !this->connections.empty() || this->open_connections < this->settings.max_connections;
+        };
+        if (!this->available.wait_until(lock, deadline, ready)) {
+            throw std::runtime_error{"postgresql_pool: timed out waiting for a connection"};
+        }
+        if (this->closed) {
+            throw std::runtime_error{"postgresql_pool: pool is closed"};
+        }
+
+        if (!this->connections.empty()) {
+            // most recently used first, it is the most likely to still be alive
+            db = std::move(this->connections.back().db);
+            last_used = this->connections.back().last_used;
+            this->connections.pop_back();
         } else {
-            nq += ch;
+            ++this->open_connections;
         }
     }
 
-    if (nq.back() != ';') {
-        nq += ';';
-	}
+    try {
+        if (db) {
+            bool healthy = PQstatus(db->pg_conn) == CONNECTION_OK;
+
+            if (healthy && std::chrono::steady_clock::now() - last_used > std::chrono::milliseconds(this->settings.health_check_interval)) {
+                PGresult* res = PQexec(db->pg_conn, "SELECT 1;");
+                healthy = PQresultStatus(res) == PGRES_TUPLES_OK;
+                PQclear(res);
+            }
+
+            if (!healthy) {
+                db.reset();
+            }
+        }
+
+        if (!db) {
+            db = std::make_unique<postgresql_database>(this->settings.host, this->settings.user, this->settings.password, this->settings.database, this->settings.port);
+            if (!db->good()) {
+                throw std::runtime_error{"postgresql_pool: failed to connect to database '" + this->settings.database + "'"};
+            }
+        }
+    } catch (...) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            --this->open_connections;
+        }
+        this->available.notify_one();
+        throw;
+    }
+
+    return connection{this, std::move(db)};
+}
+
+inline void limhamn::database::postgresql_pool::release(std::unique_ptr<postgresql_database> db) {
+    bool reusable = db->good() && PQstatus(db->pg_conn) == CONNECTION_OK;
+
+#ifdef LIBPQ_HAS_PIPELINING
+    reusable = reusable && PQpipelineStatus(db->pg_conn) == PQ_PIPELINE_OFF;
+#endif
+
+    if (reusable) {
+        switch (PQtransactionStatus(db->pg_conn)) {
+            case PQTRANS_IDLE:
+                break;
+            case PQTRANS_INTRANS:
+            case PQTRANS_INERROR: {
+                PGresult* res = PQexec(db->pg_conn, "ROLLBACK;");
+                reusable = PQresultStatus(res) == PGRES_COMMAND_OK;
+                PQclear(res);
+                break;
+            }
+            default:
+                reusable = false;
+                break;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (reusable && !this->closed) {
+            this->connections.push_back({std::move(db), std::chrono::steady_clock::now()});
+        } else {
+            --this->open_connections;
+        }
+    }
+    this->available.notify_one();
+}
+
+inline std::size_t limhamn::database::postgresql_pool::size() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->open_connections;
+}
+
+inline std::size_t limhamn::database::postgresql_pool::idle() const {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    return this->connections.size();
+}
+
+template <typename F>
+inline decltype(auto) limhamn::database::postgresql_pool::run(F&& f) {
+    connection c = this->acquire();
+    return std::forward<F>(f)(*c);
+}
+
+#ifdef LIBPQ_HAS_PIPELINING
+inline limhamn::database::postgresql_pipeline::postgresql_pipeline(postgresql_database& db) : db(db) {
+    if (!this->db.good()) {
+        throw std::runtime_error{"postgresql_pipeline: database is not open"};
+    }
+
+    if (PQenterPipelineMode(this->db.pg_conn) != 1) {
+        throw std::runtime_error{"postgresql_pipeline: failed to enter pipeline mode: " + std::string(PQerrorMessage(this->db.pg_conn))};
+    }
+
+#ifndef _WIN32
+    // lets flush() read results while it writes, so a long pipeline cannot fill both socket buffers and stall
+    PQsetnonblocking(this->db.pg_conn, 1);
+#endif
+}
+
+inline limhamn::database::postgresql_pipeline::~postgresql_pipeline() {
+    try {
+        if (this->sent > 0) {
+            static_cast<void>(this->sync());
+        }
+    } catch (...) {
+    }
+
+#ifndef _WIN32
+    PQsetnonblocking(this->db.pg_conn, 0);
+#endif
+    PQexitPipelineMode(this->db.pg_conn);
+}
+
+inline void limhamn::database::postgresql_pipeline::flush() {
+#ifndef _WIN32
+    for (;;) {
+        const int ret = PQflush(this->db.pg_conn);
+        if (ret == 0) {
+            return;
+        }
+        if (ret < 0) {
+            throw std::runtime_error{"postgresql_pipeline: " + std::string(PQerrorMessage(this->db.pg_conn))};
+        }
 
-    std::vector<std::string> str{to_string(args)...};
+        pollfd pfd{PQsocket(this->db.pg_conn), POLLIN | POLLOUT, 0};
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error{"postgresql_pipeline: poll failed"};
+        }
+
+        if ((pfd.revents & POLLIN) && PQconsumeInput(this->db.pg_conn) != 1) {
+            throw std::runtime_error{"postgresql_pipeline: " + std::string(PQerrorMessage(this->db.pg_conn))};
+        }
+    }
+#else
+    if (PQflush(this->db.pg_conn) != 0) {
+        throw std::runtime_error{"postgresql_pipeline: " + std::string(PQerrorMessage(this->db.pg_conn))};
+    }
+#endif
+}
+
+template <typename... Args>
+inline std::size_t limhamn::database::postgresql_pipeline::send(const std::string& query, Args... args) {
+    const std::string nq = _limhamn_database_impl::number_placeholders(query);
+
+    std::vector<std::string> str{remove_non_utf8(this->db.to_string(args))...};
     std::vector<const char*> param_v{};
     param_v.reserve(str.size());
     for (const std::string& s : str) {
         param_v.push_back(s.c_str());
     }
 
-    PGresult* res = PQexecParams(pg_conn, nq.c_str(), static_cast<int>(param_v.size()), nullptr, param_v.data(), nullptr, nullptr, 0);
+    if (PQsendQueryParams(this->db.pg_conn, nq.c_str(), static_cast<int>(param_v.size()), nullptr, param_v.data(), nullptr, nullptr, 0) != 1) {
+        throw std::runtime_error{"postgresql_pipeline: failed to send query: " + std::string(PQerrorMessage(this->db.pg_conn))};
+    }
 
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
-        PQclear(res);
-        return {};
+    // the query is queued once PQsendQueryParams succeeds, so sync() gets its result even if flushing fails here
+    const std::size_t index = this->sent++;
+    this->flush();
+    return index;
+}
+
+inline std::vector<limhamn::database::postgresql_pipeline::result> limhamn::database::postgresql_pipeline::sync() {
+    std::vector<result> results(this->sent);
+    this->sent = 0;
+
+    if (PQpipelineSync(this->db.pg_conn) != 1) {
+        throw std::runtime_error{"postgresql_pipeline: failed to sync: " + std::string(PQerrorMessage(this->db.pg_conn))};
     }
+    this->flush();
 
-    std::vector<std::unordered_map<std::string, std::string>> result;
-    int nrows = PQntuples(res);
-    int nfields = PQnfields(res);
+    for (auto& it : results) {
+        PGresult* res = PQgetResult(this->db.pg_conn);
+        if (res == nullptr) {
+            throw std::runtime_error{"postgresql_pipeline: connection lost: " + std::string(PQerrorMessage(this->db.pg_conn))};
+        }
 
-    for (int i = 0; i < nrows; ++i) {
-        std::unordered_map<std::string, std::string> row;
-        for (int j = 0; j < nfields; ++j) {
-            row[PQfname(res, j)] = PQgetvalue(res, i, j);
+        switch (PQresultStatus(res)) {
+            case PGRES_TUPLES_OK:
+                it.ok = true;
+                it.rows = _limhamn_database_impl::get_rows(res);
+                it.affected_rows = static_cast<std::int64_t>(it.rows.size());
+                break;
+            case PGRES_COMMAND_OK: {
+                it.ok = true;
+                const char* affected = PQcmdTuples(res);
+                it.affected_rows = affected[0] != '\0' ? std::stoll(affected) : 0;
+                break;
+            }
+            case PGRES_PIPELINE_ABORTED:
+                it.error = "skipped after an earlier query in the pipeline failed";
+                break;
+            default:
+                it.error = PQresultErrorMessage(res);
+                break;
+        }
+        PQclear(res);
+
+        // each query's results end with a null result
+        while ((res = PQgetResult(this->db.pg_conn)) != nullptr) {
+            PQclear(res);
         }
-        result.push_back(std::move(row));
     }
 
+    PGresult* res = PQgetResult(this->db.pg_conn);
+    const bool synced = res != nullptr && PQresultStatus(res) == PGRES_PIPELINE_SYNC;
     PQclear(res);
-    return result;
+    if (!synced) {
+        throw std::runtime_error{"postgresql_pipeline: expected the end of the pipeline: " + std::string(PQerrorMessage(this->db.pg_conn))};
+    }
+
+    return results;
+}
+
+inline std::size_t limhamn::database::postgresql_pipeline::pending() const {
+    return this->sent;
 }
+#endif
 #endif // LIMHAMN_DATABASE_POSTGRESQL
 #endif // LIMHAMN_DATABASE_IMPL
@@ -10,9 +10,20 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <future>
+#include <exception>
+#include <cstdint>
 #ifdef LIMHAMN_HTTP_CLIENT_IMPL
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
 #include <openssl/evp.h>
-#include <boost/system/detail/error_code.hpp>
+#include <boost/system/error_code.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/ssl.hpp>
@@ -63,9 +74,11 @@ namespace limhamn::http::client {
         std::string user_agent{"BASIC_USER_AGENT"};
         std::string body{};
         unsigned int port{80};
-        protocol protocol{protocol::http};
-        method method{method::get};
+        limhamn::http::client::protocol protocol{limhamn::http::client::protocol::http};
+        limhamn::http::client::method method{limhamn::http::client::method::get};
         std::vector<header> headers{};
+        int64_t connect_timeout{10000}; // milliseconds each of resolving, connecting and the TLS handshake may take in a client_pool, -1 for no limit
+        int64_t timeout{30000}; // milliseconds each of writing the request and reading the response may take in a client_pool, -1 for no limit
     };
     /**
      * @brief  Class representing a network request
@@ -81,93 +94,202 @@ namespace limhamn::http::client {
             [[nodiscard]] response make_request() const;
     };
 
+    /**
+     * @brief Struct that contains the settings for a client_pool
+     */
+    struct pool_settings {
+        std::size_t threads{1}; // threads that run asynchronous requests
+        std::size_t max_idle_connections{8}; // idle connections kept per host, port and protocol
+        int64_t idle_timeout{4000}; // milliseconds an idle connection is kept, should be below the servers' keep-alive timeout
+        int64_t dns_ttl{60000}; // milliseconds a resolved address is cached, 0 to resolve every connection
+    };
+
+    /**
+     * @brief  Class that makes requests over reused keep-alive connections
+     * @note   Connections are kept per host, port and protocol. DNS results and TLS sessions are cached, so a
+     *         new connection to a known host skips the lookup and resumes the TLS session instead of doing a
+     *         full handshake.
+     * @note   Thread safe. Synchronous requests block the calling thread, asynchronous requests run on the pool's own threads.
+     */
+    class client_pool {
+        public:
+            explicit client_pool(const pool_settings& settings = {});
+            ~client_pool();
+            client_pool(const client_pool&) = delete;
+            client_pool& operator=(const client_pool&) = delete;
+
+            /**
+             * @brief  Make a network request, reusing an idle connection if there is one
+             * @param  r The request to make
+             * @return Returns a Response object
+             * @throws std::runtime_error if the request fails
+             * @note   If a reused connection fails, the request is sent again on a new one only if none of it was written,
+             *         or if it is a GET (or has an Idempotency-Key header) and no part of a response arrived.
+             * @note   Every step is bounded by request::connect_timeout or request::timeout, and fails with a timeout error once that passes.
+             */
+            [[nodiscard]] response make_request(const request& r);
+            /**
+             * @brief  Make a network request on the pool's threads
+             * @param  r The request to make
+             * @return Returns a future that holds the response, or rethrows the error
+             */
+            [[nodiscard]] std::future<response> make_request_async(request r);
+            /**
+             * @brief  Make a network request on the pool's threads
+             * @param  r The request to make
+             * @param  callback The function to call with the response, or with the error if the request failed
+             */
+            void make_request_async(request r, std::function<void(response, std::exception_ptr)> callback);
+            /**
+             * @brief  Close all idle connections and forget cached DNS results and TLS sessions
+             */
+            void clear();
+        private:
+            struct state;
+            std::shared_ptr<state> impl;
+    };
+
     /**
      * @brief String that contains the user certificates.
      * @note Only used for HTTPS requests, not required.
      * @note If not set, the default root certificates will be used.
+     * @note Read once, when the first HTTPS request is made. Call reload_certificates() after changing it.
      */
     inline std::string user_cert{};
+    /**
+     * @brief Whether to also trust the certificates in the system's default locations.
+     * @note Read once, like user_cert.
+     */
+    inline bool use_system_certificates{false};
 
     /**
      * @brief  Function that gets the root certificate string.
      */
     std::string get_root_certificates();
+    /**
+     * @brief  Rebuild the shared TLS context from user_cert, the root certificates and the system certificates.
+     * @note   Requests already in progress, and connections already open in a client_pool, keep using the old one.
+     * @throws std::runtime_error if the certificates cannot be loaded. The old context is kept in that case.
+     */
+    void reload_certificates();
 }
 
 #ifdef LIMHAMN_HTTP_CLIENT_IMPL
-inline limhamn::http::client::response limhamn::http::client::client::make_request() const {
-    try {
-        response resp;
-
-        boost::asio::ssl::context ctx(boost::asio::ssl::context::tlsv12_client);
+namespace _limhamn_http_client_impl {
+    inline std::mutex context_mutex;
+    inline std::shared_ptr<boost::asio::ssl::context> shared_context{};
 
+    /**
+     * @brief Builds a TLS context, parsing the trust store
+     * @return std::shared_ptr<boost::asio::ssl::context>
+     */
+    inline std::shared_ptr<boost::asio::ssl::context> make_context() {
+        auto ctx = std::make_shared<boost::asio::ssl::context>(boost::asio::ssl::context::tlsv12_client);
         const std::string cert = limhamn::http::client::get_root_certificates();
 
-        boost::beast::http::verb verb;
-        boost::beast::http::request<boost::beast::http::string_body> http_request;
+        boost::system::error_code ec;
+        if (cert.empty() || limhamn::http::client::use_system_certificates) {
+            ctx->set_default_verify_paths(ec);
+            if (ec) {
+                throw boost::system::system_error{ec};
+            }
+        }
+        if (!cert.empty()) {
+            ctx->add_certificate_authority(boost::asio::buffer(cert.data(), cert.size()), ec);
+            if (ec) {
+                throw boost::system::system_error{ec};
+            }
+        }
+
+        ctx->set_verify_mode(boost::asio::ssl::verify_peer);
+        SSL_CTX_set_session_cache_mode(ctx->native_handle(), SSL_SESS_CACHE_CLIENT);
+
+        return ctx;
+    }
+
+    /**
+     * @brief Gets the shared TLS context, building it on first use
+     * @return std::shared_ptr<boost::asio::ssl::context>
+     * @note Host name verification is set per stream, so the context can be shared by all hosts.
+     */
+    inline std::shared_ptr<boost::asio::ssl::context> get_context() {
+        auto ctx = std::atomic_load(&shared_context);
+        if (ctx) {
+            return ctx;
+        }
+
+        std::lock_guard<std::mutex> lock(context_mutex);
+        ctx = std::atomic_load(&shared_context);
+        if (!ctx) {
+            ctx = make_context();
+            std::atomic_store(&shared_context, ctx);
+        }
+
+        return ctx;
+    }
+    /**
+     * @brief Builds the Beast request for a request
+     * @param r The request
+     * @return boost::beast::http::request<boost::beast::http::string_body>
+     */
+    inline boost::beast::http::request<boost::beast::http::string_body> build_request(const limhamn::http::client::request& r) {
+        boost::beast::http::verb verb{boost::beast::http::verb::get};
 
         switch (r.method) {
-            case method::get:
+            case limhamn::http::client::method::get:
                 verb = boost::beast::http::verb::get;
                 break;
-            case method::post:
+            case limhamn::http::client::method::post:
                 verb = boost::beast::http::verb::post;
                 break;
-            case method::put:
+            case limhamn::http::client::method::put:
                 verb = boost::beast::http::verb::put;
                 break;
-            case method::delete_:
+            case limhamn::http::client::method::delete_:
                 verb = boost::beast::http::verb::delete_;
                 break;
             default:
                 break;
         }
 
-        const auto prepare_body = [&]() {
-            http_request = boost::beast::http::request<boost::beast::http::string_body>(verb, r.host + std::to_string(r.port), 11);
-            http_request.set(boost::beast::http::field::host, r.host);
+        boost::beast::http::request<boost::beast::http::string_body> http_request{verb, r.endpoint + r.query, 11};
+        http_request.set(boost::beast::http::field::host, r.host);
 
-            if (!r.body.empty()) {
-                http_request.set(boost::beast::http::field::content_length, std::to_string(r.body.size()));
-                http_request.body() = r.body;
-            }
+        if (!r.body.empty()) {
+            http_request.body() = r.body;
+        }
 
-            for (const auto& it : r.headers) {
-                if (it.name.empty() || it.data.empty()) {
-                    continue;
-                }
-                http_request.set(it.name, it.data);
+        for (const auto& it : r.headers) {
+            if (it.name.empty() || it.data.empty()) {
+                continue;
             }
+            http_request.set(it.name, it.data);
+        }
 
-            http_request.target(r.endpoint + r.query);
-            http_request.prepare_payload();
+        http_request.prepare_payload();
+        return http_request;
+    }
+}
+
+inline limhamn::http::client::response limhamn::http::client::client::make_request() const {
+    try {
+        response resp;
+
+        boost::beast::http::request<boost::beast::http::string_body> http_request;
+
+        const auto prepare_body = [&]() {
+            http_request = _limhamn_http_client_impl::build_request(r);
         };
 
         if (r.protocol == protocol::https) {
             boost::system::error_code ec;
-            if (cert.empty()) {
-                const auto ret = ctx.set_default_verify_paths(ec);
-                if (!ret) {
-                    throw boost::system::system_error{ec};
-                }
-            } else {
-                const auto ret = ctx.add_certificate_authority(boost::asio::buffer(cert.data(), cert.size()), ec);
-                if (!ret) {
-                    throw boost::system::system_error{ec};
-                }
-            }
-
-            if (ec) {
-                throw boost::system::system_error{ec};
-            }
-
-            ctx.set_verify_mode(boost::asio::ssl::verify_peer);
-            ctx.set_verify_callback(boost::asio::ssl::host_name_verification(this->r.host));
+            const auto ctx = _limhamn_http_client_impl::get_context();
 
             boost::asio::io_context ioc;
             boost::asio::ip::tcp::resolver resolver(ioc);
 
-            boost::beast::ssl_stream<boost::beast::tcp_stream> stream(ioc, ctx);
+            boost::beast::ssl_stream<boost::beast::tcp_stream> stream(ioc, *ctx);
+            stream.set_verify_callback(boost::asio::ssl::host_name_verification(this->r.host));
 
             if (!SSL_set_tlsext_host_name(stream.native_handle(), r.host.c_str())) {
                 boost::system::error_code ssl_ec{static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category()};
@@ -3485,4 +3607,420 @@ inline std::string limhamn::http::client::get_root_certificates() {
         "-----END CERTIFICATE-----\n"
     };
 }
+
+struct limhamn::http::client::client_pool::state {
+    struct connection {
+        std::shared_ptr<boost::asio::ssl::context> ctx{};
+        // run only by the thread using the connection, so that its operations can time out and be stopped
+        std::unique_ptr<boost::asio::io_context> ioc{std::make_unique<boost::asio::io_context>(1)};
+        std::unique_ptr<boost::beast::tcp_stream> tcp{};
+        std::unique_ptr<boost::beast::ssl_stream<boost::beast::tcp_stream>> tls{};
+        boost::beast::flat_buffer buffer{};
+        std::chrono::steady_clock::time_point last_used{};
+
+        ~connection() {
+            // freeing a connection that was not shut down marks its session as not resumable
+            if (tls) {
+                SSL_set_shutdown(tls->native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+            }
+        }
+    };
+
+    struct resolved {
+        boost::asio::ip::tcp::resolver::results_type results{};
+        std::chrono::steady_clock::time_point expires{};
+    };
+
+    struct session_deleter {
+        void operator()(SSL_SESSION* session) const {
+            SSL_SESSION_free(session);
+        }
+    };
+
+    /**
+     * @brief Marks a connection as in use, so that shutdown() can stop its operations
+     */
+    class activity {
+            state& owner;
+            connection& conn;
+        public:
+            activity(state& owner, connection& conn) : owner(owner), conn(conn) {
+                std::lock_guard<std::mutex> lock(owner.mutex);
+                owner.active.insert(&conn);
+            }
+            ~activity() {
+                std::lock_guard<std::mutex> lock(owner.mutex);
+                owner.active.erase(&conn);
+            }
+            activity(const activity&) = delete;
+            activity& operator=(const activity&) = delete;
+    };
+
+    pool_settings settings{};
+    boost::asio::thread_pool workers;
+    std::atomic<bool> stopping{false};
+
+    std::mutex mutex{};
+    std::unordered_set<connection*> active{};
+    std::unordered_map<std::string, std::vector<std::unique_ptr<connection>>> idle{};
+    std::unordered_map<std::string, resolved> dns{};
+    std::unordered_map<std::string, std::unique_ptr<SSL_SESSION, session_deleter>> sessions{};
+
+    explicit state(const pool_settings& settings) : settings(settings), workers(settings.threads == 0 ? 1 : settings.threads) {}
+
+    static std::string get_key(const request& r) {
+        return (r.protocol == protocol::https ? "https://" : "http://") + r.host + ":" + std::to_string(r.port);
+    }
+
+    static void expire(boost::beast::tcp_stream& stream, const int64_t timeout) {
+        if (timeout == -1) {
+            stream.expires_never();
+        } else {
+            stream.expires_after(std::chrono::milliseconds(timeout));
+        }
+    }
+
+    /**
+     * @brief Runs one asynchronous operation on the connection's io_context until it completes
+     * @param start Starts the operation, passing the error code to the handler it is given
+     * @param timeout Milliseconds to wait before giving up, -1 to wait until the operation completes
+     * @throws boost::system::system_error if the operation fails or times out, or the pool is shutting down
+     * @note A connection whose operation threw must not be used again, its io_context may still hold the handler.
+     */
+    template <typename F>
+    void run(connection& conn, F&& start, const int64_t timeout = -1) {
+        conn.ioc->restart();
+        // checked after restart(), so that a stop() from shutdown() is either seen here or stops run_one()
+        if (stopping.load()) {
+            throw boost::system::system_error{boost::asio::error::operation_aborted};
+        }
+
+        bool finished{false};
+        boost::beast::error_code result{};
+        start([&finished, &result](const boost::beast::error_code& ec) {
+            result = ec;
+            finished = true;
+        });
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout == -1 ? 0 : timeout);
+        while (!finished) {
+            const std::size_t ran = timeout == -1 ? conn.ioc->run_one() : conn.ioc->run_one_until(deadline);
+            if (ran == 0) {
+                break;
+            }
+        }
+
+        if (!finished) {
+            throw boost::system::system_error{conn.ioc->stopped() && stopping.load() ? boost::asio::error::operation_aborted : boost::asio::error::timed_out};
+        }
+        if (result) {
+            throw boost::system::system_error{result};
+        }
+    }
+
+    /**
+     * @brief Stops the operations of every connection in use, and makes new ones fail
+     */
+    void shutdown() {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping.store(true);
+        for (auto* it : active) {
+            it->ioc->stop();
+        }
+    }
+
+    boost::asio::ip::tcp::resolver::results_type resolve(connection& conn, const request& r) {
+        const std::string key = r.host + ":" + std::to_string(r.port);
+        const auto now = std::chrono::steady_clock::now();
+
+        if (settings.dns_ttl != 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = dns.find(key);
+            if (it != dns.end() && it->second.expires > now) {
+                return it->second.results;
+            }
+        }
+
+        // the resolver does not go through the tcp_stream, so its timeout is the wait in run() instead
+        boost::asio::ip::tcp::resolver resolver(*conn.ioc);
+        boost::asio::ip::tcp::resolver::results_type results{};
+        run(conn, [&](auto complete) {
+            resolver.async_resolve(r.host, std::to_string(r.port),
+                [&results, complete](const boost::beast::error_code& ec, boost::asio::ip::tcp::resolver::results_type found) {
+                    results = std::move(found);
+                    complete(ec);
+                });
+        }, r.connect_timeout);
+
+        if (settings.dns_ttl != 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            dns[key] = {results, now + std::chrono::milliseconds(settings.dns_ttl)};
+        }
+
+        return results;
+    }
+
+    std::unique_ptr<connection> acquire(const std::string& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        auto it = idle.find(key);
+        if (it == idle.end()) {
+            return nullptr;
+        }
+
+        const auto oldest = std::chrono::steady_clock::now() - std::chrono::milliseconds(settings.idle_timeout);
+        auto& list = it->second;
+        while (!list.empty()) {
+            auto conn = std::move(list.back());
+            list.pop_back();
+            if (conn->last_used >= oldest) {
+                return conn;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void release(const std::string& key, std::unique_ptr<connection> conn) {
+        conn->last_used = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& list = idle[key];
+        if (list.size() < settings.max_idle_connections) {
+            list.push_back(std::move(conn));
+        }
+    }
+
+    void connect(connection& conn, const request& r, const std::string& key) {
+        const auto results = resolve(conn, r);
+
+        const auto open = [&](boost::beast::tcp_stream& stream) {
+            expire(stream, r.connect_timeout);
+            run(conn, [&](auto complete) {
+                stream.async_connect(results, [complete](const boost::beast::error_code& ec, const boost::asio::ip::tcp::endpoint&) {
+                    complete(ec);
+                });
+            });
+            stream.socket().set_option(boost::asio::ip::tcp::no_delay(true));
+        };
+
+        if (r.protocol != protocol::https) {
+            conn.tcp = std::make_unique<boost::beast::tcp_stream>(*conn.ioc);
+            open(*conn.tcp);
+            return;
+        }
+
+        conn.ctx = _limhamn_http_client_impl::get_context();
+        conn.tls = std::make_unique<boost::beast::ssl_stream<boost::beast::tcp_stream>>(*conn.ioc, *conn.ctx);
+        SSL* ssl = conn.tls->native_handle();
+
+        if (!SSL_set_tlsext_host_name(ssl, r.host.c_str())) {
+            boost::system::error_code ssl_ec{static_cast<int>(::ERR_get_error()), boost::asio::error::get_ssl_category()};
+            throw boost::beast::system_error{ssl_ec};
+        }
+        conn.tls->set_verify_callback(boost::asio::ssl::host_name_verification(r.host));
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = sessions.find(key);
+            if (it != sessions.end()) {
+                SSL_set_session(ssl, it->second.get());
+            }
+        }
+
+        open(get_lowest_layer(*conn.tls));
+        expire(get_lowest_layer(*conn.tls), r.connect_timeout);
+        run(conn, [&](auto complete) {
+            conn.tls->async_handshake(boost::asio::ssl::stream_base::client, complete);
+        });
+    }
+
+    void remember_session(const std::string& key, connection& conn) {
+        if (!conn.tls) {
+            return;
+        }
+
+        // TLS 1.3 tickets arrive after the handshake, so this is done once a response has been read
+        SSL_SESSION* session = SSL_get1_session(conn.tls->native_handle());
+        if (session == nullptr) {
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        sessions[key].reset(session);
+    }
+
+    /**
+     * @brief How far an exchange got before it failed
+     */
+    struct progress {
+        bool sent{false}; // some of the request was written
+        bool received{false}; // some of the response was read
+    };
+
+    response exchange(connection& conn, const request& r, boost::beast::http::request<boost::beast::http::string_body>& http_request, bool& reusable, progress& done) {
+        boost::beast::http::response_parser<boost::beast::http::string_body> parser;
+        parser.body_limit((std::numeric_limits<std::uint64_t>::max)());
+
+        const auto transfer = [&](auto& stream) {
+            auto& lowest = get_lowest_layer(stream);
+
+            expire(lowest, r.timeout);
+            run(conn, [&](auto complete) {
+                boost::beast::http::async_write(stream, http_request, [&done, complete](const boost::beast::error_code& ec, const std::size_t size) {
+                    done.sent = size != 0;
+                    complete(ec);
+                });
+            });
+
+            expire(lowest, r.timeout);
+            run(conn, [&](auto complete) {
+                boost::beast::http::async_read(stream, conn.buffer, parser, [&done, complete](const boost::beast::error_code& ec, const std::size_t size) {
+                    done.received = size != 0;
+                    complete(ec);
+                });
+            });
+
+            lowest.expires_never();
+        };
+
+        if (conn.tls) {
+            transfer(*conn.tls);
+        } else {
+            transfer(*conn.tcp);
+        }
+
+        response resp;
+        resp.http_status = parser.get().result_int();
+        resp.body = std::move(parser.get().body());
+        reusable = parser.get().keep_alive();
+
+        return resp;
+    }
+
+    response make_request(const request& r) {
+        const std::string key = get_key(r);
+        auto http_request = _limhamn_http_client_impl::build_request(r);
+        http_request.keep_alive(true);
+        if (http_request.find(boost::beast::http::field::user_agent) == http_request.end() && !r.user_agent.empty()) {
+            http_request.set(boost::beast::http::field::user_agent, r.user_agent);
+        }
+
+        // an idle connection may have been closed by the server in the meantime, so a failure on a reused connection
+        // is retried once on a new one. only if the server cannot have acted on the request: nothing of it was written,
+        // or it is a GET (or carries an Idempotency-Key) and no response arrived. a POST that was sent is never resent.
+        if (auto conn = acquire(key)) {
+            progress done{};
+            try {
+                bool reusable = false;
+                response resp{};
+                {
+                    const activity using_connection{*this, *conn};
+                    resp = exchange(*conn, r, http_request, reusable, done);
+                }
+                if (reusable) {
+                    release(key, std::move(conn));
+                }
+                return resp;
+            } catch (const std::exception& e) {
+                // a server that stalls is not a stale connection, and a pool that shuts down sends nothing more
+                const auto* error = dynamic_cast<const boost::system::system_error*>(&e);
+                const bool timed_out = error != nullptr && error->code() == boost::beast::error::timeout;
+                const bool replayable = http_request.method() == boost::beast::http::verb::get ||
+                    http_request.find("Idempotency-Key") != http_request.end();
+                if (timed_out || stopping.load() || (done.sent && (!replayable || done.received))) {
+                    throw;
+                }
+            }
+        }
+
+        auto conn = std::make_unique<connection>();
+        bool reusable = false;
+        response resp{};
+        {
+            // released only once the activity is over, so that another thread cannot pick the connection up before that
+            const activity using_connection{*this, *conn};
+            connect(*conn, r, key);
+            progress done{};
+            resp = exchange(*conn, r, http_request, reusable, done);
+        }
+        remember_session(key, *conn);
+        if (reusable) {
+            release(key, std::move(conn));
+        }
+
+        return resp;
+    }
+};
+
+inline void limhamn::http::client::reload_certificates() {
+    try {
+        auto ctx = _limhamn_http_client_impl::make_context();
+        std::lock_guard<std::mutex> lock(_limhamn_http_client_impl::context_mutex);
+        std::atomic_store(&_limhamn_http_client_impl::shared_context, std::move(ctx));
+    } catch (std::exception& e) {
+        throw std::runtime_error{e.what()};
+    }
+}
+
+inline limhamn::http::client::client_pool::client_pool(const pool_settings& settings) {
+    try {
+        this->impl = std::make_shared<state>(settings);
+    } catch (std::exception& e) {
+        throw std::runtime_error{e.what()};
+    }
+}
+
+inline limhamn::http::client::client_pool::~client_pool() {
+    // requests still running or queued fail with operation_aborted instead of holding up the join
+    this->impl->shutdown();
+    this->impl->workers.join();
+}
+
+inline limhamn::http::client::response limhamn::http::client::client_pool::make_request(const request& r) {
+    try {
+        return this->impl->make_request(r);
+    } catch (std::exception& e) {
+        throw std::runtime_error{e.what()};
+    }
+}
+
+inline std::future<limhamn::http::client::response> limhamn::http::client::client_pool::make_request_async(request r) {
+    auto promise = std::make_shared<std::promise<response>>();
+    auto future = promise->get_future();
+
+    this->make_request_async(std::move(r), [promise](response resp, const std::exception_ptr& error) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value(std::move(resp));
+        }
+    });
+
+    return future;
+}
+
+inline void limhamn::http::client::client_pool::make_request_async(request r, std::function<void(response, std::exception_ptr)> callback) {
+    boost::asio::post(this->impl->workers, [this, r = std::move(r), callback = std::move(callback)]() {
+        response resp{};
+        std::exception_ptr error{};
+
+        try {
+            resp = this->make_request(r);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        if (callback) {
+            callback(std::move(resp), error);
+        }
+    });
+}
+
+inline void limhamn::http::client::client_pool::clear() {
+    std::lock_guard<std::mutex> lock(this->impl->mutex);
+    this->impl->idle.clear();
+    this->impl->dns.clear();
+    this->impl->sessions.clear();
+}
 #endif // LIMHAMN_HTTP_CLIENT_IMPL
\ No newline at end of file
@@ -3,28 +3,70 @@
  * Licensed under the MIT license
  *
  * Dependencies: Boost Beast, Boost Asio, OpenSSL
+ * Optional dependencies: zlib (LIMHAMN_HTTP_SERVER_ZLIB), Brotli (LIMHAMN_HTTP_SERVER_BROTLI), Zstandard (LIMHAMN_HTTP_SERVER_ZSTD)
  * C++ version: >=17
  * File version: 0.1.0
- * Link: g++ ... -lboost_system -lssl -lcrypto
+ * Link: g++ ... -lboost_system -lssl -lcrypto [-lz] [-lbrotlienc] [-lzstd]
  */
 #pragma once
 
 #include <string>
 #include <functional>
 #include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <string_view>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
 #ifdef LIMHAMN_HTTP_SERVER_IMPL
 #include <filesystem>
 #include <sstream>
 #include <fstream>
 #include <random>
 #include <algorithm>
-#include <boost/system/detail/error_code.hpp>
+#include <atomic>
+#include <unordered_set>
+#include <deque>
+#include <cmath>
+#include <list>
+#include <cstring>
+#include <cstdio>
+#include <boost/system/error_code.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#ifdef LIMHAMN_HTTP_SERVER_ZLIB
+#include <zlib.h>
+#endif
+#ifdef LIMHAMN_HTTP_SERVER_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef LIMHAMN_HTTP_SERVER_ZSTD
+#include <zstd.h>
+#endif
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#endif
 #endif
 
 #define LIMHAMN_HTTP_SERVER
 
+namespace _limhamn_http_server_impl {
+    class session;
+}
+
 /**
  * @brief  Namespace that contains all the networking related classes and functions.
  */
@@ -61,6 +103,285 @@ namespace limhamn::http::server {
         temporary,
     };
 
+    /**
+     * @brief  The key/value pairs stored in a session.
+     */
+    using session_data = std::unordered_map<std::string, std::string>;
+
+    /**
+     * @brief  Interface for session storage backends.
+     * @note   Implementations are called concurrently from all server threads and must be thread safe.
+     */
+    class session_store {
+    public:
+        virtual ~session_store() = default;
+        /**
+         * @brief  Load a session.
+         * @param  id The session id
+         * @param  data Filled with the stored values if the session exists
+         * @return True if the session exists
+         */
+        virtual bool load(const std::string& id, session_data& data) = 0;
+        /**
+         * @brief  Merge values into a session, creating the session if it does not exist.
+         * @param  id The session id
+         * @param  values The values to merge into the session
+         * @note   Backends should avoid writing anything if no value actually changed.
+         */
+        virtual void store(const std::string& id, const session_data& values) = 0;
+    };
+
+    /**
+     * @brief  Session store that keeps every session in its own file (session_<id>.txt, one key=value per line).
+     * @note   This is the default backend, used when server_settings::session_store is not set.
+     */
+    class file_session_store : public session_store {
+        std::string directory{};
+        std::mutex mtx[16]{};
+
+        std::mutex& lock_for(const std::string& id);
+    public:
+        /**
+         * @brief  Constructor for the file session store
+         * @param  directory The directory to store the session files in
+         */
+        explicit file_session_store(std::string directory);
+        bool load(const std::string& id, session_data& data) override;
+        void store(const std::string& id, const session_data& values) override;
+        /**
+         * @brief  Get the path of the file that holds a session.
+         * @param  id The session id
+         * @return std::string
+         */
+        [[nodiscard]] std::string get_path(const std::string& id) const;
+        /**
+         * @brief  Read a session file.
+         * @param  path The path to the session file
+         * @param  data Filled with the values in the file
+         * @return True if the file could be opened
+         */
+        static bool read_file(const std::string& path, session_data& data);
+        /**
+         * @brief  Write a session file, replacing its contents.
+         * @param  path The path to the session file
+         * @param  data The values to write
+         */
+        static void write_file(const std::string& path, const session_data& data);
+    };
+
+    /**
+     * @brief  An enum class that represents how a memory_session_store persists its sessions.
+     */
+    enum class session_persistence {
+        none, // sessions only live in memory
+        snapshot, // changed sessions are periodically written to the directory in the file_session_store format
+        append_only, // every change is appended to a log file, which is replayed and compacted on startup
+    };
+
+    /**
+     * @brief  Struct that contains the memory session store settings.
+     */
+    struct memory_session_store_settings {
+        std::size_t shards{16};
+        int64_t ttl{-1}; // milliseconds since last use before a session is evicted, -1 to keep sessions forever
+        session_persistence persistence{session_persistence::none};
+        std::string persistence_path{"./sessions"}; // directory for snapshot, file for append_only
+        int64_t persistence_interval{5000}; // milliseconds between flushes and eviction sweeps
+        std::function<void(const std::exception&)> error_handler{}; // called when a background sweep or flush fails, see also memory_session_store::last_error()
+    };
+
+    /**
+     * @brief  Session store that keeps sessions in memory, split over independently locked shards.
+     */
+    class memory_session_store : public session_store {
+        struct entry {
+            session_data data{};
+            int64_t last_access{};
+            bool dirty{false};
+        };
+        struct shard {
+            std::mutex mtx{};
+            std::unordered_map<std::string, entry> sessions{};
+            std::vector<std::string> removed{};
+        };
+
+        memory_session_store_settings settings{};
+        std::vector<std::unique_ptr<shard>> shards{};
+        std::mutex log_mtx{};
+        std::string log_buffer{};
+        std::mutex worker_mtx{};
+        std::condition_variable worker_cv{};
+        bool stopping{false};
+        std::string background_error{}; // guarded by worker_mtx
+        std::thread worker{};
+
+        shard& shard_for(const std::string& id);
+        void restore();
+        void compact_log();
+        void sweep_and_flush();
+    public:
+        /**
+         * @brief  Constructor for the memory session store
+         * @param  settings The settings for the store
+         * @note   Persisted sessions are loaded from settings.persistence_path before the constructor returns.
+         */
+        explicit memory_session_store(const memory_session_store_settings& settings = {});
+        ~memory_session_store() override;
+        bool load(const std::string& id, session_data& data) override;
+        void store(const std::string& id, const session_data& values) override;
+        /**
+         * @brief  Evict expired sessions and write pending changes now.
+         * @note   Done periodically by a background thread if ttl or persistence is enabled.
+         */
+        void flush();
+        /**
+         * @brief  Get the number of sessions held in memory.
+         * @return std::size_t
+         */
+        [[nodiscard]] std::size_t size();
+        /**
+         * @brief  Get why the last background sweep or flush failed.
+         * @return std::string, the message of the exception, or empty if the last one succeeded
+         * @note   The failed changes are kept and retried on the next interval.
+         */
+        [[nodiscard]] std::string last_error();
+    };
+
+    class request_view;
+
+    /**
+     * @brief  Receives a request body as it is read from the connection, instead of it being buffered in memory.
+     * @note   Exceptions thrown from write() or finish() abort the request with 400 Bad Request,
+     *         or 413 Payload Too Large if the exception is a std::length_error.
+     */
+    class body_sink {
+    public:
+        virtual ~body_sink() = default;
+        /**
+         * @brief  Write a chunk of the body.
+         * @param  data The data
+         * @param  size The size of the data
+         */
+        virtual void write(const char* data, std::size_t size) = 0;
+        /**
+         * @brief  Called once the whole body has been read, before the request callback.
+         */
+        virtual void finish() {}
+    };
+
+    /**
+     * @brief  body_sink that forwards to an object with write(const char*, std::size_t) and finish() members,
+     *         such as limhamn::http::utils::multipart_writer.
+     * @note   If finish() returns a bool, false rejects the body as incomplete with 400 Bad Request.
+     *         If the object has an oversized() member, true rejects the body with 413 Payload Too Large.
+     */
+    template <typename T>
+    class basic_body_sink : public body_sink {
+    public:
+        template <typename... Args>
+        explicit basic_body_sink(Args&&... args) : target(std::forward<Args>(args)...) {}
+
+        void write(const char* data, std::size_t size) override {
+            target.write(data, size);
+            // stop reading as soon as a part is too large, instead of after the rest of the body
+            if (oversized(target, 0)) {
+                throw std::length_error{"basic_body_sink: part too large"};
+            }
+        }
+        void finish() override {
+            if constexpr (std::is_same_v<decltype(target.finish()), bool>) {
+                if (!target.finish()) {
+                    throw std::runtime_error{"basic_body_sink: incomplete body"};
+                }
+            } else {
+                target.finish();
+            }
+            if (oversized(target, 0)) {
+                throw std::length_error{"basic_body_sink: part too large"};
+            }
+        }
+        /**
+         * @brief  Get the wrapped object.
+         * @return T&
+         */
+        T& get() {
+            return target;
+        }
+    private:
+        T target;
+
+        template <typename U>
+        static auto oversized(U& object, int) -> decltype(static_cast<bool>(object.oversized())) {
+            return object.oversized();
+        }
+        template <typename U>
+        static bool oversized(U&, long) {
+            return false;
+        }
+    };
+
+    /**
+     * @brief  A request as it is passed to server_settings::access_log, once its response has been written.
+     * @note   The views are only valid for the duration of the call.
+     */
+    struct access_record {
+        std::string_view method{};
+        std::string_view target{};
+        std::string_view ip_address{};
+        std::string_view user_agent{};
+        unsigned int status{0};
+        std::uint64_t bytes_received{0};
+        std::uint64_t bytes_sent{0};
+        std::int64_t duration{0}; // microseconds from the end of the request headers to the end of the response
+    };
+
+    /**
+     * @brief  Latency distribution of one route.
+     * @note   Buckets are log-linear: four per power of two microseconds, so any value is within 25% of its bucket bound.
+     */
+    struct latency_histogram {
+        static constexpr std::size_t bucket_count{144};
+
+        std::string route{};
+        std::array<std::uint64_t, bucket_count> buckets{};
+        std::uint64_t count{0};
+        double sum{0}; // seconds
+
+        /**
+         * @brief  Get the upper bound of a bucket.
+         * @param  index The index of the bucket
+         * @return double Seconds
+         */
+        [[nodiscard]] static double bucket_upper_bound(std::size_t index);
+        /**
+         * @brief  Get a quantile, e.g. 0.99 for the 99th percentile.
+         * @param  q The quantile, between 0 and 1
+         * @return double Seconds, the upper bound of the bucket the quantile falls in
+         */
+        [[nodiscard]] double quantile(double q) const;
+    };
+
+    /**
+     * @brief  Counters and latency histograms of the server, merged from every thread.
+     */
+    struct metrics_snapshot {
+        std::uint64_t requests{0};
+        std::array<std::uint64_t, 5> status_classes{}; // 1xx to 5xx
+        std::uint64_t bytes_received{0};
+        std::uint64_t bytes_sent{0};
+        std::uint64_t rate_limited{0}; // requests answered 429 by the rate limiter
+        std::uint64_t blacklisted{0}; // connections closed because the address is blacklisted
+        std::uint64_t connections_total{0};
+        std::int64_t connections_open{0};
+        std::vector<latency_histogram> routes{};
+
+        /**
+         * @brief  Format the metrics in the Prometheus text exposition format.
+         * @return std::string
+         */
+        [[nodiscard]] std::string to_prometheus() const;
+    };
+
     /**
      * @brief  Struct that contains the server settings.
      */
@@ -72,11 +393,45 @@ namespace limhamn::http::server {
         std::vector<std::string> associated_session_cookies{};
         int64_t max_request_size{1024 * 1024 * 1024};
         std::vector<std::pair<std::string, int>> rate_limits{};
-        std::vector<std::string> blacklisted_ips{};
-        std::vector<std::string> whitelisted_ips{"127.0.0.1"};
-        int default_rate_limit{100};
+        std::vector<std::string> blacklisted_ips{}; // addresses or CIDR ranges, e.g. "10.0.0.0/8"
+        std::vector<std::string> whitelisted_ips{"127.0.0.1"}; // addresses or CIDR ranges, e.g. "::1/128"
+        int default_rate_limit{100}; // requests per minute per ip and endpoint, -1 for no limit
+        std::size_t rate_limit_table_size{65536}; // tracked ip/endpoint pairs, memory use is fixed at 16 bytes per entry
         bool trust_x_forwarded_for{false};
         bool session_is_secure{false};
+        std::shared_ptr<limhamn::http::server::session_store> session_store{}; // defaults to a file_session_store in session_directory
+        bool keep_alive{true};
+        int64_t keep_alive_timeout{5000}; // milliseconds a connection may sit idle between requests, -1 for no limit
+        int64_t body_timeout{30000}; // milliseconds reading a request body may go without receiving anything, -1 for no limit
+        int max_keep_alive_requests{100}; // requests served on one connection before it is closed, -1 for no limit
+        int threads{1}; // 0 means std::thread::hardware_concurrency()
+        bool reuse_port{false}; // one SO_REUSEPORT acceptor per thread instead of one shared acceptor
+        // called once the headers of a request are read, with an empty body and session. returning a sink streams
+        // the body into it instead of into memory, and the callback then receives the sink with an empty body.
+        std::function<std::shared_ptr<limhamn::http::server::body_sink>(const limhamn::http::server::request_view&)> body_streamer{};
+        bool enable_metrics{false}; // count requests, bytes and rejections, and keep per-route latency histograms
+        std::string metrics_endpoint{}; // path the metrics are served on in Prometheus text format, e.g. "/metrics"; empty for none
+        bool metrics_public{false}; // serve the metrics endpoint to every address, not only whitelisted ones
+        // called once each response has been written, on the connection's thread. see make_access_log() for a logger backed one
+        std::function<void(const limhamn::http::server::access_record&)> access_log{};
+        // compress responses the client accepts compressed. gzip needs LIMHAMN_HTTP_SERVER_ZLIB, br LIMHAMN_HTTP_SERVER_BROTLI
+        // and zstd LIMHAMN_HTTP_SERVER_ZSTD to be defined (and the library linked); with none of them nothing is compressed.
+        bool enable_compression{false};
+        std::size_t compression_min_size{1024}; // smaller bodies are sent as they are
+        std::size_t compression_offload_size{64 * 1024}; // bodies at least this large are compressed on the compression threads, not the connection's
+        int compression_threads{1};
+        // bytes of compressed shared_body and file_path variants kept. these are treated as immutable and compressed once,
+        // at the highest level; a file is compressed again when its size or modification time changes. 0 to disable.
+        std::size_t compression_cache_size{32 * 1024 * 1024};
+        std::size_t compression_max_file_size{16 * 1024 * 1024}; // larger files are always sent uncompressed with sendfile(2)
+        // serve repeated GET requests from memory instead of calling the callback. only 200 responses with a body or
+        // shared_body, no cookies and a non-zero response::cache_ttl are cached; hits do not load or store the session.
+        // requests that carry a session cookie are never served from or stored in the cache, nor are responses that set the session.
+        bool enable_response_cache{false};
+        std::size_t response_cache_size{64 * 1024 * 1024}; // bytes of cached responses, least recently used ones are evicted first
+        int64_t response_cache_ttl{0}; // milliseconds a response is cached for, unless it sets response::cache_ttl; 0 to cache only responses that do
+        std::vector<std::string> response_cache_query{}; // query parameters that are part of the key, the rest of the query is ignored
+        std::vector<std::string> response_cache_headers{}; // request headers that are part of the key, e.g. "Accept-Language"
     };
 
     /**
@@ -96,6 +451,144 @@ namespace limhamn::http::server {
         std::unordered_map<std::string, std::string> session{};
         std::string session_id{};
         std::unordered_map<std::string, std::string> fields{};
+        std::shared_ptr<limhamn::http::server::body_sink> sink{}; // set if the body was streamed by server_settings::body_streamer
+    };
+
+    /**
+     * @brief  Lightweight, read-only view of a request.
+     * @note   Every accessor returns a view into the connection's buffers, and the view itself is only valid for
+     *         the duration of the callback. Copy anything that has to outlive it.
+     * @note   The query string, form fields and cookies are only parsed the first time they are accessed.
+     */
+    class request_view {
+    public:
+        using pairs = std::vector<std::pair<std::string_view, std::string_view>>;
+
+        /**
+         * @brief  Get the requested path, without the query string.
+         * @return std::string_view
+         */
+        [[nodiscard]] std::string_view endpoint() const;
+        /**
+         * @brief  Get the full request target, including the query string.
+         * @return std::string_view
+         */
+        [[nodiscard]] std::string_view target() const;
+        /**
+         * @brief  Get the request method, e.g. "GET".
+         * @return std::string_view
+         */
+        [[nodiscard]] std::string_view method() const;
+        /**
+         * @brief  Get the request body.
+         * @return std::string_view
+         */
+        [[nodiscard]] std::string_view body() const;
+        /**
+         * @brief  Get the IP address of the client.
+         * @return std::string_view
+         */
+        [[nodiscard]] std::string_view ip_address() const;
+        /**
+         * @brief  Get the HTTP version, e.g. 11 for HTTP/1.1.
+         * @return unsigned int
+         */
+        [[nodiscard]] unsigned int version() const;
+        /**
+         * @brief  Get the value of a header.
+         * @param  name The case insensitive name of the header
+         * @return std::string_view, empty if the header is not present
+         */
+        [[nodiscard]] std::string_view header(std::string_view name) const;
+        /**
+         * @brief  Get the value of the Content-Type header.
+         * @return std::string_view
+         */
+        [[nodiscard]] std::string_view content_type() const;
+        /**
+         * @brief  Get the value of the User-Agent header.
+         * @return std::string_view
+         */
+        [[nodiscard]] std::string_view user_agent() const;
+        /**
+         * @brief  Get all query string parameters, in the order they appear.
+         * @return const pairs&
+         */
+        [[nodiscard]] const pairs& query() const;
+        /**
+         * @brief  Get a query string parameter.
+         * @param  key The name of the parameter
+         * @return std::string_view, empty if the parameter is not present
+         */
+        [[nodiscard]] std::string_view query(std::string_view key) const;
+        /**
+         * @brief  Get all url encoded form fields in the body, in the order they appear.
+         * @return const pairs&
+         */
+        [[nodiscard]] const pairs& fields() const;
+        /**
+         * @brief  Get a url encoded form field from the body.
+         * @param  key The name of the field
+         * @return std::string_view, empty if the field is not present
+         */
+        [[nodiscard]] std::string_view field(std::string_view key) const;
+        /**
+         * @brief  Get all cookies sent with the request.
+         * @return const pairs&
+         */
+        [[nodiscard]] const pairs& cookies() const;
+        /**
+         * @brief  Get a cookie sent with the request.
+         * @param  name The name of the cookie
+         * @return std::string_view, empty if the cookie is not present
+         */
+        [[nodiscard]] std::string_view cookie(std::string_view name) const;
+        /**
+         * @brief  Get the session data.
+         * @return const session_data&
+         */
+        [[nodiscard]] const session_data& session() const;
+        /**
+         * @brief  Get the session id, empty if the request has no valid session.
+         * @return std::string_view
+         */
+        [[nodiscard]] std::string_view session_id() const;
+        /**
+         * @brief  Get the sink the body was streamed into by server_settings::body_streamer.
+         * @return body_sink*, nullptr if the body was not streamed
+         */
+        [[nodiscard]] body_sink* sink() const;
+        /**
+         * @brief  Get the object wrapped by the basic_body_sink the body was streamed into.
+         * @return T*, nullptr if the body was not streamed into a basic_body_sink<T>
+         */
+        template <typename T>
+        [[nodiscard]] T* sink_as() const {
+            auto* ret = dynamic_cast<basic_body_sink<T>*>(this->sink_);
+            return ret != nullptr ? &ret->get() : nullptr;
+        }
+    private:
+        std::string_view target_{};
+        std::string_view method_{};
+        std::string_view body_{};
+        std::string_view ip_address_{};
+        std::string_view session_id_{};
+        unsigned int version_{};
+        const void* message{};
+        std::string_view (*find_header)(const void*, std::string_view){};
+        const session_data* session_{};
+        body_sink* sink_{};
+        mutable pairs query_{};
+        mutable pairs fields_{};
+        mutable pairs cookies_{};
+        mutable bool query_parsed{false};
+        mutable bool fields_parsed{false};
+        mutable bool cookies_parsed{false};
+
+        static void split_pairs(std::string_view str, char separator, pairs& out);
+        static std::string_view find_last(const pairs& p, std::string_view key);
+
+        friend class _limhamn_http_server_impl::session;
     };
 
     /**
@@ -113,6 +606,172 @@ namespace limhamn::http::server {
         std::string location{};
         redirect_type redirect_status{redirect_type::temporary};
         std::vector<header> headers{};
+        // alternate body sources, sent instead of body. the first one that is set is used.
+        std::function<std::size_t(char*, std::size_t)> generator{}; // fills the buffer and returns the bytes written, 0 to end. sent with chunked transfer encoding.
+        std::string file_path{}; // sent with sendfile(2) where available, 404 if it cannot be opened
+        std::shared_ptr<const std::string> shared_body{}; // sent without copying, for cached payloads
+        bool compress{true}; // may be compressed if server_settings::enable_compression is set, e.g. false for already compressed data
+        int64_t cache_ttl{-1}; // milliseconds the response may be served from the response cache, -1 for server_settings::response_cache_ttl (0 by default, never), 0 for never
+    };
+
+    /**
+     * @brief  Path parameters captured by a router when matching a request.
+     * @note   Names and values are views into the route pattern and the request target respectively.
+     */
+    class route_params {
+    public:
+        static constexpr std::size_t max_params{16};
+
+        /**
+         * @brief  Get the value of a parameter.
+         * @param  name The name of the parameter, as written between the braces in the pattern, or "*" for an unnamed wildcard
+         * @return std::string_view, empty if the parameter is not present
+         */
+        [[nodiscard]] std::string_view get(std::string_view name) const;
+        /**
+         * @brief  Get the value of a parameter.
+         * @param  name The name of the parameter
+         * @return std::string_view, empty if the parameter is not present
+         */
+        [[nodiscard]] std::string_view operator[](std::string_view name) const;
+        /**
+         * @brief  Get the number of captured parameters.
+         * @return std::size_t
+         */
+        [[nodiscard]] std::size_t size() const;
+        /**
+         * @brief  Get a captured parameter by position.
+         * @param  index The index of the parameter, in the order it appears in the pattern
+         * @return const std::pair<std::string_view, std::string_view>&
+         */
+        [[nodiscard]] const std::pair<std::string_view, std::string_view>& at(std::size_t index) const;
+    private:
+        std::array<std::pair<std::string_view, std::string_view>, max_params> params{};
+        std::size_t count{0};
+
+        friend class router;
+    };
+
+    /**
+     * @brief  Dispatches requests to handlers by method and path pattern.
+     * @note   Patterns are made of segments separated by '/'. A segment is either static text, a parameter
+     *         written as {name} which matches exactly one segment, or a wildcard written as * or *name which
+     *         matches the rest of the path and must be the last segment.
+     * @note   Static segments take precedence over parameters, which take precedence over wildcards. A more specific
+     *         branch that matches the path but has no route for the method falls through to the less specific ones.
+     * @note   Routes may only be added before the router is compiled. Compiling flattens the route tree into a
+     *         single hash table, so matching a path costs one lookup per segment regardless of the number of routes.
+     */
+    class router {
+    public:
+        using handler = std::function<response(const request_view&, const route_params&)>;
+        using fallback = std::function<response(const request_view&)>;
+
+        /**
+         * @brief  Add a route.
+         * @param  method The request method, e.g. "GET", or "*" to match any method
+         * @param  pattern The path pattern, e.g. "/users/{id}", where a last segment of "*name" matches the rest of the path
+         * @param  callback The function to call when the route matches
+         * @return router&
+         * @throws std::invalid_argument if the pattern is invalid or the route already exists
+         * @throws std::logic_error if the router has already been compiled
+         */
+        router& add(std::string_view method, std::string_view pattern, handler callback);
+        /**
+         * @brief  Add a GET route. HEAD requests are dispatched to GET routes as well.
+         * @param  pattern The path pattern
+         * @param  callback The function to call when the route matches
+         * @return router&
+         */
+        router& get(std::string_view pattern, handler callback);
+        /**
+         * @brief  Add a POST route.
+         * @param  pattern The path pattern
+         * @param  callback The function to call when the route matches
+         * @return router&
+         */
+        router& post(std::string_view pattern, handler callback);
+        /**
+         * @brief  Add a PUT route.
+         * @param  pattern The path pattern
+         * @param  callback The function to call when the route matches
+         * @return router&
+         */
+        router& put(std::string_view pattern, handler callback);
+        /**
+         * @brief  Add a DELETE route.
+         * @param  pattern The path pattern
+         * @param  callback The function to call when the route matches
+         * @return router&
+         */
+        router& del(std::string_view pattern, handler callback);
+        /**
+         * @brief  Set the function to call when no route matches the path.
+         * @param  callback The function to call. By default a 404 response is returned.
+         * @return router&
+         */
+        router& set_not_found(fallback callback);
+        /**
+         * @brief  Set the function to call when the path matches but not the method.
+         * @param  callback The function to call. By default a 405 response with an Allow header is returned.
+         * @return router&
+         */
+        router& set_method_not_allowed(fallback callback);
+        /**
+         * @brief  Compile the routes into the lookup table. Called by the server before it starts accepting requests,
+         *         and must be called before dispatch() when the router is used on its own.
+         */
+        void compile();
+        /**
+         * @brief  Dispatch a request to the matching route.
+         * @param  request The request to dispatch
+         * @return response
+         * @throws std::logic_error if the router has not been compiled
+         */
+        [[nodiscard]] response dispatch(const request_view& request);
+        /**
+         * @brief  Dispatch a request to the matching route.
+         * @param  request The request to dispatch
+         * @return response
+         */
+        response operator()(const request_view& request);
+    private:
+        static constexpr std::uint32_t none{0xFFFFFFFF};
+
+        struct route {
+            std::string method{};
+            handler callback{};
+            std::vector<std::string> param_names{};
+            std::string pattern{};
+        };
+
+        struct node {
+            std::string segment{};
+            std::uint32_t parent{none};
+            std::uint32_t param{none};
+            std::uint32_t wildcard{none};
+            std::vector<route> routes{};
+            std::vector<std::uint32_t> children{};
+        };
+
+        struct slot {
+            std::uint64_t hash{0};
+            std::uint32_t parent{none};
+            std::uint32_t child{none};
+        };
+
+        std::vector<node> nodes{1};
+        std::vector<slot> table{};
+        std::uint64_t mask{0};
+        bool compiled{false};
+        fallback not_found{};
+        fallback method_not_allowed{};
+
+        static std::uint64_t hash_segment(std::uint32_t parent, std::string_view segment);
+        [[nodiscard]] std::uint32_t find_static(std::uint32_t parent, std::string_view segment) const;
+        [[nodiscard]] const route* select(std::uint32_t current, std::string_view method) const;
+        [[nodiscard]] bool accepts(std::uint32_t current, std::string_view method) const;
+        [[nodiscard]] std::uint32_t match(std::uint32_t current, std::string_view path, std::string_view method, std::array<std::string_view, route_params::max_params>& values, std::size_t depth) const;
     };
 
     /**
@@ -124,567 +783,3765 @@ namespace limhamn::http::server {
          * @brief  Constructor for the server class
          * @param  settings The settings for the server
          * @param  callback The function to call when a request is made
+         * @note   If settings.threads is not 1, the callback is called concurrently from several threads.
          */
         server(const server_settings& settings, const std::function<response(const request&)>& callback);
+        /**
+         * @brief  Constructor for the server class
+         * @param  settings The settings for the server
+         * @param  callback The function to call when a request is made, given a request_view instead of a request
+         * @note   Avoids copying the request and parsing parts of it the callback never looks at.
+         * @note   If settings.threads is not 1, the callback is called concurrently from several threads.
+         */
+        server(const server_settings& settings, const std::function<response(const request_view&)>& callback);
+        /**
+         * @brief  Constructor for the server class
+         * @param  settings The settings for the server
+         * @param  routes The router to dispatch requests with. Compiled before the server starts, and must outlive it.
+         */
+        server(const server_settings& settings, router& routes);
         /**
          * @brief  Start the server
          */
         static void stop();
+        /**
+         * @brief  Get the current metrics
+         * @return metrics_snapshot
+         * @note   Only collected if server_settings::enable_metrics is set.
+         */
+        static metrics_snapshot metrics();
+        /**
+         * @brief  Drop every response in the response cache
+         * @note   Thread safe; use it when the data behind cached endpoints changes before their ttl runs out.
+         */
+        static void clear_response_cache();
     };
+
+#ifdef LIMHAMN_LOGGER
+    /**
+     * @brief  Create an access log callback that writes a line through a logger for every request
+     * @param  log The logger, which must outlive the server. Make it asynchronous to keep writes off the connection threads.
+     * @return std::function<void(const access_record&)> for server_settings::access_log
+     */
+    std::function<void(const access_record&)> make_access_log(const limhamn::logger::logger& log);
+#endif
 }
 
 #ifdef LIMHAMN_HTTP_SERVER_IMPL
 namespace _limhamn_http_server_impl {
     inline std::function<limhamn::http::server::response(const limhamn::http::server::request&)> generate_response_from_endpoint;
+    inline std::function<limhamn::http::server::response(const limhamn::http::server::request_view&)> generate_response_from_view;
+    inline std::function<std::shared_ptr<limhamn::http::server::body_sink>(const limhamn::http::server::request_view&)> body_streamer;
     void stop();
+    void run(const limhamn::http::server::server_settings& settings);
     static bool enable_session{true};
-    static std::string session_dir{"./sessions"};
     static std::string session_cookie_name{"session_id"};
     static std::vector<std::string> associated_session_cookies{};
     static int64_t max_request_size{1024 * 1024 * 1024};
     static int default_rate_limit{100};
-    static std::vector<std::pair<std::string, int>> rate_limited_endpoints{};
-    static std::vector<std::string> blacklisted_ips{};
-    static std::vector<std::string> whitelisted_ips{};
-    using RateLimitTracker = std::unordered_map<std::string, std::tuple<std::string, int64_t, int64_t>>;
-    static RateLimitTracker rate_limit_tracker;
+    static std::unordered_map<std::string, int> rate_limited_endpoints{};
+    static std::shared_ptr<limhamn::http::server::session_store> session_storage{};
     static bool trust_x_forwarded_for{false};
     static bool session_is_secure{false};
+    static bool keep_alive{true};
+    static int64_t keep_alive_timeout{5000};
+    static int64_t body_timeout{30000};
+    static int max_keep_alive_requests{100};
 
-    inline std::string convert_unix_millis_to_gmt(const int64_t unix_millis) {
-        if (unix_millis == -1) {
-            return "Thu, 01 Jan 1970 00:00:00 GMT";
-        }
+    /**
+     * @brief A set of IP addresses and CIDR ranges, parsed once and looked up without string compares
+     * @note Lookups do one hash lookup per distinct prefix length in the set.
+     */
+    class ip_set {
+            struct v6_key {
+                uint64_t hi{};
+                uint64_t lo{};
 
-        std::time_t time = unix_millis / 1000;
-        std::tm* tm = std::gmtime(&time);
-        char buffer[80];
-        std::strftime(buffer, 80, "%a, %d %b %Y %H:%M:%S GMT", tm);
+                bool operator==(const v6_key& other) const {
+                    return hi == other.hi && lo == other.lo;
+                }
+            };
+            struct v6_hash {
+                std::size_t operator()(const v6_key& key) const {
+                    return std::hash<uint64_t>{}(key.hi ^ (key.lo * 0x9e3779b97f4a7c15ULL));
+                }
+            };
 
-        return {(buffer)};
-    }
+            std::vector<std::pair<int, std::unordered_set<uint32_t>>> v4{};
+            std::vector<std::pair<int, std::unordered_set<v6_key, v6_hash>>> v6{};
 
-    /**
-     * @brief A class that represents a session
-     */
-    class session : public std::enable_shared_from_this<session> {
-        public:
-            explicit session(boost::asio::ip::tcp::socket socket) : net_socket(std::move(socket)) {}
+            static uint32_t mask_v4(const uint32_t address, const int prefix) {
+                return prefix == 0 ? 0 : address & (0xFFFFFFFFU << (32 - prefix));
+            }
 
-            /**
-             * @brief Starts the session
-             */
-            void start() {
-                read_request();
+            static v6_key mask_v6(const boost::asio::ip::address_v6::bytes_type& bytes, const int prefix) {
+                v6_key key{};
+                for (int i{0}; i < 8; ++i) {
+                    key.hi = (key.hi << 8) | bytes[i];
+                    key.lo = (key.lo << 8) | bytes[i + 8];
+                }
+
+                if (prefix <= 64) {
+                    key.hi = prefix == 0 ? 0 : key.hi & (~0ULL << (64 - prefix));
+                    key.lo = 0;
+                } else {
+                    key.lo = key.lo & (~0ULL << (128 - prefix));
+                }
+
+                return key;
             }
 
+            template <typename Set>
+            static Set& set_for(std::vector<std::pair<int, Set>>& sets, const int prefix) {
+                for (auto& it : sets) {
+                    if (it.first == prefix) {
+                        return it.second;
+                    }
+                }
+
+                sets.emplace_back(prefix, Set{});
+                std::sort(sets.begin(), sets.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+                return set_for(sets, prefix);
+            }
+        public:
             /**
-             * @brief Stops the session
+             * @brief Adds an address or CIDR range to the set
+             * @param str The address or range, e.g. "192.168.0.1", "10.0.0.0/8" or "2001:db8::/32"
              */
-            void stop() {
+            void add(const std::string& str) {
+                const std::size_t slash = str.find('/');
                 boost::beast::error_code ec;
-                static_cast<void>(net_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec));
-                static_cast<void>(net_socket.close(ec));
-            }
-        private:
-            boost::asio::ip::tcp::socket net_socket;
-            boost::beast::flat_buffer net_buffer;
-            boost::beast::http::request<boost::beast::http::string_body> net_request;
-            boost::beast::http::response<boost::beast::http::string_body> net_response;
-            std::shared_ptr<boost::beast::http::request_parser<boost::beast::http::string_body>> parser;
+                const auto address = boost::asio::ip::make_address(str.substr(0, slash), ec);
 
-            std::string get_ip() const {
-                if (trust_x_forwarded_for) {
-                    auto it = net_request.find("X-Forwarded-For");
-                    if (it != net_request.end()) {
-                        std::string x_forwarded_for = it->value();
-                        std::size_t pos = x_forwarded_for.find(',');
-                        if (pos != std::string::npos) {
-                            return x_forwarded_for.substr(0, pos);
-                        }
-                        return x_forwarded_for;
-                    }
-                }
-                return net_socket.remote_endpoint().address().to_string();
-            }
-
-            static std::unordered_map<std::string, std::string> parse_fields(const std::string& _body) {
-                std::string body = _body;
-
-                if (!body.empty() && body.back() != '&') {
-                    body += "&";
+                if (ec) {
+                    throw std::invalid_argument("invalid ip address: " + str);
                 }
 
-                std::unordered_map<std::string, std::string> ret{};
-                std::size_t last_amp_pos = 0;
-                std::size_t amp_pos = body.find('&');
-
-                while (amp_pos != std::string::npos) {
-                    std::size_t equals_pos = body.find('=', last_amp_pos);
-
-                    if (equals_pos != std::string::npos && equals_pos < amp_pos) {
-                        std::string key = body.substr(last_amp_pos, equals_pos - last_amp_pos);
-                        std::string value = body.substr(equals_pos + 1, amp_pos - equals_pos - 1);
-                        ret[key] = value;
+                const int max_prefix = address.is_v4() ? 32 : 128;
+                int prefix = max_prefix;
+                if (slash != std::string::npos) {
+                    try {
+                        prefix = std::stoi(str.substr(slash + 1));
+                    } catch (const std::exception&) {
+                        prefix = -1;
+                    }
+                    if (prefix < 0 || prefix > max_prefix) {
+                        throw std::invalid_argument("invalid prefix length: " + str);
                     }
-
-                    last_amp_pos = amp_pos + 1;
-                    amp_pos = body.find('&', last_amp_pos);
                 }
 
-                return ret;
+                if (address.is_v4()) {
+                    set_for(v4, prefix).insert(mask_v4(address.to_v4().to_uint(), prefix));
+                } else {
+                    set_for(v6, prefix).insert(mask_v6(address.to_v6().to_bytes(), prefix));
+                }
             }
 
-            static std::unordered_map<std::string, std::string> parse_query_string(const std::string& url) {
-                std::size_t pos = url.find('?');
+            /**
+             * @brief Checks if an address is in the set
+             * @param address The address to look up
+             * @return True if the address matches an address or range in the set
+             */
+            [[nodiscard]] bool contains(const boost::asio::ip::address& address) const {
+                if (address.is_v6() && address.to_v6().is_v4_mapped()) {
+                    return contains(boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6()));
+                }
 
-                if (pos == std::string::npos) {
-                    return {};
+                if (address.is_v4()) {
+                    const uint32_t value = address.to_v4().to_uint();
+                    for (const auto& [prefix, set] : v4) {
+                        if (set.find(mask_v4(value, prefix)) != set.end()) {
+                            return true;
+                        }
+                    }
+                    return false;
                 }
 
-                std::string req = "&" + url.substr(pos + 1);
+                const auto bytes = address.to_v6().to_bytes();
+                for (const auto& [prefix, set] : v6) {
+                    if (set.find(mask_v6(bytes, prefix)) != set.end()) {
+                        return true;
+                    }
+                }
 
-                return parse_fields(req);
+                return false;
             }
 
-            static std::string generate_random_string(const int length = 64) {
-                static constexpr char charset[] =
-                    "0123456789"
-                    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                    "abcdefghijklmnopqrstuvwxyz";
+            [[nodiscard]] bool empty() const {
+                return v4.empty() && v6.empty();
+            }
 
-                static constexpr size_t charset_size = sizeof(charset) - 1;
-                static std::mt19937 generator(std::random_device{}());
+            void clear() {
+                v4.clear();
+                v6.clear();
+            }
+    };
 
-                std::uniform_int_distribution<> distribution(0, charset_size - 1);
+    /**
+     * @brief A token bucket rate limiter over a fixed-size table
+     * @note Each bucket of the table is four 16 byte slots, one cache line. When a bucket is full the
+     *       slot that has been idle the longest is reused, which is harmless since an idle slot has
+     *       refilled anyway. Memory use therefore stays fixed no matter how many clients there are.
+     * @note Lock free; under heavy contention on a single key the limit is approximate.
+     */
+    class rate_limiter {
+            struct slot {
+                std::atomic<uint64_t> key{0};
+                std::atomic<uint64_t> state{0}; // last refill (ms, high 32 bits) | milli-tokens (low 32 bits)
+            };
 
-                std::string str(length, 0);
+            static constexpr std::size_t bucket_size{4};
+            static constexpr uint64_t window{60000};
 
-                std::generate_n(str.begin(), length, [&distribution]() { return charset[distribution(generator)]; });
+            std::unique_ptr<slot[]> slots{};
+            std::size_t bucket_mask{0};
+            std::chrono::steady_clock::time_point epoch{std::chrono::steady_clock::now()};
+        public:
+            /**
+             * @brief Allocates the table
+             * @param size The number of slots, rounded up to a power of two
+             */
+            void resize(std::size_t size) {
+                std::size_t buckets{1};
+                while (buckets * bucket_size < size) {
+                    buckets <<= 1;
+                }
 
-                return str;
+                slots = std::make_unique<slot[]>(buckets * bucket_size);
+                bucket_mask = buckets - 1;
             }
 
-            void read_request() {
-                auto self = shared_from_this();
-                parser = std::make_shared<boost::beast::http::request_parser<boost::beast::http::string_body>>();
+            /**
+             * @brief Hashes an address and endpoint into a key
+             * @param address The address
+             * @param endpoint The endpoint
+             * @return A non-zero key
+             */
+            static uint64_t make_key(const boost::asio::ip::address& address, const std::string_view endpoint) {
+                uint64_t hash{0xcbf29ce484222325ULL};
+                const auto mix = [&hash](const unsigned char c) {
+                    hash ^= c;
+                    hash *= 0x100000001b3ULL;
+                };
 
-                if (max_request_size != -1) {
-                    parser->body_limit(max_request_size);
+                if (address.is_v4()) {
+                    for (const auto c : address.to_v4().to_bytes()) mix(c);
                 } else {
-                    parser->body_limit((std::numeric_limits<std::uint64_t>::max)());
+                    for (const auto c : address.to_v6().to_bytes()) mix(c);
                 }
+                mix(0);
+                for (const auto c : endpoint) mix(static_cast<unsigned char>(c));
 
-                const auto ip = net_socket.remote_endpoint().address().to_string();
-
-                for (const auto& it : whitelisted_ips) {
-                    if (it != ip) {
-                        continue;
-                    }
-
-                    boost::beast::http::async_read(
-                        net_socket,
-                        net_buffer,
-                        *parser,
-
-                        [self](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
-                            self->on_read(ec, transferred_bytes);
-                        }
-                    );
+                return hash == 0 ? 1 : hash;
+            }
 
-                    return;
+            /**
+             * @brief Takes a token from the bucket of a key
+             * @param key The key, see make_key()
+             * @param limit The number of requests allowed per minute
+             * @return True if the request is allowed
+             */
+            bool allow(const uint64_t key, const int limit) {
+                if (limit < 0 || !slots) {
+                    return true;
+                }
+                if (limit == 0) {
+                    return false;
                 }
 
-                const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-                const auto endpoint = std::string(net_request.target().data(), net_request.target().size());
-                const std::string key = ip + ":" + endpoint;
+                const uint64_t capacity = std::min<uint64_t>(static_cast<uint64_t>(limit) * 1000, 0xFFFFFFFFULL);
+                const auto now = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - epoch).count());
 
-                for (const auto& it : blacklisted_ips) {
-                    if (ip == it) {
-                        return;
-                    }
-                }
+                slot* bucket = &slots[(key & bucket_mask) * bucket_size];
+                slot* target{nullptr};
+                uint32_t oldest{0};
+                slot* victim{bucket};
 
-                int rate_limit = default_rate_limit;
-                for (const auto& [ep, limit] : rate_limited_endpoints) {
-                    if (ep == endpoint) {
-                        rate_limit = limit;
+                for (std::size_t i{0}; i < bucket_size; ++i) {
+                    const uint64_t current = bucket[i].key.load(std::memory_order_acquire);
+                    if (current == key) {
+                        target = &bucket[i];
                         break;
                     }
+
+                    const uint32_t idle = current == 0 ? 0xFFFFFFFFU : now - static_cast<uint32_t>(bucket[i].state.load(std::memory_order_relaxed) >> 32);
+                    if (idle >= oldest) {
+                        oldest = idle;
+                        victim = &bucket[i];
+                    }
                 }
 
-                if (rate_limit_tracker.find(key) == rate_limit_tracker.end()) {
-                    rate_limit_tracker[key] = {endpoint, now, 1};
-                } else {
-                    auto& [ep, last_request_time, request_count] = rate_limit_tracker[key];
-                    if (now - last_request_time < 60000) {
-                        if (request_count >= rate_limit) {
-                            return;
-                        }
-                        request_count++;
-                    } else {
-                        last_request_time = now;
-                        request_count = 1;
+                if (!target) {
+                    uint64_t expected = victim->key.load(std::memory_order_relaxed);
+                    if (victim->key.compare_exchange_strong(expected, key, std::memory_order_acq_rel)) {
+                        victim->state.store((static_cast<uint64_t>(now) << 32) | capacity, std::memory_order_relaxed);
+                    } else if (expected != key) {
+                        return true; // lost the slot to another key, let this one request through
                     }
+                    target = victim;
                 }
 
-                boost::beast::http::async_read(
-                    net_socket,
-                    net_buffer,
-                    *parser,
+                uint64_t state = target->state.load(std::memory_order_relaxed);
+                while (true) {
+                    const auto last = static_cast<uint32_t>(state >> 32);
+                    uint64_t tokens = state & 0xFFFFFFFFULL;
 
-                    [self](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
-                        self->on_read(ec, transferred_bytes);
+                    tokens = std::min(capacity, tokens + static_cast<uint64_t>(static_cast<uint32_t>(now - last)) * capacity / window);
+                    if (tokens < 1000) {
+                        return false;
                     }
-                );
-            }
-
-            /**
-             * @brief Handles the read request
-             * @param ec The error code
-             * @param transferred_bytes The amount of bytes transferred
-             */
-            void on_read(const boost::beast::error_code& ec, std::size_t transferred_bytes) {
-                static_cast<void>(transferred_bytes); // prevents an unused parameter warning
 
-                if (!ec) {
-                    net_request = parser->release();
-                    handle_request();
+                    const uint64_t next = (static_cast<uint64_t>(now) << 32) | (tokens - 1000);
+                    if (target->state.compare_exchange_weak(state, next, std::memory_order_relaxed)) {
+                        return true;
+                    }
                 }
             }
+    };
 
-            static std::vector<limhamn::http::server::cookie> get_cookies_from_request(const std::string& cookie_header) {
-                std::vector<limhamn::http::server::cookie> cookies;
-                std::string cookie_str = cookie_header + ";";
+    static ip_set blacklisted_ips{};
+    static ip_set whitelisted_ips{};
+    static rate_limiter rate_limit_tracker{};
 
-                while (cookie_str.find(';') != std::string::npos) {
-                    std::string cookie = cookie_str.substr(0, cookie_str.find(';'));
-                    cookie_str = cookie_str.substr(cookie_str.find(';') + 1);
+    static bool metrics_enabled{false};
+    static std::string metrics_endpoint{};
+    static bool metrics_public{false};
+    static bool routed{false};
+    static std::function<void(const limhamn::http::server::access_record&)> access_log{};
+    // set by router::dispatch to the pattern of the route it picked
+    inline thread_local std::string_view current_route{};
 
-                    std::string name = cookie.substr(0, cookie.find('='));
-                    std::string value = cookie.substr(cookie.find('=') + 1);
+    /**
+     * @brief Per-thread counters, written only by their own thread and summed when the metrics are read
+     */
+    struct metrics_shard {
+        static constexpr std::size_t max_routes{256};
 
-                    if (!name.empty() && !value.empty()) {
-                        if (name.front() == ' ') {
-                            name = name.substr(1);
-                        }
-                        cookies.push_back({name, value});
-                    }
-                }
+        struct latency {
+            std::array<std::atomic<uint64_t>, limhamn::http::server::latency_histogram::bucket_count> buckets{};
+            std::atomic<uint64_t> count{0};
+            std::atomic<uint64_t> sum{0}; // microseconds
+        };
 
-                return cookies;
+        std::atomic<uint64_t> requests{0};
+        std::array<std::atomic<uint64_t>, 5> status_classes{};
+        std::atomic<uint64_t> bytes_received{0};
+        std::atomic<uint64_t> bytes_sent{0};
+        std::atomic<uint64_t> rate_limited{0};
+        std::atomic<uint64_t> blacklisted{0};
+        std::atomic<uint64_t> connections_total{0};
+        std::atomic<int64_t> connections_open{0};
+        std::array<std::atomic<latency*>, max_routes> routes{};
+        std::unordered_map<std::string_view, std::size_t> route_cache{}; // keys point into the registry's names
+
+        ~metrics_shard() {
+            for (auto& it : routes) {
+                delete it.load();
             }
+        }
 
-            static std::unordered_map<std::string, std::string> read_from_session_file(const std::string& f) {
-                std::unordered_map<std::string, std::string> session;
+        // the owning thread is the only writer, so a plain load and store is enough
+        static void add(std::atomic<uint64_t>& counter, const uint64_t value) {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+    };
 
-                std::ifstream file(f);
+    /**
+     * @brief Collects metrics_shards and route names, and merges them on read
+     * @note Routes beyond max_routes are counted under "other".
+     */
+    class metrics_registry {
+            std::mutex mutex{};
+            std::vector<std::unique_ptr<metrics_shard>> shards{};
+            std::deque<std::string> names{"other"};
+            std::unordered_map<std::string_view, std::size_t> index{{"other", 0}};
+            std::atomic<bool> full{false};
+        public:
+            metrics_shard& local() {
+                thread_local metrics_shard* shard{nullptr};
+                if (shard == nullptr) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    shards.push_back(std::make_unique<metrics_shard>());
+                    shard = shards.back().get();
+                }
+                return *shard;
+            }
 
-                if (!file.good()) {
-                    file.close();
-                    return {};
+            std::size_t route(metrics_shard& shard, const std::string_view name) {
+                if (const auto it = shard.route_cache.find(name); it != shard.route_cache.end()) {
+                    return it->second;
                 }
 
-                if (!file.is_open()) {
-                    throw std::runtime_error("failed to open session file (read_from_session_file()): " + f);
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = index.find(name);
+                if (it == index.end()) {
+                    if (full.load(std::memory_order_relaxed) || names.size() >= metrics_shard::max_routes) {
+                        full.store(true, std::memory_order_relaxed);
+                        return 0;
+                    }
+                    names.emplace_back(name);
+                    it = index.emplace(names.back(), names.size() - 1).first;
                 }
 
-                std::string line{};
-                while (std::getline(file, line)) {
-                    if (line.find('=') != std::string::npos) {
-                        std::string key = line.substr(0, line.find('='));
-                        std::string value = line.substr(line.find('=') + 1);
+                shard.route_cache.emplace(it->first, it->second);
+                return it->second;
+            }
 
-                        session[key] = value;
-                    }
+            static std::size_t bucket(const uint64_t microseconds) {
+                if (microseconds < 4) {
+                    return static_cast<std::size_t>(microseconds);
                 }
 
-                file.close();
+                std::size_t exponent{0};
+                for (uint64_t v = microseconds; v > 1; v >>= 1) {
+                    ++exponent;
+                }
 
-                return session;
+                const std::size_t index = (exponent - 1) * 4 + static_cast<std::size_t>((microseconds >> (exponent - 2)) & 3);
+                return (std::min)(index, limhamn::http::server::latency_histogram::bucket_count - 1);
             }
 
-            static void write_to_session_file(const std::string& f, const std::unordered_map<std::string, std::string>& session) {
-                std::ofstream file(f, std::ios::trunc);
-
-                if (!file.is_open() || !file.good()) {
-                    throw std::runtime_error("failed to open session file (write_to_session_file()): " + f);
+            void record(metrics_shard& shard, const std::size_t route, const unsigned int status, const uint64_t microseconds) {
+                metrics_shard::add(shard.requests, 1);
+                if (status >= 100 && status < 600) {
+                    metrics_shard::add(shard.status_classes[status / 100 - 1], 1);
                 }
 
-                for (const auto& it : session) {
-                    file << it.first << "=" << it.second << "\n";
+                metrics_shard::latency* latency = shard.routes[route].load(std::memory_order_acquire);
+                if (latency == nullptr) {
+                    latency = new metrics_shard::latency{};
+                    shard.routes[route].store(latency, std::memory_order_release);
                 }
 
-                file.close();
+                metrics_shard::add(latency->buckets[bucket(microseconds)], 1);
+                metrics_shard::add(latency->count, 1);
+                metrics_shard::add(latency->sum, microseconds);
             }
 
-            /**
-             * @brief Handles the request
-             */
-            void handle_request() {
-                if (net_request.method() == boost::beast::http::verb::options) {
-                    net_response.result(boost::beast::http::status::no_content);
-                    net_response.set(boost::beast::http::field::allow, "GET, HEAD, OPTIONS");
-                    net_response.set(boost::beast::http::field::access_control_allow_origin, "*");
-                    net_response.set(boost::beast::http::field::access_control_allow_headers, "Content-Type");
-                } else {
-                    net_response = boost::beast::http::response<boost::beast::http::string_body>();
-                    limhamn::http::server::request request{};
-
-                    request.endpoint = std::string(net_request.target().data(), net_request.target().size());
+            limhamn::http::server::metrics_snapshot snapshot() {
+                limhamn::http::server::metrics_snapshot ret{};
+                std::lock_guard<std::mutex> lock(mutex);
 
-                    std::ostringstream oss;
-                    oss << net_request;
-                    request.raw_body = oss.str(); // TODO: a little inefficient, but works for now
-                    request.body = net_request.body();
-                    request.fields = parse_fields(request.body);
-                    request.ip_address = get_ip();
-                    request.method = net_request.method_string();
-                    request.version = net_request.version();
-                    request.user_agent = net_request.at(boost::beast::http::field::user_agent).data();
+                std::vector<limhamn::http::server::latency_histogram> routes(names.size());
+                for (std::size_t i = 0; i < names.size(); ++i) {
+                    routes[i].route = names[i];
+                }
 
-                    if (request.endpoint.find('?') != std::string::npos) {
-                        request.query = parse_query_string(request.endpoint);
-                        request.endpoint = request.endpoint.substr(0, request.endpoint.find('?'));
+                for (const auto& shard : shards) {
+                    ret.requests += shard->requests.load(std::memory_order_relaxed);
+                    for (std::size_t i = 0; i < ret.status_classes.size(); ++i) {
+                        ret.status_classes[i] += shard->status_classes[i].load(std::memory_order_relaxed);
                     }
+                    ret.bytes_received += shard->bytes_received.load(std::memory_order_relaxed);
+                    ret.bytes_sent += shard->bytes_sent.load(std::memory_order_relaxed);
+                    ret.rate_limited += shard->rate_limited.load(std::memory_order_relaxed);
+                    ret.blacklisted += shard->blacklisted.load(std::memory_order_relaxed);
+                    ret.connections_total += shard->connections_total.load(std::memory_order_relaxed);
+                    ret.connections_open += shard->connections_open.load(std::memory_order_relaxed);
 
-                    if (net_request.find("Cookie") != net_request.end()) {
-                        request.cookies = get_cookies_from_request(net_request.find("Cookie")->value());
+                    for (std::size_t i = 0; i < routes.size(); ++i) {
+                        const metrics_shard::latency* latency = shard->routes[i].load(std::memory_order_acquire);
+                        if (latency == nullptr) {
+                            continue;
+                        }
+                        for (std::size_t j = 0; j < latency->buckets.size(); ++j) {
+                            routes[i].buckets[j] += latency->buckets[j].load(std::memory_order_relaxed);
+                        }
+                        routes[i].count += latency->count.load(std::memory_order_relaxed);
+                        routes[i].sum += static_cast<double>(latency->sum.load(std::memory_order_relaxed)) / 1e6;
                     }
+                }
 
-                    std::string session_id{};
-                    bool session_id_found = false;
-                    for (const auto& it : request.cookies) {
-                        if (it.name == session_cookie_name && !it.value.empty() && enable_session) {
-                            session_id = it.value;
-                            session_id_found = true;
-                            break;
-                        }
+                for (auto& it : routes) {
+                    if (it.count != 0) {
+                        ret.routes.push_back(std::move(it));
                     }
+                }
 
-                    bool erase_associated = false;
-                    if (session_id_found) {
-                        session_id.erase(std::remove(session_id.begin(), session_id.end(), '/'), session_id.end());
-                        std::filesystem::path session_file = session_dir + "/session_" + session_id + ".txt";
-                        if (!std::filesystem::exists(session_file)) {
-                            erase_associated = true;
-                            // remove associated session cookies and session cookie from request
-                            for (const auto& it : associated_session_cookies) {
-                                request.cookies.erase(
-                                    std::remove_if(request.cookies.begin(), request.cookies.end(),
-                                                   [&it](const limhamn::http::server::cookie& cookie) {
-                                                       return cookie.name == it;
-                                                   }),
-                                    request.cookies.end()
-                                );
-                            }
-                            request.cookies.erase(
-                                std::remove_if(request.cookies.begin(), request.cookies.end(),
-                                               [](const limhamn::http::server::cookie& cookie) {
-                                                   return cookie.name == session_cookie_name;
-                                               }),
-                                request.cookies.end()
-                            );
+                return ret;
+            }
+    };
 
-                            request.session.clear();
-                            request.session_id.clear();
-                        } else {
-                            request.session = read_from_session_file(session_file);
-                            request.session_id = session_id;
-                        }
-                    }
+    static metrics_registry metrics{};
 
-                    limhamn::http::server::response response = generate_response_from_endpoint(request);
+    static bool compression_enabled{false};
+    static std::size_t compression_min_size{1024};
+    static std::size_t compression_offload_size{64 * 1024};
+    static std::size_t compression_max_file_size{16 * 1024 * 1024};
+    inline std::unique_ptr<boost::asio::thread_pool> compression_workers{};
 
-                    if (!session_id_found && enable_session) {
-                        session_id = generate_random_string();
+    enum class content_encoding {
+        identity,
+        gzip,
+        brotli,
+        zstd,
+    };
 
-                        for (const auto& it : response.cookies) {
-                            if (it.name == session_cookie_name) {
-                                session_id_found = true;
-                                break;
-                            }
-                        }
+    inline constexpr std::string_view encoding_name(const content_encoding encoding) {
+        return encoding == content_encoding::gzip ? "gzip" :
+            encoding == content_encoding::brotli ? "br" :
+            encoding == content_encoding::zstd ? "zstd" : "identity";
+    }
 
-                        if (!session_id_found) {
-                            response.cookies.push_back({session_cookie_name, session_id, 0, "/", .same_site = "Strict", .http_only = true, .secure = session_is_secure});
-                        }
-                    } else if (enable_session) {
-                        std::string session_file = session_dir + "/session_" + session_id + ".txt";
-                        std::unordered_map<std::string, std::string> stored = read_from_session_file(session_file);
+    /**
+     * @brief Checks whether a content type is worth compressing
+     * @param content_type The content type, as produced by e.g. limhamn::http::utils::get_appropriate_content_type
+     * @return bool, false for images, audio, video, archives and fonts other than svg and the uncompressed formats
+     */
+    inline bool is_compressible(std::string_view content_type) {
+        content_type = content_type.substr(0, content_type.find(';'));
 
-                        for (const auto& it : response.session) {
-                            stored[it.first] = it.second;
-                        }
+        if (content_type.substr(0, 5) == "text/") {
+            return true;
+        }
 
-                        write_to_session_file(session_file, stored);
-                    }
+        static constexpr std::array<std::string_view, 14> types{
+            "application/json", "application/ld+json", "application/javascript", "application/xml", "application/xhtml+xml",
+            "application/rss+xml", "application/atom+xml", "application/manifest+json", "application/wasm",
+            "application/x-csh", "application/x-sh", "application/rtf", "image/svg+xml", "application/vnd.ms-fontobject",
+        };
+        for (const auto& it : types) {
+            if (content_type == it) {
+                return true;
+            }
+        }
 
-                    for (const auto& it : response.cookies) {
-                        std::string cookie_str = it.name + "=" + it.value + "; ";
-                        if (it.expires != 0) {
-                            cookie_str += "Expires=" + convert_unix_millis_to_gmt(it.expires) + "; ";
-                        } else {
-                            cookie_str += "Expires=session; ";
-                        }
-                        if (it.http_only) {
-                            cookie_str += "HttpOnly; ";
-                        }
-                        if (it.secure) {
-                            cookie_str += "Secure; ";
-                        }
-                        if (!it.path.empty()) {
-                            cookie_str += "Path=" + it.path + "; ";
-                        }
-                        if (!it.domain.empty()) {
-                            cookie_str += "Domain=" + it.domain + "; ";
-                        }
-                        if (!it.same_site.empty() && (it.same_site == "Strict" || it.same_site == "Lax" || it.same_site == "None")) {
-                            cookie_str += "SameSite=" + it.same_site + "; ";
-                        }
-                        for (const auto& attribute : it.attributes) {
-                            cookie_str += attribute + "; ";
-                        }
-                        for (const auto& attribute : it.extra_attributes) {
-                            cookie_str += attribute.first + "=" + attribute.second + "; ";
-                        }
+        // structured syntax suffixes, e.g. application/problem+json
+        const auto suffix = content_type.rfind('+');
+        return suffix != std::string_view::npos && (content_type.substr(suffix) == "+json" || content_type.substr(suffix) == "+xml");
+    }
 
-                        net_response.insert(boost::beast::http::field::set_cookie, cookie_str);
-                    }
+    /**
+     * @brief Picks the encoding a response is compressed with
+     * @param accept_encoding The Accept-Encoding header of the request
+     * @return content_encoding, the supported encoding with the highest q-value, preferring br, then zstd, then gzip
+     */
+    inline content_encoding choose_encoding(const std::string_view accept_encoding) {
+        static constexpr std::array<content_encoding, 3> preference{content_encoding::brotli, content_encoding::zstd, content_encoding::gzip};
+        std::array<int, 3> quality{-1, -1, -1}; // per encoding in preference order, in thousandths; -1 if not listed
+        int wildcard{-1};
 
-                    if (erase_associated) {
-                        for (const auto& it : associated_session_cookies) {
-                            response.delete_cookies.push_back(it);
+        std::size_t pos{0};
+        while (pos < accept_encoding.size()) {
+            std::size_t end = accept_encoding.find(',', pos);
+            if (end == std::string_view::npos) {
+                end = accept_encoding.size();
+            }
+            std::string_view item = accept_encoding.substr(pos, end - pos);
+            pos = end + 1;
+
+            int q{1000};
+            const auto semicolon = item.find(';');
+            if (semicolon != std::string_view::npos) {
+                std::string_view parameter = item.substr(semicolon + 1);
+                while (!parameter.empty() && (parameter.front() == ' ' || parameter.front() == '\t')) {
+                    parameter.remove_prefix(1);
+                }
+                if (parameter.size() >= 2 && (parameter[0] == 'q' || parameter[0] == 'Q') && parameter[1] == '=') {
+                    // q = 0 / 1, with up to three decimals
+                    parameter.remove_prefix(2);
+                    q = !parameter.empty() && parameter[0] == '1' ? 1000 : 0;
+                    if (parameter.size() > 2 && parameter[0] == '0' && parameter[1] == '.') {
+                        int scale{100};
+                        for (std::size_t i = 2; i < parameter.size() && i < 5 && parameter[i] >= '0' && parameter[i] <= '9'; ++i) {
+                            q += (parameter[i] - '0') * scale;
+                            scale /= 10;
                         }
                     }
+                }
+                item = item.substr(0, semicolon);
+            }
 
-                    for (const auto& it : response.delete_cookies) {
-                        std::string cookie_str = it + "=; Expires=Thu, 01 Jan 1970 00:00:00 GMT; Max-Age=0; Path=/; ";
-                        net_response.insert(boost::beast::http::field::set_cookie, cookie_str);
-                    }
+            while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) {
+                item.remove_prefix(1);
+            }
+            while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) {
+                item.remove_suffix(1);
+            }
 
-                    if (response.stop) {
-                        stop();
-                        _limhamn_http_server_impl::stop();
-                        return;
-                    }
+            const auto equals = [&item](const std::string_view name) {
+                return item.size() == name.size() && std::equal(item.begin(), item.end(), name.begin(), [](const char a, const char b) {
+                    return std::tolower(static_cast<unsigned char>(a)) == b;
+                });
+            };
 
-                    if (!response.location.empty()) {
-                        if (response.redirect_status == limhamn::http::server::redirect_type::temporary) {
-                            net_response.result(boost::beast::http::status::temporary_redirect);
-                        } else if (response.redirect_status == limhamn::http::server::redirect_type::permanent) {
-                            net_response.result(boost::beast::http::status::moved_permanently);
+            if (equals("br")) {
+                quality[0] = q;
+            } else if (equals("zstd")) {
+                quality[1] = q;
+            } else if (equals("gzip") || equals("x-gzip")) {
+                quality[2] = q;
+            } else if (item == "*") {
+                wildcard = q;
+            }
+        }
+
+        content_encoding ret{content_encoding::identity};
+        int best{0};
+        for (std::size_t i = 0; i < preference.size(); ++i) {
+#ifndef LIMHAMN_HTTP_SERVER_BROTLI
+            if (preference[i] == content_encoding::brotli) continue;
+#endif
+#ifndef LIMHAMN_HTTP_SERVER_ZSTD
+            if (preference[i] == content_encoding::zstd) continue;
+#endif
+#ifndef LIMHAMN_HTTP_SERVER_ZLIB
+            if (preference[i] == content_encoding::gzip) continue;
+#endif
+            const int q = quality[i] != -1 ? quality[i] : wildcard;
+            if (q > best) {
+                best = q;
+                ret = preference[i];
+            }
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Compresses a body
+     * @param encoding The encoding to compress with, not identity
+     * @param input The body
+     * @param best Whether to use the highest level, for variants that are cached, instead of one fast enough for every response
+     * @return std::shared_ptr<const std::string>, nullptr if compressing failed or did not make the body smaller
+     * @note The compressor state is kept per thread and reused between calls.
+     */
+    inline std::shared_ptr<const std::string> compress(const content_encoding encoding, const std::string_view input, const bool best) {
+        std::string output{};
+        static_cast<void>(best); // unused if no compression library is enabled
+
+        try {
+            if (encoding == content_encoding::gzip) {
+#ifdef LIMHAMN_HTTP_SERVER_ZLIB
+                struct deflater {
+                    z_stream stream{};
+                    int level{-2};
+
+                    ~deflater() {
+                        if (level != -2) {
+                            deflateEnd(&stream);
                         }
-                        net_response.set(boost::beast::http::field::location, response.location);
-                    } else {
-                        net_response.result(response.http_status);
                     }
+                };
+                thread_local deflater state{};
 
-                    for (const auto& it : response.headers) {
-                        net_response.set(it.name, it.data);
+                const int level = best ? 9 : 6;
+                if (state.level != level) {
+                    if (state.level != -2) {
+                        deflateEnd(&state.stream);
+                        state.level = -2;
                     }
-
-                    net_response.set(boost::beast::http::field::content_type, response.content_type);
-                    net_response.set(boost::beast::http::field::access_control_allow_origin, response.allow_origin);
-                    net_response.body() = response.body;
+                    state.stream = {};
+                    // 15 + 16 selects the gzip wrapper
+                    if (deflateInit2(&state.stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                        return nullptr;
+                    }
+                    state.level = level;
+                } else if (deflateReset(&state.stream) != Z_OK) {
+                    return nullptr;
                 }
 
-                const auto self = shared_from_this();
+                output.resize(deflateBound(&state.stream, static_cast<uLong>(input.size())));
+                state.stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+                state.stream.avail_in = static_cast<uInt>(input.size());
+                state.stream.next_out = reinterpret_cast<Bytef*>(output.data());
+                state.stream.avail_out = static_cast<uInt>(output.size());
 
-                boost::beast::http::async_write(
-                    net_socket,
-                    net_response,
-                    [self](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
-                        static_cast<void>(transferred_bytes);
-                        self->on_write(ec);
+                if (input.size() > 0xFFFFFFFFULL || deflate(&state.stream, Z_FINISH) != Z_STREAM_END) {
+                    return nullptr;
+                }
+                output.resize(state.stream.total_out);
+#else
+                return nullptr;
+#endif
+            } else if (encoding == content_encoding::brotli) {
+#ifdef LIMHAMN_HTTP_SERVER_BROTLI
+                std::size_t size = BrotliEncoderMaxCompressedSize(input.size());
+                if (size == 0) {
+                    return nullptr;
+                }
+                output.resize(size);
+                if (!BrotliEncoderCompress(best ? BROTLI_MAX_QUALITY : 4, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, input.size(),
+                    reinterpret_cast<const uint8_t*>(input.data()), &size, reinterpret_cast<uint8_t*>(output.data()))) {
+                    return nullptr;
+                }
+                output.resize(size);
+#else
+                return nullptr;
+#endif
+            } else if (encoding == content_encoding::zstd) {
+#ifdef LIMHAMN_HTTP_SERVER_ZSTD
+                struct context {
+                    ZSTD_CCtx* handle{ZSTD_createCCtx()};
+
+                    ~context() {
+                        ZSTD_freeCCtx(handle);
                     }
-                );
+                };
+                thread_local context state{};
+                if (state.handle == nullptr) {
+                    return nullptr;
+                }
+
+                output.resize(ZSTD_compressBound(input.size()));
+                const std::size_t size = ZSTD_compressCCtx(state.handle, output.data(), output.size(), input.data(), input.size(), best ? 19 : 3);
+                if (ZSTD_isError(size)) {
+                    return nullptr;
+                }
+                output.resize(size);
+#else
+                return nullptr;
+#endif
+            } else {
+                return nullptr;
+            }
+        } catch (const std::exception&) {
+            return nullptr;
+        }
+
+        if (output.size() >= input.size()) {
+            return nullptr;
+        }
+
+        return std::make_shared<const std::string>(std::move(output));
+    }
+
+    /**
+     * @brief A least recently used cache of compressed variants of shared bodies and files, bounded in bytes
+     * @note A variant that did not get smaller is cached as nullptr, so it is not compressed again.
+     */
+    class compression_cache {
+            struct entry {
+                std::string key{};
+                std::shared_ptr<const std::string> value{};
+                std::weak_ptr<const std::string> owner{}; // for shared bodies, which are keyed by address
+                bool owned{false};
+            };
+
+            std::mutex mutex{};
+            std::list<entry> entries{};
+            std::unordered_map<std::string_view, std::list<entry>::iterator> index{};
+            std::size_t bytes{0};
+            std::size_t capacity{0};
+
+            static std::size_t cost(const entry& it) {
+                return it.key.size() + (it.value ? it.value->size() : 0) + 96;
+            }
+
+            void erase(const std::list<entry>::iterator it) {
+                bytes -= cost(*it);
+                index.erase(it->key);
+                entries.erase(it);
+            }
+        public:
+            void resize(const std::size_t size) {
+                std::lock_guard<std::mutex> lock(mutex);
+                capacity = size;
+                while (bytes > capacity && !entries.empty()) {
+                    erase(std::prev(entries.end()));
+                }
+            }
+
+            [[nodiscard]] bool enabled() {
+                std::lock_guard<std::mutex> lock(mutex);
+                return capacity != 0;
             }
 
             /**
-             * @brief Handles the write request
-             * @param ec The error code
+             * @brief Looks up a variant
+             * @param key The key
+             * @param owner The shared body the variant was made from, or nullptr for files
+             * @param value Set to the variant, which is nullptr if it is not worth compressing
+             * @return bool, whether the variant was found
              */
-            void on_write(const boost::beast::error_code& ec) {
-                if (!ec) {
-                    boost::beast::error_code close_ec;
-                    static_cast<void>(net_socket.shutdown(boost::asio::ip::tcp::socket::shutdown_send, close_ec));
+            bool find(const std::string& key, const std::shared_ptr<const std::string>* owner, std::shared_ptr<const std::string>& value) {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                const auto it = index.find(key);
+                if (it == index.end()) {
+                    return false;
                 }
+
+                // the address of an expired body may have been reused by another one
+                if (it->second->owned && (owner == nullptr || it->second->owner.lock() != *owner)) {
+                    erase(it->second);
+                    return false;
+                }
+
+                entries.splice(entries.begin(), entries, it->second);
+                value = it->second->value;
+                return true;
+            }
+
+            void insert(std::string key, std::shared_ptr<const std::string> value, const std::shared_ptr<const std::string>* owner) {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (const auto it = index.find(key); it != index.end()) {
+                    erase(it->second);
+                }
+
+                entry item{std::move(key), std::move(value), {}, owner != nullptr};
+                if (owner != nullptr) {
+                    item.owner = *owner;
+                }
+                if (cost(item) > capacity / 4) {
+                    return;
+                }
+
+                bytes += cost(item);
+                entries.push_front(std::move(item));
+                index.emplace(entries.front().key, entries.begin());
+
+                while (bytes > capacity && entries.size() > 1) {
+                    erase(std::prev(entries.end()));
+                }
+            }
+
+            void clear() {
+                std::lock_guard<std::mutex> lock(mutex);
+                entries.clear();
+                index.clear();
+                bytes = 0;
             }
     };
 
+    static compression_cache compressed_variants{};
+
+    static bool response_cache_enabled{false};
+    static int64_t response_cache_ttl{0};
+    static std::vector<std::string> response_cache_query{};
+    static std::vector<std::string> response_cache_headers{};
+
     /**
-     * @brief A class that represents a listener
+     * @brief Hashes a response body for its ETag
+     * @param data The body
+     * @return uint64_t
+     * @note Reads eight bytes per step; the validator only has to change when the body does, so it is not cryptographic.
      */
-    class listener {
+    inline uint64_t hash_body(const std::string_view data) {
+        const auto mix = [](uint64_t value) {
+            value ^= value >> 33;
+            value *= 0xff51afd7ed558ccdULL;
+            value ^= value >> 33;
+            value *= 0xc4ceb9fe1a85ec53ULL;
+            value ^= value >> 33;
+            return value;
+        };
+
+        uint64_t hash = 0x9e3779b97f4a7c15ULL ^ (data.size() * 0x100000001b3ULL);
+        std::size_t i{0};
+        for (; i + 8 <= data.size(); i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data.data() + i, sizeof(word));
+            hash = (hash ^ mix(word)) * 0x9e3779b97f4a7c15ULL;
+        }
+
+        uint64_t tail{0};
+        for (std::size_t shift{0}; i < data.size(); ++i, shift += 8) {
+            tail |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << shift;
+        }
+
+        return mix(hash ^ mix(tail));
+    }
+
+    /**
+     * @brief Parses an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+     * @param date The date
+     * @return int64_t, seconds since the epoch, or -1 if the date is not an IMF-fixdate
+     */
+    inline int64_t parse_http_date(const std::string_view date) {
+        if (date.size() != 29 || date.substr(25) != " GMT" || date[3] != ',') {
+            return -1;
+        }
+
+        const auto number = [&date](const std::size_t pos, const std::size_t count) {
+            int64_t ret{0};
+            for (std::size_t i = pos; i < pos + count; ++i) {
+                if (date[i] < '0' || date[i] > '9') {
+                    return int64_t{-1};
+                }
+                ret = ret * 10 + (date[i] - '0');
+            }
+            return ret;
+        };
+
+        static constexpr std::string_view months{"JanFebMarAprMayJunJulAugSepOctNovDec"};
+        const auto month_pos = months.find(date.substr(8, 3));
+        const int64_t day = number(5, 2);
+        const int64_t year = number(12, 4);
+        const int64_t hour = number(17, 2);
+        const int64_t minute = number(20, 2);
+        const int64_t second = number(23, 2);
+        if (month_pos == std::string_view::npos || month_pos % 3 != 0 || day < 1 || year < 1970 || hour < 0 || minute < 0 || second < 0) {
+            return -1;
+        }
+
+        // days from civil, see http://howardhinnant.github.io/date_algorithms.html
+        const int64_t month = static_cast<int64_t>(month_pos / 3) + 1;
+        const int64_t y = month <= 2 ? year - 1 : year;
+        const int64_t era = y / 400;
+        const int64_t yoe = y - era * 400;
+        const int64_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+        const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+        const int64_t days = era * 146097 + doe - 719468;
+
+        return days * 86400 + hour * 3600 + minute * 60 + second;
+    }
+
+    /**
+     * @brief A response kept in the response cache
+     */
+    struct cached_response {
+        std::string key{};
+        int status{200};
+        std::string content_type{};
+        std::string allow_origin{};
+        std::vector<limhamn::http::server::header> headers{};
+        std::shared_ptr<const std::string> body{};
+        std::string etag{};
+        std::string last_modified{};
+        int64_t modified{0}; // seconds since the epoch
+        std::chrono::steady_clock::time_point expires{};
+        bool compress{true};
+        std::string_view route{}; // the router pattern, which outlives the cache
+    };
+
+    /**
+     * @brief A size and time bounded, least recently used cache of responses
+     * @note Split in shards by key hash, each with its own lock, so that concurrent hits rarely wait on each other.
+     */
+    class response_cache {
+            static constexpr std::size_t shard_count{16};
+
+            struct shard {
+                std::mutex mutex{};
+                std::list<std::shared_ptr<const cached_response>> entries{};
+                std::unordered_map<std::string_view, std::list<std::shared_ptr<const cached_response>>::iterator> index{};
+                std::size_t bytes{0};
+            };
+
+            std::array<shard, shard_count> shards{};
+            std::atomic<std::size_t> capacity{0}; // per shard
+
+            static std::size_t cost(const cached_response& it) {
+                std::size_t ret = it.key.size() + it.content_type.size() + it.allow_origin.size() + it.body->size() + 256;
+                for (const auto& header : it.headers) {
+                    ret += header.name.size() + header.data.size() + 64;
+                }
+                return ret;
+            }
+
+            shard& shard_of(const std::string_view key) {
+                return shards[std::hash<std::string_view>{}(key) % shard_count];
+            }
+
+            static void erase(shard& target, const std::list<std::shared_ptr<const cached_response>>::iterator it) {
+                target.bytes -= cost(**it);
+                target.index.erase((*it)->key);
+                target.entries.erase(it);
+            }
         public:
-            boost::asio::io_context ioc;
-            boost::asio::io_context& ref_ioc;
-            boost::asio::ip::tcp::acceptor acceptor;
+            void resize(const std::size_t size) {
+                capacity.store(size / shard_count);
+                clear();
+            }
 
-            static listener& get_instance() {
-                static listener instance;
-                return instance;
+            [[nodiscard]] bool enabled() const {
+                return capacity.load(std::memory_order_relaxed) != 0;
             }
 
             /**
-             * @brief Constructs a new listener object
-             * @param port The port to listen on
+             * @brief Looks up a response that has not expired yet
+             * @param key The key
+             * @return std::shared_ptr<const cached_response>, nullptr if there is none
              */
-            explicit listener(const int port = 8080) : ref_ioc(ioc), acceptor(ioc, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port)) {
-                run();
-                ioc.run();
+            std::shared_ptr<const cached_response> find(const std::string& key) {
+                auto& target = shard_of(key);
+                std::lock_guard<std::mutex> lock(target.mutex);
+
+                const auto it = target.index.find(key);
+                if (it == target.index.end()) {
+                    return nullptr;
+                }
+                if ((*it->second)->expires <= std::chrono::steady_clock::now()) {
+                    erase(target, it->second);
+                    return nullptr;
+                }
+
+                target.entries.splice(target.entries.begin(), target.entries, it->second);
+                return target.entries.front();
+            }
+
+            void insert(const std::shared_ptr<const cached_response>& value) {
+                auto& target = shard_of(value->key);
+                const std::size_t limit = capacity.load(std::memory_order_relaxed);
+                const std::size_t size = cost(*value);
+                if (size > limit / 2) {
+                    return;
+                }
+
+                std::lock_guard<std::mutex> lock(target.mutex);
+                if (const auto it = target.index.find(value->key); it != target.index.end()) {
+                    erase(target, it->second);
+                }
+
+                target.entries.push_front(value);
+                target.index.emplace(value->key, target.entries.begin());
+                target.bytes += size;
+
+                const auto now = std::chrono::steady_clock::now();
+                while (target.bytes > limit && target.entries.size() > 1) {
+                    erase(target, std::prev(target.entries.end()));
+                }
+                // expired entries are otherwise only dropped when they are looked up
+                if (!target.entries.empty() && target.entries.back()->expires <= now) {
+                    erase(target, std::prev(target.entries.end()));
+                }
+            }
+
+            void clear() {
+                for (auto& it : shards) {
+                    std::lock_guard<std::mutex> lock(it.mutex);
+                    it.entries.clear();
+                    it.index.clear();
+                    it.bytes = 0;
+                }
+            }
+    };
+
+    static response_cache cached_responses{};
+
+    /**
+     * @brief Checks whether an If-None-Match header matches an entity tag
+     * @param header The If-None-Match header
+     * @param etag The entity tag, quoted
+     * @return bool
+     * @note Uses the weak comparison, and ignores the encoding suffix added to compressed representations.
+     */
+    inline bool etag_matches(const std::string_view header, const std::string_view etag) {
+        std::size_t pos{0};
+        while (pos < header.size()) {
+            std::size_t end = header.find(',', pos);
+            if (end == std::string_view::npos) {
+                end = header.size();
+            }
+            std::string_view item = header.substr(pos, end - pos);
+            pos = end + 1;
+
+            while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) {
+                item.remove_prefix(1);
+            }
+            while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) {
+                item.remove_suffix(1);
+            }
+            if (item == "*") {
+                return true;
+            }
+            if (item.substr(0, 2) == "W/") {
+                item.remove_prefix(2);
+            }
+            if (item == etag) {
+                return true;
+            }
+
+            for (const auto suffix : {std::string_view{"-gzip\""}, std::string_view{"-br\""}, std::string_view{"-zstd\""}}) {
+                if (item.size() == etag.size() - 1 + suffix.size() && item.substr(item.size() - suffix.size()) == suffix &&
+                    item.substr(0, etag.size() - 1) == etag.substr(0, etag.size() - 1)) {
+                    return true;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    inline std::string convert_unix_millis_to_gmt(const int64_t unix_millis) {
+        if (unix_millis == -1) {
+            return "Thu, 01 Jan 1970 00:00:00 GMT";
+        }
+
+        std::time_t time = unix_millis / 1000;
+        std::tm tm{};
+#ifdef _WIN32
+        gmtime_s(&tm, &time);
+#else
+        gmtime_r(&time, &tm);
+#endif
+        char buffer[80];
+        std::strftime(buffer, 80, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+
+        return {(buffer)};
+    }
+
+    /**
+     * @brief A class that represents a session
+     */
+    class session : public std::enable_shared_from_this<session> {
+        public:
+            explicit session(boost::asio::ip::tcp::socket socket) : net_stream(std::move(socket)) {}
+
+            ~session() {
+                if (counted) {
+                    auto& shard = metrics.local();
+                    shard.connections_open.store(shard.connections_open.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+                }
             }
 
             /**
-             * @brief Destroys the listener object
+             * @brief Starts the session
              */
-            ~listener() {
-                stop();
-            }
+            void start() {
+                boost::beast::error_code ec;
+                const auto endpoint = net_stream.socket().remote_endpoint(ec);
+                if (ec) {
+                    return;
+                }
 
-            void stop() {
-                acceptor.cancel();
-                ioc.stop();
+                remote_address = endpoint.address();
+                remote_ip = remote_address.to_string();
+                whitelisted = whitelisted_ips.contains(remote_address);
+
+                if (!whitelisted && !blacklisted_ips.empty() && blacklisted_ips.contains(remote_address)) {
+                    if (metrics_enabled) {
+                        metrics_shard::add(metrics.local().blacklisted, 1);
+                    }
+                    stop();
+                    return;
+                }
+
+                if (metrics_enabled) {
+                    auto& shard = metrics.local();
+                    metrics_shard::add(shard.connections_total, 1);
+                    shard.connections_open.store(shard.connections_open.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    counted = true;
+                }
+
+                read_request();
             }
 
             /**
-             * @brief Runs the listener
+             * @brief Stops the session
              */
-            void run() {
-                acceptor.async_accept(
-                    [this](const boost::beast::error_code& ec, boost::asio::ip::tcp::socket socket) {
-                        if (!ec) {
-                            std::make_shared<session>(std::move(socket))->start();
+            void stop() {
+                boost::beast::error_code ec;
+                static_cast<void>(net_stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_both, ec));
+                static_cast<void>(net_stream.socket().close(ec));
+            }
+        private:
+            boost::beast::tcp_stream net_stream;
+            boost::beast::flat_buffer net_buffer;
+            boost::beast::http::request<boost::beast::http::string_body> net_request;
+            boost::beast::http::response<boost::beast::http::string_body> net_response;
+            std::shared_ptr<boost::beast::http::request_parser<boost::beast::http::string_body>> parser;
+            std::shared_ptr<boost::beast::http::request_parser<boost::beast::http::buffer_body>> stream_parser;
+            std::shared_ptr<limhamn::http::server::body_sink> sink;
+            std::vector<char> stream_buffer{};
+            unsigned int request_version{11};
+            int handled_requests{0};
+            boost::asio::ip::address remote_address{};
+            std::string remote_ip{};
+            bool whitelisted{false};
+            limhamn::http::server::request_view view{};
+            limhamn::http::server::session_data view_session{};
+            std::chrono::steady_clock::time_point request_start{};
+            bool timing{false};
+            bool rejected{false};
+            bool counted{false};
+            unsigned int response_status{0};
+            std::size_t metrics_route{0};
+            uint64_t bytes_received{0};
+            uint64_t bytes_sent{0};
+
+            std::string get_ip() const {
+                if (trust_x_forwarded_for) {
+                    auto it = net_request.find("X-Forwarded-For");
+                    if (it != net_request.end()) {
+                        std::string x_forwarded_for{it->value()};
+                        std::size_t pos = x_forwarded_for.find(',');
+                        if (pos != std::string::npos) {
+                            return x_forwarded_for.substr(0, pos);
                         }
+                        return x_forwarded_for;
+                    }
+                }
+                return remote_ip;
+            }
 
-                        this->run();
+            std::string_view get_ip_view(const boost::beast::http::request<boost::beast::http::string_body>& message) const {
+                if (trust_x_forwarded_for) {
+                    auto it = message.find("X-Forwarded-For");
+                    if (it != message.end()) {
+                        const std::string_view x_forwarded_for{it->value().data(), it->value().size()};
+                        return x_forwarded_for.substr(0, x_forwarded_for.find(','));
                     }
-                );
+                }
+                return remote_ip;
             }
-    };
 
-    inline void stop() {
-        listener::get_instance().stop();
-    }
-}
+            static std::unordered_map<std::string, std::string> parse_fields(const std::string& _body) {
+                std::string body = _body;
 
-inline limhamn::http::server::server::server(const server_settings& settings, const std::function<limhamn::http::server::response(const limhamn::http::server::request&)>& callback) {
-    _limhamn_http_server_impl::generate_response_from_endpoint = callback;
-    _limhamn_http_server_impl::session_dir = settings.session_directory;
-    _limhamn_http_server_impl::enable_session = settings.enable_session;
-    _limhamn_http_server_impl::session_cookie_name = settings.session_cookie_name;
-    _limhamn_http_server_impl::associated_session_cookies = settings.associated_session_cookies;
-    _limhamn_http_server_impl::max_request_size = settings.max_request_size;
-    _limhamn_http_server_impl::rate_limited_endpoints = settings.rate_limits;
-    _limhamn_http_server_impl::default_rate_limit = settings.default_rate_limit;
-    _limhamn_http_server_impl::blacklisted_ips = settings.blacklisted_ips;
-    _limhamn_http_server_impl::whitelisted_ips = settings.whitelisted_ips;
-    _limhamn_http_server_impl::trust_x_forwarded_for = settings.trust_x_forwarded_for;
-    _limhamn_http_server_impl::listener listener{settings.port};
-}
+                if (!body.empty() && body.back() != '&') {
+                    body += "&";
+                }
 
-inline void limhamn::http::server::server::stop() {
-    _limhamn_http_server_impl::stop();
-}
+                std::unordered_map<std::string, std::string> ret{};
+                std::size_t last_amp_pos = 0;
+                std::size_t amp_pos = body.find('&');
+
+                while (amp_pos != std::string::npos) {
+                    std::size_t equals_pos = body.find('=', last_amp_pos);
+
+                    if (equals_pos != std::string::npos && equals_pos < amp_pos) {
+                        std::string key = body.substr(last_amp_pos, equals_pos - last_amp_pos);
+                        std::string value = body.substr(equals_pos + 1, amp_pos - equals_pos - 1);
+                        ret[key] = value;
+                    }
+
+                    last_amp_pos = amp_pos + 1;
+                    amp_pos = body.find('&', last_amp_pos);
+                }
+
+                return ret;
+            }
+
+            static std::unordered_map<std::string, std::string> parse_query_string(const std::string& url) {
+                std::size_t pos = url.find('?');
+
+                if (pos == std::string::npos) {
+                    return {};
+                }
+
+                std::string req = "&" + url.substr(pos + 1);
+
+                return parse_fields(req);
+            }
+
+            static std::string generate_random_string(const int length = 64) {
+                static constexpr char charset[] =
+                    "0123456789"
+                    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                    "abcdefghijklmnopqrstuvwxyz";
+
+                static constexpr size_t charset_size = sizeof(charset) - 1;
+                thread_local std::mt19937 generator(std::random_device{}());
+
+                std::uniform_int_distribution<> distribution(0, charset_size - 1);
+
+                std::string str(length, 0);
+
+                std::generate_n(str.begin(), length, [&distribution]() { return charset[distribution(generator)]; });
+
+                return str;
+            }
+
+            void read_request() {
+                sink.reset();
+                parser = std::make_shared<boost::beast::http::request_parser<boost::beast::http::string_body>>();
+
+                if (max_request_size != -1) {
+                    parser->body_limit(max_request_size);
+                } else {
+                    parser->body_limit((std::numeric_limits<std::uint64_t>::max)());
+                }
+
+                read_header();
+            }
+
+            /**
+             * @brief Reads the request header, closing the connection if it stays idle for too long
+             */
+            void read_header() {
+                auto self = shared_from_this();
+
+                if (keep_alive_timeout != -1) {
+                    net_stream.expires_after(std::chrono::milliseconds(keep_alive_timeout));
+                } else {
+                    net_stream.expires_never();
+                }
+
+                boost::beast::http::async_read_header(
+                    net_stream,
+                    net_buffer,
+                    *parser,
+
+                    [self](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                        self->on_read_header(ec, transferred_bytes);
+                    }
+                );
+            }
+
+            /**
+             * @brief Handles the read header, then reads the body with body_timeout instead of the idle timeout
+             * @param ec The error code
+             * @param transferred_bytes The amount of bytes transferred
+             */
+            void on_read_header(const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                if (ec) {
+                    stop();
+                    return;
+                }
+
+                if (metrics_enabled || access_log) {
+                    request_start = std::chrono::steady_clock::now();
+                    timing = true;
+                    rejected = false;
+                    bytes_received = transferred_bytes;
+                    bytes_sent = 0;
+                    response_status = 0;
+                }
+
+                if (!whitelisted) {
+                    const auto target = parser->get().target();
+                    const std::string_view endpoint{target.data(), target.size()};
+                    const std::string_view path = endpoint.substr(0, endpoint.find('?'));
+
+                    int rate_limit = default_rate_limit;
+                    if (!rate_limited_endpoints.empty()) {
+                        auto it = rate_limited_endpoints.find(std::string(path));
+                        if (it != rate_limited_endpoints.end()) {
+                            rate_limit = it->second;
+                        }
+                    }
+
+                    if (!rate_limit_tracker.allow(rate_limiter::make_key(remote_address, path), rate_limit)) {
+                        if (metrics_enabled) {
+                            metrics_shard::add(metrics.local().rate_limited, 1);
+                        }
+                        reject(boost::beast::http::status::too_many_requests);
+                        return;
+                    }
+                }
+
+                request_version = parser->get().version();
+                expire_body();
+
+                if (body_streamer) {
+                    try {
+                        fill_view(parser->get());
+                        sink = body_streamer(view);
+                    } catch (const std::exception&) {
+                        reject(boost::beast::http::status::bad_request);
+                        return;
+                    }
+
+                    if (sink) {
+                        read_stream_start();
+                        return;
+                    }
+                }
+
+                auto self = shared_from_this();
+
+                boost::beast::http::async_read(
+                    net_stream,
+                    net_buffer,
+                    *parser,
+
+                    [self](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                        self->on_read(ec, transferred_bytes);
+                    }
+                );
+            }
+
+            /**
+             * @brief Arms the timeout for the next body read
+             */
+            void expire_body() {
+                if (body_timeout != -1) {
+                    net_stream.expires_after(std::chrono::milliseconds(body_timeout));
+                } else {
+                    net_stream.expires_never();
+                }
+            }
+
+            /**
+             * @brief Switches to reading the body in chunks into the sink returned by the body streamer
+             */
+            void read_stream_start() {
+                stream_parser = std::make_shared<boost::beast::http::request_parser<boost::beast::http::buffer_body>>(std::move(*parser));
+
+                if (max_request_size != -1) {
+                    stream_parser->body_limit(max_request_size);
+                } else {
+                    stream_parser->body_limit((std::numeric_limits<std::uint64_t>::max)());
+                }
+
+                // a request without a body is already complete, and reading again would wait for, or parse, the next one
+                if (stream_parser->is_done()) {
+                    finish_stream();
+                    return;
+                }
+
+                if (stream_buffer.empty()) {
+                    stream_buffer.resize(16384);
+                }
+
+                read_stream();
+            }
+
+            /**
+             * @brief Reads the next chunk of a streamed body
+             */
+            void read_stream() {
+                auto& body = stream_parser->get().body();
+                body.data = stream_buffer.data();
+                body.size = stream_buffer.size();
+                body.more = true;
+
+                expire_body();
+
+                auto self = shared_from_this();
+
+                boost::beast::http::async_read_some(
+                    net_stream,
+                    net_buffer,
+                    *stream_parser,
+
+                    [self](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                        self->on_read_stream(ec, transferred_bytes);
+                    }
+                );
+            }
+
+            /**
+             * @brief Passes a chunk of a streamed body to the sink, then reads the next one or handles the request
+             * @param ec The error code
+             * @param transferred_bytes The amount of bytes transferred
+             */
+            void on_read_stream(const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                bytes_received += transferred_bytes;
+
+                if (ec && ec != boost::beast::http::error::need_buffer) {
+                    sink.reset();
+                    stream_parser.reset();
+                    stop();
+                    return;
+                }
+
+                const std::size_t size = stream_buffer.size() - stream_parser->get().body().size;
+
+                try {
+                    if (size != 0) {
+                        sink->write(stream_buffer.data(), size);
+                    }
+
+                    if (!stream_parser->is_done()) {
+                        read_stream();
+                        return;
+                    }
+                } catch (const std::length_error&) {
+                    sink.reset();
+                    stream_parser.reset();
+                    reject(boost::beast::http::status::payload_too_large);
+                    return;
+                } catch (const std::exception&) {
+                    sink.reset();
+                    stream_parser.reset();
+                    reject(boost::beast::http::status::bad_request);
+                    return;
+                }
+
+                finish_stream();
+            }
+
+            /**
+             * @brief Tells the sink the body is complete, then handles the request
+             */
+            void finish_stream() {
+                try {
+                    sink->finish();
+                } catch (const std::length_error&) {
+                    sink.reset();
+                    stream_parser.reset();
+                    reject(boost::beast::http::status::payload_too_large);
+                    return;
+                } catch (const std::exception&) {
+                    sink.reset();
+                    stream_parser.reset();
+                    reject(boost::beast::http::status::bad_request);
+                    return;
+                }
+
+                net_request = {};
+                net_request.base() = std::move(stream_parser->get().base());
+                stream_parser.reset();
+
+                handle_request();
+            }
+
+            /**
+             * @brief Answers with an empty error response without reading the body, then closes the connection
+             * @param status The status to respond with
+             */
+            void reject(const boost::beast::http::status status) {
+                rejected = true;
+                note_response(static_cast<unsigned int>(status), "rejected");
+
+                net_response = boost::beast::http::response<boost::beast::http::string_body>();
+                net_response.version(request_version);
+                net_response.result(status);
+                net_response.keep_alive(false);
+                net_response.prepare_payload();
+
+                const auto self = shared_from_this();
+
+                boost::beast::http::async_write(
+                    net_stream,
+                    net_response,
+                    [self](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                        self->bytes_sent += transferred_bytes;
+                        self->on_write(ec, false);
+                    }
+                );
+            }
+
+            /**
+             * @brief Handles the read request
+             * @param ec The error code
+             * @param transferred_bytes The amount of bytes transferred
+             */
+            void on_read(const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                bytes_received += transferred_bytes;
+
+                if (!ec) {
+                    net_request = parser->release();
+                    handle_request();
+                } else {
+                    stop();
+                }
+            }
+
+            static std::vector<limhamn::http::server::cookie> get_cookies_from_request(const std::string& cookie_header) {
+                std::vector<limhamn::http::server::cookie> cookies;
+                std::string cookie_str = cookie_header + ";";
+
+                while (cookie_str.find(';') != std::string::npos) {
+                    std::string cookie = cookie_str.substr(0, cookie_str.find(';'));
+                    cookie_str = cookie_str.substr(cookie_str.find(';') + 1);
+
+                    std::string name = cookie.substr(0, cookie.find('='));
+                    std::string value = cookie.substr(cookie.find('=') + 1);
+
+                    if (!name.empty() && !value.empty()) {
+                        if (name.front() == ' ') {
+                            name = name.substr(1);
+                        }
+                        cookies.push_back({name, value});
+                    }
+                }
+
+                return cookies;
+            }
+
+            /**
+             * @brief Builds a request and calls the request callback
+             * @param session_id Set to the session id of the request
+             * @param session_id_found Set to true if the request carried a session id
+             * @param erase_associated Set to true if the session id does not exist
+             * @return The response from the callback
+             */
+            limhamn::http::server::response call_request(std::string& session_id, bool& session_id_found, bool& erase_associated) {
+                limhamn::http::server::request request{};
+
+                request.endpoint = std::string(net_request.target().data(), net_request.target().size());
+
+                std::ostringstream oss;
+                oss << net_request;
+                request.raw_body = oss.str(); // TODO: a little inefficient, but works for now
+                request.body = net_request.body();
+                request.fields = parse_fields(request.body);
+                request.ip_address = get_ip();
+                request.method = std::string(net_request.method_string());
+                request.version = net_request.version();
+                request.sink = sink;
+                if (auto it = net_request.find(boost::beast::http::field::user_agent); it != net_request.end()) {
+                    request.user_agent = std::string(it->value());
+                }
+
+                if (request.endpoint.find('?') != std::string::npos) {
+                    request.query = parse_query_string(request.endpoint);
+                    request.endpoint = request.endpoint.substr(0, request.endpoint.find('?'));
+                }
+
+                if (net_request.find("Cookie") != net_request.end()) {
+                    request.cookies = get_cookies_from_request(std::string(net_request.find("Cookie")->value()));
+                }
+
+                for (const auto& it : request.cookies) {
+                    if (it.name == session_cookie_name && !it.value.empty() && enable_session) {
+                        session_id = it.value;
+                        session_id_found = true;
+                        break;
+                    }
+                }
+
+                if (session_id_found) {
+                    session_id.erase(std::remove(session_id.begin(), session_id.end(), '/'), session_id.end());
+                    if (!session_storage->load(session_id, request.session)) {
+                        erase_associated = true;
+                        // remove associated session cookies and session cookie from request
+                        for (const auto& it : associated_session_cookies) {
+                            request.cookies.erase(
+                                std::remove_if(request.cookies.begin(), request.cookies.end(),
+                                               [&it](const limhamn::http::server::cookie& cookie) {
+                                                   return cookie.name == it;
+                                               }),
+                                request.cookies.end()
+                            );
+                        }
+                        request.cookies.erase(
+                            std::remove_if(request.cookies.begin(), request.cookies.end(),
+                                           [](const limhamn::http::server::cookie& cookie) {
+                                               return cookie.name == session_cookie_name;
+                                           }),
+                            request.cookies.end()
+                        );
+
+                        request.session.clear();
+                        request.session_id.clear();
+                    } else {
+                        request.session_id = session_id;
+                    }
+                }
+
+                return generate_response_from_endpoint(request);
+            }
+
+            /**
+             * @brief Points the request view at a message, clearing everything parsed from the previous one
+             * @param message The message to view
+             */
+            void fill_view(const boost::beast::http::request<boost::beast::http::string_body>& message) {
+                view.target_ = {message.target().data(), message.target().size()};
+                view.method_ = {message.method_string().data(), message.method_string().size()};
+                view.body_ = message.body();
+                view.ip_address_ = get_ip_view(message);
+                view.version_ = message.version();
+                view.message = &message;
+                view.find_header = [](const void* message, const std::string_view name) -> std::string_view {
+                    const auto& req = *static_cast<const boost::beast::http::request<boost::beast::http::string_body>*>(message);
+                    auto it = req.find(boost::beast::string_view{name.data(), name.size()});
+                    if (it == req.end()) {
+                        return {};
+                    }
+                    return {it->value().data(), it->value().size()};
+                };
+                view.session_id_ = {};
+                view.session_ = &view_session;
+                view.sink_ = sink.get();
+                view.query_parsed = false;
+                view.fields_parsed = false;
+                view.cookies_parsed = false;
+                view_session.clear();
+            }
+
+            /**
+             * @brief Fills the request view and calls the view callback
+             * @param session_id Set to the session id of the request
+             * @param session_id_found Set to true if the request carried a session id
+             * @param erase_associated Set to true if the session id does not exist
+             * @return The response from the callback
+             */
+            limhamn::http::server::response call_view(std::string& session_id, bool& session_id_found, bool& erase_associated) {
+                fill_view(net_request);
+
+                if (enable_session) {
+                    const std::string_view id = view.cookie(session_cookie_name);
+                    if (!id.empty()) {
+                        session_id_found = true;
+                        session_id = std::string(id);
+                        session_id.erase(std::remove(session_id.begin(), session_id.end(), '/'), session_id.end());
+
+                        if (!session_storage->load(session_id, view_session)) {
+                            erase_associated = true;
+                            auto& cookies = view.cookies_;
+                            cookies.erase(std::remove_if(cookies.begin(), cookies.end(), [](const auto& cookie) {
+                                if (cookie.first == session_cookie_name) {
+                                    return true;
+                                }
+                                return std::find(associated_session_cookies.begin(), associated_session_cookies.end(), cookie.first) != associated_session_cookies.end();
+                            }), cookies.end());
+                            view_session.clear();
+                        } else {
+                            view.session_id_ = session_id;
+                        }
+                    }
+                }
+
+                return generate_response_from_view(view);
+            }
+
+            /**
+             * @brief Gets the path of the current request, without the query string
+             * @return std::string_view
+             */
+            std::string_view request_path() const {
+                const auto target = net_request.target();
+                const std::string_view endpoint{target.data(), target.size()};
+                return endpoint.substr(0, endpoint.find('?'));
+            }
+
+            /**
+             * @brief Checks whether the current request asks for the metrics endpoint
+             * @return bool
+             */
+            bool is_metrics_request() const {
+                if (!metrics_enabled || metrics_endpoint.empty() || (!whitelisted && !metrics_public)) {
+                    return false;
+                }
+
+                const auto method = net_request.method();
+                return (method == boost::beast::http::verb::get || method == boost::beast::http::verb::head) && request_path() == metrics_endpoint;
+            }
+
+            /**
+             * @brief Remembers the status and route of the response for the metrics and access log
+             * @param status The status of the response
+             * @param route The route the request is counted under
+             */
+            void note_response(const unsigned int status, const std::string_view route) {
+                response_status = status;
+                if (metrics_enabled) {
+                    metrics_route = metrics.route(metrics.local(), route);
+                }
+            }
+
+            /**
+             * @brief Records the metrics and access log entry of a request once its response has been written
+             */
+            void finish_request() {
+                timing = false;
+                const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - request_start).count();
+
+                if (metrics_enabled) {
+                    auto& shard = metrics.local();
+                    metrics_shard::add(shard.bytes_received, bytes_received);
+                    metrics_shard::add(shard.bytes_sent, bytes_sent);
+                    metrics.record(shard, metrics_route, response_status, static_cast<uint64_t>(duration));
+                }
+
+                if (access_log) {
+                    const auto& message = rejected && parser ? parser->get() : net_request;
+                    const auto method = message.method_string();
+                    const auto target = message.target();
+                    const auto user_agent = message[boost::beast::http::field::user_agent];
+
+                    limhamn::http::server::access_record record{};
+                    record.method = {method.data(), method.size()};
+                    record.target = {target.data(), target.size()};
+                    record.ip_address = rejected ? std::string_view{remote_ip} : get_ip_view(message);
+                    record.user_agent = {user_agent.data(), user_agent.size()};
+                    record.status = response_status;
+                    record.bytes_received = bytes_received;
+                    record.bytes_sent = bytes_sent;
+                    record.duration = duration;
+
+                    try {
+                        access_log(record);
+                    } catch (...) {
+                    }
+                }
+            }
+
+            /**
+             * @brief Handles the request
+             */
+            void handle_request() {
+                // the body timeout is for reading; writing the response is not limited
+                net_stream.expires_never();
+
+                net_response = boost::beast::http::response<boost::beast::http::string_body>();
+                net_response.version(net_request.version());
+
+                if (net_request.method() == boost::beast::http::verb::options) {
+                    net_response.result(boost::beast::http::status::no_content);
+                    net_response.set(boost::beast::http::field::allow, "GET, HEAD, OPTIONS");
+                    net_response.set(boost::beast::http::field::access_control_allow_origin, "*");
+                    net_response.set(boost::beast::http::field::access_control_allow_headers, "Content-Type");
+                    note_response(204, request_path());
+                } else if (is_metrics_request()) {
+                    net_response.result(boost::beast::http::status::ok);
+                    net_response.set(boost::beast::http::field::content_type, "text/plain; version=0.0.4; charset=utf-8");
+                    net_response.body() = metrics.snapshot().to_prometheus();
+                    note_response(200, metrics_endpoint);
+                } else {
+                    std::string session_id{};
+                    bool session_id_found = false;
+                    bool erase_associated = false;
+
+                    current_route = {};
+
+                    // the key does not include the session, so requests that have one are never cached
+                    std::string cache_key{};
+                    std::shared_ptr<const cached_response> cached{};
+                    if (response_cache_enabled && net_request.method() == boost::beast::http::verb::get && !has_session_cookie()) {
+                        cache_key = make_cache_key();
+                        cached = cached_responses.find(cache_key);
+                    }
+                    const bool hit = cached != nullptr;
+
+                    limhamn::http::server::response response{};
+                    if (hit) {
+                        current_route = cached->route;
+                        response = make_cached_response(*cached);
+                    } else {
+                        response = generate_response_from_view ?
+                            call_view(session_id, session_id_found, erase_associated) :
+                            call_request(session_id, session_id_found, erase_associated);
+
+                        // stored before the session cookie below is added, so other visitors do not get this one's session
+                        if (!cache_key.empty() && !session_id_found && response.session.empty()) {
+                            cached = store_response(std::move(cache_key), response);
+                        }
+                    }
+
+                    if (hit) {
+                        if (not_modified(*cached)) {
+                            write_not_modified(*cached);
+                            return;
+                        }
+                        // served without touching the session, so no session cookie either
+                    } else if (!session_id_found && enable_session) {
+                        session_id = generate_random_string();
+
+                        for (const auto& it : response.cookies) {
+                            if (it.name == session_cookie_name) {
+                                session_id_found = true;
+                                break;
+                            }
+                        }
+
+                        if (!session_id_found) {
+                            response.cookies.push_back({session_cookie_name, session_id, 0, "/", .same_site = "Strict", .http_only = true, .secure = session_is_secure});
+                        }
+                    } else if (enable_session) {
+                        session_storage->store(session_id, response.session);
+                    }
+
+                    if (cached && !hit) {
+                        std::vector<limhamn::http::server::cookie> cookies = std::move(response.cookies);
+                        response = make_cached_response(*cached);
+                        response.cookies = std::move(cookies);
+                    }
+
+                    for (const auto& it : response.cookies) {
+                        std::string cookie_str = it.name + "=" + it.value + "; ";
+                        if (it.expires != 0) {
+                            cookie_str += "Expires=" + convert_unix_millis_to_gmt(it.expires) + "; ";
+                        } else {
+                            cookie_str += "Expires=session; ";
+                        }
+                        if (it.http_only) {
+                            cookie_str += "HttpOnly; ";
+                        }
+                        if (it.secure) {
+                            cookie_str += "Secure; ";
+                        }
+                        if (!it.path.empty()) {
+                            cookie_str += "Path=" + it.path + "; ";
+                        }
+                        if (!it.domain.empty()) {
+                            cookie_str += "Domain=" + it.domain + "; ";
+                        }
+                        if (!it.same_site.empty() && (it.same_site == "Strict" || it.same_site == "Lax" || it.same_site == "None")) {
+                            cookie_str += "SameSite=" + it.same_site + "; ";
+                        }
+                        for (const auto& attribute : it.attributes) {
+                            cookie_str += attribute + "; ";
+                        }
+                        for (const auto& attribute : it.extra_attributes) {
+                            cookie_str += attribute.first + "=" + attribute.second + "; ";
+                        }
+
+                        net_response.insert(boost::beast::http::field::set_cookie, cookie_str);
+                    }
+
+                    if (erase_associated) {
+                        for (const auto& it : associated_session_cookies) {
+                            response.delete_cookies.push_back(it);
+                        }
+                    }
+
+                    for (const auto& it : response.delete_cookies) {
+                        std::string cookie_str = it + "=; Expires=Thu, 01 Jan 1970 00:00:00 GMT; Max-Age=0; Path=/; ";
+                        net_response.insert(boost::beast::http::field::set_cookie, cookie_str);
+                    }
+
+                    if (response.stop) {
+                        stop();
+                        _limhamn_http_server_impl::stop();
+                        return;
+                    }
+
+                    if (!response.location.empty()) {
+                        if (response.redirect_status == limhamn::http::server::redirect_type::temporary) {
+                            net_response.result(boost::beast::http::status::temporary_redirect);
+                        } else if (response.redirect_status == limhamn::http::server::redirect_type::permanent) {
+                            net_response.result(boost::beast::http::status::moved_permanently);
+                        }
+                        net_response.set(boost::beast::http::field::location, response.location);
+                    } else {
+                        net_response.result(response.http_status);
+                    }
+
+                    for (const auto& it : response.headers) {
+                        net_response.set(it.name, it.data);
+                    }
+
+                    net_response.set(boost::beast::http::field::content_type, response.content_type);
+                    net_response.set(boost::beast::http::field::access_control_allow_origin, response.allow_origin);
+
+                    if (timing) {
+                        // routes of a router are counted by pattern, anything else by path
+                        note_response(net_response.result_int(), !current_route.empty() ? current_route :
+                            routed ? std::string_view{"unmatched"} : request_path());
+                    }
+
+                    if (compression_enabled && response.compress && response.location.empty() && !response.generator && write_compressed(response)) {
+                        return;
+                    }
+
+                    if (response.generator) {
+                        write_generated(std::move(response.generator));
+                        return;
+                    } else if (!response.file_path.empty()) {
+                        write_file(response.file_path);
+                        return;
+                    } else if (response.shared_body) {
+                        write_shared(std::move(response.shared_body));
+                        return;
+                    }
+
+                    net_response.body() = std::move(response.body);
+                }
+
+                write_response();
+            }
+
+            /**
+             * @brief Checks whether the current request carries a session cookie
+             * @return bool
+             */
+            bool has_session_cookie() const {
+                if (!enable_session) {
+                    return false;
+                }
+
+                const auto header = net_request[boost::beast::http::field::cookie];
+                std::string_view cookies{header.data(), header.size()};
+                while (!cookies.empty()) {
+                    std::size_t end = cookies.find(';');
+                    std::string_view cookie = cookies.substr(0, end);
+                    cookies = end == std::string_view::npos ? std::string_view{} : cookies.substr(end + 1);
+
+                    while (!cookie.empty() && cookie.front() == ' ') {
+                        cookie.remove_prefix(1);
+                    }
+                    if (cookie.substr(0, cookie.find('=')) == session_cookie_name) {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            /**
+             * @brief Builds the response cache key of the current request
+             * @return std::string, the path followed by the configured query parameters and headers
+             */
+            std::string make_cache_key() const {
+                const auto target = net_request.target();
+                const std::string_view endpoint{target.data(), target.size()};
+                const auto question = endpoint.find('?');
+
+                std::string key{endpoint.substr(0, question)};
+                if (question != std::string_view::npos) {
+                    const std::string_view query = endpoint.substr(question + 1);
+                    for (const auto& name : response_cache_query) {
+                        key += '\0';
+                        std::size_t pos{0};
+                        while (pos <= query.size()) {
+                            std::size_t end = query.find('&', pos);
+                            if (end == std::string_view::npos) {
+                                end = query.size();
+                            }
+                            const std::string_view pair = query.substr(pos, end - pos);
+                            if (pair.substr(0, pair.find('=')) == name) {
+                                key += pair;
+                                break;
+                            }
+                            pos = end + 1;
+                        }
+                    }
+                }
+                for (const auto& name : response_cache_headers) {
+                    const auto value = net_request[name];
+                    key += '\0';
+                    key.append(value.data(), value.size());
+                }
+
+                return key;
+            }
+
+            /**
+             * @brief Stores a response in the response cache if it may be cached
+             * @param key The cache key of the request
+             * @param response The response
+             * @return std::shared_ptr<const cached_response>, nullptr if the response was not cached
+             */
+            std::shared_ptr<const cached_response> store_response(std::string key, limhamn::http::server::response& response) const {
+                const int64_t ttl = response.cache_ttl == -1 ? response_cache_ttl : response.cache_ttl;
+                if (ttl <= 0 || response.http_status != 200 || response.stop || !response.location.empty() || response.generator ||
+                    !response.file_path.empty() || !response.cookies.empty() || !response.delete_cookies.empty()) {
+                    return nullptr;
+                }
+
+                auto ret = std::make_shared<cached_response>();
+                ret->key = std::move(key);
+                ret->status = response.http_status;
+                ret->content_type = response.content_type;
+                ret->allow_origin = response.allow_origin;
+                ret->headers = response.headers;
+                ret->body = response.shared_body ? response.shared_body : std::make_shared<const std::string>(std::move(response.body));
+                ret->compress = response.compress;
+                ret->route = current_route;
+
+                const auto now = std::chrono::system_clock::now();
+                ret->modified = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+                ret->last_modified = convert_unix_millis_to_gmt(ret->modified * 1000);
+                ret->expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(ttl);
+
+                char etag[19];
+                std::snprintf(etag, sizeof(etag), "\"%016llx\"", static_cast<unsigned long long>(hash_body(*ret->body)));
+                ret->etag = etag;
+                for (const auto& it : ret->headers) {
+                    // an ETag set by the callback is kept
+                    if (it.name.size() == 4 && boost::beast::iequals(it.name, "ETag")) {
+                        ret->etag = it.data;
+                    }
+                }
+
+                cached_responses.insert(ret);
+                return ret;
+            }
+
+            /**
+             * @brief Makes a response that sends a cached response
+             * @param cached The cached response
+             * @return limhamn::http::server::response
+             */
+            static limhamn::http::server::response make_cached_response(const cached_response& cached) {
+                limhamn::http::server::response ret{};
+                ret.http_status = cached.status;
+                ret.content_type = cached.content_type;
+                ret.allow_origin = cached.allow_origin;
+                ret.headers = cached.headers;
+                ret.headers.push_back({"ETag", cached.etag});
+                ret.headers.push_back({"Last-Modified", cached.last_modified});
+                ret.shared_body = cached.body;
+                ret.compress = cached.compress;
+                return ret;
+            }
+
+            /**
+             * @brief Checks the conditional headers of the request against a cached response
+             * @param cached The cached response
+             * @return bool, true if the client's copy is current
+             */
+            bool not_modified(const cached_response& cached) const {
+                const auto if_none_match = net_request[boost::beast::http::field::if_none_match];
+                if (!if_none_match.empty()) {
+                    // If-Modified-Since is ignored when If-None-Match is present
+                    return etag_matches({if_none_match.data(), if_none_match.size()}, cached.etag);
+                }
+
+                const auto if_modified_since = net_request[boost::beast::http::field::if_modified_since];
+                if (!if_modified_since.empty()) {
+                    const int64_t since = parse_http_date({if_modified_since.data(), if_modified_since.size()});
+                    return since != -1 && cached.modified <= since;
+                }
+
+                return false;
+            }
+
+            /**
+             * @brief Writes a 304 response for a cached response
+             * @param cached The cached response
+             */
+            void write_not_modified(const cached_response& cached) {
+                net_response.result(boost::beast::http::status::not_modified);
+                for (const auto& it : cached.headers) {
+                    net_response.set(it.name, it.data);
+                }
+                net_response.set(boost::beast::http::field::last_modified, cached.last_modified);
+
+                // the validator has to be the one of the representation a 200 would have had
+                std::string etag = cached.etag;
+                if (compression_enabled && cached.compress && is_compressible(cached.content_type) && cached.body->size() >= compression_min_size) {
+                    net_response.set(boost::beast::http::field::vary, "Accept-Encoding");
+
+                    const auto accept_encoding = net_request[boost::beast::http::field::accept_encoding];
+                    const auto encoding = choose_encoding({accept_encoding.data(), accept_encoding.size()});
+                    if (encoding != content_encoding::identity && etag.size() >= 2 && etag.back() == '"') {
+                        etag.insert(etag.size() - 1, "-" + std::string(encoding_name(encoding)));
+                    }
+                }
+                net_response.set(boost::beast::http::field::etag, etag);
+
+                if (timing) {
+                    note_response(304, !cached.route.empty() ? cached.route : routed ? std::string_view{"unmatched"} : request_path());
+                }
+
+                // no prepare_payload(), a 304 has no body and its Content-Length would describe the 200 one
+                const bool keep = next_keep_alive();
+                net_response.keep_alive(keep);
+
+                const auto self = shared_from_this();
+                boost::beast::http::async_write(
+                    net_stream,
+                    net_response,
+                    [self, keep](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                        self->bytes_sent += transferred_bytes;
+                        self->on_write(ec, keep);
+                    }
+                );
+            }
+
+            /**
+             * @brief Writes the connection's own string_body response
+             */
+            void write_response() {
+                const bool keep = next_keep_alive();
+
+                net_response.keep_alive(keep);
+                net_response.prepare_payload();
+
+                const auto self = shared_from_this();
+
+                boost::beast::http::async_write(
+                    net_stream,
+                    net_response,
+                    [self, keep](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                        self->bytes_sent += transferred_bytes;
+                        self->on_write(ec, keep);
+                    }
+                );
+            }
+
+            /**
+             * @brief Runs a compression job, on the compression threads if it is large, then continues on the connection's strand
+             * @param offload Whether the job should run on the compression threads
+             * @param job The job, which returns the compressed body or nullptr
+             * @param done Called with the result of the job
+             */
+            template <typename Job, typename Done>
+            void run_compression(const bool offload, Job&& job, Done&& done) {
+                if (!offload || !compression_workers) {
+                    done(job());
+                    return;
+                }
+
+                const auto self = shared_from_this();
+                boost::asio::post(*compression_workers, [self, job = std::forward<Job>(job), done = std::forward<Done>(done)]() mutable {
+                    auto result = job();
+                    boost::asio::post(self->net_stream.get_executor(), [self, result = std::move(result), done = std::move(done)]() mutable {
+                        done(std::move(result));
+                    });
+                });
+            }
+
+            /**
+             * @brief Sets the headers of a compressed response and writes it
+             * @param body The compressed body
+             * @param encoding The encoding it is compressed with
+             */
+            void write_encoded(std::shared_ptr<const std::string> body, const content_encoding encoding) {
+                const auto name = encoding_name(encoding);
+                net_response.set(boost::beast::http::field::content_encoding, boost::beast::string_view{name.data(), name.size()});
+
+                // a strong validator has to differ between representations
+                const auto etag = net_response.find(boost::beast::http::field::etag);
+                if (etag != net_response.end() && etag->value().size() >= 2 && etag->value().back() == '"') {
+                    std::string value{etag->value()};
+                    value.insert(value.size() - 1, "-" + std::string(name));
+                    net_response.set(boost::beast::http::field::etag, value);
+                }
+
+                write_shared(std::move(body));
+            }
+
+            /**
+             * @brief Compresses the body of a response if the client accepts it and it is worth it, then writes it
+             * @param response The response, with the headers already set on net_response
+             * @return bool, true if the response was or will be written, false if it should be sent as it is
+             */
+            bool write_compressed(limhamn::http::server::response& response) {
+                const auto status = net_response.result_int();
+                if (status < 200 || status == 204 || status == 304 || !is_compressible(response.content_type) ||
+                    net_response.find(boost::beast::http::field::content_encoding) != net_response.end()) {
+                    return false;
+                }
+
+                std::uint64_t size{0};
+                std::filesystem::file_time_type modified{};
+                if (response.shared_body) {
+                    size = response.shared_body->size();
+                } else if (!response.file_path.empty()) {
+                    std::error_code ec;
+                    if (!std::filesystem::is_regular_file(response.file_path, ec)) {
+                        return false;
+                    }
+                    size = std::filesystem::file_size(response.file_path, ec);
+                    modified = std::filesystem::last_write_time(response.file_path, ec);
+                    if (ec || size > compression_max_file_size) {
+                        return false;
+                    }
+                } else {
+                    size = response.body.size();
+                }
+
+                if (size < compression_min_size) {
+                    return false;
+                }
+
+                // the representation depends on the request from here on, whether it ends up compressed or not
+                const auto vary = net_response.find(boost::beast::http::field::vary);
+                if (vary == net_response.end()) {
+                    net_response.set(boost::beast::http::field::vary, "Accept-Encoding");
+                } else if (vary->value().find("Accept-Encoding") == boost::beast::string_view::npos) {
+                    net_response.set(boost::beast::http::field::vary, std::string(vary->value()) + ", Accept-Encoding");
+                }
+
+                const auto accept_encoding = net_request[boost::beast::http::field::accept_encoding];
+                const auto encoding = choose_encoding({accept_encoding.data(), accept_encoding.size()});
+                if (encoding == content_encoding::identity) {
+                    return false;
+                }
+
+                const bool offload = size >= compression_offload_size;
+
+                if (!response.shared_body && response.file_path.empty()) {
+                    auto body = std::make_shared<std::string>(std::move(response.body));
+                    run_compression(offload, [body, encoding]() {
+                        return compress(encoding, *body, false);
+                    }, [this, body, encoding](std::shared_ptr<const std::string> result) {
+                        if (result) {
+                            write_encoded(std::move(result), encoding);
+                        } else {
+                            net_response.body() = std::move(*body);
+                            write_response();
+                        }
+                    });
+                    return true;
+                }
+
+                if (!compressed_variants.enabled()) {
+                    return false;
+                }
+
+                std::string key{};
+                if (response.shared_body) {
+                    key = "s:" + std::to_string(reinterpret_cast<std::uintptr_t>(response.shared_body.get()));
+                } else {
+                    key = "f:" + std::to_string(size) + ":" + std::to_string(modified.time_since_epoch().count()) + ":" + response.file_path;
+                }
+                key += ":" + std::string(encoding_name(encoding));
+
+                auto source = std::move(response.shared_body);
+                const std::shared_ptr<const std::string>* owner = source ? &source : nullptr;
+
+                std::shared_ptr<const std::string> variant{};
+                if (compressed_variants.find(key, owner, variant)) {
+                    if (variant) {
+                        write_encoded(std::move(variant), encoding);
+                    } else if (source) {
+                        write_shared(std::move(source));
+                    } else {
+                        write_file(response.file_path);
+                    }
+                    return true;
+                }
+
+                // reading the file blocks, so unlike bodies in memory it is always done on the compression threads
+                run_compression(offload || !source, [source, path = response.file_path, encoding]() -> std::shared_ptr<const std::string> {
+                    if (source) {
+                        return compress(encoding, *source, true);
+                    }
+
+                    std::ifstream file(path, std::ios::binary);
+                    const std::string contents{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+                    return file ? compress(encoding, contents, true) : nullptr;
+                }, [this, source, key = std::move(key), path = response.file_path, encoding](std::shared_ptr<const std::string> result) mutable {
+                    compressed_variants.insert(std::move(key), result, source ? &source : nullptr);
+
+                    if (result) {
+                        write_encoded(std::move(result), encoding);
+                    } else if (source) {
+                        write_shared(std::move(source));
+                    } else {
+                        write_file(path);
+                    }
+                });
+                return true;
+            }
+
+            /**
+             * @brief Counts the response and checks whether the connection may be kept open after it
+             * @return bool
+             */
+            bool next_keep_alive() {
+                ++handled_requests;
+                return keep_alive && net_request.keep_alive() &&
+                    (max_keep_alive_requests == -1 || handled_requests < max_keep_alive_requests);
+            }
+
+            /**
+             * @brief Writes a message that is not the connection's own string_body response, keeping it alive until written
+             * @param message The message to write
+             * @param keep Whether the connection should be kept open for another request
+             */
+            template <typename Message>
+            void write_message(const std::shared_ptr<Message>& message, const bool keep) {
+                const auto self = shared_from_this();
+
+                boost::beast::http::async_write(
+                    net_stream,
+                    *message,
+                    [self, message, keep](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                        self->bytes_sent += transferred_bytes;
+                        self->on_write(ec, keep);
+                    }
+                );
+            }
+
+            /**
+             * @brief Writes the prepared headers with a shared, immutable body
+             * @param body The body
+             */
+            void write_shared(std::shared_ptr<const std::string> body) {
+                using message_type = boost::beast::http::response<boost::beast::http::span_body<const char>>;
+
+                const bool keep = next_keep_alive();
+                auto message = std::make_shared<message_type>(std::move(net_response.base()));
+                message->body() = {body->data(), body->size()};
+                message->keep_alive(keep);
+                message->prepare_payload();
+
+                // the span points into the string, so it has to be kept alive alongside the message
+                const auto self = shared_from_this();
+                boost::beast::http::async_write(
+                    net_stream,
+                    *message,
+                    [self, message, body, keep](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                        self->bytes_sent += transferred_bytes;
+                        self->on_write(ec, keep);
+                    }
+                );
+            }
+
+            /**
+             * @brief Writes the prepared headers with a body produced in chunks by a generator
+             * @param generator The generator
+             */
+            void write_generated(std::function<std::size_t(char*, std::size_t)> generator) {
+                struct state {
+                    boost::beast::http::response<boost::beast::http::buffer_body> message;
+                    boost::beast::http::response_serializer<boost::beast::http::buffer_body> serializer{message};
+                    std::function<std::size_t(char*, std::size_t)> generator;
+                    bool finished{false};
+
+                    state(boost::beast::http::response_header<>&& header, std::function<std::size_t(char*, std::size_t)>&& generator)
+                        : message(std::move(header)), generator(std::move(generator)) {}
+                };
+
+                bool keep = next_keep_alive();
+                auto st = std::make_shared<state>(std::move(net_response.base()), std::move(generator));
+
+                // HTTP/1.0 has no chunked encoding, so the end of the body is signalled by closing the connection
+                if (net_request.version() < 11) {
+                    keep = false;
+                } else {
+                    st->message.chunked(true);
+                }
+                st->message.keep_alive(keep);
+
+                if (stream_buffer.empty()) {
+                    stream_buffer.resize(16384);
+                }
+
+                write_chunk(st, keep);
+            }
+
+            /**
+             * @brief Writes the next chunk of a generated body
+             * @param st The state of the generated body
+             * @param keep Whether the connection should be kept open for another request
+             */
+            template <typename State>
+            void write_chunk(const std::shared_ptr<State>& st, const bool keep) {
+                auto& body = st->message.body();
+
+                if (!st->finished) {
+                    std::size_t size = 0;
+                    try {
+                        size = st->generator(stream_buffer.data(), stream_buffer.size());
+                    } catch (const std::exception&) {
+                        // the headers may already be sent, so there is nothing to do but close the connection
+                        stop();
+                        return;
+                    }
+
+                    if (size == 0) {
+                        body.data = nullptr;
+                        body.size = 0;
+                        body.more = false;
+                        st->finished = true;
+                    } else {
+                        body.data = stream_buffer.data();
+                        body.size = (std::min)(size, stream_buffer.size());
+                        body.more = true;
+                    }
+                }
+
+                const auto self = shared_from_this();
+
+                boost::beast::http::async_write(
+                    net_stream,
+                    st->serializer,
+                    [self, st, keep](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                        self->bytes_sent += transferred_bytes;
+
+                        if (ec && ec != boost::beast::http::error::need_buffer) {
+                            self->stop();
+                            return;
+                        }
+
+                        if (st->serializer.is_done()) {
+                            self->on_write({}, keep);
+                            return;
+                        }
+
+                        self->write_chunk(st, keep);
+                    }
+                );
+            }
+
+            /**
+             * @brief Answers 404 when a file cannot be opened, keeping the prepared headers
+             * @param keep Whether the connection should be kept open for another request
+             */
+            void write_file_not_found(const bool keep) {
+                response_status = 404;
+                net_response.result(boost::beast::http::status::not_found);
+                net_response.body().clear();
+                net_response.keep_alive(keep);
+                net_response.prepare_payload();
+
+                const auto self = shared_from_this();
+
+                boost::beast::http::async_write(
+                    net_stream,
+                    net_response,
+                    [self, keep](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                        self->bytes_sent += transferred_bytes;
+                        self->on_write(ec, keep);
+                    }
+                );
+            }
+
+#ifdef __linux__
+            /**
+             * @brief A file being sent with sendfile(2), closed when the last reference goes away
+             */
+            struct file_state {
+                int fd{-1};
+                off_t offset{0};
+                off_t size{0};
+
+                ~file_state() {
+                    if (fd != -1) {
+                        ::close(fd);
+                    }
+                }
+            };
+
+            /**
+             * @brief Writes the prepared headers, then the file straight from the page cache with sendfile(2)
+             * @param path The path to the file
+             */
+            void write_file(const std::string& path) {
+                const bool keep = next_keep_alive();
+
+                auto st = std::make_shared<file_state>();
+                st->fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+                struct stat info{};
+                if (st->fd == -1 || ::fstat(st->fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+                    write_file_not_found(keep);
+                    return;
+                }
+                st->size = info.st_size;
+
+                auto message = std::make_shared<boost::beast::http::response<boost::beast::http::empty_body>>(std::move(net_response.base()));
+                message->keep_alive(keep);
+                message->content_length(static_cast<std::uint64_t>(st->size));
+
+                auto serializer = std::make_shared<boost::beast::http::response_serializer<boost::beast::http::empty_body>>(*message);
+                const auto self = shared_from_this();
+
+                boost::beast::http::async_write_header(
+                    net_stream,
+                    *serializer,
+                    [self, message, serializer, st, keep](const boost::beast::error_code& ec, std::size_t transferred_bytes) {
+                        self->bytes_sent += transferred_bytes;
+
+                        if (ec) {
+                            self->stop();
+                            return;
+                        }
+
+                        self->send_file(st, keep);
+                    }
+                );
+            }
+
+            /**
+             * @brief Sends as much of the file as the socket accepts, then waits until it can take more
+             * @param st The file being sent
+             * @param keep Whether the connection should be kept open for another request
+             */
+            void send_file(const std::shared_ptr<file_state>& st, const bool keep) {
+                auto& socket = net_stream.socket();
+
+                boost::beast::error_code ec;
+                socket.native_non_blocking(true, ec);
+                if (ec) {
+                    stop();
+                    return;
+                }
+
+                while (st->offset < st->size) {
+                    const std::size_t count = static_cast<std::size_t>((std::min)(st->size - st->offset, static_cast<off_t>(1 << 24)));
+                    const ssize_t sent = ::sendfile(socket.native_handle(), st->fd, &st->offset, count);
+
+                    if (sent > 0) {
+                        continue;
+                    }
+                    if (sent < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                        const auto self = shared_from_this();
+                        socket.async_wait(boost::asio::ip::tcp::socket::wait_write, [self, st, keep](const boost::beast::error_code& wait_ec) {
+                            if (wait_ec) {
+                                self->stop();
+                                return;
+                            }
+
+                            self->send_file(st, keep);
+                        });
+                        return;
+                    }
+
+                    // an error, or the file shrank while it was being sent
+                    stop();
+                    return;
+                }
+
+                bytes_sent += static_cast<uint64_t>(st->size);
+                on_write({}, keep);
+            }
+#else
+            /**
+             * @brief Writes the prepared headers with the file as a file_body
+             * @param path The path to the file
+             */
+            void write_file(const std::string& path) {
+                const bool keep = next_keep_alive();
+
+                boost::beast::error_code ec;
+                boost::beast::http::file_body::value_type body;
+                body.open(path.c_str(), boost::beast::file_mode::scan, ec);
+
+                if (ec) {
+                    write_file_not_found(keep);
+                    return;
+                }
+
+                auto message = std::make_shared<boost::beast::http::response<boost::beast::http::file_body>>(std::move(net_response.base()), std::move(body));
+                message->keep_alive(keep);
+                message->prepare_payload();
+
+                write_message(message, keep);
+            }
+#endif
+
+            /**
+             * @brief Handles the write request
+             * @param ec The error code
+             * @param keep Whether the connection should be kept open for another request
+             */
+            void on_write(const boost::beast::error_code& ec, const bool keep) {
+                if (timing) {
+                    finish_request();
+                }
+
+                if (ec) {
+                    return;
+                }
+
+                if (keep) {
+                    net_request = {};
+                    read_request();
+                    return;
+                }
+
+                boost::beast::error_code close_ec;
+                static_cast<void>(net_stream.socket().shutdown(boost::asio::ip::tcp::socket::shutdown_send, close_ec));
+            }
+    };
+
+    class listener;
+    inline std::atomic<listener*> active_listener{nullptr};
+
+    /**
+     * @brief A class that represents a listener
+     */
+    class listener {
+        public:
+            /**
+             * @brief Constructs a new listener object and runs it until stopped
+             * @param port The port to listen on
+             * @param threads The number of threads to run the listener on, 0 means one per core
+             * @param reuse_port Whether each thread should get its own SO_REUSEPORT acceptor and io_context
+             */
+            explicit listener(const int port = 8080, const int threads = 1, const bool reuse_port = false) {
+                std::size_t thread_count = threads > 0 ? static_cast<std::size_t>(threads) : std::thread::hardware_concurrency();
+                if (thread_count == 0) {
+                    thread_count = 1;
+                }
+
+#ifndef SO_REUSEPORT
+                static_cast<void>(reuse_port);
+                const bool per_thread_acceptor = false;
+#else
+                const bool per_thread_acceptor = reuse_port && thread_count > 1;
+#endif
+                const std::size_t context_count = per_thread_acceptor ? thread_count : 1;
+
+                for (std::size_t i{0}; i < context_count; ++i) {
+                    contexts.push_back(std::make_unique<boost::asio::io_context>(per_thread_acceptor ? 1 : static_cast<int>(thread_count)));
+                    acceptors.push_back(make_acceptor(*contexts.back(), port, per_thread_acceptor));
+                    retry_timers.push_back(std::make_unique<boost::asio::steady_timer>(*contexts.back()));
+                }
+
+                for (std::size_t i{0}; i < context_count; ++i) {
+                    run(*contexts.at(i), *acceptors.at(i), *retry_timers.at(i));
+                }
+
+                active_listener.store(this);
+
+                std::vector<std::thread> workers;
+                std::exception_ptr exception{};
+                std::mutex exception_mutex;
+
+                const auto work = [this, &exception, &exception_mutex](boost::asio::io_context& ioc) {
+                    try {
+                        ioc.run();
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(exception_mutex);
+                        if (!exception) {
+                            exception = std::current_exception();
+                        }
+                        stop();
+                    }
+                };
+
+                for (std::size_t i{1}; i < thread_count; ++i) {
+                    workers.emplace_back(work, std::ref(*contexts.at(per_thread_acceptor ? i : 0)));
+                }
+
+                work(*contexts.at(0));
+
+                for (auto& it : workers) {
+                    it.join();
+                }
+
+                active_listener.store(nullptr);
+
+                if (exception) {
+                    std::rethrow_exception(exception);
+                }
+            }
+
+            /**
+             * @brief Destroys the listener object
+             */
+            ~listener() {
+                stop();
+            }
+
+            /**
+             * @brief Stops every io_context owned by the listener
+             * @note Safe to call from any thread, including from within a request handler.
+             */
+            void stop() {
+                for (auto& it : contexts) {
+                    it->stop();
+                }
+            }
+        private:
+            static constexpr std::chrono::milliseconds retry_delay{100};
+
+            std::vector<std::unique_ptr<boost::asio::io_context>> contexts;
+            std::vector<std::unique_ptr<boost::asio::ip::tcp::acceptor>> acceptors;
+            std::vector<std::unique_ptr<boost::asio::steady_timer>> retry_timers;
+
+            static std::unique_ptr<boost::asio::ip::tcp::acceptor> make_acceptor(boost::asio::io_context& ioc, const int port, const bool reuse_port) {
+                const boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::tcp::v4(), static_cast<unsigned short>(port));
+                auto acceptor = std::make_unique<boost::asio::ip::tcp::acceptor>(ioc);
+
+                acceptor->open(endpoint.protocol());
+                acceptor->set_option(boost::asio::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+                if (reuse_port) {
+                    using reuse_port_option = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+                    acceptor->set_option(reuse_port_option(true));
+                }
+#else
+                static_cast<void>(reuse_port);
+#endif
+                acceptor->bind(endpoint);
+                acceptor->listen(boost::asio::socket_base::max_listen_connections);
+
+                return acceptor;
+            }
+
+            /**
+             * @brief Runs the accept loop of an acceptor
+             * @note Every connection gets its own strand, so a session never runs on two threads at once.
+             * @note Accept errors other than an aborted connection are retried after retry_delay.
+             */
+            void run(boost::asio::io_context& ioc, boost::asio::ip::tcp::acceptor& acceptor, boost::asio::steady_timer& retry_timer) {
+                acceptor.async_accept(
+                    boost::asio::make_strand(ioc),
+                    [this, &ioc, &acceptor, &retry_timer](const boost::beast::error_code& ec, boost::asio::ip::tcp::socket socket) {
+                        if (!ec) {
+                            std::make_shared<session>(std::move(socket))->start();
+                        } else if (ec == boost::asio::error::operation_aborted) {
+                            return;
+                        } else if (ec != boost::asio::error::connection_aborted) {
+                            // errors like EMFILE last until a connection closes, retrying at once would spin
+                            retry_timer.expires_after(retry_delay);
+                            retry_timer.async_wait([this, &ioc, &acceptor, &retry_timer](const boost::beast::error_code& timer_ec) {
+                                if (timer_ec != boost::asio::error::operation_aborted) {
+                                    this->run(ioc, acceptor, retry_timer);
+                                }
+                            });
+                            return;
+                        }
+
+                        this->run(ioc, acceptor, retry_timer);
+                    }
+                );
+            }
+    };
+
+    inline void stop() {
+        if (auto* it = active_listener.load()) {
+            it->stop();
+        }
+    }
+}
+
+inline void _limhamn_http_server_impl::run(const limhamn::http::server::server_settings& settings) {
+    _limhamn_http_server_impl::session_storage = settings.session_store ? settings.session_store : std::make_shared<limhamn::http::server::file_session_store>(settings.session_directory);
+    _limhamn_http_server_impl::enable_session = settings.enable_session;
+    _limhamn_http_server_impl::session_cookie_name = settings.session_cookie_name;
+    _limhamn_http_server_impl::associated_session_cookies = settings.associated_session_cookies;
+    _limhamn_http_server_impl::max_request_size = settings.max_request_size;
+    _limhamn_http_server_impl::body_streamer = settings.body_streamer;
+    _limhamn_http_server_impl::rate_limited_endpoints = {settings.rate_limits.begin(), settings.rate_limits.end()};
+    _limhamn_http_server_impl::default_rate_limit = settings.default_rate_limit;
+    _limhamn_http_server_impl::rate_limit_tracker.resize(settings.rate_limit_table_size);
+    _limhamn_http_server_impl::blacklisted_ips.clear();
+    for (const auto& it : settings.blacklisted_ips) {
+        _limhamn_http_server_impl::blacklisted_ips.add(it);
+    }
+    _limhamn_http_server_impl::whitelisted_ips.clear();
+    for (const auto& it : settings.whitelisted_ips) {
+        _limhamn_http_server_impl::whitelisted_ips.add(it);
+    }
+    _limhamn_http_server_impl::trust_x_forwarded_for = settings.trust_x_forwarded_for;
+    _limhamn_http_server_impl::session_is_secure = settings.session_is_secure;
+    _limhamn_http_server_impl::keep_alive = settings.keep_alive;
+    _limhamn_http_server_impl::keep_alive_timeout = settings.keep_alive_timeout;
+    _limhamn_http_server_impl::body_timeout = settings.body_timeout;
+    _limhamn_http_server_impl::max_keep_alive_requests = settings.max_keep_alive_requests;
+    _limhamn_http_server_impl::metrics_enabled = settings.enable_metrics;
+    _limhamn_http_server_impl::metrics_endpoint = settings.metrics_endpoint;
+    _limhamn_http_server_impl::metrics_public = settings.metrics_public;
+    _limhamn_http_server_impl::access_log = settings.access_log;
+    _limhamn_http_server_impl::compression_enabled = settings.enable_compression;
+    _limhamn_http_server_impl::compression_min_size = settings.compression_min_size;
+    _limhamn_http_server_impl::compression_offload_size = settings.compression_offload_size;
+    _limhamn_http_server_impl::compression_max_file_size = settings.compression_max_file_size;
+    _limhamn_http_server_impl::response_cache_enabled = settings.enable_response_cache && settings.response_cache_size != 0;
+    _limhamn_http_server_impl::response_cache_ttl = settings.response_cache_ttl;
+    _limhamn_http_server_impl::response_cache_query = settings.response_cache_query;
+    _limhamn_http_server_impl::response_cache_headers = settings.response_cache_headers;
+    _limhamn_http_server_impl::cached_responses.resize(settings.enable_response_cache ? settings.response_cache_size : 0);
+    _limhamn_http_server_impl::compressed_variants.clear();
+    _limhamn_http_server_impl::compressed_variants.resize(settings.enable_compression ? settings.compression_cache_size : 0);
+    if (settings.enable_compression) {
+        _limhamn_http_server_impl::compression_workers = std::make_unique<boost::asio::thread_pool>(static_cast<std::size_t>((std::max)(settings.compression_threads, 1)));
+    }
+
+    {
+        _limhamn_http_server_impl::listener listener{settings.port, settings.threads, settings.reuse_port};
+
+        // finished jobs post back to the listener's io_contexts, so they have to be done before those go away
+        if (_limhamn_http_server_impl::compression_workers) {
+            _limhamn_http_server_impl::compression_workers->join();
+        }
+    }
+
+    _limhamn_http_server_impl::compression_workers.reset();
+}
+
+inline limhamn::http::server::server::server(const server_settings& settings, const std::function<limhamn::http::server::response(const limhamn::http::server::request&)>& callback) {
+    _limhamn_http_server_impl::routed = false;
+    _limhamn_http_server_impl::generate_response_from_endpoint = callback;
+    _limhamn_http_server_impl::generate_response_from_view = nullptr;
+    _limhamn_http_server_impl::run(settings);
+}
+
+inline limhamn::http::server::server::server(const server_settings& settings, const std::function<limhamn::http::server::response(const limhamn::http::server::request_view&)>& callback) {
+    _limhamn_http_server_impl::routed = false;
+    _limhamn_http_server_impl::generate_response_from_endpoint = nullptr;
+    _limhamn_http_server_impl::generate_response_from_view = callback;
+    _limhamn_http_server_impl::run(settings);
+}
+
+inline void limhamn::http::server::server::stop() {
+    _limhamn_http_server_impl::stop();
+}
+
+inline limhamn::http::server::metrics_snapshot limhamn::http::server::server::metrics() {
+    return _limhamn_http_server_impl::metrics.snapshot();
+}
+
+inline void limhamn::http::server::server::clear_response_cache() {
+    _limhamn_http_server_impl::cached_responses.clear();
+}
+
+inline double limhamn::http::server::latency_histogram::bucket_upper_bound(const std::size_t index) {
+    if (index < 4) {
+        return static_cast<double>(index + 1) / 1e6;
+    }
+
+    const std::size_t exponent = index / 4 + 1;
+    const std::size_t sub = index % 4;
+    return static_cast<double>(static_cast<uint64_t>(5 + sub) << (exponent - 2)) / 1e6;
+}
+
+inline double limhamn::http::server::latency_histogram::quantile(const double q) const {
+    if (this->count == 0) {
+        return 0;
+    }
+
+    const auto rank = static_cast<std::uint64_t>(std::ceil(q * static_cast<double>(this->count)));
+    std::uint64_t seen{0};
+    for (std::size_t i = 0; i < this->buckets.size(); ++i) {
+        seen += this->buckets[i];
+        if (seen >= rank && seen != 0) {
+            return bucket_upper_bound(i);
+        }
+    }
+
+    return bucket_upper_bound(this->buckets.size() - 1);
+}
+
+inline std::string limhamn::http::server::metrics_snapshot::to_prometheus() const {
+    std::string ret{};
+    ret.reserve(4096 + this->routes.size() * 2048);
+
+    const auto counter = [&ret](const char* name, const char* help, const char* type, const auto value) {
+        ret += std::string("# HELP ") + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+        ret += std::string(name) + " " + std::to_string(value) + "\n";
+    };
+
+    ret += "# HELP limhamn_http_requests_total Requests answered, by status class.\n# TYPE limhamn_http_requests_total counter\n";
+    for (std::size_t i = 0; i < this->status_classes.size(); ++i) {
+        ret += "limhamn_http_requests_total{code=\"" + std::to_string(i + 1) + "xx\"} " + std::to_string(this->status_classes[i]) + "\n";
+    }
+    counter("limhamn_http_received_bytes_total", "Bytes of requests read.", "counter", this->bytes_received);
+    counter("limhamn_http_sent_bytes_total", "Bytes of responses written.", "counter", this->bytes_sent);
+    counter("limhamn_http_rate_limited_total", "Requests rejected by the rate limiter.", "counter", this->rate_limited);
+    counter("limhamn_http_blacklisted_total", "Connections closed because the address is blacklisted.", "counter", this->blacklisted);
+    counter("limhamn_http_connections_total", "Connections accepted.", "counter", this->connections_total);
+    counter("limhamn_http_connections_open", "Connections currently open.", "gauge", this->connections_open);
+
+    const auto escape = [](const std::string& value) {
+        std::string escaped{};
+        for (const char c : value) {
+            if (c == '\\' || c == '"') {
+                escaped += '\\';
+                escaped += c;
+            } else if (c == '\n') {
+                escaped += "\\n";
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    };
+
+    const auto seconds = [](const double value) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+        return std::string(buffer);
+    };
+
+    ret += "# HELP limhamn_http_request_duration_seconds Time from the end of the request headers to the end of the response.\n";
+    ret += "# TYPE limhamn_http_request_duration_seconds histogram\n";
+    for (const auto& it : this->routes) {
+        const std::string label = "route=\"" + escape(it.route) + "\"";
+        std::uint64_t cumulative{0};
+        for (std::size_t i = 0; i < it.buckets.size(); ++i) {
+            cumulative += it.buckets[i];
+            // one line per power of two, from 64us (bucket 19) to about 67s (bucket 99), is plenty for dashboards
+            if (i % 4 == 3 && i >= 19 && i <= 99) {
+                ret += "limhamn_http_request_duration_seconds_bucket{" + label + ",le=\"" + seconds(latency_histogram::bucket_upper_bound(i)) + "\"} " + std::to_string(cumulative) + "\n";
+            }
+        }
+        ret += "limhamn_http_request_duration_seconds_bucket{" + label + ",le=\"+Inf\"} " + std::to_string(it.count) + "\n";
+        ret += "limhamn_http_request_duration_seconds_sum{" + label + "} " + seconds(it.sum) + "\n";
+        ret += "limhamn_http_request_duration_seconds_count{" + label + "} " + std::to_string(it.count) + "\n";
+    }
+
+    ret += "# HELP limhamn_http_request_duration_quantile_seconds Latency quantiles, as bucket upper bounds.\n";
+    ret += "# TYPE limhamn_http_request_duration_quantile_seconds gauge\n";
+    for (const auto& it : this->routes) {
+        const std::string label = "route=\"" + escape(it.route) + "\"";
+        for (const double q : {0.5, 0.9, 0.99, 0.999}) {
+            ret += "limhamn_http_request_duration_quantile_seconds{" + label + ",quantile=\"" + seconds(q) + "\"} " + seconds(it.quantile(q)) + "\n";
+        }
+    }
+
+    return ret;
+}
+
+inline limhamn::http::server::server::server(const server_settings& settings, router& routes) {
+    routes.compile();
+    _limhamn_http_server_impl::routed = true;
+    _limhamn_http_server_impl::generate_response_from_endpoint = nullptr;
+    _limhamn_http_server_impl::generate_response_from_view = [&routes](const limhamn::http::server::request_view& request) {
+        return routes.dispatch(request);
+    };
+    _limhamn_http_server_impl::run(settings);
+}
+
+inline std::string_view limhamn::http::server::request_view::endpoint() const {
+    return this->target_.substr(0, this->target_.find('?'));
+}
+
+inline std::string_view limhamn::http::server::request_view::target() const {
+    return this->target_;
+}
+
+inline std::string_view limhamn::http::server::request_view::method() const {
+    return this->method_;
+}
+
+inline std::string_view limhamn::http::server::request_view::body() const {
+    return this->body_;
+}
+
+inline std::string_view limhamn::http::server::request_view::ip_address() const {
+    return this->ip_address_;
+}
+
+inline unsigned int limhamn::http::server::request_view::version() const {
+    return this->version_;
+}
+
+inline std::string_view limhamn::http::server::request_view::header(const std::string_view name) const {
+    return this->find_header ? this->find_header(this->message, name) : std::string_view{};
+}
+
+inline std::string_view limhamn::http::server::request_view::content_type() const {
+    return this->header("Content-Type");
+}
+
+inline std::string_view limhamn::http::server::request_view::user_agent() const {
+    return this->header("User-Agent");
+}
+
+inline void limhamn::http::server::request_view::split_pairs(std::string_view str, const char separator, pairs& out) {
+    out.clear();
+
+    while (!str.empty()) {
+        const std::size_t end = str.find(separator);
+        std::string_view pair = str.substr(0, end);
+        str = end == std::string_view::npos ? std::string_view{} : str.substr(end + 1);
+
+        if (separator == ';' && !pair.empty() && pair.front() == ' ') {
+            pair.remove_prefix(1);
+        }
+
+        const std::size_t equals = pair.find('=');
+        if (equals == std::string_view::npos) {
+            continue;
+        }
+
+        out.emplace_back(pair.substr(0, equals), pair.substr(equals + 1));
+    }
+}
+
+inline std::string_view limhamn::http::server::request_view::find_last(const pairs& p, const std::string_view key) {
+    for (auto it = p.rbegin(); it != p.rend(); ++it) {
+        if (it->first == key) {
+            return it->second;
+        }
+    }
+
+    return {};
+}
+
+inline const limhamn::http::server::request_view::pairs& limhamn::http::server::request_view::query() const {
+    if (!this->query_parsed) {
+        const std::size_t pos = this->target_.find('?');
+        split_pairs(pos == std::string_view::npos ? std::string_view{} : this->target_.substr(pos + 1), '&', this->query_);
+        this->query_parsed = true;
+    }
+
+    return this->query_;
+}
+
+inline std::string_view limhamn::http::server::request_view::query(const std::string_view key) const {
+    return find_last(this->query(), key);
+}
+
+inline const limhamn::http::server::request_view::pairs& limhamn::http::server::request_view::fields() const {
+    if (!this->fields_parsed) {
+        split_pairs(this->body_, '&', this->fields_);
+        this->fields_parsed = true;
+    }
+
+    return this->fields_;
+}
+
+inline std::string_view limhamn::http::server::request_view::field(const std::string_view key) const {
+    return find_last(this->fields(), key);
+}
+
+inline const limhamn::http::server::request_view::pairs& limhamn::http::server::request_view::cookies() const {
+    if (!this->cookies_parsed) {
+        split_pairs(this->header("Cookie"), ';', this->cookies_);
+        this->cookies_.erase(std::remove_if(this->cookies_.begin(), this->cookies_.end(), [](const auto& it) {
+            return it.first.empty() || it.second.empty();
+        }), this->cookies_.end());
+        this->cookies_parsed = true;
+    }
+
+    return this->cookies_;
+}
+
+inline std::string_view limhamn::http::server::request_view::cookie(const std::string_view name) const {
+    for (const auto& it : this->cookies()) {
+        if (it.first == name) {
+            return it.second;
+        }
+    }
+
+    return {};
+}
+
+inline const limhamn::http::server::session_data& limhamn::http::server::request_view::session() const {
+    static const session_data empty{};
+    return this->session_ ? *this->session_ : empty;
+}
+
+inline std::string_view limhamn::http::server::request_view::session_id() const {
+    return this->session_id_;
+}
+
+inline limhamn::http::server::body_sink* limhamn::http::server::request_view::sink() const {
+    return this->sink_;
+}
+
+inline limhamn::http::server::file_session_store::file_session_store(std::string directory) : directory(std::move(directory)) {}
+
+inline std::mutex& limhamn::http::server::file_session_store::lock_for(const std::string& id) {
+    return this->mtx[std::hash<std::string>{}(id) % (sizeof(this->mtx) / sizeof(this->mtx[0]))];
+}
+
+inline std::string limhamn::http::server::file_session_store::get_path(const std::string& id) const {
+    return this->directory + "/session_" + id + ".txt";
+}
+
+inline bool limhamn::http::server::file_session_store::read_file(const std::string& path, session_data& data) {
+    std::ifstream file(path);
+
+    if (!file.is_open() || !file.good()) {
+        return false;
+    }
+
+    std::string line{};
+    while (std::getline(file, line)) {
+        const std::size_t pos = line.find('=');
+        if (pos != std::string::npos) {
+            data[line.substr(0, pos)] = line.substr(pos + 1);
+        }
+    }
+
+    return true;
+}
+
+inline void limhamn::http::server::file_session_store::write_file(const std::string& path, const session_data& data) {
+    std::ofstream file(path, std::ios::trunc);
+
+    if (!file.is_open() || !file.good()) {
+        throw std::runtime_error("failed to open session file (write_file()): " + path);
+    }
+
+    for (const auto& it : data) {
+        file << it.first << "=" << it.second << "\n";
+    }
+}
+
+inline bool limhamn::http::server::file_session_store::load(const std::string& id, session_data& data) {
+    std::lock_guard<std::mutex> lock(this->lock_for(id));
+    return read_file(this->get_path(id), data);
+}
+
+inline void limhamn::http::server::file_session_store::store(const std::string& id, const session_data& values) {
+    std::lock_guard<std::mutex> lock(this->lock_for(id));
+    const std::string path = this->get_path(id);
+
+    session_data stored{};
+    const bool exists = read_file(path, stored);
+
+    bool changed = !exists;
+    for (const auto& it : values) {
+        auto stored_it = stored.find(it.first);
+        if (stored_it == stored.end() || stored_it->second != it.second) {
+            stored[it.first] = it.second;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        write_file(path, stored);
+    }
+}
+
+inline limhamn::http::server::memory_session_store::memory_session_store(const memory_session_store_settings& settings) : settings(settings) {
+    const std::size_t count = settings.shards == 0 ? 1 : settings.shards;
+    for (std::size_t i{0}; i < count; ++i) {
+        this->shards.push_back(std::make_unique<shard>());
+    }
+
+    this->restore();
+
+    if (settings.ttl == -1 && settings.persistence == session_persistence::none) {
+        return;
+    }
+
+    this->worker = std::thread([this]() {
+        const auto interval = std::chrono::milliseconds(this->settings.persistence_interval > 0 ? this->settings.persistence_interval : 1000);
+        std::unique_lock<std::mutex> lock(this->worker_mtx);
+        while (!this->stopping) {
+            this->worker_cv.wait_for(lock, interval);
+            lock.unlock();
+            std::string error{};
+            try {
+                this->sweep_and_flush();
+            } catch (const std::exception& e) {
+                // whatever could not be written is kept and retried on the next interval
+                error = e.what();
+                if (this->settings.error_handler) {
+                    try {
+                        this->settings.error_handler(e);
+                    } catch (...) {
+                        // a throwing handler must not end the worker
+                    }
+                }
+            }
+            lock.lock();
+            this->background_error = std::move(error);
+        }
+    });
+}
+
+inline limhamn::http::server::memory_session_store::~memory_session_store() {
+    {
+        std::lock_guard<std::mutex> lock(this->worker_mtx);
+        this->stopping = true;
+    }
+    this->worker_cv.notify_all();
+
+    if (this->worker.joinable()) {
+        this->worker.join();
+    }
+
+    try {
+        this->sweep_and_flush();
+    } catch (const std::exception&) {}
+}
+
+inline limhamn::http::server::memory_session_store::shard& limhamn::http::server::memory_session_store::shard_for(const std::string& id) {
+    return *this->shards[std::hash<std::string>{}(id) % this->shards.size()];
+}
+
+inline bool limhamn::http::server::memory_session_store::load(const std::string& id, session_data& data) {
+    const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    auto& s = this->shard_for(id);
+    std::lock_guard<std::mutex> lock(s.mtx);
+
+    auto it = s.sessions.find(id);
+    if (it == s.sessions.end()) {
+        return false;
+    }
+
+    if (this->settings.ttl != -1 && now - it->second.last_access > this->settings.ttl) {
+        s.removed.push_back(id);
+        s.sessions.erase(it);
+        return false;
+    }
+
+    it->second.last_access = now;
+    data = it->second.data;
+
+    return true;
+}
+
+inline void limhamn::http::server::memory_session_store::store(const std::string& id, const session_data& values) {
+    const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    auto& s = this->shard_for(id);
+    std::string record{};
+
+    {
+        std::lock_guard<std::mutex> lock(s.mtx);
+
+        auto it = s.sessions.find(id);
+        const bool created = it == s.sessions.end();
+        if (created) {
+            it = s.sessions.emplace(id, entry{}).first;
+            it->second.dirty = true;
+            record += "+" + id + "\n";
+        }
+
+        auto& current = it->second;
+        current.last_access = now;
+
+        for (const auto& value : values) {
+            auto stored = current.data.find(value.first);
+            if (stored != current.data.end() && stored->second == value.second) {
+                continue;
+            }
+
+            current.data[value.first] = value.second;
+            current.dirty = true;
+            record += "=" + id + "\t" + value.first + "=" + value.second + "\n";
+        }
+    }
+
+    if (this->settings.persistence == session_persistence::append_only && !record.empty()) {
+        std::lock_guard<std::mutex> lock(this->log_mtx);
+        this->log_buffer += record;
+    }
+}
+
+inline void limhamn::http::server::memory_session_store::flush() {
+    this->sweep_and_flush();
+}
+
+inline std::size_t limhamn::http::server::memory_session_store::size() {
+    std::size_t ret{0};
+    for (auto& it : this->shards) {
+        std::lock_guard<std::mutex> lock(it->mtx);
+        ret += it->sessions.size();
+    }
+    return ret;
+}
+
+inline std::string limhamn::http::server::memory_session_store::last_error() {
+    std::lock_guard<std::mutex> lock(this->worker_mtx);
+    return this->background_error;
+}
+
+inline void limhamn::http::server::memory_session_store::sweep_and_flush() {
+    const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    std::vector<std::pair<std::string, session_data>> changed{};
+    std::vector<std::string> removed{};
+
+    for (auto& s : this->shards) {
+        std::lock_guard<std::mutex> lock(s->mtx);
+
+        for (auto it = s->sessions.begin(); it != s->sessions.end();) {
+            if (this->settings.ttl != -1 && now - it->second.last_access > this->settings.ttl) {
+                s->removed.push_back(it->first);
+                it = s->sessions.erase(it);
+                continue;
+            }
+
+            if (it->second.dirty && this->settings.persistence == session_persistence::snapshot) {
+                changed.emplace_back(it->first, it->second.data);
+            }
+            it->second.dirty = false;
+            ++it;
+        }
+
+        removed.insert(removed.end(), s->removed.begin(), s->removed.end());
+        s->removed.clear();
+    }
+
+    if (this->settings.persistence == session_persistence::snapshot) {
+        for (std::size_t i{0}; i < changed.size(); ++i) {
+            try {
+                file_session_store::write_file(this->settings.persistence_path + "/session_" + changed[i].first + ".txt", changed[i].second);
+            } catch (const std::exception&) {
+                // mark the unwritten sessions dirty again so the next flush retries them
+                for (std::size_t j{i}; j < changed.size(); ++j) {
+                    auto& sh = this->shard_for(changed[j].first);
+                    std::lock_guard<std::mutex> lock(sh.mtx);
+                    if (auto it = sh.sessions.find(changed[j].first); it != sh.sessions.end()) {
+                        it->second.dirty = true;
+                    }
+                }
+                throw;
+            }
+        }
+        for (const auto& id : removed) {
+            std::error_code ec;
+            std::filesystem::remove(this->settings.persistence_path + "/session_" + id + ".txt", ec);
+        }
+    } else if (this->settings.persistence == session_persistence::append_only) {
+        std::string buffer{};
+        {
+            std::lock_guard<std::mutex> lock(this->log_mtx);
+            for (const auto& id : removed) {
+                this->log_buffer += "-" + id + "\n";
+            }
+            buffer.swap(this->log_buffer);
+        }
+
+        if (!buffer.empty()) {
+            std::ofstream file(this->settings.persistence_path, std::ios::app | std::ios::binary);
+            if (!file.is_open()) {
+                std::lock_guard<std::mutex> lock(this->log_mtx);
+                this->log_buffer.insert(0, buffer);
+                throw std::runtime_error("failed to open session log (sweep_and_flush()): " + this->settings.persistence_path);
+            }
+            file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        }
+    }
+}
+
+inline void limhamn::http::server::memory_session_store::restore() {
+    const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    if (this->settings.persistence == session_persistence::snapshot) {
+        std::error_code ec;
+        if (!std::filesystem::is_directory(this->settings.persistence_path, ec)) {
+            return;
+        }
+
+        for (const auto& it : std::filesystem::directory_iterator(this->settings.persistence_path, ec)) {
+            const std::string name = it.path().filename().string();
+            if (name.rfind("session_", 0) != 0 || name.size() <= 12 || name.substr(name.size() - 4) != ".txt") {
+                continue;
+            }
+
+            entry e{};
+            if (!file_session_store::read_file(it.path().string(), e.data)) {
+                continue;
+            }
+            e.last_access = now;
+
+            const std::string id = name.substr(8, name.size() - 12);
+            auto& s = this->shard_for(id);
+            s.sessions[id] = std::move(e);
+        }
+    } else if (this->settings.persistence == session_persistence::append_only) {
+        std::ifstream file(this->settings.persistence_path, std::ios::binary);
+        if (!file.is_open()) {
+            return;
+        }
+
+        std::string line{};
+        while (std::getline(file, line)) {
+            if (line.size() < 2) {
+                continue;
+            }
+
+            if (line.front() == '+') {
+                const std::string id = line.substr(1);
+                this->shard_for(id).sessions[id].last_access = now;
+            } else if (line.front() == '-') {
+                const std::string id = line.substr(1);
+                this->shard_for(id).sessions.erase(id);
+            } else if (line.front() == '=') {
+                const std::size_t tab = line.find('\t');
+                const std::size_t equals = line.find('=', tab);
+                if (tab == std::string::npos || equals == std::string::npos) {
+                    continue;
+                }
+
+                const std::string id = line.substr(1, tab - 1);
+                auto& e = this->shard_for(id).sessions[id];
+                e.last_access = now;
+                e.data[line.substr(tab + 1, equals - tab - 1)] = line.substr(equals + 1);
+            }
+        }
+
+        file.close();
+        this->compact_log();
+    }
+}
+
+inline void limhamn::http::server::memory_session_store::compact_log() {
+    const std::string tmp = this->settings.persistence_path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::trunc | std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("failed to open session log (compact_log()): " + tmp);
+        }
+
+        for (auto& s : this->shards) {
+            for (const auto& [id, e] : s->sessions) {
+                file << "+" << id << "\n";
+                for (const auto& [key, value] : e.data) {
+                    file << "=" << id << "\t" << key << "=" << value << "\n";
+                }
+            }
+        }
+    }
+
+    std::filesystem::rename(tmp, this->settings.persistence_path);
+}
+
+inline std::string_view limhamn::http::server::route_params::get(const std::string_view name) const {
+    for (std::size_t i = 0; i < this->count; ++i) {
+        if (this->params[i].first == name) {
+            return this->params[i].second;
+        }
+    }
+
+    return {};
+}
+
+inline std::string_view limhamn::http::server::route_params::operator[](const std::string_view name) const {
+    return this->get(name);
+}
+
+inline std::size_t limhamn::http::server::route_params::size() const {
+    return this->count;
+}
+
+inline const std::pair<std::string_view, std::string_view>& limhamn::http::server::route_params::at(const std::size_t index) const {
+    if (index >= this->count) {
+        throw std::out_of_range{"route_params::at: index out of range"};
+    }
+
+    return this->params[index];
+}
+
+inline std::uint64_t limhamn::http::server::router::hash_segment(const std::uint32_t parent, const std::string_view segment) {
+    std::uint64_t hash = 14695981039346656037ULL ^ parent;
+    for (const char c : segment) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+inline limhamn::http::server::router& limhamn::http::server::router::add(const std::string_view method, std::string_view pattern, handler callback) {
+    if (this->compiled) {
+        throw std::logic_error{"router::add: routes cannot be added after the router has been compiled"};
+    }
+    if (pattern.empty() || pattern.front() != '/') {
+        throw std::invalid_argument{"router::add: pattern must start with '/'"};
+    }
+
+    const std::string_view full_pattern = pattern;
+    std::uint32_t current = 0;
+    std::vector<std::string> param_names{};
+
+    while (!pattern.empty()) {
+        pattern.remove_prefix(1);
+        const std::size_t end = pattern.find('/');
+        const std::string_view segment = pattern.substr(0, end);
+        pattern = end == std::string_view::npos ? std::string_view{} : pattern.substr(end);
+
+        if (segment.empty()) {
+            continue;
+        }
+
+        if (segment.front() == '*') {
+            if (!pattern.empty() && pattern != "/") {
+                throw std::invalid_argument{"router::add: wildcard must be the last segment"};
+            }
+
+            param_names.emplace_back(segment.size() == 1 ? "*" : segment.substr(1));
+            if (this->nodes[current].wildcard == none) {
+                this->nodes[current].wildcard = static_cast<std::uint32_t>(this->nodes.size());
+                this->nodes.push_back({.segment = "*", .parent = current});
+            }
+            current = this->nodes[current].wildcard;
+            break;
+        }
+
+        if (segment.front() == '{') {
+            if (segment.size() < 3 || segment.back() != '}') {
+                throw std::invalid_argument{"router::add: invalid parameter segment"};
+            }
+
+            param_names.emplace_back(segment.substr(1, segment.size() - 2));
+            if (this->nodes[current].param == none) {
+                this->nodes[current].param = static_cast<std::uint32_t>(this->nodes.size());
+                this->nodes.push_back({.segment = "{}", .parent = current});
+            }
+            current = this->nodes[current].param;
+            continue;
+        }
+
+        std::uint32_t next = none;
+        for (const auto& child : this->nodes[current].children) {
+            if (this->nodes[child].segment == segment) {
+                next = child;
+                break;
+            }
+        }
+        if (next == none) {
+            next = static_cast<std::uint32_t>(this->nodes.size());
+            this->nodes[current].children.push_back(next);
+            this->nodes.push_back({.segment = std::string(segment), .parent = current});
+        }
+        current = next;
+    }
+
+    if (param_names.size() > route_params::max_params) {
+        throw std::invalid_argument{"router::add: too many parameters in pattern"};
+    }
+
+    for (const auto& it : this->nodes[current].routes) {
+        if (it.method == method) {
+            throw std::invalid_argument{"router::add: route already exists"};
+        }
+    }
+
+    this->nodes[current].routes.push_back({std::string(method), std::move(callback), std::move(param_names), std::string(full_pattern)});
+    return *this;
+}
+
+inline limhamn::http::server::router& limhamn::http::server::router::get(const std::string_view pattern, handler callback) {
+    return this->add("GET", pattern, std::move(callback));
+}
+
+inline limhamn::http::server::router& limhamn::http::server::router::post(const std::string_view pattern, handler callback) {
+    return this->add("POST", pattern, std::move(callback));
+}
+
+inline limhamn::http::server::router& limhamn::http::server::router::put(const std::string_view pattern, handler callback) {
+    return this->add("PUT", pattern, std::move(callback));
+}
+
+inline limhamn::http::server::router& limhamn::http::server::router::del(const std::string_view pattern, handler callback) {
+    return this->add("DELETE", pattern, std::move(callback));
+}
+
+inline limhamn::http::server::router& limhamn::http::server::router::set_not_found(fallback callback) {
+    this->not_found = std::move(callback);
+    return *this;
+}
+
+inline limhamn::http::server::router& limhamn::http::server::router::set_method_not_allowed(fallback callback) {
+    this->method_not_allowed = std::move(callback);
+    return *this;
+}
+
+inline void limhamn::http::server::router::compile() {
+    if (this->compiled) {
+        return;
+    }
+
+    std::size_t statics = 0;
+    for (const auto& it : this->nodes) {
+        statics += it.children.size();
+    }
+
+    std::size_t size = 16;
+    while (size < statics * 2) {
+        size <<= 1;
+    }
+
+    this->table.assign(size, slot{});
+    this->mask = size - 1;
+
+    for (std::uint32_t parent = 0; parent < this->nodes.size(); ++parent) {
+        for (const auto& child : this->nodes[parent].children) {
+            const std::uint64_t hash = hash_segment(parent, this->nodes[child].segment);
+            std::uint64_t index = hash & this->mask;
+            while (this->table[index].child != none) {
+                index = (index + 1) & this->mask;
+            }
+            this->table[index] = {hash, parent, child};
+        }
+        this->nodes[parent].children.clear();
+        this->nodes[parent].children.shrink_to_fit();
+    }
+
+    this->compiled = true;
+}
+
+inline std::uint32_t limhamn::http::server::router::find_static(const std::uint32_t parent, const std::string_view segment) const {
+    const std::uint64_t hash = hash_segment(parent, segment);
+    for (std::uint64_t index = hash & this->mask; this->table[index].child != none; index = (index + 1) & this->mask) {
+        const auto& it = this->table[index];
+        if (it.hash == hash && it.parent == parent && this->nodes[it.child].segment == segment) {
+            return it.child;
+        }
+    }
+
+    return none;
+}
+
+inline const limhamn::http::server::router::route* limhamn::http::server::router::select(const std::uint32_t current, const std::string_view method) const {
+    const route* fallback_route = nullptr;
+    for (const auto& it : this->nodes[current].routes) {
+        if (it.method == method) {
+            return &it;
+        }
+        if (it.method == "*" || (method == "HEAD" && it.method == "GET")) {
+            fallback_route = &it;
+        }
+    }
+
+    return fallback_route;
+}
+
+inline bool limhamn::http::server::router::accepts(const std::uint32_t current, const std::string_view method) const {
+    // an empty method matches any node with routes, to find the path for a 405
+    return method.empty() ? !this->nodes[current].routes.empty() : this->select(current, method) != nullptr;
+}
+
+inline std::uint32_t limhamn::http::server::router::match(const std::uint32_t current, std::string_view path, const std::string_view method, std::array<std::string_view, route_params::max_params>& values, const std::size_t depth) const {
+    while (!path.empty() && path.front() == '/') {
+        path.remove_prefix(1);
+    }
+
+    if (path.empty()) {
+        if (this->accepts(current, method)) {
+            return current;
+        }
+        // a trailing wildcard also matches an empty remainder
+        const std::uint32_t wildcard = this->nodes[current].wildcard;
+        if (wildcard != none && depth < route_params::max_params && this->accepts(wildcard, method)) {
+            values[depth] = {};
+            return wildcard;
+        }
+        return none;
+    }
+
+    const std::size_t end = path.find('/');
+    const std::string_view segment = path.substr(0, end);
+    const std::string_view rest = end == std::string_view::npos ? std::string_view{} : path.substr(end);
+
+    // static segments first, then parameters, backtracking only when a more specific branch dead-ends
+    if (const std::uint32_t next = this->find_static(current, segment); next != none) {
+        if (const std::uint32_t found = this->match(next, rest, method, values, depth); found != none) {
+            return found;
+        }
+    }
+
+    if (const std::uint32_t next = this->nodes[current].param; next != none && depth < route_params::max_params) {
+        values[depth] = segment;
+        if (const std::uint32_t found = this->match(next, rest, method, values, depth + 1); found != none) {
+            return found;
+        }
+    }
+
+    if (const std::uint32_t next = this->nodes[current].wildcard; next != none && depth < route_params::max_params && this->accepts(next, method)) {
+        values[depth] = path;
+        return next;
+    }
+
+    return none;
+}
+
+inline limhamn::http::server::response limhamn::http::server::router::dispatch(const request_view& request) {
+    if (!this->compiled) {
+        throw std::logic_error{"router::dispatch: the router must be compiled before dispatching"};
+    }
+
+    const std::string_view method = request.method();
+    std::array<std::string_view, route_params::max_params> values{};
+    std::uint32_t found = this->match(0, request.endpoint(), method, values, 0);
+    // no route accepts the method, so find the path regardless of method to tell a 404 from a 405
+    if (found == none && !method.empty()) {
+        found = this->match(0, request.endpoint(), {}, values, 0);
+    }
+
+    if (found == none) {
+        if (this->not_found) {
+            return this->not_found(request);
+        }
+
+        response res{};
+        res.http_status = 404;
+        res.content_type = "text/plain";
+        res.body = "Not Found";
+        return res;
+    }
+
+    const route* selected = this->select(found, method);
+    if (selected == nullptr) {
+        if (this->method_not_allowed) {
+            return this->method_not_allowed(request);
+        }
+
+        std::string allow{};
+        for (const auto& it : this->nodes[found].routes) {
+            allow += allow.empty() ? it.method : ", " + it.method;
+        }
+
+        response res{};
+        res.http_status = 405;
+        res.content_type = "text/plain";
+        res.body = "Method Not Allowed";
+        res.headers.push_back({"Allow", allow});
+        return res;
+    }
+
+    _limhamn_http_server_impl::current_route = selected->pattern;
+
+    route_params params{};
+    params.count = selected->param_names.size();
+    for (std::size_t i = 0; i < params.count; ++i) {
+        params.params[i] = {selected->param_names[i], values[i]};
+    }
+
+    return selected->callback(request, params);
+}
+
+inline limhamn::http::server::response limhamn::http::server::router::operator()(const request_view& request) {
+    return this->dispatch(request);
+}
+#ifdef LIMHAMN_LOGGER
+inline std::function<void(const limhamn::http::server::access_record&)> limhamn::http::server::make_access_log(const limhamn::logger::logger& log) {
+    return [&log](const access_record& record) {
+        log.log(limhamn::logger::type::access, "{} {} {}", record.method, record.target, record.status,
+            limhamn::logger::field{"ip", record.ip_address},
+            limhamn::logger::field{"bytes_sent", record.bytes_sent},
+            limhamn::logger::field{"duration_us", record.duration},
+            limhamn::logger::field{"user_agent", record.user_agent});
+    };
+}
+#endif
 #endif // LIMHAMN_HTTP_SERVER_IMPL
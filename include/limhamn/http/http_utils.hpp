@@ -12,8 +12,19 @@
 #include <vector>
 #include <unordered_map>
 #include <random>
+#include <string_view>
+#include <functional>
+#include <fstream>
 #ifdef LIMHAMN_HTTP_UTILS_IMPL
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <array>
+#include <cstring>
 #include <openssl/evp.h>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
 #endif
 
 #define LIMHAMN_HTTP_UTILS
@@ -61,12 +72,154 @@ namespace limhamn::http::utils {
         std::size_t size{};
     };
 
+    /**
+     * @brief  Headers of a single part in a multipart body.
+     */
+    struct multipart_part {
+        std::string name{};
+        std::string filename{};
+        std::string content_type{};
+    };
+
+    /**
+     * @brief  Incremental multipart/form-data parser.
+     * @note   The body can be fed in chunks of any size as it arrives. Part data is passed to the callbacks as it
+     *         is parsed, so memory use is bounded by the chunk size plus the size of the part headers.
+     */
+    class multipart_parser {
+        public:
+            std::function<void(const multipart_part&)> on_part_begin{};
+            std::function<void(const char*, std::size_t)> on_part_data{};
+            std::function<void()> on_part_end{};
+
+            /**
+             * @brief  Constructor for the multipart_parser class
+             * @param  boundary The boundary, without the leading dashes
+             * @param  max_header_size The max size of the headers of a single part
+             * @throws std::invalid_argument if the boundary is empty
+             */
+            explicit multipart_parser(const std::string& boundary, std::size_t max_header_size = 16384);
+            /**
+             * @brief  Get the boundary from a Content-Type header value.
+             * @param  content_type The value of the Content-Type header, e.g. "multipart/form-data; boundary=abc"
+             * @return std::string, empty if there is no boundary
+             */
+            static std::string get_boundary(std::string_view content_type);
+            /**
+             * @brief  Feed a chunk of the body to the parser.
+             * @param  data The data
+             * @param  size The size of the data
+             * @throws std::runtime_error if the body is malformed
+             */
+            void feed(const char* data, std::size_t size);
+            /**
+             * @brief  Check whether the closing boundary has been parsed.
+             * @return bool
+             */
+            [[nodiscard]] bool done() const;
+        private:
+            enum class state {
+                preamble,
+                boundary,
+                headers,
+                body,
+                epilogue,
+            };
+
+            std::string delimiter{};
+            std::string buffer{};
+            std::size_t max_header_size{};
+            state current{state::preamble};
+            multipart_part part{};
+
+            void parse_headers(std::string_view headers);
+    };
+
+    /**
+     * @brief  Writes the file parts of a multipart/form-data body to disk as it arrives.
+     * @note   Each file is hashed while it is written, so nothing is read back or held in memory.
+     */
+    class multipart_writer {
+        public:
+            /**
+             * @brief  Constructor for the multipart_writer class
+             * @param  boundary The boundary, without the leading dashes
+             * @param  format The format used to get the output file. %f is replaced by the field name, %h is replaced by the sha256 hash of the file contents, %r is replaced by a random string.
+             * @param  max_file_size The max size of each file. If the file is larger, it is removed and skipped.
+             * @param  max_field_size The max size of each part without a filename, which are kept in memory as fields instead.
+             * @param  fields_to_disk Whether to write parts without a filename to disk like files, instead of keeping them as fields.
+             */
+            multipart_writer(const std::string& boundary, std::string format, std::size_t max_file_size = 100000000, std::size_t max_field_size = 512, bool fields_to_disk = false);
+            ~multipart_writer();
+            multipart_writer(const multipart_writer&) = delete;
+            multipart_writer& operator=(const multipart_writer&) = delete;
+
+            /**
+             * @brief  Feed a chunk of the body to the writer.
+             * @param  data The data
+             * @param  size The size of the data
+             * @throws std::runtime_error if the body is malformed
+             */
+            void write(const char* data, std::size_t size);
+            /**
+             * @brief  Finish writing. Removes a file that was left incomplete by a truncated body.
+             * @return bool, true if the whole body was parsed
+             */
+            bool finish();
+            /**
+             * @brief  Check whether a part was skipped because it was larger than max_file_size or max_field_size.
+             * @return bool
+             */
+            [[nodiscard]] bool oversized() const;
+            /**
+             * @brief  Get the files that were written.
+             * @return const std::vector<multipart_file>&
+             */
+            [[nodiscard]] const std::vector<multipart_file>& get_files() const;
+            /**
+             * @brief  Get the parts without a filename.
+             * @return const std::unordered_map<std::string, std::string>&
+             */
+            [[nodiscard]] const std::unordered_map<std::string, std::string>& get_fields() const;
+        private:
+            multipart_parser parser;
+            std::string format{};
+            std::size_t max_file_size{};
+            std::size_t max_field_size{};
+            bool fields_to_disk{false};
+
+            std::vector<multipart_file> files{};
+            std::unordered_map<std::string, std::string> fields{};
+
+            multipart_file file{};
+            std::string pending_path{};
+            std::string field{};
+            std::ofstream output{};
+            void* hash_context{nullptr};
+            bool writing_file{false};
+            bool writing_field{false};
+            bool skipping{false};
+            bool too_large{false};
+
+            void begin(const multipart_part& part);
+            void data(const char* data, std::size_t size);
+            void end();
+            void discard();
+    };
+
     /**
      * @brief Parse the request body into a map of fields.
      * @param body The request body.
      * @return std::unordered_map<std::string, std::string>
      */
     std::unordered_map<std::string, std::string> parse_fields(const std::string& body);
+    /**
+     * @brief Call a function for every key=value pair of a request body or query string, without copying.
+     * @param body The body, e.g. "a=1&b=2". Pairs without '=' are skipped.
+     * @param callback The function to call with the key and value, as std::string_views into body.
+     */
+    template <typename F>
+    void for_each_field(std::string_view body, F&& callback);
     /**
      * @brief Parse the query string into a map of fields.
      * @param url The URL to parse.
@@ -79,24 +232,48 @@ namespace limhamn::http::utils {
      * @return std::string
      */
     std::string htmlspecialchars(const std::string& str);
+    /**
+     * @brief  Function that replaces certain special characters with the matching HTML entity, appending the result.
+     * @param  str The string to replace in.
+     * @param  out The string to append to. Reuse it between calls to avoid allocating.
+     */
+    void htmlspecialchars(std::string_view str, std::string& out);
     /**
      * @brief  Function that replaces certain HTML entices with the matching special characters. Same behavior as PHP's htmlspecialchars_decode function.
      * @param  str The string to replace in.
      * @return std::string
      */
     std::string htmlspecialchars_decode(const std::string& str);
+    /**
+     * @brief  Function that replaces certain HTML entities with the matching special characters, appending the result.
+     * @param  str The string to replace in.
+     * @param  out The string to append to.
+     */
+    void htmlspecialchars_decode(std::string_view str, std::string& out);
     /**
      * @brief  Function that URL encodes a string.
      * @param  str The string to encode.
      * @return std::string
      */
     std::string urlencode(const std::string& str);
+    /**
+     * @brief  Function that URL encodes a string, appending the result.
+     * @param  str The string to encode.
+     * @param  out The string to append to.
+     */
+    void urlencode(std::string_view str, std::string& out);
     /**
      * @brief  Function that URL decodes a string.
      * @param  str The string to decode.
      * @return std::string
      */
     std::string urldecode(const std::string& str);
+    /**
+     * @brief  Function that URL decodes a string, appending the result.
+     * @param  str The string to decode.
+     * @param  out The string to append to.
+     */
+    void urldecode(std::string_view str, std::string& out);
     /**
      * @brief  Function that removes single and double quotes from a std::string.
      * @param  str The string to replace in.
@@ -112,9 +289,10 @@ namespace limhamn::http::utils {
     /**
      * @brief  Function that parses a multipart body, getting file data.
      * @param  request The body to parse.
-     * @param  format The format used to get the output file. %f is replaced by the file name, %h is replaced by the file name sha256 hash, %r is replaced by a random string.
+     * @param  format The format used to get the output file. %f is replaced by the field name, %h is replaced by the sha256 hash of the file contents, %r is replaced by a random string.
      * @param  max_chunk_size The max size of each chunk. If the chunk is larger, the file is rejected.
      * @note   request must contain a Content-Type header. If you're using http_server.hpp, pass in the request.raw_body.
+     * @note   The whole body has to be in memory. Use multipart_writer to write uploads to disk as they arrive instead.
      * @return std::vector<snet::Utils::multipart_file>
      */
     std::vector<multipart_file> parse_multipart_form_file(const std::string& request, const std::string& format, const std::size_t max_chunk_size = 100000000);
@@ -138,32 +316,157 @@ namespace limhamn::http::utils {
      * @return std::string
      */
     std::string sha256hash(const std::string& data);
+    /**
+     * @brief  Encode data as lower case hexadecimal.
+     * @param  data The data to encode.
+     * @return std::string
+     */
+    std::string to_hex(std::string_view data);
+    /**
+     * @brief  Encode data as lower case hexadecimal, appending the result.
+     * @param  data The data to encode.
+     * @param  out The string to append to.
+     */
+    void to_hex(std::string_view data, std::string& out);
 }
 
 #ifdef LIMHAMN_HTTP_UTILS_IMPL
-inline std::unordered_map<std::string, std::string> limhamn::http::utils::parse_fields(const std::string& _body) {
-    std::string body = _body;
+/**
+ * @brief Scanning kernels for the string functions. Each returns the index of the first byte that needs work, or size.
+ * @note SSE2 (always there on x86-64) and AVX2 if the compiler targets it, and a table elsewhere.
+ *       The vector loops do the bulk; the table handles the tail and any other target.
+ */
+namespace _limhamn_http_utils_impl {
+    inline constexpr std::array<bool, 256> make_table(const char* characters, const bool invert) {
+        std::array<bool, 256> ret{};
+        for (auto& it : ret) {
+            it = invert;
+        }
+        for (; *characters != '\0'; ++characters) {
+            ret[static_cast<unsigned char>(*characters)] = !invert;
+        }
+        return ret;
+    }
 
-    if (!body.empty() && body.back() != '&') {
-        body += "&";
+    inline constexpr std::array<bool, 256> html_special = make_table("<>&\"'\\", false);
+    inline constexpr std::array<bool, 256> url_reserved = make_table(
+        "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz-_.~", true);
+
+    inline unsigned int first_set(const uint32_t mask) {
+#ifdef _MSC_VER
+        unsigned long ret;
+        _BitScanForward(&ret, mask);
+        return static_cast<unsigned int>(ret);
+#else
+        return static_cast<unsigned int>(__builtin_ctz(mask));
+#endif
     }
 
-    std::unordered_map<std::string, std::string> ret{};
-    std::size_t last_amp_pos = 0;
-    std::size_t amp_pos = body.find('&');
+    inline std::size_t scan(const std::array<bool, 256>& table, const char* data, const std::size_t size, std::size_t i) {
+        for (; i < size; ++i) {
+            if (table[static_cast<unsigned char>(data[i])]) {
+                return i;
+            }
+        }
+        return size;
+    }
 
-    while (amp_pos != std::string::npos) {
-        std::size_t equals_pos = body.find('=', last_amp_pos);
+    /**
+     * @brief Finds the first of < > & " ' \
+     */
+    inline std::size_t find_html_special(const char* data, const std::size_t size) {
+        std::size_t i{0};
+#if defined(__AVX2__)
+        {
+            const __m256i lt = _mm256_set1_epi8('<'), gt = _mm256_set1_epi8('>'), amp = _mm256_set1_epi8('&');
+            const __m256i quot = _mm256_set1_epi8('"'), apos = _mm256_set1_epi8('\''), bsol = _mm256_set1_epi8('\\');
+            for (; i + 32 <= size; i += 32) {
+                const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+                const __m256i hit = _mm256_or_si256(
+                    _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, lt), _mm256_cmpeq_epi8(v, gt)), _mm256_cmpeq_epi8(v, amp)),
+                    _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quot), _mm256_cmpeq_epi8(v, apos)), _mm256_cmpeq_epi8(v, bsol)));
+                if (const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit))) {
+                    return i + first_set(mask);
+                }
+            }
+        }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+        const __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>'), amp = _mm_set1_epi8('&');
+        const __m128i quot = _mm_set1_epi8('"'), apos = _mm_set1_epi8('\''), bsol = _mm_set1_epi8('\\');
+        for (; i + 16 <= size; i += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            const __m128i hit = _mm_or_si128(
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)), _mm_cmpeq_epi8(v, amp)),
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, apos)), _mm_cmpeq_epi8(v, bsol)));
+            if (const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(hit))) {
+                return i + first_set(mask);
+            }
+        }
+#endif
+        return scan(html_special, data, size, i);
+    }
 
-        if (equals_pos != std::string::npos && equals_pos < amp_pos) {
-            std::string key = body.substr(last_amp_pos, equals_pos - last_amp_pos);
-            std::string value = body.substr(equals_pos + 1, amp_pos - equals_pos - 1);
-            ret[key] = value;
+    /**
+     * @brief Finds the first byte that is not unreserved in the sense of RFC 3986, i.e. not [0-9A-Za-z-._~]
+     */
+    inline std::size_t find_url_reserved(const char* data, const std::size_t size) {
+        std::size_t i{0};
+#if defined(__SSE2__) || defined(_M_X64)
+        // x - low <= count - 1, unsigned, as min(x - low, count - 1) == x - low
+        const auto in_range = [](const __m128i v, const char low, const char count) {
+            const __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8(low));
+            return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(static_cast<char>(count - 1))), shifted);
+        };
+        for (; i + 16 <= size; i += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            const __m128i ok = _mm_or_si128(
+                _mm_or_si128(in_range(v, '0', 10), in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 26)),
+                _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')), _mm_cmpeq_epi8(v, _mm_set1_epi8('_'))),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')), _mm_cmpeq_epi8(v, _mm_set1_epi8('~')))));
+            const auto mask = static_cast<uint32_t>(_mm_movemask_epi8(ok)) ^ 0xFFFFU;
+            if (mask != 0) {
+                return i + first_set(mask);
+            }
+        }
+#endif
+        return scan(url_reserved, data, size, i);
+    }
+
+    inline int hex_value(const char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
         }
+        const char lower = static_cast<char>(c | 0x20);
+        if (lower >= 'a' && lower <= 'f') {
+            return lower - 'a' + 10;
+        }
+        return -1;
+    }
+
+    inline constexpr char hex_digits[] = "0123456789abcdef";
+}
 
-        last_amp_pos = amp_pos + 1;
-        amp_pos = body.find('&', last_amp_pos);
+template <typename F>
+inline void limhamn::http::utils::for_each_field(std::string_view body, F&& callback) {
+    while (!body.empty()) {
+        const std::size_t amp_pos = body.find('&');
+        const std::string_view pair = body.substr(0, amp_pos);
+        body = amp_pos == std::string_view::npos ? std::string_view{} : body.substr(amp_pos + 1);
+
+        const std::size_t equals_pos = pair.find('=');
+        if (equals_pos != std::string_view::npos) {
+            callback(pair.substr(0, equals_pos), pair.substr(equals_pos + 1));
+        }
     }
+}
+
+inline std::unordered_map<std::string, std::string> limhamn::http::utils::parse_fields(const std::string& body) {
+    std::unordered_map<std::string, std::string> ret{};
+
+    for_each_field(body, [&ret](const std::string_view key, const std::string_view value) {
+        ret[std::string(key)] = std::string(value);
+    });
 
     return ret;
 }
@@ -175,9 +478,7 @@ inline std::unordered_map<std::string, std::string> limhamn::http::utils::parse_
         return {};
     }
 
-    std::string req = "&" + url.substr(pos + 1);
-
-    return parse_fields(req);
+    return parse_fields(url.substr(pos + 1));
 }
 
 inline std::unordered_map<std::string, std::string> limhamn::http::utils::parse_multipart_form_data(const std::string& request, const std::size_t max_len) {
@@ -268,224 +569,519 @@ inline std::unordered_map<std::string, std::string> limhamn::http::utils::parse_
 }
 
 inline std::vector<limhamn::http::utils::multipart_file> limhamn::http::utils::parse_multipart_form_file(const std::string& request, const std::string& format, const std::size_t max_chunk_size) {
-    const auto split = [](const std::string& str, const std::string& delimiter) -> std::vector<std::string> {
-        std::vector<std::string> tokens{};
-        std::size_t start{0};
-        std::size_t end{str.find(delimiter)};
-
-        while (end != std::string::npos) {
-            tokens.push_back(str.substr(start, end - start));
-            start = end + delimiter.length();
-            end = str.find(delimiter, start);
-        }
-
-        tokens.push_back(str.substr(start, end));
-
-        return tokens;
-    };
-
-    const auto trim = [](const std::string& str) -> std::string {
-        const char* whitespace{" \t\n\r\f\v"};
-        const std::size_t start{str.find_first_not_of(whitespace)};
-        const std::size_t end{str.find_last_not_of(whitespace)};
-
-        return (start == std::string::npos) ? "" : str.substr(start, end - start + 1);
-    };
-
-    std::string boundary{};
     const std::size_t boundary_pos{request.find("boundary=")};
-    if (boundary_pos != std::string::npos) {
-        const std::size_t boundary_end{request.find("\r\n", boundary_pos)};
-
-        if (boundary_end == std::string::npos) {
-            return {};
-        }
+    if (boundary_pos == std::string::npos) {
+        return {};
+    }
 
-        boundary = "--" + request.substr(boundary_pos + 9, boundary_end - boundary_pos - 9);
+    const std::size_t boundary_end{request.find("\r\n", boundary_pos)};
+    if (boundary_end == std::string::npos) {
+        return {};
     }
 
+    const std::string boundary{multipart_parser::get_boundary(std::string_view{request}.substr(boundary_pos, boundary_end - boundary_pos))};
     if (boundary.empty()) {
         return {};
     }
 
-    const std::vector<std::string> parts{split(request, boundary)};
+    multipart_writer writer{boundary, format, max_chunk_size, 0, true};
+    try {
+        writer.write(request.data(), request.size());
+    } catch (const std::exception&) {
+        // keep whatever was written before the malformed part, as before
+    }
+    writer.finish();
+
     std::vector<multipart_file> ret;
-    for (const auto& part : parts) {
-        if (part.empty() || part == "--\r\n") {
-            continue;
+    for (const auto& file : writer.get_files()) {
+        bool new_file{true};
+        for (auto& it : ret) {
+            if (it.name == file.name) {
+                it.size += file.size;
+                new_file = false;
+                break;
+            }
         }
 
-        const std::size_t end{part.find("\r\n\r\n")};
-        if (end == std::string::npos) {
-            continue;
+        if (new_file) {
+            ret.push_back(file);
         }
+    }
 
-        const std::string headers{part.substr(0, end)};
-        const std::string content{part.substr(end + 4)};
+    return ret;
+}
 
-        multipart_file file{};
-        const std::size_t pos{headers.find("filename=")};
+inline limhamn::http::utils::multipart_parser::multipart_parser(const std::string& boundary, const std::size_t max_header_size) :
+    delimiter("\r\n--" + boundary),
+    // the first boundary has no preceding line break, so pretend there was one
+    buffer("\r\n"),
+    max_header_size(max_header_size) {
+    if (boundary.empty()) {
+        throw std::invalid_argument{"multipart_parser: boundary must not be empty"};
+    }
+}
 
-        if (pos != std::string::npos && (headers.at(pos - 1) == ' ' || headers.at(pos - 1) == ';')) {
-            const std::size_t filename_start{headers.find('"', pos) + 1};
-            const std::size_t filename_end{headers.find('"', filename_start)};
+inline std::string limhamn::http::utils::multipart_parser::get_boundary(const std::string_view content_type) {
+    const std::size_t pos{content_type.find("boundary=")};
+    if (pos == std::string_view::npos) {
+        return {};
+    }
 
-            if (filename_start != std::string::npos && filename_end != std::string::npos) {
-                file.filename = headers.substr(filename_start, filename_end - filename_start);
-                file.filename.erase(std::remove_if(file.filename.begin(), file.filename.end(), [](const char c) {
-                    return c == '/' || c == '\\';
-                }), file.filename.end());
-            }
-        }
+    std::string_view boundary{content_type.substr(pos + 9)};
+    if (!boundary.empty() && boundary.front() == '"') {
+        boundary.remove_prefix(1);
+        boundary = boundary.substr(0, boundary.find('"'));
+    } else {
+        boundary = boundary.substr(0, boundary.find_first_of("; \t\r\n"));
+    }
 
-        std::size_t pos2{headers.find(" name=")};
-        if (pos2 == std::string::npos) {
-            pos2 = headers.find(";name=");
-        }
-        if (pos2 != std::string::npos) {
-            std::size_t name_start{headers.find('"', pos2) + 1};
-            std::size_t name_end{headers.find('"', name_start)};
+    return std::string{boundary};
+}
+
+inline bool limhamn::http::utils::multipart_parser::done() const {
+    return this->current == state::epilogue;
+}
 
-            if (name_start != std::string::npos && name_end != std::string::npos) {
-                file.name = headers.substr(name_start, name_end - name_start);
+inline void limhamn::http::utils::multipart_parser::parse_headers(const std::string_view headers) {
+    const auto get_parameter = [](const std::string_view line, const std::string_view key) -> std::string {
+        std::size_t pos{0};
+        while ((pos = line.find(key, pos)) != std::string_view::npos) {
+            if (pos == 0 || line[pos - 1] == ' ' || line[pos - 1] == ';' || line[pos - 1] == '\t') {
+                break;
             }
+            pos += key.size();
+        }
+        if (pos == std::string_view::npos) {
+            return {};
         }
 
-        if (file.name.empty()) {
-            continue;
+        std::string_view value{line.substr(pos + key.size())};
+        if (!value.empty() && value.front() == '"') {
+            value.remove_prefix(1);
+            return std::string{value.substr(0, value.find('"'))};
         }
 
-        file.path = format;
-        file.sha256 = limhamn::http::utils::sha256hash(file.name);
+        return std::string{value.substr(0, value.find(';'))};
+    };
 
-        while (file.path.find("%f") != std::string::npos) {
-            file.path.replace(file.path.find("%f"), 2, file.name);
+    const auto starts_with = [](const std::string_view line, const std::string_view prefix) {
+        if (line.size() < prefix.size()) {
+            return false;
         }
-        while (file.path.find("%h") != std::string::npos) {
-            file.path.replace(file.path.find("%h"), 2, file.sha256);
+        for (std::size_t i{0}; i < prefix.size(); ++i) {
+            if (std::tolower(static_cast<unsigned char>(line[i])) != prefix[i]) {
+                return false;
+            }
         }
-        while (file.path.find("%r") != std::string::npos) {
-            file.path.replace(file.path.find("%r"), 2, limhamn::http::utils::generate_random_string(64));
+        return true;
+    };
+
+    this->part = multipart_part{};
+
+    std::string_view rest{headers};
+    while (!rest.empty()) {
+        const std::size_t end{rest.find("\r\n")};
+        const std::string_view line{rest.substr(0, end)};
+        rest = end == std::string_view::npos ? std::string_view{} : rest.substr(end + 2);
+
+        if (starts_with(line, "content-disposition:")) {
+            this->part.name = get_parameter(line, "name=");
+            this->part.filename = get_parameter(line, "filename=");
+            this->part.filename.erase(std::remove_if(this->part.filename.begin(), this->part.filename.end(), [](const char c) {
+                return c == '/' || c == '\\';
+            }), this->part.filename.end());
+        } else if (starts_with(line, "content-type:")) {
+            std::string_view value{line.substr(13)};
+            while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+                value.remove_prefix(1);
+            }
+            this->part.content_type = std::string{value};
         }
+    }
+}
 
-        std::ofstream of{file.path};
+inline void limhamn::http::utils::multipart_parser::feed(const char* data, const std::size_t size) {
+    this->buffer.append(data, size);
 
-        if (!of.is_open()) {
-            continue;
-        }
+    std::size_t consumed{0};
+    for (;;) {
+        const std::string_view view{std::string_view{this->buffer}.substr(consumed)};
 
-        std::string data{trim(content)};
-        file.size = data.size();
+        if (this->current == state::preamble || this->current == state::body) {
+            const std::size_t pos{view.find(this->delimiter)};
+            if (pos == std::string_view::npos) {
+                // keep enough to recognize a delimiter split across two chunks
+                const std::size_t keep{std::min(view.size(), this->delimiter.size() - 1)};
+                if (this->current == state::body && view.size() > keep && this->on_part_data) {
+                    this->on_part_data(view.data(), view.size() - keep);
+                }
+                consumed += view.size() - keep;
+                break;
+            }
 
-        if (file.size > max_chunk_size) {
-            of.close();
-            std::filesystem::remove(file.path);
-            continue;
-        }
+            if (this->current == state::body) {
+                if (pos > 0 && this->on_part_data) {
+                    this->on_part_data(view.data(), pos);
+                }
+                if (this->on_part_end) {
+                    this->on_part_end();
+                }
+            }
 
-        of << data;
-        of.close();
+            consumed += pos + this->delimiter.size();
+            this->current = state::boundary;
+        } else if (this->current == state::boundary) {
+            // transport padding may follow the boundary before the line break
+            const std::size_t pos{view.find_first_not_of(" \t")};
+            if (pos == std::string_view::npos || view.size() < pos + 2) {
+                break;
+            }
 
-        if (!file.name.empty() && !data.empty()) {
-            bool new_file{true};
-            for (auto& it : ret) {
-                if (it.name == file.name) {
-                    it.size += file.size;
-                    new_file = false;
-                    break;
+            if (view.substr(pos, 2) == "--") {
+                consumed = this->buffer.size();
+                this->current = state::epilogue;
+            } else if (view.substr(pos, 2) == "\r\n") {
+                consumed += pos + 2;
+                this->current = state::headers;
+            } else {
+                throw std::runtime_error{"multipart_parser: malformed boundary"};
+            }
+        } else if (this->current == state::headers) {
+            const std::size_t pos{view.find("\r\n\r\n")};
+            if (pos == std::string_view::npos) {
+                if (view.size() > this->max_header_size) {
+                    throw std::runtime_error{"multipart_parser: part headers too large"};
                 }
+                break;
             }
 
-            if (new_file) {
-                ret.push_back(file);
+            this->parse_headers(view.substr(0, pos));
+            consumed += pos + 4;
+            this->current = state::body;
+
+            if (this->on_part_begin) {
+                this->on_part_begin(this->part);
             }
+        } else {
+            consumed = this->buffer.size();
+            break;
         }
     }
 
-    return ret;
+    this->buffer.erase(0, consumed);
 }
 
-inline std::string limhamn::http::utils::htmlspecialchars(const std::string& str) {
-    std::string ret{str};
+inline limhamn::http::utils::multipart_writer::multipart_writer(const std::string& boundary, std::string format, const std::size_t max_file_size, const std::size_t max_field_size, const bool fields_to_disk) :
+    parser(boundary),
+    format(std::move(format)),
+    max_file_size(max_file_size),
+    max_field_size(max_field_size),
+    fields_to_disk(fields_to_disk) {
+    this->parser.on_part_begin = [this](const multipart_part& part) { this->begin(part); };
+    this->parser.on_part_data = [this](const char* data, const std::size_t size) { this->data(data, size); };
+    this->parser.on_part_end = [this]() { this->end(); };
+}
+
+inline limhamn::http::utils::multipart_writer::~multipart_writer() {
+    this->discard();
+}
+
+inline void limhamn::http::utils::multipart_writer::discard() {
+    if (this->writing_file) {
+        this->output.close();
+        std::error_code ec;
+        std::filesystem::remove(this->file.path, ec);
+        this->writing_file = false;
+    }
+
+    if (this->hash_context != nullptr) {
+        EVP_MD_CTX_free(static_cast<EVP_MD_CTX*>(this->hash_context));
+        this->hash_context = nullptr;
+    }
+}
+
+inline void limhamn::http::utils::multipart_writer::begin(const multipart_part& part) {
+    this->writing_file = false;
+    this->writing_field = false;
+    this->skipping = false;
+
+    if (part.name.empty()) {
+        this->skipping = true;
+        return;
+    }
+
+    if (part.filename.empty() && !this->fields_to_disk) {
+        this->writing_field = true;
+        this->field.clear();
+        this->file = multipart_file{};
+        this->file.name = part.name;
+        return;
+    }
+
+    this->file = multipart_file{};
+    this->file.name = part.name;
+    this->file.filename = part.filename;
+    this->pending_path = this->format;
+
+    while (this->pending_path.find("%f") != std::string::npos) {
+        this->pending_path.replace(this->pending_path.find("%f"), 2, this->file.name);
+    }
+    while (this->pending_path.find("%r") != std::string::npos) {
+        this->pending_path.replace(this->pending_path.find("%r"), 2, limhamn::http::utils::generate_random_string(64));
+    }
+
+    this->file.path = this->pending_path;
+    // the hash is only known once the file is complete, so write to a temporary name and rename it afterwards
+    if (this->file.path.find("%h") != std::string::npos) {
+        const std::string temporary{"tmp-" + limhamn::http::utils::generate_random_string(16)};
+        while (this->file.path.find("%h") != std::string::npos) {
+            this->file.path.replace(this->file.path.find("%h"), 2, temporary);
+        }
+        this->file.path += ".part";
+    }
+
+    this->output.open(this->file.path, std::ios::binary | std::ios::trunc);
+    if (!this->output.is_open()) {
+        this->skipping = true;
+        return;
+    }
+
+    EVP_MD_CTX* context = EVP_MD_CTX_new();
+    if (context == nullptr || !EVP_DigestInit_ex(context, EVP_sha256(), nullptr)) {
+        EVP_MD_CTX_free(context);
+        this->output.close();
+        std::error_code ec;
+        std::filesystem::remove(this->file.path, ec);
+        this->skipping = true;
+        return;
+    }
+
+    this->hash_context = context;
+    this->writing_file = true;
+}
+
+inline void limhamn::http::utils::multipart_writer::data(const char* data, const std::size_t size) {
+    if (this->skipping) {
+        return;
+    }
+
+    if (this->writing_field) {
+        if (this->field.size() + size > this->max_field_size) {
+            this->writing_field = false;
+            this->skipping = true;
+            this->too_large = true;
+            return;
+        }
+        this->field.append(data, size);
+        return;
+    }
+
+    if (!this->writing_file) {
+        return;
+    }
 
-    for (std::size_t i{0}; i < ret.length(); i++) {
-        if (ret.at(i) == '<') {
-            ret.replace(i, 1, "&lt;");
-        } else if (ret.at(i) == '>') {
-            ret.replace(i, 1, "&gt;");
-        } else if (ret.at(i) == '&') {
-            ret.replace(i, 1, "&amp;");
-        } else if (ret.at(i) == '"') {
-            ret.replace(i, 1, "&quot;");
-        } else if (ret.at(i) == '\'') {
-            ret.replace(i, 1, "&apos;");
-        } else if (ret.at(i) == '\\') {
-            ret.replace(i, 1, "&bsol;");
+    if (this->file.size + size > this->max_file_size) {
+        this->discard();
+        this->skipping = true;
+        this->too_large = true;
+        return;
+    }
+
+    this->output.write(data, static_cast<std::streamsize>(size));
+    EVP_DigestUpdate(static_cast<EVP_MD_CTX*>(this->hash_context), data, size);
+    this->file.size += size;
+}
+
+inline void limhamn::http::utils::multipart_writer::end() {
+    if (this->writing_field) {
+        this->fields[this->file.name] = this->field;
+        this->writing_field = false;
+        return;
+    }
+
+    if (!this->writing_file) {
+        return;
+    }
+
+    this->output.close();
+
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int len{0};
+    if (EVP_DigestFinal_ex(static_cast<EVP_MD_CTX*>(this->hash_context), hash, &len)) {
+        static constexpr char hex[] = "0123456789abcdef";
+        this->file.sha256.resize(len * 2);
+        for (unsigned int i{0}; i < len; ++i) {
+            this->file.sha256[i * 2] = hex[hash[i] >> 4];
+            this->file.sha256[i * 2 + 1] = hex[hash[i] & 0xF];
+        }
+    }
+    EVP_MD_CTX_free(static_cast<EVP_MD_CTX*>(this->hash_context));
+    this->hash_context = nullptr;
+    this->writing_file = false;
+
+    if (this->file.size == 0) {
+        std::error_code ec;
+        std::filesystem::remove(this->file.path, ec);
+        return;
+    }
+
+    if (this->pending_path.find("%h") != std::string::npos) {
+        std::string path{this->pending_path};
+        while (path.find("%h") != std::string::npos) {
+            path.replace(path.find("%h"), 2, this->file.sha256);
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(this->file.path, path, ec);
+        if (ec) {
+            std::filesystem::remove(this->file.path, ec);
+            return;
+        }
+        this->file.path = path;
+    }
+
+    this->files.push_back(this->file);
+}
+
+inline void limhamn::http::utils::multipart_writer::write(const char* data, const std::size_t size) {
+    this->parser.feed(data, size);
+}
+
+inline bool limhamn::http::utils::multipart_writer::finish() {
+    this->discard();
+    return this->parser.done();
+}
+
+inline bool limhamn::http::utils::multipart_writer::oversized() const {
+    return this->too_large;
+}
+
+inline const std::vector<limhamn::http::utils::multipart_file>& limhamn::http::utils::multipart_writer::get_files() const {
+    return this->files;
+}
+
+inline const std::unordered_map<std::string, std::string>& limhamn::http::utils::multipart_writer::get_fields() const {
+    return this->fields;
+}
+
+inline void limhamn::http::utils::htmlspecialchars(const std::string_view str, std::string& out) {
+    const char* data = str.data();
+    const std::size_t size = str.size();
+
+    // one reservation that fits typical markup; escape-heavy input grows geometrically from there
+    out.reserve(out.size() + size + size / 8 + 16);
+
+    std::size_t pos{0};
+    while (pos < size) {
+        const std::size_t next = pos + _limhamn_http_utils_impl::find_html_special(data + pos, size - pos);
+        out.append(data + pos, next - pos);
+        if (next == size) {
+            break;
         }
+
+        switch (data[next]) {
+            case '<': out.append("&lt;", 4); break;
+            case '>': out.append("&gt;", 4); break;
+            case '&': out.append("&amp;", 5); break;
+            case '"': out.append("&quot;", 6); break;
+            case '\'': out.append("&apos;", 6); break;
+            default: out.append("&bsol;", 6); break;
+        }
+        pos = next + 1;
     }
+}
 
+inline std::string limhamn::http::utils::htmlspecialchars(const std::string& str) {
+    std::string ret{};
+    htmlspecialchars(std::string_view{str}, ret);
     return ret;
 }
 
-inline std::string limhamn::http::utils::urldecode(const std::string& str) {
-    std::string ret;
-    ret.reserve(str.length());
-
-    for (std::size_t i = 0; i < str.length(); ++i) {
-        if (str[i] == '%' && i + 2 < str.length()) {
-            std::istringstream iss(str.substr(i + 1, 2));
-            int hex_value;
-            if (iss >> std::hex >> hex_value) {
-                ret += static_cast<char>(hex_value);
-                i += 2;
-            } else {
-                ret += '%';
-            }
+inline void limhamn::http::utils::urldecode(const std::string_view str, std::string& out) {
+    out.reserve(out.size() + str.size());
+
+    std::size_t pos{0};
+    while (pos < str.size()) {
+        const void* found = std::memchr(str.data() + pos, '%', str.size() - pos);
+        const std::size_t next = found == nullptr ? str.size() : static_cast<std::size_t>(static_cast<const char*>(found) - str.data());
+        out.append(str.data() + pos, next - pos);
+        if (next == str.size()) {
+            break;
+        }
+
+        const int high = next + 2 < str.size() ? _limhamn_http_utils_impl::hex_value(str[next + 1]) : -1;
+        const int low = high != -1 ? _limhamn_http_utils_impl::hex_value(str[next + 2]) : -1;
+        if (low != -1) {
+            out += static_cast<char>(high * 16 + low);
+            pos = next + 3;
         } else {
-            ret += str[i];
+            out += '%';
+            pos = next + 1;
         }
     }
+}
 
+inline std::string limhamn::http::utils::urldecode(const std::string& str) {
+    std::string ret{};
+    urldecode(std::string_view{str}, ret);
     return ret;
 }
 
-inline std::string limhamn::http::utils::urlencode(const std::string& str) {
-    std::ostringstream encoded;
-    encoded.fill('0');
-    encoded << std::hex;
+inline void limhamn::http::utils::urlencode(const std::string_view str, std::string& out) {
+    out.reserve(out.size() + str.size() + str.size() / 4 + 16);
 
-    for (const auto& c : str) {
-        if (isalnum(static_cast<unsigned char>(c)) || c == '-' || c == '_' || c == '.' || c == '~') {
-            encoded << c;
-        } else {
-            encoded << '%' << std::setw(2) << static_cast<int>(static_cast<unsigned char>(c));
+    std::size_t pos{0};
+    while (pos < str.size()) {
+        const std::size_t next = pos + _limhamn_http_utils_impl::find_url_reserved(str.data() + pos, str.size() - pos);
+        out.append(str.data() + pos, next - pos);
+        if (next == str.size()) {
+            break;
         }
+
+        const auto c = static_cast<unsigned char>(str[next]);
+        const char encoded[3] = {'%', _limhamn_http_utils_impl::hex_digits[c >> 4], _limhamn_http_utils_impl::hex_digits[c & 0xF]};
+        out.append(encoded, 3);
+        pos = next + 1;
     }
+}
 
-    return encoded.str();
+inline std::string limhamn::http::utils::urlencode(const std::string& str) {
+    std::string ret{};
+    urlencode(std::string_view{str}, ret);
+    return ret;
 }
 
-inline std::string limhamn::http::utils::htmlspecialchars_decode(const std::string& str) {
-    std::string ret{str};
+inline void limhamn::http::utils::htmlspecialchars_decode(const std::string_view str, std::string& out) {
+    static constexpr std::array<std::pair<std::string_view, char>, 6> entities{{
+        {"&lt;", '<'}, {"&gt;", '>'}, {"&amp;", '&'}, {"&quot;", '"'}, {"&apos;", '\''}, {"&bsol;", '\\'},
+    }};
+
+    out.reserve(out.size() + str.size());
 
-    for (std::size_t i{0}; i < ret.length(); i++) {
-        if (ret.at(i) == '&') {
-            if (ret.at(i + 1) == 'l' && ret.at(i + 2) == 't' && ret.at(i + 3) == ';') {
-                ret.replace(i, 4, "<");
-            } else if (ret.at(i + 1) == 'g' && ret.at(i + 2) == 't' && ret.at(i + 3) == ';') {
-                ret.replace(i, 4, ">");
-            } else if (ret.at(i + 1) == 'a' && ret.at(i + 2) == 'm' && ret.at(i + 3) == 'p' && ret.at(i + 4) == ';') {
-                ret.replace(i, 5, "&");
-            } else if (ret.at(i + 1) == 'q' && ret.at(i + 2) == 'u' && ret.at(i + 3) == 'o' && ret.at(i + 4) == 't' && ret.at(i + 5) == ';') {
-                ret.replace(i, 6, "\"");
-            } else if (ret.at(i + 1) == 'a' && ret.at(i + 2) == 'p' && ret.at(i + 3) == 'o' && ret.at(i + 4) == 's' && ret.at(i + 5) == ';') {
-                ret.replace(i, 6, "'");
-            } else if (ret.at(i + 1) == 'b' && ret.at(i + 2) == 's' && ret.at(i + 3) == 'o' && ret.at(i + 4) == 'l' && ret.at(i + 5) == ';') {
-                ret.replace(i, 6, "\\");
+    std::size_t pos{0};
+    while (pos < str.size()) {
+        const void* found = std::memchr(str.data() + pos, '&', str.size() - pos);
+        const std::size_t next = found == nullptr ? str.size() : static_cast<std::size_t>(static_cast<const char*>(found) - str.data());
+        out.append(str.data() + pos, next - pos);
+        if (next == str.size()) {
+            break;
+        }
+
+        pos = next + 1;
+        out += '&';
+        for (const auto& [entity, c] : entities) {
+            if (str.compare(next, entity.size(), entity) == 0) {
+                out.back() = c;
+                pos = next + entity.size();
+                break;
             }
         }
     }
+}
 
+inline std::string limhamn::http::utils::htmlspecialchars_decode(const std::string& str) {
+    std::string ret{};
+    htmlspecialchars_decode(std::string_view{str}, ret);
     return ret;
 }
 
@@ -626,13 +1222,7 @@ inline std::string limhamn::http::utils::sha256hash(const std::string& data) {
                 unsigned int len{0};
 
                 if (EVP_DigestFinal_ex(context, hash, &len)) {
-                    std::stringstream ss{};
-
-                    for (unsigned int i{0}; i < len; ++i) {
-                        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
-                    }
-
-                    ret = ss.str();
+                    to_hex({reinterpret_cast<const char*>(hash), len}, ret);
                 }
             }
         }
@@ -643,6 +1233,24 @@ inline std::string limhamn::http::utils::sha256hash(const std::string& data) {
     return ret;
 }
 
+inline void limhamn::http::utils::to_hex(const std::string_view data, std::string& out) {
+    const std::size_t offset = out.size();
+    out.resize(offset + data.size() * 2);
+
+    char* it = out.data() + offset;
+    for (const char c : data) {
+        const auto byte = static_cast<unsigned char>(c);
+        *it++ = _limhamn_http_utils_impl::hex_digits[byte >> 4];
+        *it++ = _limhamn_http_utils_impl::hex_digits[byte & 0xF];
+    }
+}
+
+inline std::string limhamn::http::utils::to_hex(const std::string_view data) {
+    std::string ret{};
+    to_hex(data, ret);
+    return ret;
+}
+
 inline void limhamn::http::utils::url::parse_url_from_string(const std::string& URL) {
     std::string url{URL};
     std::size_t pos{url.find("https://")};
@@ -10,9 +10,34 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #ifdef LIMHAMN_INI_PARSER_IMPL
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <cerrno>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#else
+#include <filesystem>
+#endif
+#include <charconv>
+#include <cstdlib>
+#include <type_traits>
 #endif
 #include <unordered_map>
 
@@ -102,63 +127,474 @@ namespace limhamn::ini {
          */
         [[nodiscard]] header_value& operator[](const std::string& header);
     };
+
+    /**
+     * @brief A read-only INI table, parsed in one pass into a flat array of entries grouped by header, with an open
+     *        addressing hash index over it
+     * @note Keys and values are views into the data, which the table owns. A file is copied into the table when it is
+     *       constructed, so changing or truncating the file afterwards does not affect it.
+     *       Prefer this over ini_parser for large files that are only read.
+     */
+    class ini_table {
+    public:
+        /**
+         * @brief An entry in the table
+         */
+        struct entry {
+            std::string_view header{};
+            std::string_view key{};
+            std::string_view value{};
+        };
+        using const_iterator = std::vector<entry>::const_iterator;
+    private:
+        std::unique_ptr<std::string> buffer{}; // the data, which stays put when the table is moved
+        std::vector<entry> entries{}; // in the order of the file, except that the entries of a header are kept together
+        std::vector<uint32_t> slots{}; // index + 1 into entries, or 0 if the slot is empty
+        std::size_t mask{0};
+        struct header_range {
+            std::string_view name{};
+            std::size_t first{0};
+            std::size_t last{0};
+        };
+        std::vector<header_range> headers{}; // sorted by name
+
+        static std::size_t hash(std::string_view header, std::string_view key) noexcept;
+        void parse(std::string_view data);
+
+        friend class ini_reloader;
+    public:
+        /**
+         * @brief Construct an empty table
+         */
+        ini_table() = default;
+        /**
+         * @brief Construct a new table
+         * @param data INI data
+         * @param is_file Is the data a file
+         * @note Throws std::runtime_error if the file cannot be read.
+         */
+        explicit ini_table(const std::string& data, bool is_file = false);
+        ini_table(const ini_table&) = delete;
+        ini_table& operator=(const ini_table&) = delete;
+        ini_table(ini_table&& other) noexcept;
+        ini_table& operator=(ini_table&& other) noexcept;
+
+        /**
+         * @brief Find a value
+         * @param header Header
+         * @param key Key
+         * @return const std::string_view*, or nullptr if there is no such value
+         */
+        [[nodiscard]] const std::string_view* find(std::string_view header, std::string_view key) const noexcept;
+        /**
+         * @brief Get a value
+         * @param header Header
+         * @param key Key
+         * @return std::string_view
+         * @note Throws std::invalid_argument if there is no such value.
+         */
+        [[nodiscard]] std::string_view get(std::string_view header, std::string_view key) const;
+        /**
+         * @brief Get the entries of a header, in the order of the file
+         * @param header Header
+         * @return std::pair<const_iterator, const_iterator>, the beginning and end of the entries
+         */
+        [[nodiscard]] std::pair<const_iterator, const_iterator> get_header(std::string_view header) const noexcept;
+        /**
+         * @brief Get the number of entries
+         * @return std::size_t
+         */
+        [[nodiscard]] std::size_t size() const noexcept;
+        [[nodiscard]] const_iterator begin() const noexcept;
+        [[nodiscard]] const_iterator end() const noexcept;
+        /**
+         * @brief Copy the table into an ini_parser, e.g. to modify it
+         * @return config
+         */
+        [[nodiscard]] config get_data() const;
+        /**
+         * @brief Get a value converted to a type
+         * @param header Header
+         * @param key Key
+         * @return T, one of bool, an integer or floating point type, std::string, std::string_view, a std::chrono::duration
+         *         (e.g. 250ms, 5s, 1.5h; a bare number is in the units of the duration) or a std::vector of those
+         *         (separated by commas)
+         * @note Throws std::invalid_argument if there is no such value or it cannot be converted.
+         */
+        template <typename T> [[nodiscard]] T get(std::string_view header, std::string_view key) const;
+        /**
+         * @brief Get a value converted to a type, or a fallback
+         * @param header Header
+         * @param key Key
+         * @param fallback Returned if there is no such value or it cannot be converted
+         * @return T, see get<T>()
+         */
+        template <typename T> [[nodiscard]] T get_or(std::string_view header, std::string_view key, T fallback) const;
+    };
+
+    /**
+     * @brief A class that holds the current snapshot of an INI file, and can reload it when the file changes
+     * @note A reload parses the file into a new ini_table and swaps it in atomically, RCU style: readers keep using the
+     *       snapshot they have until they are done with it, and are never blocked by the reload.
+     * @note Snapshots read the file into their own buffer, so editing the file in place does not change, or invalidate,
+     *       the snapshots readers hold.
+     */
+    class ini_reloader {
+        std::string path{};
+        std::shared_ptr<const ini_table> current{};
+        std::atomic<uint64_t> current_generation{0};
+        std::thread watcher{};
+        std::atomic<bool> stopping{false};
+        int stop_fd[2]{-1, -1}; // wakes the watcher to stop
+
+        static std::shared_ptr<const ini_table> load(const std::string& path);
+    public:
+        /**
+         * @brief Load the file
+         * @param path The file
+         * @note Throws std::runtime_error if the file cannot be read.
+         */
+        explicit ini_reloader(std::string path);
+        /**
+         * @brief Stop watching the file
+         */
+        ~ini_reloader();
+        ini_reloader(const ini_reloader&) = delete;
+        ini_reloader& operator=(const ini_reloader&) = delete;
+
+        /**
+         * @brief Get the current snapshot
+         * @return std::shared_ptr<const ini_table>, which stays valid after later reloads
+         */
+        [[nodiscard]] std::shared_ptr<const ini_table> snapshot() const;
+        /**
+         * @brief Get the generation of the current snapshot, which is incremented by every reload
+         * @return uint64_t
+         */
+        [[nodiscard]] uint64_t generation() const noexcept;
+        /**
+         * @brief Load the file again
+         * @return bool, false if it could not be read, in which case the current snapshot is kept
+         */
+        bool reload();
+        /**
+         * @brief Reload the file whenever it is written or replaced, from a background thread
+         * @note Uses inotify on Linux. Elsewhere the modification time is checked once a second.
+         */
+        void watch();
+    };
+
+    /**
+     * @brief A handle to a value of an ini_reloader, converted once per snapshot
+     * @note Reading it costs an atomic load and a comparison while the snapshot is unchanged. A handle is not thread
+     *       safe; give each thread its own, e.g. as a thread_local or a member of a per-thread object.
+     */
+    template <typename T>
+    class ini_handle {
+        const ini_reloader* reloader{nullptr};
+        std::string header{};
+        std::string key{};
+        T fallback{};
+        T value{};
+        std::shared_ptr<const ini_table> table{}; // keeps the views of a std::string_view value valid
+        uint64_t generation{static_cast<uint64_t>(-1)};
+
+        void refresh();
+    public:
+        /**
+         * @brief Construct a new handle
+         * @param reloader The ini_reloader, which must outlive the handle
+         * @param header Header
+         * @param key Key
+         * @param fallback The value if there is no such key, or it cannot be converted
+         */
+        ini_handle(const ini_reloader& reloader, std::string header, std::string key, T fallback = T{});
+
+        /**
+         * @brief Get the value
+         * @return const T&, valid until the next call
+         */
+        [[nodiscard]] const T& get();
+        [[nodiscard]] const T& operator*();
+        [[nodiscard]] const T* operator->();
+    };
 }  // namespace limhamn::ini
 
 #ifdef LIMHAMN_INI_PARSER_IMPL
-inline void limhamn::ini::ini_parser::parse(const std::string& data) {
-    parsed_map.clear();
+namespace _limhamn_ini_parser_impl {
+    inline bool is_space(const char c) noexcept {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
 
-    if (data.empty()) {
-        throw std::invalid_argument("data is empty");
+    inline std::string_view trim(std::string_view str) noexcept {
+        while (!str.empty() && is_space(str.front())) {
+            str.remove_prefix(1);
+        }
+        while (!str.empty() && is_space(str.back())) {
+            str.remove_suffix(1);
+        }
+        return str;
     }
 
-    std::stringstream ss{data};
-    std::string it{};
-    std::string current_header{};
-    while (std::getline(ss, it)) {
-        it.erase(std::remove_if(it.begin(), it.end(), ::isspace), it.end());
-        if (it.empty() || it.at(0) == ';' || it.at(0) == '#') {
-            continue;
+    /**
+     * @brief Strips a trailing comment and the quotes around a value
+     * @param value The value, trimmed
+     * @return std::string_view
+     */
+    inline std::string_view clean_value(std::string_view value) noexcept {
+        std::size_t pos{0};
+        if (!value.empty() && value.front() == '"') {
+            const std::size_t quote = value.find('"', 1);
+            if (quote != std::string_view::npos) {
+                pos = quote + 1;
+            }
         }
 
-        // check if it's a header
-        if (it.at(0) == '[' && it.at(it.size() - 1) == ']') {
-            current_header = it.substr(1, it.size() - 2);
-            continue;
+        for (; pos < value.size(); ++pos) {
+            if ((value[pos] == ';' || value[pos] == '#') && (pos == 0 || value[pos - 1] != '\\')) {
+                value = trim(value.substr(0, pos));
+                break;
+            }
         }
 
-        if (current_header.empty()) {
-            continue;
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+            value = value.substr(1, value.size() - 2);
         }
+        return value;
+    }
 
-        // find = and split
-        auto pos = it.find('=');
-        if (pos + 1 == std::string::npos) {
-            continue;
+    /**
+     * @brief Parses INI data in one pass
+     * @param data The data
+     * @param callback Called with the header, key and value of each entry, all views into data
+     * @note Surrounding whitespace is removed from headers, keys and values; whitespace inside them is kept.
+     */
+    template <typename Callback>
+    void parse(const std::string_view data, Callback&& callback) {
+        std::string_view header{};
+        const char* it = data.data();
+        const char* const end = it + data.size();
+
+        while (it < end) {
+            const char* newline = static_cast<const char*>(std::memchr(it, '\n', static_cast<std::size_t>(end - it)));
+            if (newline == nullptr) {
+                newline = end;
+            }
+            const std::string_view line = trim(std::string_view(it, static_cast<std::size_t>(newline - it)));
+            it = newline + 1;
+
+            if (line.empty() || line.front() == ';' || line.front() == '#') {
+                continue;
+            }
+
+            if (line.front() == '[' && line.back() == ']') {
+                header = trim(line.substr(1, line.size() - 2));
+                continue;
+            }
+
+            const std::size_t pos = line.find('=');
+            if (header.empty() || pos == std::string_view::npos) {
+                continue;
+            }
+
+            const std::string_view key = trim(line.substr(0, pos));
+            if (key.empty()) {
+                continue;
+            }
+
+            callback(header, key, clean_value(trim(line.substr(pos + 1))));
         }
+    }
 
-        std::string key = it.substr(0, pos);
-        std::string value = it.substr(pos + 1);
+    /**
+     * @brief Reads a whole file into a string
+     * @note The file is read rather than mapped: a mapping of a file that is truncated while it is mapped faults on
+     *       access, and a file that is edited in place would change the views parsed from it.
+     */
+    inline std::string read_contents(const std::string& path) {
+        std::string ret{};
+#ifndef _WIN32
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw std::runtime_error("could not open file: " + path);
+        }
 
-        pos = value.find(';');
-        if (pos != std::string::npos) {
-            if (pos - 1 != std::string::npos && value.at(pos - 1) != '\\') {
-                value = value.substr(0, pos);
+        struct stat st{};
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            ret.reserve(static_cast<std::size_t>(st.st_size));
+        }
+
+        char chunk[65536];
+        while (true) {
+            const ssize_t n = ::read(fd, chunk, sizeof(chunk));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0) {
+                ::close(fd);
+                throw std::runtime_error("could not read file: " + path);
+            }
+            if (n == 0) {
+                break;
             }
+            ret.append(chunk, static_cast<std::size_t>(n));
         }
+        ::close(fd);
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            throw std::runtime_error("could not open file: " + path);
+        }
+        ret.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+#endif
+        return ret;
+    }
+
+    template <typename T>
+    struct is_duration : std::false_type {};
+    template <typename Rep, typename Period>
+    struct is_duration<std::chrono::duration<Rep, Period>> : std::true_type {};
+
+    template <typename T>
+    struct is_vector : std::false_type {};
+    template <typename T, typename Allocator>
+    struct is_vector<std::vector<T, Allocator>> : std::true_type {};
+
+    template <typename T>
+    struct dependent_false : std::false_type {};
 
-        pos = value.find('#');
-        if (pos != std::string::npos) {
-            if (pos - 1 != std::string::npos && value.at(pos - 1) != '\\') {
-                value = value.substr(0, pos);
+    inline bool iequals(const std::string_view a, const std::string_view b) noexcept {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (std::size_t i = 0; i < a.size(); ++i) {
+            if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+                return false;
             }
         }
-        if (value.front() == '"' && value.back() == '"') {
-            value = value.substr(1, value.size() - 2);
+        return true;
+    }
+
+    inline bool parse_double(const std::string_view in, double& out, std::size_t& used) {
+        const std::string copy{in}; // strtod needs a terminated string
+        char* end{nullptr};
+        out = std::strtod(copy.c_str(), &end);
+        used = static_cast<std::size_t>(end - copy.c_str());
+        return used != 0;
+    }
+
+    /**
+     * @brief Converts a value
+     * @param in The value
+     * @param out Set to the converted value
+     * @return bool, false if the value is not valid for the type
+     */
+    template <typename T>
+    bool convert(const std::string_view in, T& out) {
+        if constexpr (std::is_same_v<T, std::string>) {
+            out.assign(in);
+            return true;
+        } else if constexpr (std::is_same_v<T, std::string_view>) {
+            out = in;
+            return true;
+        } else if constexpr (std::is_same_v<T, bool>) {
+            for (const char* it : {"true", "yes", "on", "1"}) {
+                if (iequals(in, it)) {
+                    out = true;
+                    return true;
+                }
+            }
+            for (const char* it : {"false", "no", "off", "0"}) {
+                if (iequals(in, it)) {
+                    out = false;
+                    return true;
+                }
+            }
+            return false;
+        } else if constexpr (std::is_integral_v<T>) {
+            std::string_view str = in;
+            if (!str.empty() && str.front() == '+') {
+                str.remove_prefix(1);
+            }
+            int base{10};
+            if (str.size() > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+                str.remove_prefix(2);
+                base = 16;
+            }
+            const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), out, base);
+            return ec == std::errc{} && ptr == str.data() + str.size();
+        } else if constexpr (std::is_floating_point_v<T>) {
+            double value{};
+            std::size_t used{};
+            if (!parse_double(in, value, used) || used != in.size()) {
+                return false;
+            }
+            out = static_cast<T>(value);
+            return true;
+        } else if constexpr (is_duration<T>::value) {
+            double value{};
+            std::size_t used{};
+            if (!parse_double(in, value, used)) {
+                return false;
+            }
+
+            const std::string_view unit = trim(in.substr(used));
+            if (unit.empty()) {
+                out = std::chrono::duration_cast<T>(std::chrono::duration<double, typename T::period>(value));
+            } else if (unit == "ns") {
+                out = std::chrono::duration_cast<T>(std::chrono::duration<double, std::nano>(value));
+            } else if (unit == "us") {
+                out = std::chrono::duration_cast<T>(std::chrono::duration<double, std::micro>(value));
+            } else if (unit == "ms") {
+                out = std::chrono::duration_cast<T>(std::chrono::duration<double, std::milli>(value));
+            } else if (unit == "s") {
+                out = std::chrono::duration_cast<T>(std::chrono::duration<double>(value));
+            } else if (unit == "m" || unit == "min") {
+                out = std::chrono::duration_cast<T>(std::chrono::duration<double, std::ratio<60>>(value));
+            } else if (unit == "h") {
+                out = std::chrono::duration_cast<T>(std::chrono::duration<double, std::ratio<3600>>(value));
+            } else if (unit == "d") {
+                out = std::chrono::duration_cast<T>(std::chrono::duration<double, std::ratio<86400>>(value));
+            } else {
+                return false;
+            }
+            return true;
+        } else if constexpr (is_vector<T>::value) {
+            out.clear();
+            if (in.empty()) {
+                return true;
+            }
+
+            std::size_t pos{0};
+            for (;;) {
+                const std::size_t end = in.find(',', pos);
+                typename T::value_type item{};
+                if (!convert(trim(in.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos)), item)) {
+                    return false;
+                }
+                out.push_back(std::move(item));
+                if (end == std::string_view::npos) {
+                    return true;
+                }
+                pos = end + 1;
+            }
+        } else {
+            static_assert(dependent_false<T>::value, "unsupported type");
+            return false;
         }
+    }
+}
 
-        parsed_map[current_header][key] = value;
+inline void limhamn::ini::ini_parser::parse(const std::string& data) {
+    parsed_map.clear();
+
+    if (data.empty()) {
+        throw std::invalid_argument("data is empty");
     }
+
+    _limhamn_ini_parser_impl::parse(data, [this](const std::string_view header, const std::string_view key, const std::string_view value) {
+        parsed_map[std::string(header)][std::string(key)] = std::string(value);
+    });
 }
 
 inline limhamn::ini::ini_parser::ini_parser(const std::string& data, bool is_file) {
@@ -168,20 +604,19 @@ inline limhamn::ini::ini_parser::ini_parser(const std::string& data, bool is_fil
 inline void limhamn::ini::ini_parser::load(const std::string& data, bool is_file) {
     this->parsed_map.clear();
 
-    std::string buffer{};
+    if (!is_file) {
+        parse(data);
+        return;
+    }
 
-    if (is_file) {
-        std::ifstream file(data);
-        if (file.is_open()) {
-            std::string line;
-            while (std::getline(file, line)) {
-                buffer += line + "\n";
-            }
-            file.close();
-        }
+    std::string buffer{};
+    try {
+        buffer = _limhamn_ini_parser_impl::read_contents(data);
+    } catch (const std::runtime_error&) {
+        // a file that cannot be opened is treated as empty
     }
 
-    parse(is_file ? buffer : data);
+    parse(buffer);
 }
 
 [[nodiscard]] inline limhamn::ini::value& limhamn::ini::ini_parser::get(const std::string& header, const std::string& key) {
@@ -262,4 +697,396 @@ inline void limhamn::ini::ini_parser::set(const std::string& header, const std::
 [[nodiscard]] inline limhamn::ini::header_value& limhamn::ini::ini_parser::operator[](const std::string& header) {
     return get_header(header);
 }
+
+inline std::size_t limhamn::ini::ini_table::hash(const std::string_view header, const std::string_view key) noexcept {
+    const std::size_t h = std::hash<std::string_view>{}(header);
+    return h ^ (std::hash<std::string_view>{}(key) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+}
+
+inline void limhamn::ini::ini_table::parse(const std::string_view data) {
+    // a rough guess at the number of entries, to avoid most reallocations
+    this->entries.reserve(data.size() / 32);
+
+    // the headers are numbered in order of appearance, so a header that appears twice can be brought together
+    std::unordered_map<std::string_view, uint32_t> ordinals{};
+    std::vector<uint32_t> entry_ordinals{};
+    std::string_view last_header{};
+    uint32_t ordinal{0};
+    bool grouped = true;
+
+    _limhamn_ini_parser_impl::parse(data, [&](const std::string_view header, const std::string_view key, const std::string_view value) {
+        if (header.data() != last_header.data() || header.size() != last_header.size()) {
+            const auto [it, inserted] = ordinals.try_emplace(header, static_cast<uint32_t>(ordinals.size()));
+            if (!inserted && grouped && it->second != ordinal) {
+                grouped = false;
+                // back fill the ordinals of what came before, which until now were not needed
+                entry_ordinals.reserve(this->entries.capacity());
+                for (const auto& e : this->entries) {
+                    entry_ordinals.push_back(ordinals.at(e.header));
+                }
+            }
+            ordinal = it->second;
+            last_header = header;
+        }
+
+        this->entries.push_back(entry{header, key, value});
+        if (!grouped) {
+            entry_ordinals.push_back(ordinal);
+        }
+    });
+
+    if (!grouped) {
+        std::vector<uint32_t> order(this->entries.size());
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            order[i] = static_cast<uint32_t>(i);
+        }
+        std::stable_sort(order.begin(), order.end(), [&entry_ordinals](const uint32_t a, const uint32_t b) {
+            return entry_ordinals[a] < entry_ordinals[b];
+        });
+
+        std::vector<entry> sorted{};
+        sorted.reserve(order.size());
+        for (const auto it : order) {
+            sorted.push_back(this->entries[it]);
+        }
+        this->entries = std::move(sorted);
+    }
+
+    std::size_t capacity{16};
+    while (capacity < this->entries.size() * 2) {
+        capacity <<= 1;
+    }
+    this->slots.assign(capacity, 0);
+    this->mask = capacity - 1;
+
+    // hashing everything first lets the slots be fetched ahead of use, as each one is most likely a cache miss
+    std::vector<std::size_t> hashes(this->entries.size());
+    for (std::size_t i = 0; i < hashes.size(); ++i) {
+        hashes[i] = hash(this->entries[i].header, this->entries[i].key) & this->mask;
+    }
+
+    // index the entries, keeping the first position but the last value of duplicate keys, like in ini_parser
+    std::size_t out{0};
+    for (std::size_t i = 0; i < this->entries.size(); ++i) {
+#if defined(__GNUC__) || defined(__clang__)
+        if (i + 16 < hashes.size()) {
+            __builtin_prefetch(&this->slots[hashes[i + 16]], 1);
+        }
+#endif
+        const entry current = this->entries[i];
+        std::size_t slot = hashes[i];
+        for (;; slot = (slot + 1) & this->mask) {
+            if (this->slots[slot] == 0) {
+                this->entries[out] = current;
+                this->slots[slot] = static_cast<uint32_t>(++out);
+                break;
+            }
+
+            entry& existing = this->entries[this->slots[slot] - 1];
+            if (existing.key == current.key && existing.header == current.header) {
+                existing.value = current.value;
+                break;
+            }
+        }
+    }
+    this->entries.resize(out);
+    this->entries.shrink_to_fit();
+
+    for (std::size_t i = 0; i < this->entries.size(); ++i) {
+        if (this->headers.empty() || this->headers.back().name != this->entries[i].header) {
+            this->headers.push_back(header_range{this->entries[i].header, i, i});
+        }
+        this->headers.back().last = i + 1;
+    }
+    std::sort(this->headers.begin(), this->headers.end(), [](const header_range& a, const header_range& b) {
+        return a.name < b.name;
+    });
+}
+
+inline limhamn::ini::ini_table::ini_table(const std::string& data, bool is_file) {
+    if (!is_file) {
+        this->buffer = std::make_unique<std::string>(data);
+        this->parse(*this->buffer);
+        return;
+    }
+
+    this->buffer = std::make_unique<std::string>(_limhamn_ini_parser_impl::read_contents(data));
+    this->parse(*this->buffer);
+}
+
+inline limhamn::ini::ini_table::ini_table(ini_table&& other) noexcept
+    : buffer(std::move(other.buffer)), entries(std::move(other.entries)), slots(std::move(other.slots)), mask(other.mask),
+      headers(std::move(other.headers)) {
+    other.entries.clear();
+    other.slots.clear();
+    other.headers.clear();
+}
+
+inline limhamn::ini::ini_table& limhamn::ini::ini_table::operator=(ini_table&& other) noexcept {
+    if (this != &other) {
+        this->buffer = std::move(other.buffer);
+        this->entries = std::move(other.entries);
+        this->slots = std::move(other.slots);
+        this->mask = other.mask;
+        this->headers = std::move(other.headers);
+        other.entries.clear();
+        other.slots.clear();
+        other.headers.clear();
+    }
+    return *this;
+}
+
+[[nodiscard]] inline const std::string_view* limhamn::ini::ini_table::find(const std::string_view header, const std::string_view key) const noexcept {
+    if (this->slots.empty()) {
+        return nullptr;
+    }
+
+    for (std::size_t slot = hash(header, key) & this->mask; this->slots[slot] != 0; slot = (slot + 1) & this->mask) {
+        const entry& it = this->entries[this->slots[slot] - 1];
+        if (it.key == key && it.header == header) {
+            return &it.value;
+        }
+    }
+    return nullptr;
+}
+
+[[nodiscard]] inline std::string_view limhamn::ini::ini_table::get(const std::string_view header, const std::string_view key) const {
+    if (header.empty()) {
+        throw std::invalid_argument("header is empty");
+    }
+    if (key.empty()) {
+        throw std::invalid_argument("key is empty; call get_header instead");
+    }
+
+    const std::string_view* ret = this->find(header, key);
+    if (ret == nullptr) {
+        throw std::invalid_argument("key not found");
+    }
+    return *ret;
+}
+
+[[nodiscard]] inline std::pair<limhamn::ini::ini_table::const_iterator, limhamn::ini::ini_table::const_iterator> limhamn::ini::ini_table::get_header(const std::string_view header) const noexcept {
+    const auto it = std::lower_bound(this->headers.begin(), this->headers.end(), header, [](const header_range& a, const std::string_view b) {
+        return a.name < b;
+    });
+    if (it == this->headers.end() || it->name != header) {
+        return {this->entries.end(), this->entries.end()};
+    }
+
+    const auto first = this->entries.begin() + static_cast<std::ptrdiff_t>(it->first);
+    return {first, this->entries.begin() + static_cast<std::ptrdiff_t>(it->last)};
+}
+
+[[nodiscard]] inline std::size_t limhamn::ini::ini_table::size() const noexcept {
+    return this->entries.size();
+}
+
+[[nodiscard]] inline limhamn::ini::ini_table::const_iterator limhamn::ini::ini_table::begin() const noexcept {
+    return this->entries.begin();
+}
+
+[[nodiscard]] inline limhamn::ini::ini_table::const_iterator limhamn::ini::ini_table::end() const noexcept {
+    return this->entries.end();
+}
+
+[[nodiscard]] inline limhamn::ini::config limhamn::ini::ini_table::get_data() const {
+    config ret{};
+    for (const auto& it : this->entries) {
+        ret[std::string(it.header)][std::string(it.key)] = std::string(it.value);
+    }
+    return ret;
+}
+
+template <typename T>
+[[nodiscard]] T limhamn::ini::ini_table::get(const std::string_view header, const std::string_view key) const {
+    T ret{};
+    if (!_limhamn_ini_parser_impl::convert(this->get(header, key), ret)) {
+        throw std::invalid_argument("value cannot be converted: " + std::string(header) + "." + std::string(key));
+    }
+    return ret;
+}
+
+template <typename T>
+[[nodiscard]] T limhamn::ini::ini_table::get_or(const std::string_view header, const std::string_view key, T fallback) const {
+    const std::string_view* value = this->find(header, key);
+    if (value == nullptr) {
+        return fallback;
+    }
+
+    T ret{};
+    if (!_limhamn_ini_parser_impl::convert(*value, ret)) {
+        return fallback;
+    }
+    return ret;
+}
+
+inline std::shared_ptr<const limhamn::ini::ini_table> limhamn::ini::ini_reloader::load(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("could not open file: " + path);
+    }
+
+    auto ret = std::make_shared<ini_table>();
+    ret->buffer = std::make_unique<std::string>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (file.bad()) {
+        throw std::runtime_error("could not read file: " + path);
+    }
+    ret->parse(*ret->buffer);
+    return ret;
+}
+
+inline limhamn::ini::ini_reloader::ini_reloader(std::string path) : path(std::move(path)) {
+    this->current = load(this->path);
+}
+
+inline limhamn::ini::ini_reloader::~ini_reloader() {
+    if (this->watcher.joinable()) {
+        this->stopping.store(true);
+#ifdef __linux__
+        const char byte{0};
+        static_cast<void>(::write(this->stop_fd[1], &byte, 1));
+#endif
+        this->watcher.join();
+    }
+#ifdef __linux__
+    for (const int fd : this->stop_fd) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+#endif
+}
+
+[[nodiscard]] inline std::shared_ptr<const limhamn::ini::ini_table> limhamn::ini::ini_reloader::snapshot() const {
+    return std::atomic_load_explicit(&this->current, std::memory_order_acquire);
+}
+
+[[nodiscard]] inline uint64_t limhamn::ini::ini_reloader::generation() const noexcept {
+    return this->current_generation.load(std::memory_order_acquire);
+}
+
+inline bool limhamn::ini::ini_reloader::reload() {
+    std::shared_ptr<const ini_table> next{};
+    try {
+        next = load(this->path);
+    } catch (const std::exception&) {
+        return false;
+    }
+
+    // the old snapshot is freed by whichever reader lets go of it last
+    std::atomic_store_explicit(&this->current, std::move(next), std::memory_order_release);
+    this->current_generation.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+inline void limhamn::ini::ini_reloader::watch() {
+    if (this->watcher.joinable()) {
+        return;
+    }
+
+#ifdef __linux__
+    if (this->stop_fd[0] < 0 && ::pipe2(this->stop_fd, O_CLOEXEC) != 0) {
+        throw std::runtime_error("could not create pipe");
+    }
+
+    // the directory is watched rather than the file, as editors and deployment tools usually replace it with a rename
+    const std::size_t slash = this->path.find_last_of('/');
+    const std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : this->path.substr(0, slash);
+    const std::string name = slash == std::string::npos ? this->path : this->path.substr(slash + 1);
+
+    const int fd = ::inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd < 0) {
+        throw std::runtime_error("could not initialize inotify");
+    }
+    if (::inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        ::close(fd);
+        throw std::runtime_error("could not watch directory: " + directory);
+    }
+
+    this->watcher = std::thread([this, fd, name]() {
+        alignas(inotify_event) char buffer[4096];
+        pollfd fds[2] = {{fd, POLLIN, 0}, {this->stop_fd[0], POLLIN, 0}};
+
+        for (;;) {
+            if (::poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            if (fds[1].revents != 0) {
+                break;
+            }
+
+            bool changed = false;
+            ssize_t size{};
+            while ((size = ::read(fd, buffer, sizeof(buffer))) > 0) {
+                for (char* it = buffer; it < buffer + size;) {
+                    const auto* event = reinterpret_cast<const inotify_event*>(it);
+                    if (event->len > 0 && name == event->name) {
+                        changed = true;
+                    }
+                    it += sizeof(inotify_event) + event->len;
+                }
+            }
+
+            if (changed) {
+                this->reload();
+            }
+        }
+
+        ::close(fd);
+    });
+#else
+    this->watcher = std::thread([this]() {
+        std::error_code ec{};
+        auto modified = std::filesystem::last_write_time(this->path, ec);
+
+        for (int tick = 1; !this->stopping.load(); ++tick) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (tick % 10 != 0) {
+                continue;
+            }
+
+            const auto now = std::filesystem::last_write_time(this->path, ec);
+            if (!ec && now != modified) {
+                modified = now;
+                this->reload();
+            }
+        }
+    });
+#endif
+}
+
+template <typename T>
+limhamn::ini::ini_handle<T>::ini_handle(const ini_reloader& reloader, std::string header, std::string key, T fallback)
+    : reloader(&reloader), header(std::move(header)), key(std::move(key)), fallback(std::move(fallback)) {
+    this->refresh();
+}
+
+template <typename T>
+void limhamn::ini::ini_handle<T>::refresh() {
+    // the generation is read first, so a reload in between is at worst picked up twice
+    this->generation = this->reloader->generation();
+    this->table = this->reloader->snapshot();
+    this->value = this->table->get_or<T>(this->header, this->key, this->fallback);
+}
+
+template <typename T>
+[[nodiscard]] const T& limhamn::ini::ini_handle<T>::get() {
+    if (this->reloader->generation() != this->generation) {
+        this->refresh();
+    }
+    return this->value;
+}
+
+template <typename T>
+[[nodiscard]] const T& limhamn::ini::ini_handle<T>::operator*() {
+    return this->get();
+}
+
+template <typename T>
+[[nodiscard]] const T* limhamn::ini::ini_handle<T>::operator->() {
+    return &this->get();
+}
 #endif
@@ -12,12 +12,64 @@
 #ifdef LIMHAMN_LOGGER_IMPL
 #include <iostream>
 #include <fstream>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <vector>
+#include <cstdint>
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
 #endif
 #include <string>
+#include <string_view>
 #include <ctime>
+#include <cstddef>
+#include <memory>
 
 #define LIMHAMN_LOGGER
 
+/**
+ * @brief  Lowest severity that LIMHAMN_LOG and logger::log<type>() keep, in the order notice (0), access (1),
+ *         warning (2) and error (3). Calls below it compile to nothing.
+ */
+#ifndef LIMHAMN_LOGGER_MIN_LEVEL
+#define LIMHAMN_LOGGER_MIN_LEVEL 0
+#endif
+
+/**
+ * @brief  Size of the per-thread buffer logger::log() formats into. Longer lines are truncated.
+ */
+#ifndef LIMHAMN_LOGGER_BUFFER_SIZE
+#define LIMHAMN_LOGGER_BUFFER_SIZE 4096
+#endif
+
+/**
+ * @brief  Logs with logger::log(), without evaluating the arguments if the type is below LIMHAMN_LOGGER_MIN_LEVEL.
+ */
+#define LIMHAMN_LOG(log_object, log_type, ...) \
+    do { \
+        if constexpr (::limhamn::logger::enabled(log_type)) { \
+            (log_object).log(log_type, __VA_ARGS__); \
+        } \
+    } while (false)
+
+namespace _limhamn_logger_impl {
+    class async_backend;
+}
+
 /**
  * @brief  logger namespace containing all the classes and functions for the logger.
  */
@@ -51,12 +103,61 @@ namespace limhamn::logger {
         none,
     };
 
+    /**
+     * @brief  List of integers representing what an asynchronous logger does when its queue is full.
+     */
+    enum class overflow {
+        block, // wait for the background thread to make room
+        drop, // discard the message
+        count, // discard the message and log how many were discarded once there is room again
+    };
+
+    /**
+     * @brief  List of integers representing line formats for logger::log().
+     */
+    enum class output_format {
+        text, // prefix, date, message and key=value fields
+        json, // one JSON object per line
+    };
+
+    /**
+     * @brief  Gets the severity of a log type, as compared against LIMHAMN_LOGGER_MIN_LEVEL.
+     * @param  t: log type.
+     * @return int containing the severity.
+     */
+    constexpr int severity(const type t) {
+        return t == type::notice ? 0 : t == type::access ? 1 : t == type::warning ? 2 : t == type::error ? 3 : -1;
+    }
+
+    /**
+     * @brief  Checks whether a log type is compiled in.
+     * @param  t: log type.
+     * @return bool true if messages of the type are kept.
+     */
+    constexpr bool enabled(const type t) {
+        return severity(t) >= LIMHAMN_LOGGER_MIN_LEVEL;
+    }
+
+    /**
+     * @brief  Key/value pair attached to a logger::log() line. The value is referenced, not copied.
+     */
+    template <typename T>
+    struct field {
+        std::string_view key;
+        const T& value;
+    };
+
+    template <typename T>
+    field(std::string_view, const T&) -> field<T>;
+
     using logger_status = status;
     using logger_error_type = type;
     using logger_stream = stream;
     using logger_file = std::string;
     using logger_boolean = bool;
     using logger_prefix = std::string;
+    using logger_overflow = overflow;
+    using logger_format = output_format;
 
     /**
      * @brief  Struct containing settings to initialize the logger with.
@@ -78,6 +179,10 @@ namespace limhamn::logger {
         logger_prefix error_log_prefix{"[ERROR]: "};
         logger_prefix warning_log_prefix{"[WARNING]: "};
         logger_prefix notice_log_prefix{"[NOTICE]: "};
+        logger_boolean async{false}; // write from a background thread that keeps the files open, instead of on the caller's thread
+        std::size_t async_queue_size{8192}; // messages the background thread may fall behind by, rounded up to a power of two
+        logger_overflow async_overflow{overflow::block}; // what to do with messages when the queue is full
+        logger_format format{output_format::text}; // line format used by log()
     };
 
     /**
@@ -96,9 +201,17 @@ namespace limhamn::logger {
 
     /**
      * @brief  Class that handles logging.
+     * @note   With logger_properties::async, messages are queued in a lock-free ring buffer and written in
+     *         batches by a background thread. Copies of a logger share that thread.
      */
     class logger {
             logger_properties prop{};
+            std::shared_ptr<::_limhamn_logger_impl::async_backend> backend{};
+
+            /**
+             * @brief  Writes a complete line to the log of a type.
+             */
+            void write_line(logger_error_type type, std::string_view line) const noexcept;
         public:
             /**
              * @brief  Constructor for the logger.
@@ -127,6 +240,36 @@ namespace limhamn::logger {
              * @param  data: std::string containing the data to log.
              */
             void write_to_log(logger_error_type type, const std::string& data) const noexcept; // NOLINT
+            /**
+             * @brief  Formats and writes a line to the log, without allocating.
+             * @param  type: logger_error_type enum representing the type of log.
+             * @param  fmt: format string, where each {} is replaced by the next argument and {{ and }} are literal braces.
+             * @param  args: arguments, integers, floating point numbers, bools, characters and strings. field arguments
+             *         are not substituted but appended as key=value, or as members of the JSON object.
+             * @note   A newline is appended. The line is formatted into a per-thread buffer of LIMHAMN_LOGGER_BUFFER_SIZE bytes.
+             */
+            template <typename... Args>
+            void log(logger_error_type type, std::string_view fmt, const Args&... args) const noexcept;
+            /**
+             * @brief  Formats and writes a line to the log, compiled out if the type is below LIMHAMN_LOGGER_MIN_LEVEL.
+             * @param  fmt: format string.
+             * @param  args: arguments.
+             */
+            template <logger_error_type T, typename... Args>
+            void log(std::string_view fmt, const Args&... args) const noexcept;
+            /**
+             * @brief  Waits until every queued message has been written. Does nothing for a synchronous logger.
+             */
+            void flush() const noexcept;
+            /**
+             * @brief  Closes and reopens the log files, e.g. after they have been rotated. Does nothing for a synchronous logger.
+             */
+            void reopen() const noexcept;
+            /**
+             * @brief  Gets the number of messages discarded because the queue was full.
+             * @return std::size_t containing the number of messages.
+             */
+            [[nodiscard]] std::size_t dropped() const noexcept;
             /**
              * @brief  Overrides the properties of the logger.
              * @param  prop: logger_properties struct containing the settings for the logger.
@@ -141,19 +284,670 @@ namespace limhamn::logger {
 }
 
 #ifdef LIMHAMN_LOGGER_IMPL
+namespace _limhamn_logger_impl {
+    /**
+     * @brief  Formats the current local time, reformatting it at most once per second per thread.
+     * @return const char* containing the date, valid until the thread's next call.
+     */
+    inline const char* format_date() {
+        thread_local std::time_t cached{-1};
+        thread_local char buf[20]{};
+
+        const std::time_t time = std::time(nullptr);
+        if (time != cached) {
+            std::tm local{};
+#if defined(__unix__) || defined(__APPLE__)
+            localtime_r(&time, &local);
+#else
+            local = *std::localtime(&time);
+#endif
+            std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &local);
+            cached = time;
+        }
+
+        return buf;
+    }
+
+    /**
+     * @brief  Gets the index of a log type, in the order access, error, warning, notice.
+     * @return int containing the index, or -1 for an unknown type.
+     */
+    inline int type_index(const limhamn::logger::type type) {
+        switch (type) {
+            case limhamn::logger::type::access: return 0;
+            case limhamn::logger::type::error: return 1;
+            case limhamn::logger::type::warning: return 2;
+            case limhamn::logger::type::notice: return 3;
+            default: return -1;
+        }
+    }
+
+    /**
+     * @brief  Bounded multi-producer, single-consumer queue of log lines drained by a background thread.
+     * @note   Producers claim a slot with a compare-and-swap on the head and publish it through the slot's
+     *         sequence number, so they never take a lock. Slot strings keep their capacity, so queuing a message
+     *         of a size seen before does not allocate.
+     */
+    class async_backend {
+            static constexpr int types{4};
+            static constexpr int destinations{types + 1}; // one file per log type, then the standard stream
+            static constexpr std::size_t max_batch{256};
+
+            struct alignas(64) slot {
+                std::atomic<std::size_t> sequence{0};
+                std::uint8_t type{0};
+                std::string text{};
+            };
+
+            limhamn::logger::logger_properties prop{};
+            std::unique_ptr<slot[]> slots{};
+            std::size_t mask{0};
+            alignas(64) std::atomic<std::size_t> head{0};
+            alignas(64) std::atomic<std::size_t> done{0};
+            std::atomic<std::size_t> dropped_total{0};
+            std::atomic<std::size_t> dropped_by_type[types]{};
+            std::atomic<bool> sleeping{false};
+            std::atomic<bool> stopping{false};
+            std::atomic<bool> reopen_requested{false};
+            std::mutex mutex{};
+            std::condition_variable wake{};
+            std::thread worker{};
+
+#if defined(__unix__) || defined(__APPLE__)
+            int fds[destinations]{-1, -1, -1, -1, -1};
+#else
+            std::ofstream files[types]{};
+#endif
+
+            void open_files();
+            void close_files();
+            void write(int destination, const std::vector<const std::string*>& lines);
+            void run();
+        public:
+            explicit async_backend(const limhamn::logger::logger_properties& prop);
+            ~async_backend();
+            async_backend(const async_backend&) = delete;
+            async_backend& operator=(const async_backend&) = delete;
+
+            /**
+             * @brief  Queues a message.
+             * @return bool true if it was queued, false if it was discarded.
+             */
+            bool push(int type, std::string_view prefix, std::string_view data);
+            void flush();
+            void reopen();
+            [[nodiscard]] std::size_t dropped() const;
+    };
+
+    inline async_backend::async_backend(const limhamn::logger::logger_properties& prop) : prop(prop) {
+        std::size_t capacity{2};
+        while (capacity < prop.async_queue_size) {
+            capacity <<= 1;
+        }
+
+        this->slots = std::make_unique<slot[]>(capacity);
+        for (std::size_t i = 0; i < capacity; ++i) {
+            this->slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        this->mask = capacity - 1;
+
+        this->open_files();
+        this->worker = std::thread([this]() { this->run(); });
+    }
+
+    inline async_backend::~async_backend() {
+        this->stopping.store(true);
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->wake.notify_one();
+        }
+        if (this->worker.joinable()) {
+            this->worker.join();
+        }
+        this->close_files();
+    }
+
+    inline bool async_backend::push(const int type, const std::string_view prefix, const std::string_view data) {
+        slot* s{};
+        std::size_t pos = this->head.load(std::memory_order_relaxed);
+
+        for (;;) {
+            s = &this->slots[pos & this->mask];
+            const std::size_t sequence = s->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(pos);
+
+            if (diff == 0) {
+                if (this->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // full
+                if (this->prop.async_overflow != limhamn::logger::overflow::block) {
+                    this->dropped_total.fetch_add(1, std::memory_order_relaxed);
+                    this->dropped_by_type[type].fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                std::this_thread::yield();
+                pos = this->head.load(std::memory_order_relaxed);
+            } else {
+                pos = this->head.load(std::memory_order_relaxed);
+            }
+        }
+
+        s->type = static_cast<std::uint8_t>(type);
+        s->text.assign(prefix);
+        s->text.append(data);
+        s->sequence.store(pos + 1, std::memory_order_release);
+
+        // pairs with the fence in run(), so either the worker sees the message or we see it sleeping
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (this->sleeping.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->wake.notify_one();
+        }
+
+        return true;
+    }
+
+    inline void async_backend::flush() {
+        const std::size_t target = this->head.load();
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->wake.notify_one();
+        }
+        while (this->done.load(std::memory_order_acquire) < target && this->worker.joinable()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    inline void async_backend::reopen() {
+        this->reopen_requested.store(true);
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->wake.notify_one();
+    }
+
+    inline std::size_t async_backend::dropped() const {
+        return this->dropped_total.load(std::memory_order_relaxed);
+    }
+
+    inline void async_backend::open_files() {
+        if (!this->prop.output_to_file) {
+            return;
+        }
+
+        const std::string* paths[types]{&prop.access_log_file, &prop.error_log_file, &prop.warning_log_file, &prop.notice_log_file};
+        for (int i = 0; i < types; ++i) {
+            if (paths[i]->empty()) {
+                continue;
+            }
+#if defined(__unix__) || defined(__APPLE__)
+            // several types may share a file, they share the descriptor too so lines keep their order
+            for (int j = 0; j < i; ++j) {
+                if (*paths[j] == *paths[i] && this->fds[j] != -1) {
+                    this->fds[i] = this->fds[j];
+                    break;
+                }
+            }
+            if (this->fds[i] == -1) {
+                this->fds[i] = ::open(paths[i]->c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+            }
+#else
+            this->files[i].open(*paths[i], std::ios::app | std::ios::binary);
+#endif
+        }
+
+#if defined(__unix__) || defined(__APPLE__)
+        if (this->prop.output_to_std) {
+            this->fds[types] = this->prop.stream == limhamn::logger::stream::stdout ? STDOUT_FILENO :
+                this->prop.stream == limhamn::logger::stream::stderr ? STDERR_FILENO : -1;
+        }
+#endif
+    }
+
+    inline void async_backend::close_files() {
+#if defined(__unix__) || defined(__APPLE__)
+        for (int i = 0; i < types; ++i) {
+            if (this->fds[i] == -1) {
+                continue;
+            }
+            bool shared{false};
+            for (int j = i + 1; j < types; ++j) {
+                shared = shared || this->fds[j] == this->fds[i];
+            }
+            if (!shared) {
+                ::close(this->fds[i]);
+            }
+            this->fds[i] = -1;
+        }
+        this->fds[types] = -1;
+#else
+        for (auto& it : this->files) {
+            if (it.is_open()) {
+                it.close();
+            }
+        }
+#endif
+    }
+
+    inline void async_backend::write(const int destination, const std::vector<const std::string*>& lines) {
+        if (lines.empty()) {
+            return;
+        }
+
+#if defined(__unix__) || defined(__APPLE__)
+        const int fd = this->fds[destination];
+        if (fd == -1) {
+            return;
+        }
+
+        static constexpr std::size_t max_iov = IOV_MAX < 1024 ? IOV_MAX : 1024;
+        iovec iov[max_iov];
+
+        std::size_t next{0};
+        while (next < lines.size()) {
+            std::size_t count{0};
+            for (; count < max_iov && next + count < lines.size(); ++count) {
+                iov[count].iov_base = const_cast<char*>(lines[next + count]->data());
+                iov[count].iov_len = lines[next + count]->size();
+            }
+            next += count;
+
+            iovec* it = iov;
+            while (count > 0) {
+                const ssize_t written = ::writev(fd, it, static_cast<int>(count));
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return;
+                }
+
+                // skip past what was written, a short write can end in the middle of a line
+                auto left = static_cast<std::size_t>(written);
+                while (count > 0 && left >= it->iov_len) {
+                    left -= it->iov_len;
+                    ++it;
+                    --count;
+                }
+                if (count > 0) {
+                    it->iov_base = static_cast<char*>(it->iov_base) + left;
+                    it->iov_len -= left;
+                }
+            }
+        }
+#else
+        if (destination == types) {
+            auto& stream = this->prop.stream == limhamn::logger::stream::stdout ? std::cout : std::cerr;
+            for (const auto* it : lines) {
+                stream << *it;
+            }
+            return;
+        }
+        auto& file = this->files[destination];
+        if (file.is_open()) {
+            for (const auto* it : lines) {
+                file << *it;
+            }
+            file.flush();
+        }
+#endif
+    }
+
+    inline void async_backend::run() {
+        const std::string* prefixes[types]{&prop.access_log_prefix, &prop.error_log_prefix, &prop.warning_log_prefix, &prop.notice_log_prefix};
+        std::vector<const std::string*> lines[destinations]{};
+        std::string notes[types]{};
+        std::size_t reported[types]{};
+        std::size_t tail{0};
+
+        for (auto& it : lines) {
+            it.reserve(max_batch);
+        }
+
+        for (;;) {
+            if (this->reopen_requested.exchange(false)) {
+                this->close_files();
+                this->open_files();
+            }
+
+            std::size_t count{0};
+            while (count < max_batch) {
+                const slot& s = this->slots[(tail + count) & this->mask];
+                if (s.sequence.load(std::memory_order_acquire) != tail + count + 1) {
+                    break;
+                }
+                if (this->prop.output_to_file) {
+                    lines[s.type].push_back(&s.text);
+                }
+                if (this->prop.output_to_std) {
+                    lines[types].push_back(&s.text);
+                }
+                ++count;
+            }
+
+            if (this->prop.async_overflow == limhamn::logger::overflow::count) {
+                for (int i = 0; i < types; ++i) {
+                    const std::size_t dropped = this->dropped_by_type[i].load(std::memory_order_relaxed);
+                    if (dropped != reported[i]) {
+                        notes[i] = *prefixes[i] + std::to_string(dropped - reported[i]) + " log messages dropped because the queue was full\n";
+                        reported[i] = dropped;
+                        if (this->prop.output_to_file) {
+                            lines[i].push_back(&notes[i]);
+                        }
+                        if (this->prop.output_to_std) {
+                            lines[types].push_back(&notes[i]);
+                        }
+                    }
+                }
+            }
+
+            for (int i = 0; i < destinations; ++i) {
+                this->write(i, lines[i]);
+                lines[i].clear();
+            }
+
+            if (count > 0) {
+                for (std::size_t i = 0; i < count; ++i) {
+                    this->slots[(tail + i) & this->mask].sequence.store(tail + i + this->mask + 1, std::memory_order_release);
+                }
+                tail += count;
+                this->done.store(tail, std::memory_order_release);
+                continue;
+            }
+
+            if (this->stopping.load() && this->head.load() == tail) {
+                return;
+            }
+
+            this->sleeping.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                const slot& s = this->slots[tail & this->mask];
+                if (s.sequence.load(std::memory_order_acquire) != tail + 1 && !this->stopping.load() && !this->reopen_requested.load()) {
+                    this->wake.wait_for(lock, std::chrono::milliseconds(100));
+                }
+            }
+            this->sleeping.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    inline const char* level_name(const limhamn::logger::type type) {
+        switch (type) {
+            case limhamn::logger::type::access: return "access";
+            case limhamn::logger::type::error: return "error";
+            case limhamn::logger::type::warning: return "warning";
+            case limhamn::logger::type::notice: return "notice";
+            default: return "undefined";
+        }
+    }
+
+    /**
+     * @brief  Fixed size buffer a line is formatted into. Text that does not fit is cut off.
+     */
+    struct log_buffer {
+        // room kept for the line terminator, so a cut off line still ends properly
+        static constexpr std::size_t reserve{3};
+        static constexpr std::size_t capacity{LIMHAMN_LOGGER_BUFFER_SIZE > reserve ? LIMHAMN_LOGGER_BUFFER_SIZE - reserve : 1};
+
+        char data[capacity + reserve]{};
+        std::size_t size{0};
+        bool json{false}; // escape appended text for a JSON string
+        bool object{false}; // the line is a JSON object, cut back to member_end if it does not fit
+        bool in_value{false}; // inside a JSON string value, after its opening quote
+        bool cut{false}; // text stopped fitting, everything after is dropped
+        bool cut_in_string{false}; // the line was cut off inside a JSON string value, which is closed and kept
+        std::size_t member_end{0}; // end of the last complete member of the JSON object
+
+        void clear() {
+            size = 0;
+            json = false;
+            object = false;
+            in_value = false;
+            cut = false;
+            cut_in_string = false;
+            member_end = 0;
+        }
+
+        // called after each complete member of a JSON object, and after its opening brace
+        void end_member() {
+            if (!cut) {
+                member_end = size;
+            }
+        }
+
+        void append_raw(const std::string_view text, const bool whole = false) {
+            if (cut) {
+                return;
+            }
+
+            std::size_t n = text.size();
+            if (n > capacity - size) {
+                cut = true;
+                cut_in_string = in_value;
+                // escape sequences are written whole or not at all
+                n = whole ? 0 : capacity - size;
+            }
+
+            std::memcpy(data + size, text.data(), n);
+            size += n;
+        }
+
+        void append(const std::string_view text) {
+            if (!json) {
+                append_raw(text);
+                return;
+            }
+
+            std::size_t start{0};
+            for (std::size_t i = 0; i < text.size(); ++i) {
+                const auto c = static_cast<unsigned char>(text[i]);
+                if (c != '"' && c != '\\' && c >= 0x20) {
+                    continue;
+                }
+
+                append_raw(text.substr(start, i - start));
+                start = i + 1;
+
+                switch (c) {
+                    case '"': append_raw("\\\"", true); break;
+                    case '\\': append_raw("\\\\", true); break;
+                    case '\n': append_raw("\\n", true); break;
+                    case '\r': append_raw("\\r", true); break;
+                    case '\t': append_raw("\\t", true); break;
+                    default: {
+                        static constexpr char hex[] = "0123456789abcdef";
+                        const char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+                        append_raw({escaped, sizeof(escaped)}, true);
+                        break;
+                    }
+                }
+            }
+            append_raw(text.substr(start));
+        }
+
+        void finish(const std::string_view terminator) {
+            if (cut_in_string) {
+                data[size++] = '"';
+            } else if (cut && object) {
+                // a cut between or inside keys and numbers cannot be repaired, drop the incomplete member
+                size = member_end;
+            }
+            const std::size_t n = std::min(terminator.size(), sizeof(data) - size);
+            std::memcpy(data + size, terminator.data(), n);
+            size += n;
+        }
+
+        [[nodiscard]] std::string_view view() const {
+            return {data, size};
+        }
+    };
+
+    template <typename T>
+    struct is_field : std::false_type {};
+    template <typename T>
+    struct is_field<limhamn::logger::field<T>> : std::true_type {};
+
+    template <typename T>
+    constexpr bool is_string_v = std::is_convertible_v<const T&, std::string_view> && !std::is_same_v<T, std::nullptr_t>;
+    template <typename T>
+    constexpr bool is_quoted_v = is_string_v<T> || std::is_same_v<T, char>; // JSON has no char type, so a char is a one character string
+
+    template <typename T>
+    inline void append_value(log_buffer& out, const T& value) {
+        if constexpr (std::is_same_v<T, bool>) {
+            out.append_raw(value ? "true" : "false");
+        } else if constexpr (std::is_same_v<T, char>) {
+            out.append({&value, 1});
+        } else if constexpr (std::is_integral_v<T>) {
+            char buf[24];
+            const auto res = std::to_chars(buf, buf + sizeof(buf), value);
+            out.append_raw({buf, static_cast<std::size_t>(res.ptr - buf)});
+        } else if constexpr (std::is_floating_point_v<T>) {
+            // JSON has no nan or infinity, a bare number there must be null
+            if (out.object && !out.json && !std::isfinite(value)) {
+                out.append_raw("null");
+                return;
+            }
+            char buf[32];
+            const int n = std::snprintf(buf, sizeof(buf), "%g", static_cast<double>(value));
+            out.append_raw({buf, n > 0 ? static_cast<std::size_t>(n) : 0});
+        } else if constexpr (is_string_v<T>) {
+            out.append(std::string_view{value});
+        } else {
+            static_assert(!sizeof(T), "limhamn::logger::logger::log: unsupported argument type");
+        }
+    }
+
+    /**
+     * @brief  Type erased argument of logger::log().
+     */
+    struct format_arg {
+        void (*write)(log_buffer&, const void*){};
+        const void* value{};
+        std::string_view key{};
+        bool is_field{false};
+        bool quoted{false}; // a string, which JSON output puts in quotes
+    };
+
+    template <typename T>
+    inline void write_value(log_buffer& out, const void* value) {
+        append_value(out, *static_cast<const T*>(value));
+    }
+
+    template <typename T>
+    inline format_arg make_arg(const T& value) {
+        if constexpr (is_field<T>::value) {
+            using value_type = std::remove_cv_t<std::remove_reference_t<decltype(value.value)>>;
+            return {&write_value<value_type>, &value.value, value.key, true, is_quoted_v<value_type>};
+        } else {
+            return {&write_value<T>, &value, {}, false, is_quoted_v<T>};
+        }
+    }
+
+    /**
+     * @brief  Formats a message, replacing each {} with the next argument that is not a field.
+     */
+    inline void format_message(log_buffer& out, const std::string_view fmt, const format_arg* args, const std::size_t count) {
+        std::size_t next{0};
+        std::size_t start{0};
+
+        for (std::size_t i = 0; i < fmt.size(); ++i) {
+            if ((fmt[i] != '{' && fmt[i] != '}') || i + 1 == fmt.size()) {
+                continue;
+            }
+
+            const char c = fmt[i];
+            const char after = fmt[i + 1];
+            if (after != c && !(c == '{' && after == '}')) {
+                continue;
+            }
+
+            out.append(fmt.substr(start, i - start));
+            start = i + 2;
+            ++i;
+
+            if (after == c) {
+                out.append({&fmt[i], 1});
+                continue;
+            }
+
+            while (next < count && args[next].is_field) {
+                ++next;
+            }
+            if (next < count) {
+                args[next].write(out, args[next].value);
+                ++next;
+            } else {
+                out.append("{}");
+            }
+        }
+
+        out.append(fmt.substr(start));
+    }
+}
+
 inline limhamn::logger::logger::logger(const logger_properties& prop) {
-    this->prop = prop;
+    this->override_properties(prop);
 }
 
 inline void limhamn::logger::logger::override_properties(const logger_properties& prop) noexcept {
     this->prop = prop;
+    this->backend.reset();
+
+    if (prop.async) {
+        try {
+            this->backend = std::make_shared<_limhamn_logger_impl::async_backend>(prop);
+        } catch (...) {
+            // no thread, fall back to writing synchronously
+            this->backend.reset();
+        }
+    }
 }
 
 inline limhamn::logger::logger_properties limhamn::logger::logger::get() noexcept {
     return this->prop;
 }
 
+inline void limhamn::logger::logger::flush() const noexcept {
+    if (this->backend) {
+        this->backend->flush();
+    }
+}
+
+inline void limhamn::logger::logger::reopen() const noexcept {
+    if (this->backend) {
+        this->backend->reopen();
+    }
+}
+
+inline std::size_t limhamn::logger::logger::dropped() const noexcept {
+    return this->backend ? this->backend->dropped() : 0;
+}
+
 inline void limhamn::logger::logger::write_to_log(const logger_error_type type, const std::string& data) const noexcept {
+    if (this->backend) {
+        const int index = _limhamn_logger_impl::type_index(type);
+        if (index == -1) {
+            return;
+        }
+
+        try {
+            const std::string* prefixes[]{&prop.access_log_prefix, &prop.error_log_prefix, &prop.warning_log_prefix, &prop.notice_log_prefix};
+            if (prop.log_date) {
+                thread_local std::string prefix{};
+                prefix.assign(*prefixes[index]);
+                prefix.append(_limhamn_logger_impl::format_date());
+                prefix.append(": ");
+                static_cast<void>(this->backend->push(index, prefix, data));
+            } else {
+                static_cast<void>(this->backend->push(index, *prefixes[index], data));
+            }
+        } catch (...) {
+        }
+        return;
+    }
+
     static_cast<void>(write_to_log_f(type, data));
 }
 
@@ -180,11 +974,7 @@ inline limhamn::logger::logger_return limhamn::logger::logger::write_to_log_f(co
     }
 
     if (prop.log_date) {
-        std::time_t time = std::time(nullptr);
-        std::tm local = *std::localtime(&time);
-
-        char buf[20];
-        std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &local);
+        const char* buf = _limhamn_logger_impl::format_date();
 
         ret.date = buf;
 
@@ -195,6 +985,13 @@ inline limhamn::logger::logger_return limhamn::logger::logger::write_to_log_f(co
     ret.file = logfile;
     ret.type = type;
 
+    if (this->backend) {
+        ret.message = data;
+        ret.data = prefix + data;
+        ret.status = this->backend->push(_limhamn_logger_impl::type_index(type), prefix, data) ? status::success : status::failure;
+        return ret;
+    }
+
     if (prop.output_to_std) {
         if (prop.stream == stream::stderr) {
             std::cerr << prefix << data;
@@ -226,4 +1023,126 @@ inline limhamn::logger::logger_return limhamn::logger::logger::write_to_log_f(co
 
     return ret;
 }
+
+inline void limhamn::logger::logger::write_line(const logger_error_type type, const std::string_view line) const noexcept {
+    const int index = _limhamn_logger_impl::type_index(type);
+    if (index == -1) {
+        return;
+    }
+
+    try {
+        if (this->backend) {
+            static_cast<void>(this->backend->push(index, {}, line));
+            return;
+        }
+
+        if (prop.output_to_std) {
+            if (prop.stream == stream::stderr) {
+                std::cerr.write(line.data(), static_cast<std::streamsize>(line.size()));
+            } else if (prop.stream == stream::stdout) {
+                std::cout.write(line.data(), static_cast<std::streamsize>(line.size()));
+            }
+        }
+
+        const std::string* files[]{&prop.access_log_file, &prop.error_log_file, &prop.warning_log_file, &prop.notice_log_file};
+        if (prop.output_to_file && !files[index]->empty()) {
+            std::ofstream stream(*files[index], std::ios::app);
+            stream.write(line.data(), static_cast<std::streamsize>(line.size()));
+        }
+    } catch (...) {
+    }
+}
+
+template <typename... Args>
+inline void limhamn::logger::logger::log(const logger_error_type type, const std::string_view fmt, const Args&... args) const noexcept {
+    const int index = _limhamn_logger_impl::type_index(type);
+    if (index == -1 || !enabled(type)) {
+        return;
+    }
+
+    thread_local _limhamn_logger_impl::log_buffer out{};
+    out.clear();
+
+    // one extra element, so that there is an array even without arguments
+    const _limhamn_logger_impl::format_arg argv[] = {_limhamn_logger_impl::make_arg(args)..., {}};
+    constexpr std::size_t argc = sizeof...(Args);
+
+    if (prop.format == output_format::json) {
+        out.object = true;
+        out.append_raw("{");
+        out.end_member();
+        if (prop.log_date) {
+            out.append_raw("\"time\":\"");
+            out.append_raw(_limhamn_logger_impl::format_date());
+            out.append_raw("\"");
+            out.end_member();
+        }
+        out.append_raw(prop.log_date ? ",\"level\":\"" : "\"level\":\"");
+        out.append_raw(_limhamn_logger_impl::level_name(type));
+        out.append_raw("\"");
+        out.end_member();
+        out.append_raw(",\"message\":\"");
+        out.json = true;
+        out.in_value = true;
+        _limhamn_logger_impl::format_message(out, fmt, argv, argc);
+        out.json = false;
+        out.append_raw("\"");
+        out.in_value = false;
+        out.end_member();
+
+        for (std::size_t i = 0; i < argc; ++i) {
+            if (!argv[i].is_field) {
+                continue;
+            }
+            out.append_raw(",\"");
+            out.json = true;
+            out.append(argv[i].key);
+            out.json = false;
+            out.append_raw(argv[i].quoted ? "\":\"" : "\":");
+            out.json = argv[i].quoted;
+            out.in_value = argv[i].quoted;
+            argv[i].write(out, argv[i].value);
+            out.json = false;
+            if (argv[i].quoted) {
+                out.append_raw("\"");
+            }
+            out.in_value = false;
+            out.end_member();
+        }
+
+        out.finish("}\n");
+    } else {
+        const std::string* prefixes[]{&prop.access_log_prefix, &prop.error_log_prefix, &prop.warning_log_prefix, &prop.notice_log_prefix};
+        out.append_raw(*prefixes[index]);
+        if (prop.log_date) {
+            out.append_raw(_limhamn_logger_impl::format_date());
+            out.append_raw(": ");
+        }
+        _limhamn_logger_impl::format_message(out, fmt, argv, argc);
+
+        for (std::size_t i = 0; i < argc; ++i) {
+            if (!argv[i].is_field) {
+                continue;
+            }
+            out.append_raw(" ");
+            out.append(argv[i].key);
+            out.append_raw("=");
+            argv[i].write(out, argv[i].value);
+        }
+
+        out.finish("\n");
+    }
+
+    this->write_line(type, out.view());
+}
+
+template <limhamn::logger::logger_error_type T, typename... Args>
+inline void limhamn::logger::logger::log(const std::string_view fmt, const Args&... args) const noexcept {
+    if constexpr (enabled(T)) {
+        this->log(T, fmt, args...);
+    } else {
+        static_cast<void>(fmt);
+        (static_cast<void>(args), ...);
+    }
+}
 #endif // LIMHAMN_LOGGER_IMPL
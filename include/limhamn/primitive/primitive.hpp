@@ -21,6 +21,9 @@
 #include <vector>
 #include <filesystem>
 #include <mutex>
+#include <list>
+#include <unordered_map>
+#include <array>
 
 #define LIMHAMN_PRIMITIVE
 
@@ -50,6 +53,15 @@ namespace limhamn::primitive {
         PangoLayout* layout{};
         bool active{false};
         std::recursive_mutex mtx{};
+        // widths of recently measured text, most recently used first; the key is prefixed by a markup flag
+        std::list<std::pair<std::string, int>> cache{};
+        std::unordered_map<std::string, std::list<std::pair<std::string, int>>::iterator> cache_index{};
+        std::size_t cache_size{1024};
+        // advances of the printable ASCII characters in Pango units, or -1 until measured
+        std::array<int, 95> ascii_advances{};
+        bool ascii_fast_path{false};
+
+        int measure(const char* text, int length, bool markup);
     public:
         explicit font_manager() = default;
         /**
@@ -66,6 +78,28 @@ namespace limhamn::primitive {
          * @return A pair of integers representing the estimated width and height of the text.
          */
         [[nodiscard]] std::pair<int,int> estimate_length(const std::string& text, int length = -1, bool markup = true);
+        /**
+         * @brief Finds how much of a text string fits in a width.
+         * @pre The font manager must be initialized with a font.
+         * @param text The text string.
+         * @param width The width the text must fit in.
+         * @param markup If true, markup is applied to the text.
+         * @return The length in bytes of the longest prefix that fits, ending at a character boundary.
+         * @note Uses a binary search, so it takes about log2(n) measurements rather than n.
+         */
+        [[nodiscard]] int fit_length(const std::string& text, int width, bool markup = true);
+        /**
+         * @brief Sets the number of measurements that are cached.
+         * @param size The number of measurements. 0 disables the cache.
+         */
+        void set_cache_size(std::size_t size);
+        /**
+         * @brief Sets whether plain printable ASCII text is measured by adding up cached character advances instead of laying it out with Pango.
+         * @param enabled If true, the fast path is used. Off by default.
+         * @note Much faster, but ignores kerning, so widths may be a pixel or two wider than Pango's for some fonts, and
+         *       fit_length() and the ellipsis in draw_text() may cut text a character earlier or later than Pango would.
+         */
+        void set_ascii_fast_path(bool enabled);
         /**
          * @brief Gets the internal PangoLayout object as a reference.
          * @pre The font manager must be initialized with a font.
@@ -219,6 +253,95 @@ namespace limhamn::primitive {
         int w{};
         int h{};
     };
+    /**
+     * @brief Class for recording drawing operations, to be drawn all at once by draw_manager::submit().
+     * @note Colors are parsed when a command is recorded and stored as packed RGBA, so a frame can be recorded without
+     *       the draw manager's lock and submitted without any parsing.
+     */
+    class draw_frame {
+        enum class kind {
+            rect,
+            text,
+            image,
+            arrow,
+            circle,
+        };
+        struct command {
+            kind type{kind::rect};
+            draw_position pos{};
+            uint32_t color{}; // rect: the fill; text: the background; arrow and circle: prev
+            uint32_t second_color{}; // text: the text; arrow and circle: next
+            int direction{}; // arrow and circle: the direction; text: the padding
+            int slash{};
+            bool flag{}; // rect: filled; text: markup
+            std::string text{};
+            void* data{};
+        };
+        std::vector<command> commands{};
+    public:
+        draw_frame() = default;
+        /**
+         * @brief Packs a color.
+         * @param col The color, in the format #RRGGBB.
+         * @param alpha The alpha, 0 to 255.
+         * @return The color as 0xRRGGBBAA.
+         */
+        [[nodiscard]] static uint32_t pack_color(const std::string& col, int alpha = 255);
+        /**
+         * @brief Records a rectangle. See draw_manager::draw_rect().
+         * @param pos The position and size of the rectangle.
+         * @param props The properties of the rectangle shape.
+         */
+        void draw_rect(const draw_position& pos, const draw_properties& props);
+        /**
+         * @brief Records a rectangle.
+         * @param pos The position and size of the rectangle.
+         * @param color The color, from pack_color().
+         * @param filled If false, only the outline is drawn.
+         */
+        void draw_rect(const draw_position& pos, uint32_t color, bool filled = true);
+        /**
+         * @brief Records text. See draw_manager::draw_text().
+         * @param pos The position and size of the text.
+         * @param padding The padding around the text.
+         * @param text The text to be drawn.
+         * @param markup If true, markup is applied to the text.
+         * @param props The properties of the text.
+         */
+        void draw_text(const draw_position& pos, int padding, std::string text, bool markup, const draw_properties& props);
+        /**
+         * @brief Records an image. See draw_manager::draw_image().
+         * @param data Pointer to the image data, which must stay valid until the frame is submitted.
+         * @param coords The coordinates where the image will be drawn.
+         */
+        void draw_image(void* data, const draw_position& coords);
+        /**
+         * @brief Records an arrow shape. See draw_manager::draw_arrow().
+         * @param pos The position and size of the arrow.
+         * @param direction The direction of the arrow (0 or 1).
+         * @param slash The slash direction (0 or 1).
+         * @param props The properties of the arrow shape.
+         */
+        void draw_arrow(const draw_position& pos, int direction, int slash, const draw_shape_properties& props);
+        /**
+         * @brief Records a circle shape. See draw_manager::draw_circle().
+         * @param pos The position and size of the circle.
+         * @param direction The direction of the circle (0 or 1).
+         * @param props The properties of the circle shape.
+         */
+        void draw_circle(const draw_position& pos, int direction, const draw_shape_properties& props);
+        /**
+         * @brief Removes all commands, keeping the memory for the next frame.
+         */
+        void clear();
+        /**
+         * @brief Gets the number of recorded commands.
+         * @return The number of commands.
+         */
+        [[nodiscard]] std::size_t size() const;
+
+        friend class draw_manager;
+    };
     /**
      * @brief Class for managing drawing operations.
      * @note This class is used for drawing shapes, images, and text.
@@ -236,9 +359,21 @@ namespace limhamn::primitive {
         cairo_surface_t* surface{};
         cairo_t* d{};
         std::recursive_mutex mtx{};
+        std::vector<draw_position> damage{}; // merged, clipped rectangles drawn since the last map() or map_damage()
+        bool full_damage{true};
+#if LIMHAMN_PRIMITIVE_X11
+        Window last_window{};
+#endif
 
-        static void cairo_set_source_hex(cairo_t* cr, const std::string& col, int alpha);
+        void set_source(uint32_t color);
         void reinit();
+        void ensure_context();
+        void add_damage(draw_position pos);
+        void image_impl(void* data, const draw_position& coords);
+        void arrow_impl(const draw_position& pos, int direction, int slash, uint32_t prev, uint32_t next);
+        void circle_impl(const draw_position& pos, int direction, uint32_t prev, uint32_t next);
+        void rects_impl(const draw_position* pos, std::size_t count, uint32_t color, bool filled);
+        int text_impl(const draw_position& pos, int padding, const std::string& input_text, bool markup, uint32_t background, uint32_t foreground);
     public:
         explicit draw_manager() = default;
 #if LIMHAMN_PRIMITIVE_CANVAS
@@ -317,19 +452,43 @@ namespace limhamn::primitive {
          * @param props The properties of the rectangle shape.
          */
         void draw_rect(const draw_position& pos, const draw_properties& props);
+        /**
+         * @brief Draws a recorded frame.
+         * @param frame The frame.
+         * @note Takes the lock once for the whole frame. Rectangles of the same color are drawn as one path, including ones
+         *       recorded later if nothing in between overlaps them, so the result is the same as drawing the commands in order.
+         */
+        void submit(const draw_frame& frame);
 #if LIMHAMN_PRIMITIVE_X11
         /*
          * @brief Map the drawable to a window.
          * @param win The window to map the drawable to.
          * @note This function only needs to be called for X11 protocol. Do it when the window has been created and preferably when you're done drawing.
+         * @note Copies the whole drawable, so it is also what to call on Expose. See map_damage() to copy only what was drawn.
          */
         void map(Window win);
+        /*
+         * @brief Map the regions drawn since the last map to a window.
+         * @param win The window to map the drawable to.
+         * @note Nothing is sent if nothing was drawn, so use map() when the window needs a full copy, e.g. on Expose.
+         *       The first call for a window, and the first after invalidate() or resize(), copies everything.
+         */
+        void map_damage(Window win);
 #endif
         /**
          * @brief Maps the drawable to the screen.
-         * @note Does not need to be called, but exists anyway.
+         * @note Does not need to be called, but exists anyway. For the canvas protocol, it flushes the drawing to the canvas data and clears the damage; call get_damage() first to know which regions of the data changed.
          */
         void map();
+        /**
+         * @brief Gets the regions drawn since the last call to map().
+         * @return The regions, merged and clipped to the drawing area. The whole drawing area if everything must be presented again.
+         */
+        [[nodiscard]] std::vector<draw_position> get_damage();
+        /**
+         * @brief Marks the whole drawing area as drawn, so that the next map() presents all of it.
+         */
+        void invalidate();
         /**
          * @brief Saves the current screen to a file.
          * @param file The filename to save the screen to.
@@ -408,12 +567,33 @@ inline void limhamn::primitive::font_manager::init_font(const std::string& font)
 
     pango_layout_set_font_description(this->layout, desc);
 
+    this->ascii_advances.fill(-1);
+    this->cache.clear();
+    this->cache_index.clear();
+
     metrics = pango_context_get_metrics(context, desc, pango_language_from_string ("en-us"));
     this->h = pango_font_metrics_get_height(metrics) / PANGO_SCALE;
 
     pango_font_metrics_unref(metrics);
     g_object_unref(context);
 }
+inline int limhamn::primitive::font_manager::measure(const char* text, const int length, const bool markup) {
+    PangoRectangle r;
+
+    if (markup) {
+        pango_layout_set_markup(this->layout, text, length);
+    } else {
+        pango_layout_set_text(this->layout, text, length);
+    }
+
+    pango_layout_get_extents(this->layout, nullptr, &r);
+
+    if (markup) {
+        pango_layout_set_attributes(this->layout, nullptr);
+    }
+
+    return r.width;
+}
 [[nodiscard]] inline std::pair<int,int> limhamn::primitive::font_manager::estimate_length(const std::string& text, const int length, bool markup) {
     std::lock_guard<std::recursive_mutex> lock(this->mtx);
 
@@ -428,25 +608,104 @@ inline void limhamn::primitive::font_manager::init_font(const std::string& font)
         markup = true;
     }
 
-    PangoRectangle r;
+    const std::size_t size = length < 0 ? text.length() : std::min(static_cast<std::size_t>(length), text.length());
+
+    if (!markup && this->ascii_fast_path) {
+        long long width{0};
+        bool ascii = true;
+        for (std::size_t i = 0; i < size && ascii; ++i) {
+            const auto c = static_cast<unsigned char>(text[i]);
+            if (c < 0x20 || c > 0x7E) {
+                ascii = false;
+                break;
+            }
+
+            int& advance = this->ascii_advances[c - 0x20];
+            if (advance < 0) {
+                const char glyph = static_cast<char>(c);
+                advance = this->measure(&glyph, 1, false);
+            }
+            width += advance;
+        }
 
-    if (markup) {
-        pango_layout_set_markup(this->layout, text.c_str(), static_cast<int>(length == -1 ? text.length() : length));
-    } else {
-        pango_layout_set_text(this->layout, text.c_str(), static_cast<int>(length == -1 ? text.length() : length));
+        if (ascii) {
+            return {static_cast<int>(width / PANGO_SCALE), this->h};
+        }
     }
 
-    pango_layout_get_extents(this->layout, nullptr, &r);
+    std::string key{};
+    key.reserve(size + 1);
+    key += markup ? 'm' : 't';
+    key.append(text, 0, size);
 
-    if (markup) {
-        pango_layout_set_attributes(this->layout, nullptr);
+    if (this->cache_size != 0) {
+        const auto it = this->cache_index.find(key);
+        if (it != this->cache_index.end()) {
+            this->cache.splice(this->cache.begin(), this->cache, it->second);
+            return {it->second->second, this->h};
+        }
+    }
+
+    const int width = this->measure(text.c_str(), static_cast<int>(size), markup) / PANGO_SCALE;
+
+    if (this->cache_size != 0) {
+        this->cache.emplace_front(key, width);
+        this->cache_index.emplace(std::move(key), this->cache.begin());
+        while (this->cache.size() > this->cache_size) {
+            this->cache_index.erase(this->cache.back().first);
+            this->cache.pop_back();
+        }
     }
 
     return {
-        (r.width / PANGO_SCALE),
+        width,
         this->h
     };
 }
+[[nodiscard]] inline int limhamn::primitive::font_manager::fit_length(const std::string& text, const int width, const bool markup) {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    if (this->estimate_length(text, -1, markup).first <= width) {
+        return static_cast<int>(text.length());
+    }
+
+    // the lengths a prefix may have without splitting a UTF-8 sequence
+    std::vector<int> boundaries{};
+    boundaries.reserve(text.length() + 1);
+    for (std::size_t i = 0; i <= text.length(); ++i) {
+        if (i == text.length() || (static_cast<unsigned char>(text[i]) & 0xC0) != 0x80) {
+            boundaries.push_back(static_cast<int>(i));
+        }
+    }
+
+    // boundaries[lo] fits, boundaries[hi] does not
+    std::size_t lo{0};
+    std::size_t hi{boundaries.size() - 1};
+    while (hi - lo > 1) {
+        const std::size_t mid = lo + (hi - lo) / 2;
+        if (this->estimate_length(text, boundaries[mid], markup).first <= width) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return boundaries[lo];
+}
+inline void limhamn::primitive::font_manager::set_cache_size(const std::size_t size) {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    this->cache_size = size;
+    while (this->cache.size() > this->cache_size) {
+        this->cache_index.erase(this->cache.back().first);
+        this->cache.pop_back();
+    }
+}
+inline void limhamn::primitive::font_manager::set_ascii_fast_path(const bool enabled) {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    this->ascii_fast_path = enabled;
+}
 [[nodiscard]] inline PangoLayout& limhamn::primitive::font_manager::get_layout() const {
     if (!this->layout) {
         throw std::runtime_error("FontManager not initialized");
@@ -544,24 +803,90 @@ inline limhamn::primitive::image_manager::~image_manager() {
     initialized = false;
 }
 
-inline void limhamn::primitive::draw_manager::cairo_set_source_hex(cairo_t* cr, const std::string& col, int alpha) {
+[[nodiscard]] inline uint32_t limhamn::primitive::draw_frame::pack_color(const std::string& col, int alpha) {
     if (col.empty() || col[0] != '#' || col.length() != 7) {
         throw std::invalid_argument("Invalid color format. Expected format: #RRGGBB");
     }
 
-    unsigned int hex;
-    std::istringstream iss(col.substr(1));
-    iss >> std::hex >> hex;
+    uint32_t hex{0};
+    for (std::size_t i = 1; i < col.length(); ++i) {
+        const char c = col[i];
+        uint32_t digit{};
+        if (c >= '0' && c <= '9') {
+            digit = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            digit = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            digit = c - 'A' + 10;
+        } else {
+            throw std::invalid_argument("Failed to parse color hex value");
+        }
+        hex = hex << 4 | digit;
+    }
 
-    if (iss.fail()) {
-        throw std::invalid_argument("Failed to parse color hex value");
+    return hex << 8 | static_cast<uint32_t>(std::clamp(alpha, 0, 255));
+}
+inline void limhamn::primitive::draw_frame::draw_rect(const draw_position& pos, const draw_properties& props) {
+    this->draw_rect(pos, pack_color(props.invert ? props.background : props.foreground, props.invert ? props.background_alpha : props.foreground_alpha), props.filled);
+}
+inline void limhamn::primitive::draw_frame::draw_rect(const draw_position& pos, uint32_t color, bool filled) {
+    command cmd{};
+    cmd.type = kind::rect;
+    cmd.pos = pos;
+    cmd.color = color;
+    cmd.flag = filled;
+    this->commands.push_back(std::move(cmd));
+}
+inline void limhamn::primitive::draw_frame::draw_text(const draw_position& pos, int padding, std::string text, bool markup, const draw_properties& props) {
+    command cmd{};
+    cmd.type = kind::text;
+    cmd.pos = pos;
+    cmd.color = pack_color(props.invert ? props.foreground : props.background, props.invert ? props.foreground_alpha : props.background_alpha);
+    cmd.second_color = pack_color(props.foreground, props.foreground_alpha);
+    cmd.direction = padding;
+    cmd.flag = markup;
+    cmd.text = std::move(text);
+    this->commands.push_back(std::move(cmd));
+}
+inline void limhamn::primitive::draw_frame::draw_image(void* data, const draw_position& coords) {
+    if (data == nullptr) {
+        throw std::invalid_argument("Image data cannot be null");
     }
 
-    double r = ((hex >> 16) & 0xFF) / 255.0;
-    double g = ((hex >> 8) & 0xFF) / 255.0;
-    double b = (hex & 0xFF) / 255.0;
+    command cmd{};
+    cmd.type = kind::image;
+    cmd.pos = coords;
+    cmd.data = data;
+    this->commands.push_back(std::move(cmd));
+}
+inline void limhamn::primitive::draw_frame::draw_arrow(const draw_position& pos, int direction, int slash, const draw_shape_properties& props) {
+    command cmd{};
+    cmd.type = kind::arrow;
+    cmd.pos = pos;
+    cmd.color = pack_color(props.prev, props.prev_alpha);
+    cmd.second_color = pack_color(props.next, props.next_alpha);
+    cmd.direction = direction;
+    cmd.slash = slash;
+    this->commands.push_back(std::move(cmd));
+}
+inline void limhamn::primitive::draw_frame::draw_circle(const draw_position& pos, int direction, const draw_shape_properties& props) {
+    command cmd{};
+    cmd.type = kind::circle;
+    cmd.pos = pos;
+    cmd.color = pack_color(props.prev, props.prev_alpha);
+    cmd.second_color = pack_color(props.next, props.next_alpha);
+    cmd.direction = direction;
+    this->commands.push_back(std::move(cmd));
+}
+inline void limhamn::primitive::draw_frame::clear() {
+    this->commands.clear();
+}
+[[nodiscard]] inline std::size_t limhamn::primitive::draw_frame::size() const {
+    return this->commands.size();
+}
 
-    cairo_set_source_rgba(cr, r, g, b, alpha / 255.0);
+inline void limhamn::primitive::draw_manager::set_source(const uint32_t color) {
+    cairo_set_source_rgba(this->d, (color >> 24 & 0xFF) / 255.0, (color >> 16 & 0xFF) / 255.0, (color >> 8 & 0xFF) / 255.0, (color & 0xFF) / 255.0);
 }
 
 #if LIMHAMN_PRIMITIVE_CANVAS
@@ -643,16 +968,13 @@ inline void limhamn::primitive::draw_manager::resize(const draw_size& size) {
         }
     }
 #endif
-}
-inline void limhamn::primitive::draw_manager::draw_image(void* data, const draw_position& coords) {
-    std::lock_guard<std::recursive_mutex> lock(this->mtx);
 
-    if (data == nullptr) {
-        throw std::invalid_argument("Image data cannot be null");
+    // the surface refers to the old pixmap or size
+    if (this->proto != protocol::unknown) {
+        this->reinit();
     }
-
-    this->reinit();
-
+}
+inline void limhamn::primitive::draw_manager::image_impl(void* data, const draw_position& coords) {
     auto manager = image_manager();
     manager.initialize(static_cast<uint8_t*>(data), coords.w, coords.h);
 
@@ -663,10 +985,7 @@ inline void limhamn::primitive::draw_manager::draw_image(void* data, const draw_
 
     cairo_set_source_surface(this->d, this->surface, this->w, this->h);
 }
-
-inline void limhamn::primitive::draw_manager::draw_arrow(const draw_position& pos, int direction, int slash, const draw_shape_properties& props) {
-    std::lock_guard<std::recursive_mutex> lock(this->mtx);
-
+inline void limhamn::primitive::draw_manager::arrow_impl(const draw_position& pos, int direction, int slash, const uint32_t prev, const uint32_t next) {
     int x = pos.x;
     int y = pos.y;
     int w = pos.w;
@@ -675,11 +994,9 @@ inline void limhamn::primitive::draw_manager::draw_arrow(const draw_position& po
     x = direction ? x : x + w;
     w = direction ? w : - w;
 
-    this->reinit();
-
     double hh = slash ? (direction ? 0 : h) : h / 2;
 
-    cairo_set_source_hex(this->d, props.prev, props.prev_alpha);
+    this->set_source(prev);
     cairo_set_operator(this->d, CAIRO_OPERATOR_SOURCE);
 
     cairo_rectangle(this->d, x, y, w, h);
@@ -690,16 +1007,11 @@ inline void limhamn::primitive::draw_manager::draw_arrow(const draw_position& po
     cairo_line_to(this->d, x, y + h);
     cairo_close_path(this->d);
 
-    cairo_set_source_hex(this->d, props.next, props.next_alpha);
+    this->set_source(next);
     cairo_fill(this->d);
 }
-
-inline void limhamn::primitive::draw_manager::draw_circle(const draw_position& pos, int direction, const draw_shape_properties& props) {
-    std::lock_guard<std::recursive_mutex> lock(this->mtx);
-
-    this->reinit();
-
-    cairo_set_source_hex(this->d, props.prev, props.prev_alpha);
+inline void limhamn::primitive::draw_manager::circle_impl(const draw_position& pos, int direction, const uint32_t prev, const uint32_t next) {
+    this->set_source(prev);
     cairo_set_operator(this->d, CAIRO_OPERATOR_SOURCE);
 
     cairo_rectangle(this->d, pos.x, pos.y, pos.w, pos.h);
@@ -715,34 +1027,195 @@ inline void limhamn::primitive::draw_manager::draw_circle(const draw_position& p
     cairo_arc(this->d, cx, cy, rad, start, end);
     cairo_close_path(this->d);
 
-    cairo_set_source_hex(this->d, props.next, props.next_alpha);
+    this->set_source(next);
     cairo_fill(this->d);
 }
-inline void limhamn::primitive::draw_manager::draw_rect(const draw_position& pos, const draw_properties& props) {
-    std::lock_guard<std::recursive_mutex> lock(this->mtx);
-
-    this->reinit();
-
-    cairo_set_source_hex(this->d, props.invert ? props.background.c_str() : props.foreground.c_str(), props.invert ? props.background_alpha : props.foreground_alpha);
+inline void limhamn::primitive::draw_manager::rects_impl(const draw_position* pos, const std::size_t count, const uint32_t color, const bool filled) {
+    this->set_source(color);
     cairo_set_operator(this->d, CAIRO_OPERATOR_SOURCE);
 
-    if (props.filled) {
-        cairo_rectangle(this->d, pos.x, pos.y, pos.w, pos.h);
+    for (std::size_t i = 0; i < count; ++i) {
+        if (filled) {
+            cairo_rectangle(this->d, pos[i].x, pos[i].y, pos[i].w, pos[i].h);
+        } else {
+            cairo_rectangle(this->d, pos[i].x, pos[i].y, pos[i].w - 1, pos[i].h - 1);
+        }
+    }
+
+    if (filled) {
         cairo_fill(this->d);
     } else {
-        cairo_rectangle(this->d, pos.x, pos.y, pos.w - 1, pos.h - 1);
         cairo_stroke(this->d);
     }
 }
+inline void limhamn::primitive::draw_manager::draw_image(void* data, const draw_position& coords) {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    if (data == nullptr) {
+        throw std::invalid_argument("Image data cannot be null");
+    }
+
+    this->ensure_context();
+    this->add_damage(coords);
+    this->image_impl(data, coords);
+}
+
+inline void limhamn::primitive::draw_manager::draw_arrow(const draw_position& pos, int direction, int slash, const draw_shape_properties& props) {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    this->ensure_context();
+    this->add_damage(pos);
+    this->arrow_impl(pos, direction, slash, draw_frame::pack_color(props.prev, props.prev_alpha), draw_frame::pack_color(props.next, props.next_alpha));
+}
+
+inline void limhamn::primitive::draw_manager::draw_circle(const draw_position& pos, int direction, const draw_shape_properties& props) {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    this->ensure_context();
+    this->add_damage(pos);
+    this->circle_impl(pos, direction, draw_frame::pack_color(props.prev, props.prev_alpha), draw_frame::pack_color(props.next, props.next_alpha));
+}
+inline void limhamn::primitive::draw_manager::draw_rect(const draw_position& pos, const draw_properties& props) {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    this->ensure_context();
+    this->add_damage(pos);
+    this->rects_impl(&pos, 1, draw_frame::pack_color(props.invert ? props.background : props.foreground, props.invert ? props.background_alpha : props.foreground_alpha), props.filled);
+}
+inline void limhamn::primitive::draw_manager::submit(const draw_frame& frame) {
+    // a run of commands drawn with one state; only rectangles share a batch
+    struct batch {
+        const draw_frame::command* first{};
+        std::vector<draw_position> rects{};
+        int x1{}, y1{}, x2{}, y2{};
+    };
+
+    const auto bounds = [](const draw_frame::command& cmd) {
+        draw_position pos = cmd.pos;
+        if (pos.w < 0) {
+            pos.x += pos.w;
+            pos.w = -pos.w;
+        }
+        if (pos.h < 0) {
+            pos.y += pos.h;
+            pos.h = -pos.h;
+        }
+        // filled rectangles on whole pixels cover exactly their area; anything else may reach a pixel outside
+        const int pad = cmd.type == draw_frame::kind::rect && cmd.flag ? 0 : 1;
+        return std::array<int, 4>{pos.x - pad, pos.y - pad, pos.x + pos.w + pad, pos.y + pos.h + pad};
+    };
+
+    std::vector<batch> batches{};
+    batches.reserve(frame.commands.size());
+
+    for (const auto& cmd : frame.commands) {
+        const auto box = bounds(cmd);
+
+        // move a rectangle back into an earlier batch of the same state, as long as it does not pass anything it overlaps
+        if (cmd.type == draw_frame::kind::rect) {
+            constexpr std::size_t max_lookback = 32;
+            batch* target{nullptr};
+            for (std::size_t i = batches.size(), steps = 0; i > 0 && steps < max_lookback; --i, ++steps) {
+                batch& it = batches[i - 1];
+                if (it.first->type == draw_frame::kind::rect && it.first->color == cmd.color && it.first->flag == cmd.flag) {
+                    target = &it;
+                    break;
+                }
+                if (box[0] < it.x2 && it.x1 < box[2] && box[1] < it.y2 && it.y1 < box[3]) {
+                    break;
+                }
+            }
+
+            if (target) {
+                target->rects.push_back(cmd.pos);
+                target->x1 = std::min(target->x1, box[0]);
+                target->y1 = std::min(target->y1, box[1]);
+                target->x2 = std::max(target->x2, box[2]);
+                target->y2 = std::max(target->y2, box[3]);
+                continue;
+            }
+        }
+
+        batch next{};
+        next.first = &cmd;
+        if (cmd.type == draw_frame::kind::rect) {
+            next.rects.push_back(cmd.pos);
+        }
+        next.x1 = box[0];
+        next.y1 = box[1];
+        next.x2 = box[2];
+        next.y2 = box[3];
+        batches.push_back(std::move(next));
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    this->ensure_context();
+
+    for (const auto& it : batches) {
+        const auto& cmd = *it.first;
+        switch (cmd.type) {
+            case draw_frame::kind::rect:
+                for (const auto& rect : it.rects) {
+                    this->add_damage(rect);
+                }
+                this->rects_impl(it.rects.data(), it.rects.size(), cmd.color, cmd.flag);
+                break;
+            case draw_frame::kind::text:
+                this->text_impl(cmd.pos, cmd.direction, cmd.text, cmd.flag, cmd.color, cmd.second_color);
+                break;
+            case draw_frame::kind::image:
+                this->add_damage(cmd.pos);
+                this->image_impl(cmd.data, cmd.pos);
+                break;
+            case draw_frame::kind::arrow:
+                this->add_damage(cmd.pos);
+                this->arrow_impl(cmd.pos, cmd.direction, cmd.slash, cmd.color, cmd.second_color);
+                break;
+            case draw_frame::kind::circle:
+                this->add_damage(cmd.pos);
+                this->circle_impl(cmd.pos, cmd.direction, cmd.color, cmd.second_color);
+                break;
+        }
+    }
+}
 #if LIMHAMN_PRIMITIVE_X11
 inline void limhamn::primitive::draw_manager::map(Window win) {
     std::lock_guard<std::recursive_mutex> lock(this->mtx);
 
+    this->invalidate();
+    this->map_damage(win);
+}
+inline void limhamn::primitive::draw_manager::map_damage(Window win) {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
     if (this->proto == protocol::x11) {
         if (!this->xwin.drawable) {
             throw std::runtime_error("Drawable not initialized");
         }
-        XCopyArea(this->xwin.dpy, this->xwin.drawable, win, this->xwin.gc, 0, 0, this->w, this->h, 0, 0);
+
+        if (win != this->last_window) {
+            this->full_damage = true;
+            this->last_window = win;
+        }
+        if (!this->full_damage && this->damage.empty()) {
+            return;
+        }
+
+        if (this->surface) {
+            cairo_surface_flush(this->surface);
+        }
+
+        if (this->full_damage) {
+            XCopyArea(this->xwin.dpy, this->xwin.drawable, win, this->xwin.gc, 0, 0, this->w, this->h, 0, 0);
+        } else {
+            for (const auto& it : this->damage) {
+                XCopyArea(this->xwin.dpy, this->xwin.drawable, win, this->xwin.gc, it.x, it.y, it.w, it.h, it.x, it.y);
+            }
+        }
+
+        this->damage.clear();
+        this->full_damage = false;
         XFlush(this->xwin.dpy);
     } else {
         throw std::runtime_error("Mapping not supported for this protocol");
@@ -755,6 +1228,93 @@ inline void limhamn::primitive::draw_manager::map() {
     if (this->proto == protocol::x11) {
         throw std::runtime_error("X11 must be called with a window");
     }
+
+    if (this->surface) {
+        cairo_surface_flush(this->surface);
+    }
+
+    this->damage.clear();
+    this->full_damage = false;
+}
+[[nodiscard]] inline std::vector<limhamn::primitive::draw_position> limhamn::primitive::draw_manager::get_damage() {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    if (this->full_damage) {
+        return {{0, 0, this->w, this->h}};
+    }
+    return this->damage;
+}
+inline void limhamn::primitive::draw_manager::invalidate() {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    this->damage.clear();
+    this->full_damage = true;
+}
+inline void limhamn::primitive::draw_manager::add_damage(draw_position pos) {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    if (this->full_damage) {
+        return;
+    }
+
+    // arrows may be given with a negative width, and antialiasing and strokes reach a pixel outside
+    if (pos.w < 0) {
+        pos.x += pos.w;
+        pos.w = -pos.w;
+    }
+    if (pos.h < 0) {
+        pos.y += pos.h;
+        pos.h = -pos.h;
+    }
+
+    int x1 = std::max(pos.x - 1, 0);
+    int y1 = std::max(pos.y - 1, 0);
+    int x2 = std::min(pos.x + pos.w + 1, this->w);
+    int y2 = std::min(pos.y + pos.h + 1, this->h);
+    if (x1 >= x2 || y1 >= y2) {
+        return;
+    }
+
+    // merge with every rectangle it overlaps or touches, until none is left
+    for (std::size_t i = 0; i < this->damage.size();) {
+        const auto& it = this->damage[i];
+        if (it.x > x2 || it.x + it.w < x1 || it.y > y2 || it.y + it.h < y1) {
+            ++i;
+            continue;
+        }
+
+        x1 = std::min(x1, it.x);
+        y1 = std::min(y1, it.y);
+        x2 = std::max(x2, it.x + it.w);
+        y2 = std::max(y2, it.y + it.h);
+        this->damage.erase(this->damage.begin() + static_cast<std::ptrdiff_t>(i));
+        i = 0;
+    }
+    this->damage.push_back({x1, y1, x2 - x1, y2 - y1});
+
+    // many small copies cost more than one large one
+    constexpr std::size_t max_rects = 16;
+    if (this->damage.size() > max_rects) {
+        draw_position bounds = this->damage.front();
+        for (const auto& it : this->damage) {
+            const int bx2 = std::max(bounds.x + bounds.w, it.x + it.w);
+            const int by2 = std::max(bounds.y + bounds.h, it.y + it.h);
+            bounds.x = std::min(bounds.x, it.x);
+            bounds.y = std::min(bounds.y, it.y);
+            bounds.w = bx2 - bounds.x;
+            bounds.h = by2 - bounds.y;
+        }
+        this->damage.assign(1, bounds);
+    }
+
+    long long area{0};
+    for (const auto& it : this->damage) {
+        area += static_cast<long long>(it.w) * it.h;
+    }
+    if (area * 4 >= static_cast<long long>(this->w) * this->h * 3) {
+        this->damage.clear();
+        this->full_damage = true;
+    }
 }
 inline void limhamn::primitive::draw_manager::save_screen(const std::string& file) {
     std::lock_guard<std::recursive_mutex> lock(this->mtx);
@@ -791,9 +1351,20 @@ inline void limhamn::primitive::draw_manager::initialize_font(const std::string&
 
     this->font.init_font(font);
 }
+inline void limhamn::primitive::draw_manager::ensure_context() {
+    std::lock_guard<std::recursive_mutex> lock(this->mtx);
+
+    // the surface is kept between draw calls, and only created again when the drawable changes
+    if (!this->d) {
+        this->reinit();
+    }
+}
 inline void limhamn::primitive::draw_manager::reinit() {
     std::lock_guard<std::recursive_mutex> lock(this->mtx);
 
+    this->damage.clear();
+    this->full_damage = true;
+
     if (this->surface && cairo_surface_get_reference_count(this->surface) != 0) {
         cairo_surface_destroy(this->surface);
     }
@@ -824,6 +1395,18 @@ inline void limhamn::primitive::draw_manager::reinit() {
 inline int limhamn::primitive::draw_manager::draw_text(const draw_position& pos, int padding, const std::string& input_text, bool markup, const draw_properties& props) {
     std::lock_guard<std::recursive_mutex> lock(this->mtx);
 
+    const int render = pos.x || pos.y || pos.w || pos.h;
+    if (!render) {
+        // only measuring, so the colors are not needed
+        return this->text_impl(pos, padding, input_text, markup, 0, 0);
+    }
+
+    return this->text_impl(pos, padding, input_text, markup,
+        draw_frame::pack_color(props.invert ? props.foreground : props.background, props.invert ? props.foreground_alpha : props.background_alpha),
+        draw_frame::pack_color(props.foreground, props.foreground_alpha));
+}
+inline int limhamn::primitive::draw_manager::text_impl(const draw_position& pos, int padding, const std::string& input_text, bool markup, const uint32_t background, const uint32_t foreground) {
+
     int x = pos.x;
     int y = pos.y;
     unsigned int w = pos.w;
@@ -841,9 +1424,10 @@ inline int limhamn::primitive::draw_manager::draw_text(const draw_position& pos,
         x += padding;
         w -= padding;
 
-        this->reinit();
+        this->ensure_context();
+        this->add_damage({x - padding, y, static_cast<int>(w) + padding, static_cast<int>(h)});
 
-        cairo_set_source_hex(this->d, props.invert ? props.foreground.c_str() : props.background.c_str(), props.invert ? props.foreground_alpha : props.background_alpha);
+        this->set_source(background);
         cairo_set_operator(this->d, CAIRO_OPERATOR_SOURCE);
         cairo_rectangle(this->d, x - padding, y, w + padding, h);
         cairo_fill(this->d);
@@ -860,10 +1444,10 @@ inline int limhamn::primitive::draw_manager::draw_text(const draw_position& pos,
     }
 
     int length = static_cast<int>(input_text.length());
-    int estimated_width = font.estimate_length(input_text, input_text.length(), markup).first;
+    int estimated_width = font.estimate_length(input_text, length, markup).first;
 
-    for (length = std::min(length, static_cast<int>(input_text.length())); length && estimated_width > w; font.estimate_length(input_text, length--, markup).first) {
-        estimated_width = font.estimate_length(input_text, length, markup).first;
+    if (static_cast<unsigned int>(estimated_width) > w) {
+        length = font.fit_length(input_text, static_cast<int>(w), markup);
     }
 
     if (!length) {
@@ -872,8 +1456,17 @@ inline int limhamn::primitive::draw_manager::draw_text(const draw_position& pos,
 
     std::string text = input_text.substr(0, length);
     if (length < static_cast<int>(input_text.length())) {
-        for (std::size_t i = length; i && i > length - 3; text[--i] = '.')
-            ; // NOP
+        // replace the last three characters, not bytes, so that no UTF-8 sequence is split
+        int characters{0};
+        while (length && characters < 3) {
+            --length;
+            if ((static_cast<unsigned char>(text[length]) & 0xC0) != 0x80) {
+                ++characters;
+            }
+        }
+        text.resize(length);
+        text.append(characters, '.');
+        length = static_cast<int>(text.length());
     }
 
     estimated_width = font.estimate_length(text, -1, markup).first;
@@ -896,7 +1489,7 @@ inline int limhamn::primitive::draw_manager::draw_text(const draw_position& pos,
 
     pango_layout_set_single_paragraph_mode(this->font.layout, true);
 
-    cairo_set_source_hex(this->d, props.foreground, props.foreground_alpha);
+    this->set_source(foreground);
     cairo_move_to(this->d, x, y + (h - this->font.get_height()) / 2);
 
     pango_cairo_update_layout(this->d, this->font.layout);
@@ -10,25 +10,59 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <cstdint>
 #ifdef LIMHAMN_SMTP_CLIENT_IMPL
 #include <openssl/evp.h>
-#include <boost/system/detail/error_code.hpp>
+#include <openssl/ssl.h>
+#include <boost/system/error_code.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/ssl.hpp>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <stdexcept>
+#include <optional>
+#include <ctime>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <cstdio>
 #endif
 
 #define LIMHAMN_SMTP_CLIENT
 
+namespace _limhamn_smtp_client_impl {
+    class connection;
+    class pool_state;
+}
+
 /**
  * @brief  Namespace that contains all the networking related classes and functions.
  */
 namespace limhamn::smtp::client {
+    /**
+     * @brief  Struct that represents a file attached to a message.
+     */
+    struct attachment {
+        std::string path{}; // the file to read, as the message is sent; empty to use data instead
+        std::string data{}; // the contents, if path is empty
+        std::string filename{}; // the name shown to the recipient; defaults to the last component of path
+        std::string content_type{}; // defaults to application/octet-stream
+    };
+
     /**
      * @brief  Struct that can be used to construct a client.
      */
     struct mail_properties {
         std::string from{};
-        std::string to{};
+        std::string to{}; // one address, or several separated by commas
         std::string smtp_server{};
         unsigned int smtp_port{465};
         std::string username{};
@@ -36,205 +70,1250 @@ namespace limhamn::smtp::client {
         std::string subject{};
         std::string data{};
         std::string content_type{};
+        std::vector<attachment> attachments{}; // sent as a multipart/mixed message, with the data as its first part
     };
 
     /**
-     * @brief  Class that represents a client.
+     * @brief  Struct containing the settings of a session.
      */
-    class client {
-    public:
-        explicit client(const mail_properties& prop);
+    struct session_settings {
+        std::string smtp_server{};
+        unsigned int smtp_port{465};
+        std::string username{}; // empty to not authenticate
+        std::string password{};
+        bool starttls{false}; // connect in plain text and upgrade with STARTTLS (usually port 587) instead of implicit TLS
+        bool verify_peer{true}; // verify the server's certificate and host name against the default verify paths
+        std::string helo_domain{"localhost"}; // the name sent with EHLO
+        int64_t timeout{30000}; // milliseconds each network operation may take before the connection is dropped
+        std::size_t chunk_size{65536}; // bytes of the message generated and written at a time
+        bool chunking{true}; // send messages with BDAT (RFC 3030) instead of DATA if the server offers CHUNKING
+
+        /**
+         * @brief  Get the session settings of a mail_properties.
+         * @param  prop The mail properties
+         * @return session_settings
+         */
+        static session_settings from(const mail_properties& prop);
     };
-}
 
-#ifdef LIMHAMN_SMTP_CLIENT_IMPL
-namespace _limhamn_smtp_client_impl {
-    class smtp_ssl_client {
+    /**
+     * @brief  Struct containing the outcome of sending one message.
+     */
+    struct send_result {
+        bool ok{false}; // the server accepted the message for at least one recipient
+        int code{0}; // the reply code that decided the outcome, e.g. 250, 0 if the connection failed, or -1 if an attachment could not be opened
+        std::string message{}; // the reply text, or a description of the error
+        std::vector<std::string> rejected_recipients{};
+
+        /**
+         * @brief  Check whether sending again later may succeed.
+         * @return bool, true for 4xx replies and connection errors
+         */
+        [[nodiscard]] bool transient() const;
+    };
+
+    /**
+     * @brief  Class that represents a persistent, authenticated connection to an SMTP server.
+     * @note   Uses PIPELINING (RFC 2920) if the server offers it, in which case a batch of messages costs about one round
+     *         trip per message: the end of each message is sent together with the commands of the next one.
+     * @note   Messages are generated and written in chunks, reading attachments as they go, and sent with BDAT if the server
+     *         offers CHUNKING (RFC 3030).
+     * @note   Not thread safe; use a pool to send from several threads. Throws std::runtime_error if the connection fails,
+     *         after which the session cannot be used again.
+     */
+    class session {
+        std::unique_ptr<_limhamn_smtp_client_impl::connection> connection;
     public:
         /**
-         * @brief Constructor.
-         * @param io_context IO context.
-         * @param ssl_context SSL context.
-         * @param prop Mail properties.
+         * @brief  Connect, say EHLO, upgrade to TLS and authenticate.
+         * @param  settings The settings
          */
-        smtp_ssl_client(boost::asio::io_context& io_context, boost::asio::ssl::context& ssl_context, limhamn::smtp::client::mail_properties prop)
-            : resolver_(io_context), socket_(io_context, ssl_context), mail_properties_(std::move(prop)) {}
+        explicit session(const session_settings& settings);
+        ~session();
+        session(session&&) noexcept;
+        session& operator=(session&&) noexcept;
 
         /**
-         * @brief Start the client.
+         * @brief  Send a message.
+         * @param  mail The message. Only from, to, subject, data, content_type and attachments are used.
+         * @return send_result
          */
-        void start() {
-            auto endpoints = resolver_.resolve(mail_properties_.smtp_server, std::to_string(mail_properties_.smtp_port));
-            boost::asio::async_connect(socket_.lowest_layer(), endpoints,
-                [this](const boost::system::error_code& ec, const boost::asio::ip::tcp::endpoint&) {
-                    if (!ec) {
-                        start_tls();
-                    } else {
-                        throw std::runtime_error("Connect error: " + ec.message());
-                    }
-                });
-        }
+        send_result send(const mail_properties& mail);
+        /**
+         * @brief  Send several messages, pipelined.
+         * @param  mails The messages
+         * @return std::vector<send_result>, one per message
+         */
+        std::vector<send_result> send(const std::vector<mail_properties>& mails);
+        /**
+         * @brief  Check that the connection is still usable.
+         * @return bool
+         */
+        bool noop();
+        /**
+         * @brief  Say QUIT and close the connection.
+         */
+        void quit();
+        /**
+         * @brief  Check whether the server offers PIPELINING.
+         * @return bool
+         */
+        [[nodiscard]] bool pipelining() const;
+    };
 
-    private:
+    /**
+     * @brief  Struct containing the settings of a pool.
+     */
+    struct pool_settings {
+        session_settings session{};
+        std::size_t sessions{4}; // connections, each with its own thread
+        std::size_t max_queue{10000}; // messages waiting to be sent; send() blocks while the queue is full
+        std::size_t batch_size{50}; // messages one session takes from the queue at a time
+        int max_retries{3}; // times a message that failed transiently is sent again
+        int64_t retry_delay{2000}; // milliseconds before the first retry, doubled for each one after that
+        int64_t idle_check{30000}; // milliseconds a session may be idle before it is checked with NOOP before use
+    };
+
+    /**
+     * @brief  Class that represents a small pool of sessions sending from a bounded queue.
+     * @note   Thread safe. Sessions are connected when they are first needed and reconnected after errors.
+     */
+    class pool {
+        std::shared_ptr<_limhamn_smtp_client_impl::pool_state> state;
+    public:
+        explicit pool(const pool_settings& settings);
         /**
-         * @brief Encode a string to base64.
-         * @param input Input string.
-         * @return std::string Encoded string.
+         * @brief  Send the queued messages, then close the sessions.
          */
-        static std::string base64_encode(const std::string& input) noexcept {
-            BIO* b64 = BIO_new(BIO_f_base64());
-            BIO* mem = BIO_new(BIO_s_mem());
-            b64 = BIO_push(b64, mem);
-            BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
-            BIO_write(b64, input.data(), static_cast<int>(input.size()));
-            BIO_flush(b64);
-            BUF_MEM* buffer_ptr;
-            BIO_get_mem_ptr(b64, &buffer_ptr);
-            std::string output(buffer_ptr->data, buffer_ptr->length);
-            BIO_free_all(b64);
-            return output;
-        }
+        ~pool();
+        pool(const pool&) = delete;
+        pool& operator=(const pool&) = delete;
 
         /**
-         * @brief Start TLS.
+         * @brief  Queue a message.
+         * @param  mail The message. Only from, to, subject, data, content_type and attachments are used.
+         * @return std::future<send_result>, ready once the message is sent or has failed for good
          */
-        void start_tls() {
-            socket_.lowest_layer().set_option(boost::asio::ip::tcp::no_delay(true));
-            socket_.handshake(boost::asio::ssl::stream_base::client);
-            send_ehlo();
-        }
+        std::future<send_result> send(mail_properties mail);
+        /**
+         * @brief  Wait until every queued message is sent or has failed.
+         */
+        void wait();
+    };
 
+    /**
+     * @brief  Class that represents a client.
+     */
+    class client {
+    public:
         /**
-         * @brief Send EHLO.
+         * @brief  Send one message over a new session.
+         * @param  prop The message and the server to send it through
+         * @note   Throws std::runtime_error if the message is not accepted.
          */
-        void send_ehlo() {
-            std::string domain = mail_properties_.from.substr(mail_properties_.from.find('@') + 1);
-            std::string ehlo_cmd = "EHLO " + domain + "\r\n";
-            boost::asio::async_write(socket_, boost::asio::buffer(ehlo_cmd),
-                [this](const boost::system::error_code& ec, std::size_t) {
-                    if (!ec) {
-                        read_response();
-                    } else {
-                        throw std::runtime_error("EHLO error: " + ec.message());
+        explicit client(const mail_properties& prop);
+    };
+}
+
+#ifdef LIMHAMN_SMTP_CLIENT_IMPL
+namespace _limhamn_smtp_client_impl {
+    /**
+     * @brief Encode a string to base64.
+     * @param input Input string.
+     * @return std::string Encoded string.
+     */
+    inline std::string base64_encode(const std::string& input) noexcept {
+        BIO* b64 = BIO_new(BIO_f_base64());
+        BIO* mem = BIO_new(BIO_s_mem());
+        b64 = BIO_push(b64, mem);
+        BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
+        BIO_write(b64, input.data(), static_cast<int>(input.size()));
+        BIO_flush(b64);
+        BUF_MEM* buffer_ptr;
+        BIO_get_mem_ptr(b64, &buffer_ptr);
+        std::string output(buffer_ptr->data, buffer_ptr->length);
+        BIO_free_all(b64);
+        return output;
+    }
+
+    /**
+     * @brief A reply from the server
+     */
+    struct reply {
+        int code{0};
+        std::string text{};
+    };
+
+    /**
+     * @brief Splits a comma separated list of addresses
+     * @param list The list
+     * @return std::vector<std::string>
+     */
+    inline std::vector<std::string> split_addresses(const std::string& list) {
+        std::vector<std::string> ret{};
+        std::size_t pos{0};
+        while (pos <= list.size()) {
+            std::size_t end = list.find(',', pos);
+            if (end == std::string::npos) {
+                end = list.size();
+            }
+
+            std::string item = list.substr(pos, end - pos);
+            item.erase(0, item.find_first_not_of(" \t"));
+            item.erase(item.find_last_not_of(" \t") + 1);
+            if (!item.empty()) {
+                ret.push_back(std::move(item));
+            }
+            pos = end + 1;
+        }
+        return ret;
+    }
+
+    /**
+     * @brief Gets the envelope form of an address, e.g. <user@example.com> for "User <user@example.com>"
+     * @param address The address
+     * @return std::string
+     */
+    inline std::string envelope_address(const std::string& address) {
+        const std::size_t begin = address.find('<');
+        const std::size_t end = address.find('>', begin);
+        if (begin != std::string::npos && end != std::string::npos) {
+            return address.substr(begin, end - begin + 1);
+        }
+        return "<" + address + ">";
+    }
+
+    /**
+     * @brief Encodes base64 in whole 76 character lines, for data that arrives in pieces
+     */
+    class base64_lines {
+            static constexpr const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        public:
+            static constexpr std::size_t line_input = 57; // bytes that encode to one line
+
+            /**
+             * @brief Appends the encoded data, with CRLF after every line
+             * @param data The data; a multiple of line_input bytes unless it is the end of the input
+             * @param size The size of the data
+             * @param out The string to append to
+             */
+            static void append(const unsigned char* data, const std::size_t size, std::string& out) {
+                const std::size_t start = out.size();
+                out.resize(start + (size + 2) / 3 * 4 + (size + line_input - 1) / line_input * 2);
+                char* dst = &out[start];
+
+                std::size_t i{0};
+                while (i < size) {
+                    const std::size_t line_end = (std::min)(size, i + line_input);
+                    for (; i + 3 <= line_end; i += 3) {
+                        const uint32_t v = static_cast<uint32_t>(data[i]) << 16 | static_cast<uint32_t>(data[i + 1]) << 8 | data[i + 2];
+                        *dst++ = alphabet[v >> 18 & 0x3F];
+                        *dst++ = alphabet[v >> 12 & 0x3F];
+                        *dst++ = alphabet[v >> 6 & 0x3F];
+                        *dst++ = alphabet[v & 0x3F];
+                    }
+                    if (i < line_end) {
+                        const bool two = i + 1 < line_end;
+                        const uint32_t v = static_cast<uint32_t>(data[i]) << 16 | (two ? static_cast<uint32_t>(data[i + 1]) << 8 : 0);
+                        *dst++ = alphabet[v >> 18 & 0x3F];
+                        *dst++ = alphabet[v >> 12 & 0x3F];
+                        *dst++ = two ? alphabet[v >> 6 & 0x3F] : '=';
+                        *dst++ = '=';
+                        i = line_end;
+                    }
+                    *dst++ = '\r';
+                    *dst++ = '\n';
+                }
+
+                out.resize(static_cast<std::size_t>(dst - out.data()));
+            }
+    };
+
+    /**
+     * @brief Dot-stuffs DATA content (RFC 5321 4.5.2) that is written in pieces
+     */
+    class dot_stuffer {
+            bool line_start{true};
+        public:
+            void append(const std::string& data, std::string& out) {
+                out.reserve(out.size() + data.size() + 16);
+
+                std::size_t pos{0};
+                while (pos < data.size()) {
+                    if (line_start && data[pos] == '.') {
+                        out += '.';
+                    }
+                    const std::size_t end = data.find('\n', pos);
+                    if (end == std::string::npos) {
+                        out.append(data, pos, std::string::npos);
+                        line_start = false;
+                        return;
+                    }
+                    out.append(data, pos, end + 1 - pos);
+                    line_start = true;
+                    pos = end + 1;
+                }
+            }
+    };
+
+    /**
+     * @brief Produces a message in chunks: headers, the body with CRLF line endings, and attachments as base64 parts
+     * @note Attachments are read from their files as the chunks are produced, so only about one chunk is in memory.
+     */
+    class message_stream {
+            enum class stage {
+                headers,
+                body,
+                part_header,
+                part_data,
+                closing,
+                done,
+            };
+
+            const limhamn::smtp::client::mail_properties& mail;
+            std::size_t chunk_size{};
+            std::string boundary{};
+            std::vector<std::unique_ptr<std::ifstream>> files{};
+            stage current{stage::headers};
+            std::size_t position{0}; // in the body, or in the data of an in memory attachment
+            std::size_t part{0};
+            bool previous_cr{false};
+            std::vector<unsigned char> input{};
+
+            static std::string file_name(const limhamn::smtp::client::attachment& it) {
+                if (!it.filename.empty()) {
+                    return it.filename;
+                }
+                const std::size_t slash = it.path.find_last_of("/\\");
+                return slash == std::string::npos ? it.path : it.path.substr(slash + 1);
+            }
+
+            void append_headers(std::string& out) {
+                char date[64];
+                const std::time_t now = std::time(nullptr);
+                std::tm tm{};
+#ifdef _WIN32
+                gmtime_s(&tm, &now);
+#else
+                gmtime_r(&now, &tm);
+#endif
+                std::strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S +0000", &tm);
+
+                const std::string content_type = mail.content_type.empty() ? std::string("text/plain; charset=\"utf-8\"") : mail.content_type;
+
+                out += "From: " + mail.from + "\r\n";
+                out += "To: " + mail.to + "\r\n";
+                out += "Subject: " + mail.subject + "\r\n";
+                out += std::string("Date: ") + date + "\r\n";
+                out += "MIME-Version: 1.0\r\n";
+                if (mail.attachments.empty()) {
+                    out += "Content-Type: " + content_type + "\r\n\r\n";
+                    return;
+                }
+
+                out += "Content-Type: multipart/mixed; boundary=\"" + boundary + "\"\r\n\r\n";
+                out += "This is a multi-part message in MIME format.\r\n";
+                out += "--" + boundary + "\r\n";
+                out += "Content-Type: " + content_type + "\r\n\r\n";
+            }
+
+            /**
+             * @brief Appends the body from position on, up to about limit bytes, normalising line endings to CRLF
+             * @return bool, true if the end of the body was reached
+             */
+            bool append_body(std::string& out, const std::size_t limit) {
+                const std::string& data = mail.data;
+                const std::size_t end = (std::min)(data.size(), position + limit);
+                out.reserve(out.size() + end - position + 64);
+
+                for (; position < end; ++position) {
+                    const char c = data[position];
+                    if (c == '\n' && !previous_cr) {
+                        out += '\r';
+                    }
+                    out += c;
+                    previous_cr = c == '\r';
+                }
+
+                if (position < data.size()) {
+                    return false;
+                }
+                if (!data.empty() && data.back() != '\n') {
+                    out += "\r\n";
+                }
+                return true;
+            }
+
+            void append_part_header(std::string& out) {
+                const auto& it = mail.attachments[part];
+                const std::string name = file_name(it);
+                const std::string type = it.content_type.empty() ? std::string("application/octet-stream") : it.content_type;
+
+                out += "--" + boundary + "\r\n";
+                out += "Content-Type: " + type + "; name=\"" + name + "\"\r\n";
+                out += "Content-Transfer-Encoding: base64\r\n";
+                out += "Content-Disposition: attachment; filename=\"" + name + "\"\r\n\r\n";
+            }
+
+            /**
+             * @brief Appends up to about limit bytes of the current attachment, encoded
+             * @return bool, true if the end of the attachment was reached
+             */
+            bool append_part_data(std::string& out, const std::size_t limit) {
+                const auto& it = mail.attachments[part];
+                const std::size_t lines = (std::max)(static_cast<std::size_t>(1), limit / 78);
+                const std::size_t want = lines * base64_lines::line_input;
+
+                if (it.path.empty()) {
+                    const std::size_t size = (std::min)(want, it.data.size() - position);
+                    base64_lines::append(reinterpret_cast<const unsigned char*>(it.data.data()) + position, size, out);
+                    position += size;
+                    return position == it.data.size();
+                }
+
+                std::ifstream& file = *files[part];
+                input.resize(want);
+                file.read(reinterpret_cast<char*>(input.data()), static_cast<std::streamsize>(want));
+                const auto got = static_cast<std::size_t>(file.gcount());
+                if (file.bad()) {
+                    throw std::runtime_error("failed to read attachment: " + it.path);
+                }
+
+                base64_lines::append(input.data(), got, out);
+                return got < want;
+            }
+        public:
+            /**
+             * @brief Opens the attachments
+             * @param mail The message, which must outlive the stream
+             * @param chunk_size The size a chunk is filled up to
+             * @note Throws std::runtime_error if an attachment cannot be opened.
+             */
+            message_stream(const limhamn::smtp::client::mail_properties& mail, const std::size_t chunk_size)
+                : mail(mail), chunk_size((std::max)(chunk_size, static_cast<std::size_t>(1024))) {
+                if (mail.attachments.empty()) {
+                    return;
+                }
+
+                std::random_device device{};
+                char buffer[48];
+                std::snprintf(buffer, sizeof(buffer), "=_limhamn_%08x%08x%08x", device(), device(), device());
+                boundary = buffer;
+
+                for (const auto& it : mail.attachments) {
+                    if (it.path.empty()) {
+                        files.emplace_back();
+                        continue;
+                    }
+                    files.push_back(std::make_unique<std::ifstream>(it.path, std::ios::binary));
+                    if (!*files.back()) {
+                        throw std::runtime_error("failed to open attachment: " + it.path);
                     }
+                }
+            }
+
+            /**
+             * @brief Produces the next chunk
+             * @param chunk Set to the chunk, of about chunk_size bytes
+             * @return bool, false if the whole message has been produced
+             */
+            bool next(std::string& chunk) {
+                chunk.clear();
+
+                while (chunk.size() < chunk_size && current != stage::done) {
+                    const std::size_t room = chunk_size - chunk.size();
+
+                    switch (current) {
+                        case stage::headers:
+                            append_headers(chunk);
+                            current = stage::body;
+                            break;
+                        case stage::body:
+                            if (append_body(chunk, room)) {
+                                position = 0;
+                                current = mail.attachments.empty() ? stage::done : stage::part_header;
+                            }
+                            break;
+                        case stage::part_header:
+                            append_part_header(chunk);
+                            current = stage::part_data;
+                            break;
+                        case stage::part_data:
+                            if (append_part_data(chunk, room)) {
+                                position = 0;
+                                ++part;
+                                current = part < mail.attachments.size() ? stage::part_header : stage::closing;
+                            }
+                            break;
+                        case stage::closing:
+                            chunk += "--" + boundary + "--\r\n";
+                            current = stage::done;
+                            break;
+                        case stage::done:
+                            break;
+                    }
+                }
+
+                return !chunk.empty();
+            }
+    };
+
+    /**
+     * @brief An SMTP connection driven by asynchronous operations with a timeout each
+     */
+    class connection {
+        public:
+            explicit connection(const limhamn::smtp::client::session_settings& settings)
+                : settings(settings), ssl_context(boost::asio::ssl::context::tls_client) {
+                ssl_context.set_options(boost::asio::ssl::context::default_workarounds | boost::asio::ssl::context::no_sslv2 |
+                    boost::asio::ssl::context::no_sslv3 | boost::asio::ssl::context::no_tlsv1 | boost::asio::ssl::context::no_tlsv1_1);
+                if (settings.verify_peer) {
+                    ssl_context.set_default_verify_paths();
+                    ssl_context.set_verify_mode(boost::asio::ssl::verify_peer);
+                } else {
+                    ssl_context.set_verify_mode(boost::asio::ssl::verify_none);
+                }
+
+                stream.emplace(context, ssl_context);
+                open();
+            }
+
+            ~connection() {
+                close();
+            }
+
+            [[nodiscard]] bool pipelining() const {
+                return supports_pipelining;
+            }
+
+            std::vector<limhamn::smtp::client::send_result> send(const std::vector<limhamn::smtp::client::mail_properties>& mails) {
+                std::vector<limhamn::smtp::client::send_result> ret(mails.size());
+                send(mails, ret);
+                return ret;
+            }
+
+            /**
+             * @brief Sends messages, recording the outcome of each as soon as its final reply arrives
+             * @param mails The messages
+             * @param ret One result per message. If this throws, the messages whose result still has code 0 never got a
+             *        final reply; the others were decided by the server and must not be sent again.
+             */
+            void send(const std::vector<limhamn::smtp::client::mail_properties>& mails, std::vector<limhamn::smtp::client::send_result>& ret) {
+                ret.assign(mails.size(), limhamn::smtp::client::send_result{});
+                if (supports_pipelining) {
+                    send_pipelined(mails, ret);
+                } else {
+                    send_stepwise(mails, ret);
+                }
+            }
+
+            bool noop() {
+                try {
+                    write("NOOP\r\n");
+                    return read_reply().code == 250;
+                } catch (const std::exception&) {
+                    return false;
+                }
+            }
+
+            void quit() {
+                try {
+                    write("QUIT\r\n");
+                    read_reply();
+                } catch (const std::exception&) {
+                }
+                close();
+            }
+        private:
+            limhamn::smtp::client::session_settings settings{};
+            boost::asio::io_context context{};
+            boost::asio::ssl::context ssl_context;
+            std::optional<boost::asio::ssl::stream<boost::asio::ip::tcp::socket>> stream{};
+            std::string input{};
+            bool tls{false};
+            bool supports_pipelining{false};
+            bool supports_chunking{false};
+            std::string auth_mechanisms{};
+
+            /**
+             * @brief Runs an asynchronous operation to completion, or drops the connection after the timeout
+             * @param start Starts the operation with the completion handler it is given
+             * @param what What the operation is, for the error message
+             */
+            template <typename Start>
+            void run(Start&& start, const char* what) {
+                bool done = false;
+                boost::system::error_code result{};
+
+                start([&done, &result](const boost::system::error_code& ec, auto&&...) {
+                    done = true;
+                    result = ec;
                 });
-        }
 
-        /**
-         * @brief Read response.
-         */
-        void read_response() {
-            boost::asio::async_read_until(socket_, response_, "\r\n",
-                [this](const boost::system::error_code& ec, std::size_t) {
-                    if (!ec) {
-                        std::istream response_stream(&response_);
-                        std::string response_line;
-                        std::getline(response_stream, response_line);
-                        if (response_line.substr(0, 3) == "250") {
-                            send_auth_login();
-                        } else if (response_line.substr(0, 3) == "220") {
-                            start_tls();
+                context.restart();
+                context.run_for(std::chrono::milliseconds(settings.timeout));
+
+                if (!done) {
+                    close();
+                    // lets the aborted operation complete, so nothing refers to done and result afterwards
+                    context.restart();
+                    context.run();
+                    throw std::runtime_error(std::string(what) + " timed out");
+                }
+                if (result) {
+                    throw std::runtime_error(std::string(what) + " failed: " + result.message());
+                }
+            }
+
+            void close() {
+                if (!stream) {
+                    return;
+                }
+                boost::system::error_code ec;
+                static_cast<void>(stream->lowest_layer().close(ec));
+            }
+
+            void write(const std::string& data) {
+                if (tls) {
+                    run([this, &data](auto&& handler) {
+                        boost::asio::async_write(*stream, boost::asio::buffer(data), handler);
+                    }, "write");
+                } else {
+                    run([this, &data](auto&& handler) {
+                        boost::asio::async_write(stream->next_layer(), boost::asio::buffer(data), handler);
+                    }, "write");
+                }
+            }
+
+            /**
+             * @brief Reads one, possibly multiline, reply
+             * @return reply
+             */
+            reply read_reply() {
+                reply ret{};
+
+                for (;;) {
+                    std::size_t end = input.find("\r\n");
+                    while (end == std::string::npos) {
+                        if (tls) {
+                            run([this](auto&& handler) {
+                                boost::asio::async_read_until(*stream, boost::asio::dynamic_buffer(input), "\r\n", handler);
+                            }, "read");
+                        } else {
+                            run([this](auto&& handler) {
+                                boost::asio::async_read_until(stream->next_layer(), boost::asio::dynamic_buffer(input), "\r\n", handler);
+                            }, "read");
                         }
-                    } else {
-                        throw std::runtime_error("Read response error: " + ec.message());
+                        end = input.find("\r\n");
                     }
-                });
-        }
 
-        /**
-         * @brief Send AUTH LOGIN.
-         */
-        void send_auth_login() {
-            std::string auth_cmd = "AUTH LOGIN\r\n";
-            boost::asio::async_write(socket_, boost::asio::buffer(auth_cmd),
-                [this](const boost::system::error_code& ec, std::size_t) {
-                    if (!ec) {
-                        send_username();
-                    } else {
-                        throw std::runtime_error("Auth error: " + ec.message());
+                    const std::string line = input.substr(0, end);
+                    input.erase(0, end + 2);
+
+                    if (line.size() < 3) {
+                        throw std::runtime_error("malformed reply: " + line);
                     }
-                });
-        }
+                    ret.code = std::atoi(line.substr(0, 3).c_str());
+                    if (!ret.text.empty()) {
+                        ret.text += '\n';
+                    }
+                    ret.text += line.size() > 4 ? line.substr(4) : "";
 
-        /**
-         * @brief Send username.
-         */
-        void send_username() {
-            std::string encoded_username = base64_encode(mail_properties_.username) + "\r\n";
-            boost::asio::async_write(socket_, boost::asio::buffer(encoded_username),
-                [this](const boost::system::error_code& ec, std::size_t) {
-                    if (!ec) {
-                        send_password();
-                    } else {
-                        throw std::runtime_error("Username error: " + ec.message());
+                    if (line.size() == 3 || line[3] == ' ') {
+                        return ret;
                     }
-                });
-        }
+                }
+            }
 
-        /**
-         * @brief Send password.
-         */
-        void send_password() {
-            std::string encoded_password = base64_encode(mail_properties_.password) + "\r\n";
-            boost::asio::async_write(socket_, boost::asio::buffer(encoded_password),
-                [this](const boost::system::error_code& ec, std::size_t) {
-                    if (!ec) {
-                        send_email_data();
+            reply expect(const int code, const char* what) {
+                reply ret = read_reply();
+                if (ret.code != code) {
+                    throw std::runtime_error(std::string(what) + " rejected: " + std::to_string(ret.code) + " " + ret.text);
+                }
+                return ret;
+            }
+
+            void ehlo() {
+                write("EHLO " + settings.helo_domain + "\r\n");
+                const reply ret = expect(250, "EHLO");
+
+                supports_pipelining = false;
+                supports_chunking = false;
+                auth_mechanisms.clear();
+
+                std::size_t pos{0};
+                while (pos <= ret.text.size()) {
+                    std::size_t end = ret.text.find('\n', pos);
+                    if (end == std::string::npos) {
+                        end = ret.text.size();
+                    }
+                    std::string line = ret.text.substr(pos, end - pos);
+                    for (auto& c : line) {
+                        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+                    }
+
+                    if (line == "PIPELINING") {
+                        supports_pipelining = true;
+                    } else if (line == "CHUNKING") {
+                        supports_chunking = true;
+                    } else if (line.rfind("AUTH ", 0) == 0 || line.rfind("AUTH=", 0) == 0) {
+                        auth_mechanisms += " " + line.substr(5) + " ";
+                    }
+                    pos = end + 1;
+                }
+            }
+
+            void handshake() {
+                if (settings.verify_peer) {
+                    // SNI, and the name the certificate is checked against
+                    SSL_set_tlsext_host_name(stream->native_handle(), settings.smtp_server.c_str());
+                    stream->set_verify_callback(boost::asio::ssl::host_name_verification(settings.smtp_server));
+                }
+
+                run([this](auto&& handler) {
+                    stream->async_handshake(boost::asio::ssl::stream_base::client, handler);
+                }, "TLS handshake");
+                tls = true;
+            }
+
+            void open() {
+                boost::asio::ip::tcp::resolver resolver(context);
+                boost::asio::ip::tcp::resolver::results_type endpoints{};
+                run([&resolver, &endpoints, this](auto&& handler) {
+                    resolver.async_resolve(settings.smtp_server, std::to_string(settings.smtp_port),
+                        [&endpoints, handler](const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::results_type results) mutable {
+                            endpoints = std::move(results);
+                            handler(ec);
+                        });
+                }, "resolve");
+
+                run([this, &endpoints](auto&& handler) {
+                    boost::asio::async_connect(stream->lowest_layer(), endpoints, handler);
+                }, "connect");
+                stream->lowest_layer().set_option(boost::asio::ip::tcp::no_delay(true));
+
+                if (!settings.starttls) {
+                    handshake();
+                }
+
+                expect(220, "greeting");
+                ehlo();
+
+                if (settings.starttls) {
+                    write("STARTTLS\r\n");
+                    expect(220, "STARTTLS");
+                    handshake();
+                    // the capabilities may change once the connection is encrypted
+                    ehlo();
+                }
+
+                if (!settings.username.empty()) {
+                    authenticate();
+                }
+            }
+
+            void authenticate() {
+                if (auth_mechanisms.find(" PLAIN ") != std::string::npos) {
+                    write("AUTH PLAIN " + base64_encode(std::string(1, '\0') + settings.username + std::string(1, '\0') + settings.password) + "\r\n");
+                    expect(235, "AUTH PLAIN");
+                    return;
+                }
+
+                write("AUTH LOGIN\r\n");
+                expect(334, "AUTH LOGIN");
+                write(base64_encode(settings.username) + "\r\n");
+                expect(334, "AUTH LOGIN username");
+                write(base64_encode(settings.password) + "\r\n");
+                expect(235, "AUTH LOGIN password");
+            }
+
+            /**
+             * @brief Appends the commands that start a transaction
+             * @param with_data Whether to end with DATA, rather than leaving it to BDAT
+             */
+            static void append_envelope(const limhamn::smtp::client::mail_properties& mail, std::string& out, std::vector<std::string>& recipients, const bool with_data) {
+                recipients = split_addresses(mail.to);
+                out += "MAIL FROM:" + envelope_address(mail.from) + "\r\n";
+                for (const auto& it : recipients) {
+                    out += "RCPT TO:" + envelope_address(it) + "\r\n";
+                }
+                if (with_data) {
+                    out += "DATA\r\n";
+                }
+            }
+
+            /**
+             * @brief Reads the replies to the commands of append_envelope()
+             * @param recipients The recipients
+             * @param with_data Whether DATA was sent
+             * @param result Set to the failure if the transaction cannot go on
+             * @return int, 1 if the message can be sent, 0 if not but MAIL was accepted (so RSET is needed), -1 if MAIL failed
+             */
+            int read_envelope(const std::vector<std::string>& recipients, const bool with_data, limhamn::smtp::client::send_result& result) {
+                const reply mail = read_reply();
+                reply first_rejection{};
+                for (const auto& it : recipients) {
+                    const reply rcpt = read_reply();
+                    if (rcpt.code / 100 != 2) {
+                        result.rejected_recipients.push_back(it);
+                        if (first_rejection.code == 0) {
+                            first_rejection = rcpt;
+                        }
+                    }
+                }
+                const reply data = with_data ? read_reply() : reply{354, ""};
+
+                if (mail.code / 100 == 2 && result.rejected_recipients.size() < recipients.size() && data.code == 354) {
+                    return 1;
+                }
+
+                const reply& cause = mail.code / 100 != 2 ? mail : first_rejection.code != 0 ? first_rejection : data;
+                result.ok = false;
+                result.code = cause.code;
+                result.message = cause.text;
+                return mail.code / 100 == 2 ? 0 : -1;
+            }
+
+            [[nodiscard]] bool use_chunking() const {
+                return supports_chunking && settings.chunking;
+            }
+
+            /**
+             * @brief Sends the message, except for the last chunk, which is appended to out with the end of the message
+             * @param message The message
+             * @param out Where the rest goes, to be written with whatever follows it
+             * @param failure Set to the first failed BDAT reply that had to be read while sending
+             * @return std::size_t, the number of replies still to be read for the message once out is written
+             */
+            std::size_t stream_message(message_stream& message, std::string& out, reply& failure) {
+                std::string chunk{};
+                std::string ahead{};
+                std::string buffer{};
+                dot_stuffer stuffer{};
+                std::size_t outstanding{0};
+                const bool chunking = use_chunking();
+
+                bool more = message.next(chunk);
+                while (more) {
+                    more = message.next(ahead);
+                    std::string& target = more ? buffer : out;
+
+                    if (chunking) {
+                        target += "BDAT " + std::to_string(chunk.size()) + (more ? "\r\n" : " LAST\r\n");
+                        target += chunk;
+                        ++outstanding;
                     } else {
-                        throw std::runtime_error("Password error: " + ec.message());
+                        stuffer.append(chunk, target);
+                        if (!more) {
+                            target += ".\r\n";
+                            outstanding = 1;
+                        }
                     }
-                });
-        }
 
-        /**
-         * @brief Assemble email data.
-         * @return std::string Email data.
-         */
-        [[nodiscard]] std::string assemble_email_data() const {
-            std::string email_data = "MAIL FROM:" + mail_properties_.from + "\r\n"
-                                     "RCPT TO:" + mail_properties_.to + "\r\n"
-                                     "DATA\r\n"
-                                     "Subject:" + mail_properties_.subject + "\r\n";
+                    if (!more) {
+                        break;
+                    }
 
-            if (mail_properties_.content_type.empty()) {
-                email_data += "Content-Type: text/plain; charset=\"utf-8\"\r\n";
-            } else {
-                email_data += "Content-Type: " + mail_properties_.content_type + "\r\n";
+                    write(buffer);
+                    buffer.clear();
+                    std::swap(chunk, ahead);
+
+                    // without PIPELINING each BDAT is answered before the next; with it, a few replies are let through
+                    while (chunking && outstanding > 0 && (!supports_pipelining || outstanding >= 16)) {
+                        const reply ret = read_reply();
+                        --outstanding;
+                        if (ret.code / 100 != 2 && failure.code == 0) {
+                            failure = ret;
+                        }
+                    }
+                }
+
+                return outstanding;
             }
 
-            email_data += mail_properties_.data + "\r\n";
-            email_data += ".\r\n";
+            /**
+             * @brief Reads the replies that end a message
+             * @param count The number of replies
+             * @param failure A failure from stream_message(), which takes precedence
+             * @param result Set to the outcome
+             */
+            void read_message_replies(const std::size_t count, const reply& failure, limhamn::smtp::client::send_result& result) {
+                reply decision = failure;
+                for (std::size_t i = 0; i < count; ++i) {
+                    const reply ret = read_reply();
+                    // the first failure decides, otherwise the last reply
+                    if (decision.code == 0 || decision.code / 100 == 2) {
+                        decision = ret;
+                    }
+                }
 
-            return email_data;
-        }
+                result.ok = decision.code / 100 == 2;
+                result.code = decision.code;
+                result.message = decision.text;
+            }
 
-        /**
-         * @brief Send email data.
-         */
-        void send_email_data() {
-            boost::asio::async_write(socket_, boost::asio::buffer(assemble_email_data()),
-                [this](const boost::system::error_code& ec, std::size_t) {
-                    if (!ec) {
-                        read_response();
+            /**
+             * @brief Opens the attachments of a message
+             * @return std::optional<message_stream>, empty if the message cannot be sent, which is recorded in result
+             */
+            std::optional<message_stream> open_message(const limhamn::smtp::client::mail_properties& mail, limhamn::smtp::client::send_result& result) const {
+                try {
+                    return std::optional<message_stream>(std::in_place, mail, settings.chunk_size);
+                } catch (const std::exception& e) {
+                    result.ok = false;
+                    result.code = -1;
+                    result.message = e.what();
+                    return std::nullopt;
+                }
+            }
+
+            void send_pipelined(const std::vector<limhamn::smtp::client::mail_properties>& mails, std::vector<limhamn::smtp::client::send_result>& ret) {
+                std::vector<std::string> recipients{};
+                std::string out{};
+                std::size_t pending{0}; // replies of the message in out, which come first
+                std::size_t pending_index{0};
+                reply pending_failure{};
+                bool need_reset = false;
+                const bool with_data = !use_chunking();
+
+                for (std::size_t i = 0; i <= mails.size(); ++i) {
+                    const bool last = i == mails.size();
+
+                    std::optional<message_stream> message = last ? std::nullopt : open_message(mails[i], ret[i]);
+
+                    const bool reset = need_reset && message;
+                    if (reset) {
+                        out += "RSET\r\n";
+                    }
+                    if (message) {
+                        append_envelope(mails[i], out, recipients, with_data);
+                    }
+
+                    if (!out.empty()) {
+                        write(out);
+                        out.clear();
+                    }
+
+                    if (pending > 0) {
+                        read_message_replies(pending, pending_failure, ret[pending_index]);
+                        pending = 0;
+                    }
+                    if (reset) {
+                        read_reply();
+                        need_reset = false;
+                    }
+                    if (!message) {
+                        continue;
+                    }
+
+                    const int state = read_envelope(recipients, with_data, ret[i]);
+                    if (state == 1) {
+                        pending_failure = reply{};
+                        pending = stream_message(*message, out, pending_failure);
+                        pending_index = i;
                     } else {
-                        throw std::runtime_error("Email data error: " + ec.message());
+                        need_reset = state == 0;
+                    }
+                }
+
+                if (need_reset) {
+                    write("RSET\r\n");
+                    read_reply();
+                }
+            }
+
+            void send_stepwise(const std::vector<limhamn::smtp::client::mail_properties>& mails, std::vector<limhamn::smtp::client::send_result>& ret) {
+                for (std::size_t i = 0; i < mails.size(); ++i) {
+                    auto& result = ret[i];
+                    auto message = open_message(mails[i], result);
+                    if (!message) {
+                        continue;
+                    }
+
+                    const auto recipients = split_addresses(mails[i].to);
+
+                    write("MAIL FROM:" + envelope_address(mails[i].from) + "\r\n");
+                    const reply mail = read_reply();
+                    if (mail.code / 100 != 2) {
+                        result.code = mail.code;
+                        result.message = mail.text;
+                        continue;
+                    }
+
+                    reply first_rejection{};
+                    for (const auto& it : recipients) {
+                        write("RCPT TO:" + envelope_address(it) + "\r\n");
+                        const reply rcpt = read_reply();
+                        if (rcpt.code / 100 != 2) {
+                            result.rejected_recipients.push_back(it);
+                            if (first_rejection.code == 0) {
+                                first_rejection = rcpt;
+                            }
+                        }
+                    }
+
+                    if (result.rejected_recipients.size() == recipients.size()) {
+                        result.code = first_rejection.code;
+                        result.message = first_rejection.text;
+                        write("RSET\r\n");
+                        read_reply();
+                        continue;
+                    }
+
+                    if (!use_chunking()) {
+                        write("DATA\r\n");
+                        const reply data = read_reply();
+                        if (data.code != 354) {
+                            result.code = data.code;
+                            result.message = data.text;
+                            write("RSET\r\n");
+                            read_reply();
+                            continue;
+                        }
+                    }
+
+                    std::string out{};
+                    reply failure{};
+                    const std::size_t count = stream_message(*message, out, failure);
+                    write(out);
+                    read_message_replies(count, failure, result);
+                }
+            }
+    };
+
+    /**
+     * @brief The queue and worker threads of a pool
+     */
+    class pool_state {
+            struct item {
+                limhamn::smtp::client::mail_properties mail{};
+                std::promise<limhamn::smtp::client::send_result> promise{};
+                int attempts{0};
+                std::chrono::steady_clock::time_point not_before{};
+            };
+
+            limhamn::smtp::client::pool_settings settings{};
+            std::mutex mutex{};
+            std::condition_variable changed{};
+            std::deque<item> queue{};
+            std::size_t busy{0};
+            bool stopping{false};
+            std::vector<std::thread> workers{};
+
+            /**
+             * @brief Puts a message back for another attempt, or fails it for good
+             */
+            void retry_or_fail(item&& it, limhamn::smtp::client::send_result result) {
+                if (result.transient() && it.attempts <= settings.max_retries) {
+                    const int64_t delay = settings.retry_delay << (std::min)(it.attempts - 1, 16);
+                    it.not_before = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay);
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    queue.push_back(std::move(it));
+                    return;
+                }
+
+                it.promise.set_value(std::move(result));
+            }
+
+            void work() {
+                std::unique_ptr<connection> session{};
+                auto last_used = std::chrono::steady_clock::now();
+
+                for (;;) {
+                    std::vector<item> batch{};
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        for (;;) {
+                            const auto now = std::chrono::steady_clock::now();
+                            auto wake = now + std::chrono::hours(1);
+                            for (auto it = queue.begin(); it != queue.end() && batch.size() < settings.batch_size;) {
+                                if (it->not_before <= now) {
+                                    batch.push_back(std::move(*it));
+                                    it = queue.erase(it);
+                                } else {
+                                    wake = (std::min)(wake, it->not_before);
+                                    ++it;
+                                }
+                            }
+                            if (!batch.empty()) {
+                                ++busy;
+                                break;
+                            }
+                            if (stopping && queue.empty()) {
+                                if (session) {
+                                    lock.unlock();
+                                    session->quit();
+                                }
+                                return;
+                            }
+                            changed.wait_until(lock, wake);
+                        }
+                    }
+                    // room in the queue for blocked producers
+                    changed.notify_all();
+
+                    std::vector<limhamn::smtp::client::mail_properties> mails{};
+                    mails.reserve(batch.size());
+                    for (auto& it : batch) {
+                        ++it.attempts;
+                        mails.push_back(it.mail);
+                    }
+
+                    std::vector<limhamn::smtp::client::send_result> results(batch.size());
+                    try {
+                        if (session && std::chrono::steady_clock::now() - last_used > std::chrono::milliseconds(settings.idle_check) && !session->noop()) {
+                            session.reset();
+                        }
+                        if (!session) {
+                            session = std::make_unique<connection>(settings.session);
+                        }
+                        session->send(mails, results);
+                    } catch (const std::exception& e) {
+                        // only the messages that never got a final reply are retried; the others were already decided
+                        session.reset();
+                        for (auto& it : results) {
+                            if (it.code == 0) {
+                                it = limhamn::smtp::client::send_result{false, 0, e.what(), {}};
+                            }
+                        }
+                    }
+                    last_used = std::chrono::steady_clock::now();
+
+                    for (std::size_t i = 0; i < batch.size(); ++i) {
+                        retry_or_fail(std::move(batch[i]), std::move(results[i]));
+                    }
+
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        --busy;
                     }
+                    changed.notify_all();
+                }
+            }
+        public:
+            explicit pool_state(const limhamn::smtp::client::pool_settings& settings) : settings(settings) {
+                if (this->settings.sessions == 0) {
+                    this->settings.sessions = 1;
+                }
+                if (this->settings.batch_size == 0) {
+                    this->settings.batch_size = 1;
+                }
+
+                for (std::size_t i = 0; i < this->settings.sessions; ++i) {
+                    workers.emplace_back([this]() {
+                        work();
+                    });
+                }
+            }
+
+            ~pool_state() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                changed.notify_all();
+
+                for (auto& it : workers) {
+                    it.join();
+                }
+            }
+
+            std::future<limhamn::smtp::client::send_result> send(limhamn::smtp::client::mail_properties mail) {
+                item it{};
+                it.mail = std::move(mail);
+                auto ret = it.promise.get_future();
+
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this]() {
+                    return queue.size() < settings.max_queue;
                 });
-        }
+                queue.push_back(std::move(it));
+                lock.unlock();
 
-        boost::asio::ip::tcp::resolver resolver_;
-        boost::asio::ssl::stream<boost::asio::ip::tcp::socket> socket_;
-        boost::asio::streambuf response_;
-        limhamn::smtp::client::mail_properties mail_properties_;
+                changed.notify_all();
+                return ret;
+            }
+
+            void wait() {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [this]() {
+                    return queue.empty() && busy == 0;
+                });
+            }
     };
 }
 
+inline limhamn::smtp::client::session_settings limhamn::smtp::client::session_settings::from(const mail_properties& prop) {
+    session_settings ret{};
+    ret.smtp_server = prop.smtp_server;
+    ret.smtp_port = prop.smtp_port;
+    ret.username = prop.username;
+    ret.password = prop.password;
+    ret.starttls = prop.smtp_port == 587 || prop.smtp_port == 25;
+
+    const std::size_t at = prop.from.find('@');
+    if (at != std::string::npos) {
+        ret.helo_domain = prop.from.substr(at + 1);
+        ret.helo_domain = ret.helo_domain.substr(0, ret.helo_domain.find('>'));
+    }
+
+    return ret;
+}
+
+inline bool limhamn::smtp::client::send_result::transient() const {
+    return !this->ok && (this->code == 0 || this->code / 100 == 4);
+}
+
+inline limhamn::smtp::client::session::session(const session_settings& settings)
+    : connection(std::make_unique<_limhamn_smtp_client_impl::connection>(settings)) {
+}
+
+inline limhamn::smtp::client::session::~session() = default;
+inline limhamn::smtp::client::session::session(session&&) noexcept = default;
+inline limhamn::smtp::client::session& limhamn::smtp::client::session::operator=(session&&) noexcept = default;
+
+inline limhamn::smtp::client::send_result limhamn::smtp::client::session::send(const mail_properties& mail) {
+    return this->connection->send({mail}).front();
+}
+
+inline std::vector<limhamn::smtp::client::send_result> limhamn::smtp::client::session::send(const std::vector<mail_properties>& mails) {
+    return this->connection->send(mails);
+}
+
+inline bool limhamn::smtp::client::session::noop() {
+    return this->connection->noop();
+}
+
+inline void limhamn::smtp::client::session::quit() {
+    this->connection->quit();
+}
+
+inline bool limhamn::smtp::client::session::pipelining() const {
+    return this->connection->pipelining();
+}
+
+inline limhamn::smtp::client::pool::pool(const pool_settings& settings)
+    : state(std::make_shared<_limhamn_smtp_client_impl::pool_state>(settings)) {
+}
+
+inline limhamn::smtp::client::pool::~pool() = default;
+
+inline std::future<limhamn::smtp::client::send_result> limhamn::smtp::client::pool::send(mail_properties mail) {
+    return this->state->send(std::move(mail));
+}
+
+inline void limhamn::smtp::client::pool::wait() {
+    this->state->wait();
+}
+
 inline limhamn::smtp::client::client::client(const mail_properties& prop) {
-    boost::asio::io_context ctx;
-    boost::asio::ssl::context ssl_ctx(boost::asio::ssl::context::tlsv13);
-    ssl_ctx.set_default_verify_paths();
-    _limhamn_smtp_client_impl::smtp_ssl_client client(ctx, ssl_ctx, prop);
-    client.start();
-    ctx.run();
+    session connection{session_settings::from(prop)};
+    const send_result result = connection.send(prop);
+    connection.quit();
+
+    if (!result.ok) {
+        throw std::runtime_error("Send error: " + std::to_string(result.code) + " " + result.message);
+    }
 }
 #endif // LIMHAMN_SMTP_CLIENT_IMPL
@@ -11,6 +11,7 @@
 #include <string>
 #include <functional>
 #include <memory>
+#include <cstdint>
 
 #define LIMHAMN_SOCKET_UDS
 
@@ -19,31 +20,80 @@
 #include <asio.hpp>
 #include <iostream>
 #include <filesystem>
+#include <vector>
+#include <array>
+#include <thread>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <exception>
+#include <chrono>
+#include <stdexcept>
+#include <limits>
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #endif
 
 namespace limhamn::socket_impl {
     class uds_session;
     class uds_server;
+    class uds_client;
 }
 
 /**
  * @brief  Namespace that contains all the socket related classes and functions.
  */
 namespace limhamn::socket {
+    /**
+     * @brief How messages are separated on the socket
+     */
+    enum class uds_framing {
+        delimiter, // requests end with read_delimiter, which is not passed to the callback; replies are written as they are
+        length_prefixed, // requests and replies are a 4 byte big endian length followed by that many bytes, and may be binary
+    };
+
+    /**
+     * @brief Settings for a uds_server
+     */
+    struct uds_server_settings {
+        uds_framing framing{uds_framing::delimiter};
+        std::string read_delimiter{"\n"}; // must not be empty in delimiter mode
+        int threads{1}; // threads run() runs the server on, 0 means std::thread::hardware_concurrency()
+        // requests read from one connection whose replies have not been written yet. once it is reached the connection
+        // is not read from until its replies are written, so a client that does not read cannot make the server buffer.
+        std::size_t max_in_flight{64};
+        std::size_t max_message_size{16 * 1024 * 1024}; // connections sending a larger request are closed
+        // let a uds_client move message bodies through a shared memory ring instead of the socket (Linux, length_prefixed only)
+        bool shared_memory{false};
+        std::size_t max_shared_memory{256 * 1024 * 1024}; // largest ring region a client may attach
+    };
+
     /**
      * @brief Public class representing a UDS socket
+     * @note  Requests on one connection may be pipelined; they are handled in order, and replies that are ready
+     *        together are written with one gathered write. An empty reply is not sent in delimiter mode.
+     * @note  With more than one thread the callback is called concurrently for different connections.
+     * @note  The constructors throw std::invalid_argument if read_delimiter is empty in delimiter mode.
      */
     class uds_server {
         std::string file{};
         std::string read_delimiter{"\n"};
         std::function<std::string(const std::string&)> callback{};
-        std::shared_ptr<limhamn::socket_impl::uds_server> server;
+        limhamn::socket::uds_server_settings settings{};
 #ifdef LIMHAMN_SOCKET_UDS_IMPL
-        asio::io_context ctx;
+        asio::io_context ctx; // declared before server, which must be destroyed while ctx is alive
 #endif
+        std::shared_ptr<limhamn::socket_impl::uds_server> server;
         bool running{false};
     public:
         uds_server(const std::string& file, const std::function<std::string(const std::string&)>& callback, const std::string& read_delimiter, bool run);
+        uds_server(const std::string& file, const std::function<std::string(const std::string&)>& callback, const uds_server_settings& settings, bool run = false);
         ~uds_server();
 
         void run();
@@ -51,6 +101,56 @@ namespace limhamn::socket {
 
         bool is_running();
     };
+
+    /**
+     * @brief Blocking client for a uds_server
+     * @note  Not thread safe. send() only queues; the queue is written by receive() or flush(), so requests sent
+     *        together are written together. Keep at most the server's max_in_flight requests unanswered, or both
+     *        sides can block writing to each other.
+     */
+    class uds_client {
+        std::shared_ptr<limhamn::socket_impl::uds_client> client;
+    public:
+        /**
+         * @brief Connect to a uds_server
+         * @param file The path to the socket
+         * @param settings The framing and read_delimiter the server uses. In delimiter mode replies are read up to read_delimiter.
+         * @throws std::invalid_argument if read_delimiter is empty in delimiter mode
+         * @throws std::runtime_error if the connection fails
+         */
+        explicit uds_client(const std::string& file, const uds_server_settings& settings = {});
+        ~uds_client();
+
+        /**
+         * @brief Offer the server a shared memory region for message bodies
+         * @param ring_size The size of each of the two rings, requests and replies, in bytes
+         * @return bool, true if the server accepted it; otherwise messages keep going through the socket
+         * @note  Needs Linux, length_prefixed framing and uds_server_settings::shared_memory; a server without the latter
+         *        closes the connection. Messages that do not fit in the free part of a ring still go through the socket,
+         *        in order; otherwise only 12 byte notifications do.
+         */
+        bool enable_shared_memory(std::size_t ring_size = 4 * 1024 * 1024);
+        /**
+         * @brief Queue a request
+         * @param data The request
+         */
+        void send(const std::string& data);
+        /**
+         * @brief Write the queued requests
+         */
+        void flush();
+        /**
+         * @brief Wait for the next reply, writing the queued requests first
+         * @return std::string
+         */
+        std::string receive();
+        /**
+         * @brief Send a request and wait for its reply
+         * @param data The request
+         * @return std::string
+         */
+        std::string request(const std::string& data);
+    };
 }
 
 /**
@@ -58,100 +158,884 @@ namespace limhamn::socket {
  */
 #ifdef LIMHAMN_SOCKET_UDS_IMPL
 namespace limhamn::socket_impl {
+/**
+ * @brief Control frames, sent where a length would be: 0xFFFFFFFF, then a 4 byte type and a 4 byte value, big endian
+ */
+enum class control : std::uint32_t {
+    attach = 1, // the client passes a memfd with SCM_RIGHTS; the server answers with attach, value 1 if it mapped it
+    doorbell = 2, // the next value messages are in the sender's ring
+};
+
+inline constexpr std::uint32_t control_marker{0xFFFFFFFFU};
+inline constexpr std::size_t control_size{12};
+
+inline void put_u32(char* out, const std::uint32_t value) {
+    out[0] = static_cast<char>(value >> 24);
+    out[1] = static_cast<char>(value >> 16);
+    out[2] = static_cast<char>(value >> 8);
+    out[3] = static_cast<char>(value);
+}
+
+inline std::uint32_t get_u32(const char* in) {
+    return (static_cast<std::uint32_t>(static_cast<unsigned char>(in[0])) << 24) |
+        (static_cast<std::uint32_t>(static_cast<unsigned char>(in[1])) << 16) |
+        (static_cast<std::uint32_t>(static_cast<unsigned char>(in[2])) << 8) |
+        static_cast<std::uint32_t>(static_cast<unsigned char>(in[3]));
+}
+
+/**
+ * @brief The header of one ring in the shared region; the data follows it
+ */
+struct ring_header {
+    static constexpr std::uint64_t expected_magic{0x6c696d68616d6e01ULL};
+
+    std::uint64_t magic{expected_magic};
+    std::uint64_t capacity{0};
+    alignas(64) std::atomic<std::uint64_t> head{0}; // bytes ever written, only advanced by the producer
+    alignas(64) std::atomic<std::uint64_t> tail{0}; // bytes ever read, only advanced by the consumer
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "the rings need lock free 64 bit atomics to work across processes");
+
+/**
+ * @brief A single producer, single consumer byte ring of length prefixed messages in shared memory
+ * @note Messages wrap around the end of the ring, so every free byte is usable.
+ * @note The other process can write to the whole region, so the capacity is kept here and head, tail and lengths
+ *       read from it are checked against it before every copy.
+ */
+class shared_ring {
+        ring_header* header{nullptr};
+        char* data{nullptr};
+        std::uint64_t capacity{0};
+
+        void copy_in(const std::uint64_t position, const char* in, const std::size_t size) {
+            const std::size_t offset = static_cast<std::size_t>(position % capacity);
+            const std::size_t first = (std::min)(size, static_cast<std::size_t>(capacity) - offset);
+            std::memcpy(data + offset, in, first);
+            std::memcpy(data, in + first, size - first);
+        }
+
+        void copy_out(const std::uint64_t position, char* out, const std::size_t size) const {
+            const std::size_t offset = static_cast<std::size_t>(position % capacity);
+            const std::size_t first = (std::min)(size, static_cast<std::size_t>(capacity) - offset);
+            std::memcpy(out, data + offset, first);
+            std::memcpy(out + first, data, size - first);
+        }
+    public:
+        shared_ring() = default;
+        shared_ring(void* region, const std::uint64_t capacity)
+            : header(static_cast<ring_header*>(region)), data(static_cast<char*>(region) + sizeof(ring_header)), capacity(capacity) {}
+
+        static constexpr std::size_t region_size(const std::size_t capacity) {
+            return sizeof(ring_header) + capacity;
+        }
+
+        /**
+         * @brief Appends a message if there is room for it
+         * @param message The message
+         * @return bool, false if the ring does not have room right now
+         */
+        bool push(const std::string_view message) {
+            const std::uint64_t head = header->head.load(std::memory_order_relaxed);
+            const std::uint64_t tail = header->tail.load(std::memory_order_acquire);
+            if (head - tail > capacity || message.size() + 4 > capacity - (head - tail)) {
+                return false;
+            }
+
+            char length[4];
+            put_u32(length, static_cast<std::uint32_t>(message.size()));
+            copy_in(head, length, 4);
+            copy_in(head + 4, message.data(), message.size());
+            header->head.store(head + 4 + message.size(), std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Takes the oldest message
+         * @param out Set to the message
+         * @param max_size The largest message accepted
+         * @return bool, false if the ring is empty, corrupt or the message is larger than max_size
+         */
+        bool pop(std::string& out, const std::size_t max_size) {
+            const std::uint64_t tail = header->tail.load(std::memory_order_relaxed);
+            const std::uint64_t head = header->head.load(std::memory_order_acquire);
+            const std::uint64_t used = head - tail;
+            if (used < 4 || used > capacity) {
+                return false;
+            }
+
+            char length[4];
+            copy_out(tail, length, 4);
+            const std::uint32_t size = get_u32(length);
+            if (4 + static_cast<std::uint64_t>(size) > used || size > max_size) {
+                return false;
+            }
+
+            out.resize(size);
+            copy_out(tail + 4, out.data(), size);
+            header->tail.store(tail + 4 + size, std::memory_order_release);
+            return true;
+        }
+};
+
+#ifdef __linux__
+/**
+ * @brief A mapped shared region holding a request ring followed by a reply ring
+ */
+class shared_region {
+        void* address{MAP_FAILED};
+        std::size_t size{0};
+    public:
+        shared_ring requests{};
+        shared_ring replies{};
+
+        shared_region() = default;
+        shared_region(const shared_region&) = delete;
+        shared_region& operator=(const shared_region&) = delete;
+
+        ~shared_region() {
+            if (address != MAP_FAILED) {
+                ::munmap(address, size);
+            }
+        }
+
+        /**
+         * @brief Maps a region created by create()
+         * @param fd The memfd, which is not closed
+         * @param max_size The largest region accepted
+         * @return bool
+         */
+        bool map(const int fd, const std::size_t max_size) {
+            // without these seals the client could shrink the memfd under the mapping, and the server would get SIGBUS
+            constexpr int seals = F_SEAL_SHRINK | F_SEAL_GROW;
+            const int applied = ::fcntl(fd, F_GET_SEALS);
+            if (applied == -1 || (applied & seals) != seals) {
+                return false;
+            }
+
+            struct stat info{};
+            if (::fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(2 * sizeof(ring_header)) ||
+                static_cast<std::size_t>(info.st_size) > max_size) {
+                return false;
+            }
+
+            size = static_cast<std::size_t>(info.st_size);
+            address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (address == MAP_FAILED) {
+                return false;
+            }
+
+            // the layout has to be exactly what create() makes. the capacity is read once; the rings never read it again
+            const auto* first = static_cast<const volatile ring_header*>(address);
+            const std::uint64_t capacity = first->capacity;
+            if (first->magic != ring_header::expected_magic || capacity == 0 || capacity > size ||
+                shared_ring::region_size(capacity) * 2 != size) {
+                return false;
+            }
+            const auto* second = reinterpret_cast<const volatile ring_header*>(static_cast<const char*>(address) + shared_ring::region_size(capacity));
+            if (second->magic != ring_header::expected_magic || second->capacity != capacity) {
+                return false;
+            }
+
+            requests = shared_ring{address, capacity};
+            replies = shared_ring{static_cast<char*>(address) + shared_ring::region_size(capacity), capacity};
+            return true;
+        }
+
+        /**
+         * @brief Creates a region in a new memfd
+         * @param capacity The capacity of each ring
+         * @return int, the memfd, or -1
+         */
+        int create(const std::size_t capacity) {
+            const int fd = ::memfd_create("limhamn-uds", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+            if (fd == -1) {
+                return -1;
+            }
+
+            size = shared_ring::region_size(capacity) * 2;
+            if (::ftruncate(fd, static_cast<off_t>(size)) != 0 || ::fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0) {
+                ::close(fd);
+                return -1;
+            }
+            address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (address == MAP_FAILED) {
+                ::close(fd);
+                return -1;
+            }
+
+            new (address) ring_header{};
+            static_cast<ring_header*>(address)->capacity = capacity;
+            void* second = static_cast<char*>(address) + shared_ring::region_size(capacity);
+            new (second) ring_header{};
+            static_cast<ring_header*>(second)->capacity = capacity;
+
+            requests = shared_ring{address, capacity};
+            replies = shared_ring{second, capacity};
+            return fd;
+        }
+};
+#endif
+
 class uds_session : public std::enable_shared_from_this<uds_session> {
     public:
         explicit uds_session(asio::local::stream_protocol::socket socket,
-                const std::function<std::string(const std::string&)>& callback, const std::string& read_delimiter = "\n") : socket_(std::move(socket)), callback_(std::move(callback)), read_delimiter_(std::move(read_delimiter)) {};
+                const std::function<std::string(const std::string&)>& callback, const limhamn::socket::uds_server_settings& settings)
+            : socket_(std::move(socket)), callback_(callback), settings_(settings) {};
 
         void start() {
+            buffer_.resize(16384);
             read();
         }
     private:
+        static constexpr std::size_t header_size{4};
+
+        /**
+         * @brief A reply waiting to be written, or a control frame if type is set
+         */
+        struct reply {
+            std::string data{};
+            control type{};
+            std::uint32_t value{0};
+        };
+
+        std::size_t in_flight() const {
+            return pending_count_ + writing_count_;
+        }
+
+        void close() {
+            asio::error_code ec;
+            socket_.close(ec);
+        }
+
         void read() {
-            auto self = shared_from_this();
-            asio::async_read_until(socket_, buffer_, read_delimiter_,
-                    [self](asio::error_code ec, std::size_t bytes_transferred) {
-                        if (!ec) {
-                            std::istream stream(&self->buffer_);
-                            std::string data{};
-                            std::getline(stream, data);
+            if (reading_ || !socket_.is_open()) {
+                return;
+            }
 
-                            if (!self->socket_.is_open()) {
-                                throw std::runtime_error{"read(): socket not open"};
-                            }
+            if (end_ == buffer_.size()) {
+                // the message being read is larger than the buffer; max_message_size is checked when it is parsed
+                buffer_.resize(buffer_.size() * 2);
+            }
 
-                            if (!self->callback_) {
-                                throw std::runtime_error{"no valid r/w callback"};
-                            }
+            reading_ = true;
+            auto self = shared_from_this();
+#ifdef __linux__
+            if (settings_.shared_memory && settings_.framing == limhamn::socket::uds_framing::length_prefixed) {
+                // a passed fd only survives recvmsg, so wait for readability and receive by hand
+                socket_.async_wait(asio::local::stream_protocol::socket::wait_read, [self](asio::error_code ec) {
+                    self->reading_ = false;
+                    if (ec) {
+                        self->close();
+                        return;
+                    }
+
+                    const ssize_t received = self->receive();
+                    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                        self->read();
+                        return;
+                    }
+                    if (received <= 0) {
+                        self->close();
+                        return;
+                    }
 
-                            const std::string& ret = self->callback_(data);
+                    self->end_ += static_cast<std::size_t>(received);
+                    self->process();
+                });
+                return;
+            }
+#endif
+            socket_.async_read_some(asio::buffer(buffer_.data() + end_, buffer_.size() - end_),
+                    [self](asio::error_code ec, std::size_t bytes_transferred) {
+                        self->reading_ = false;
 
-                            if (!ret.empty()) {
-                                self->write(ret);
-                            }
-                        } else if (ec == asio::error::eof) {
+                        if (ec) {
+                            // eof is the client hanging up; anything else is just as final for this connection
+                            self->close();
                             return;
-                        } else {
-                            throw std::runtime_error{"read() failed."};
                         }
+
+                        self->end_ += bytes_transferred;
+                        self->process();
                     }
             );
         }
-        void write(const std::string& response) {
-            auto self = shared_from_this();
 
-            if (!socket_.is_open()) {
-                throw std::runtime_error{"socket_ is not open"};
+#ifdef __linux__
+        /**
+         * @brief Receives into the buffer with recvmsg, keeping a passed fd
+         * @return ssize_t, as recvmsg
+         */
+        ssize_t receive() {
+            iovec vector{buffer_.data() + end_, buffer_.size() - end_};
+            alignas(cmsghdr) char control_buffer[CMSG_SPACE(sizeof(int) * 4)];
+
+            msghdr message{};
+            message.msg_iov = &vector;
+            message.msg_iovlen = 1;
+            message.msg_control = control_buffer;
+            message.msg_controllen = sizeof(control_buffer);
+
+            const ssize_t ret = ::recvmsg(socket_.native_handle(), &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+            if (ret <= 0) {
+                return ret;
+            }
+
+            for (cmsghdr* it = CMSG_FIRSTHDR(&message); it != nullptr; it = CMSG_NXTHDR(&message, it)) {
+                if (it->cmsg_level != SOL_SOCKET || it->cmsg_type != SCM_RIGHTS) {
+                    continue;
+                }
+
+                const std::size_t count = (it->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (std::size_t i = 0; i < count; ++i) {
+                    int fd;
+                    std::memcpy(&fd, CMSG_DATA(it) + i * sizeof(int), sizeof(int));
+                    if (passed_fd_ != -1) {
+                        ::close(passed_fd_);
+                    }
+                    passed_fd_ = fd;
+                }
+            }
+
+            return ret;
+        }
+
+        /**
+         * @brief Maps the region the client passed, and queues the answer
+         */
+        void attach() {
+            auto region = std::make_unique<shared_region>();
+            const bool ok = passed_fd_ != -1 && region->map(passed_fd_, settings_.max_shared_memory);
+            if (passed_fd_ != -1) {
+                ::close(passed_fd_);
+                passed_fd_ = -1;
+            }
+
+            if (ok) {
+                region_ = std::move(region);
+            }
+            pending_.push_back({{}, control::attach, ok ? 1U : 0U});
+        }
+#endif
+
+        /**
+         * @brief Gets the next complete request, from the ring if a doorbell announced one, otherwise from the buffer
+         * @param request Set to the request
+         * @return bool, false if there is no complete request
+         */
+        bool next_request(std::string& request) {
+#ifdef __linux__
+            if (ring_requests_ != 0) {
+                if (!region_ || !region_->requests.pop(request, settings_.max_message_size)) {
+                    failed_ = true;
+                    return false;
+                }
+                --ring_requests_;
+                return true;
             }
+#endif
+
+            const char* data = buffer_.data() + begin_;
+            const std::size_t size = end_ - begin_;
+
+            if (settings_.framing == limhamn::socket::uds_framing::length_prefixed) {
+                if (size < header_size) {
+                    return false;
+                }
+
+                const std::size_t length = get_u32(data);
+#ifdef __linux__
+                if (length == control_marker && settings_.shared_memory) {
+                    if (size < control_size) {
+                        return false;
+                    }
+
+                    const auto type = static_cast<control>(get_u32(data + 4));
+                    const std::uint32_t value = get_u32(data + 8);
+                    begin_ += control_size;
+
+                    if (type == control::attach) {
+                        attach();
+                    } else if (type == control::doorbell) {
+                        ring_requests_ = value;
+                    } else {
+                        failed_ = true;
+                        return false;
+                    }
+                    return next_request(request);
+                }
+#endif
+                if (length > settings_.max_message_size) {
+                    failed_ = true;
+                    return false;
+                }
+                if (size < header_size + length) {
+                    return false;
+                }
 
-            asio::async_write(socket_, asio::buffer(response),
+                request.assign(data + header_size, length);
+                begin_ += header_size + length;
+                return true;
+            }
+
+            const std::string_view view{data, size};
+            const std::string& delimiter = settings_.read_delimiter;
+            // the part before scanned_ was already searched when less of the request had arrived
+            const std::size_t from = scanned_ > begin_ ? scanned_ - begin_ : 0;
+            const std::size_t pos = delimiter.empty() ? std::string_view::npos : view.find(delimiter, from);
+
+            if (pos == std::string_view::npos) {
+                scanned_ = begin_ + (size >= delimiter.size() ? size - delimiter.size() + 1 : 0);
+                if (size > settings_.max_message_size) {
+                    failed_ = true;
+                }
+                return false;
+            }
+
+            request.assign(data, pos);
+            begin_ += pos + delimiter.size();
+            scanned_ = begin_;
+            return true;
+        }
+
+        /**
+         * @brief Queues a reply, through the reply ring if one is attached and it has room
+         * @param data The reply
+         */
+        void queue_reply(std::string data) {
+            ++pending_count_;
+#ifdef __linux__
+            if (region_ && region_->replies.push(data)) {
+                // consecutive ring replies share one doorbell, which has to stay in order with the replies around it
+                if (!pending_.empty() && pending_.back().type == control::doorbell) {
+                    ++pending_.back().value;
+                } else {
+                    pending_.push_back({{}, control::doorbell, 1});
+                }
+                return;
+            }
+#endif
+            pending_.push_back({std::move(data), {}, 0});
+        }
+
+        /**
+         * @brief Handles the complete requests in the buffer, then writes the replies and reads more
+         */
+        void process() {
+            while (!failed_ && in_flight() < settings_.max_in_flight && next_request(request_)) {
+                std::string reply{};
+                try {
+                    reply = callback_(request_);
+                } catch (const std::exception&) {
+                    close();
+                    return;
+                }
+
+                if (settings_.framing == limhamn::socket::uds_framing::delimiter && reply.empty()) {
+                    continue;
+                }
+                queue_reply(std::move(reply));
+            }
+
+            // a request that is too large ends the connection, once the replies to the ones before it are written
+            if (failed_) {
+                if (writing_.empty() && !pending_.empty()) {
+                    write();
+                } else if (writing_.empty()) {
+                    close();
+                }
+                return;
+            }
+
+            // move the unparsed rest of the buffer to the front, so the buffer only grows for large messages
+            if (begin_ == end_) {
+                begin_ = end_ = scanned_ = 0;
+            } else if (begin_ > buffer_.size() / 2) {
+                std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+                end_ -= begin_;
+                scanned_ -= (std::min)(scanned_, begin_);
+                begin_ = 0;
+            }
+
+            if (writing_.empty() && !pending_.empty()) {
+                write();
+            }
+            if (in_flight() < settings_.max_in_flight) {
+                read();
+            }
+        }
+
+        void write() {
+            writing_.swap(pending_);
+            writing_count_ = pending_count_;
+            pending_count_ = 0;
+
+            buffers_.clear();
+            headers_.resize(writing_.size());
+            for (std::size_t i = 0; i < writing_.size(); ++i) {
+                if (writing_[i].type != control{}) {
+                    put_u32(headers_[i].data(), control_marker);
+                    put_u32(headers_[i].data() + 4, static_cast<std::uint32_t>(writing_[i].type));
+                    put_u32(headers_[i].data() + 8, writing_[i].value);
+                    buffers_.emplace_back(headers_[i].data(), control_size);
+                    continue;
+                }
+                if (settings_.framing == limhamn::socket::uds_framing::length_prefixed) {
+                    put_u32(headers_[i].data(), static_cast<std::uint32_t>(writing_[i].data.size()));
+                    buffers_.emplace_back(headers_[i].data(), header_size);
+                }
+                buffers_.emplace_back(writing_[i].data.data(), writing_[i].data.size());
+            }
+
+            auto self = shared_from_this();
+            asio::async_write(socket_, buffers_,
                     [self](asio::error_code ec, std::size_t) {
-                        if (!ec) {
-                            self->read();
+                        if (ec) {
+                            self->close();
                             return;
                         }
 
-                        throw std::runtime_error{"async_write() failed: " + ec.message()};
+                        self->writing_.clear();
+                        self->writing_count_ = 0;
+                        if (!self->pending_.empty()) {
+                            self->write();
+                        }
+
+                        // requests may be waiting in the buffer for the in-flight count to drop
+                        self->process();
                     }
             );
         }
 
         asio::local::stream_protocol::socket socket_;
-        asio::streambuf buffer_{};
         std::function<std::string(const std::string&)> callback_{};
-        std::string read_delimiter_{};
+        limhamn::socket::uds_server_settings settings_{};
+        std::vector<char> buffer_{};
+        std::size_t begin_{0};
+        std::size_t end_{0};
+        std::size_t scanned_{0};
+        bool reading_{false};
+        bool failed_{false};
+        std::string request_{};
+        std::vector<reply> pending_{};
+        std::vector<reply> writing_{};
+        std::size_t pending_count_{0};
+        std::size_t writing_count_{0};
+        std::vector<std::array<char, control_size>> headers_{};
+        std::vector<asio::const_buffer> buffers_{};
+#ifdef __linux__
+        int passed_fd_{-1};
+        std::uint32_t ring_requests_{0};
+        std::unique_ptr<shared_region> region_{};
+    public:
+        ~uds_session() {
+            if (passed_fd_ != -1) {
+                ::close(passed_fd_);
+            }
+        }
+#endif
 };
 
 class uds_server {
     public:
-        uds_server(asio::io_context& ctx, const std::string& path, const std::function<std::string(const std::string&)>& callback, const std::string& read_delimiter) : acceptor_(ctx, asio::local::stream_protocol::endpoint(path)), callback_(std::move(callback)), read_delimiter_(std::move(read_delimiter)) {
+        uds_server(asio::io_context& ctx, const std::string& path, const std::function<std::string(const std::string&)>& callback, const limhamn::socket::uds_server_settings& settings)
+            : ctx_(ctx), acceptor_(ctx, asio::local::stream_protocol::endpoint(path)), retry_timer_(ctx), callback_(callback), settings_(settings) {
                 accept();
             }
     private:
+        static constexpr std::chrono::milliseconds retry_delay{100};
+
         void accept() {
-            acceptor_.async_accept(
+            // every connection gets its own strand, so its handlers never run concurrently
+            acceptor_.async_accept(asio::make_strand(ctx_),
                     [this](asio::error_code ec, asio::local::stream_protocol::socket socket) {
                         if (!ec) {
-                            std::make_shared<uds_session>(std::move(socket), callback_, std::move(read_delimiter_))->start();
-                        } else {
-                            throw std::runtime_error{"async_accept() failed."};
+                            std::make_shared<uds_session>(std::move(socket), callback_, settings_)->start();
+                        } else if (ec == asio::error::operation_aborted) {
+                            return;
+                        } else if (ec != asio::error::connection_aborted) {
+                            // errors like EMFILE last until a connection closes, retrying at once would spin
+                            retry_timer_.expires_after(retry_delay);
+                            retry_timer_.async_wait([this](asio::error_code timer_ec) {
+                                if (timer_ec != asio::error::operation_aborted) {
+                                    accept();
+                                }
+                            });
+                            return;
                         }
+
+                        accept();
                     }
             );
         }
 
+        asio::io_context& ctx_;
         asio::local::stream_protocol::acceptor acceptor_;
+        asio::steady_timer retry_timer_;
         std::function<std::string(const std::string&)> callback_;
-        std::string read_delimiter_;
+        limhamn::socket::uds_server_settings settings_;
+};
+
+class uds_client {
+    public:
+        uds_client(const std::string& path, const limhamn::socket::uds_server_settings& settings) : socket_(ctx_), settings_(settings) {
+            if (settings_.framing == limhamn::socket::uds_framing::delimiter && settings_.read_delimiter.empty()) {
+                throw std::invalid_argument{"uds_client(): read_delimiter must not be empty in delimiter mode"};
+            }
+
+            asio::error_code ec;
+            socket_.connect(asio::local::stream_protocol::endpoint(path), ec);
+            if (ec) {
+                throw std::runtime_error{"uds_client(): connect() failed: " + ec.message()};
+            }
+        }
+
+        bool enable_shared_memory(const std::size_t ring_size) {
+#ifdef __linux__
+            if (settings_.framing != limhamn::socket::uds_framing::length_prefixed || region_ || ring_size < 64) {
+                return false;
+            }
+
+            flush();
+
+            auto region = std::make_unique<shared_region>();
+            const int fd = region->create(ring_size);
+            if (fd == -1) {
+                return false;
+            }
+
+            char frame[control_size];
+            put_u32(frame, control_marker);
+            put_u32(frame + 4, static_cast<std::uint32_t>(control::attach));
+            put_u32(frame + 8, 0);
+
+            iovec vector{frame, control_size};
+            alignas(cmsghdr) char control_buffer[CMSG_SPACE(sizeof(int))];
+            msghdr message{};
+            message.msg_iov = &vector;
+            message.msg_iovlen = 1;
+            message.msg_control = control_buffer;
+            message.msg_controllen = sizeof(control_buffer);
+
+            cmsghdr* header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+            ssize_t sent;
+            do {
+                sent = ::sendmsg(socket_.native_handle(), &message, MSG_NOSIGNAL);
+            } while (sent < 0 && errno == EINTR);
+            ::close(fd);
+
+            // a short write cannot happen for 12 bytes on a stream socket that is not shut down
+            if (sent != static_cast<ssize_t>(control_size)) {
+                throw std::runtime_error{"enable_shared_memory(): sendmsg() failed"};
+            }
+
+            // replies to requests sent before this may arrive first; they are kept for receive()
+            attach_answer_ = -1;
+            while (attach_answer_ == -1) {
+                std::string reply{};
+                if (next_frame(reply)) {
+                    ready_.push_back(std::move(reply));
+                }
+            }
+
+            if (attach_answer_ == 1) {
+                region_ = std::move(region);
+            }
+            return attach_answer_ == 1;
+#else
+            static_cast<void>(ring_size);
+            return false;
+#endif
+        }
+
+        void send(const std::string& data) {
+            if (settings_.framing == limhamn::socket::uds_framing::delimiter) {
+                out_ += data;
+                out_ += settings_.read_delimiter;
+                return;
+            }
+
+#ifdef __linux__
+            if (region_ && region_->requests.push(data)) {
+                if (last_doorbell_ != std::string::npos) {
+                    put_u32(out_.data() + last_doorbell_ + 8, get_u32(out_.data() + last_doorbell_ + 8) + 1);
+                } else {
+                    last_doorbell_ = out_.size();
+                    char frame[control_size];
+                    put_u32(frame, control_marker);
+                    put_u32(frame + 4, static_cast<std::uint32_t>(control::doorbell));
+                    put_u32(frame + 8, 1);
+                    out_.append(frame, control_size);
+                }
+                return;
+            }
+#endif
+
+            char length[header_size];
+            put_u32(length, static_cast<std::uint32_t>(data.size()));
+            out_.append(length, header_size);
+            out_ += data;
+            last_doorbell_ = std::string::npos;
+        }
+
+        void flush() {
+            if (out_.empty()) {
+                return;
+            }
+
+            asio::error_code ec;
+            asio::write(socket_, asio::buffer(out_), ec);
+            out_.clear();
+            last_doorbell_ = std::string::npos;
+
+            if (ec) {
+                throw std::runtime_error{"flush(): write() failed: " + ec.message()};
+            }
+        }
+
+        std::string receive() {
+            flush();
+
+            if (!ready_.empty()) {
+                std::string ret = std::move(ready_.front());
+                ready_.erase(ready_.begin());
+                return ret;
+            }
+
+            std::string ret{};
+            while (!next_frame(ret)) {
+            }
+            return ret;
+        }
+    private:
+        static constexpr std::size_t header_size{4};
+
+        /**
+         * @brief Reads more from the socket into in_
+         */
+        void read_more() {
+            if (in_begin_ != 0) {
+                in_.erase(0, in_begin_);
+                in_begin_ = 0;
+            }
+
+            const std::size_t size = in_.size();
+            in_.resize(size + 65536);
+
+            asio::error_code ec;
+            const std::size_t received = socket_.read_some(asio::buffer(in_.data() + size, 65536), ec);
+            in_.resize(size + received);
+
+            if (ec) {
+                throw std::runtime_error{"receive(): read_some() failed: " + ec.message()};
+            }
+        }
+
+        /**
+         * @brief Reads the next frame
+         * @param out Set to the reply, if the frame was one
+         * @return bool, false if the frame was a control frame
+         */
+        bool next_frame(std::string& out) {
+#ifdef __linux__
+            if (ring_replies_ != 0) {
+                if (!region_ || !region_->replies.pop(out, (std::numeric_limits<std::uint32_t>::max)())) {
+                    throw std::runtime_error{"receive(): the reply ring is corrupt"};
+                }
+                --ring_replies_;
+                return true;
+            }
+#endif
+
+            if (settings_.framing == limhamn::socket::uds_framing::delimiter) {
+                const std::string& delimiter = settings_.read_delimiter;
+                std::size_t from = in_begin_;
+                for (;;) {
+                    const std::size_t pos = in_.find(delimiter, from);
+                    if (pos != std::string::npos) {
+                        out.assign(in_, in_begin_, pos - in_begin_);
+                        in_begin_ = pos + delimiter.size();
+                        return true;
+                    }
+
+                    const std::size_t scanned = in_.size() - in_begin_;
+                    read_more();
+                    from = scanned >= delimiter.size() ? scanned - delimiter.size() + 1 : 0;
+                }
+            }
+
+            while (in_.size() - in_begin_ < header_size) {
+                read_more();
+            }
+
+            const std::uint32_t length = get_u32(in_.data() + in_begin_);
+            if (length == control_marker) {
+                while (in_.size() - in_begin_ < control_size) {
+                    read_more();
+                }
+
+                const auto type = static_cast<control>(get_u32(in_.data() + in_begin_ + 4));
+                const std::uint32_t value = get_u32(in_.data() + in_begin_ + 8);
+                in_begin_ += control_size;
+
+                if (type == control::doorbell) {
+                    ring_replies_ += value;
+                } else if (type == control::attach) {
+                    attach_answer_ = static_cast<int>(value);
+                }
+                return false;
+            }
+
+            while (in_.size() - in_begin_ < header_size + length) {
+                read_more();
+            }
+
+            out.assign(in_, in_begin_ + header_size, length);
+            in_begin_ += header_size + length;
+            return true;
+        }
+
+        asio::io_context ctx_{};
+        asio::local::stream_protocol::socket socket_;
+        limhamn::socket::uds_server_settings settings_{};
+        std::string out_{};
+        std::size_t last_doorbell_{std::string::npos};
+        std::string in_{};
+        std::size_t in_begin_{0};
+        std::vector<std::string> ready_{};
+        std::uint32_t ring_replies_{0};
+        int attach_answer_{-1};
+#ifdef __linux__
+        std::unique_ptr<shared_region> region_{};
+#endif
 };
 } // namespace limhamn::socket_impl
 
 inline limhamn::socket::uds_server::uds_server(const std::string& file, const std::function<std::string(const std::string&)>& callback,
         const std::string& read_delimiter = "\n", const bool run = false)
-    : file(file), callback(callback), read_delimiter(read_delimiter) {
+    : uds_server(file, callback, uds_server_settings{uds_framing::delimiter, read_delimiter}, run) {
+}
+
+inline limhamn::socket::uds_server::uds_server(const std::string& file, const std::function<std::string(const std::string&)>& callback,
+        const uds_server_settings& settings, const bool run)
+    : file(file), read_delimiter(settings.read_delimiter), callback(callback), settings(settings) {
+    if (this->settings.framing == uds_framing::delimiter && this->settings.read_delimiter.empty()) {
+        throw std::invalid_argument{"uds_server(): read_delimiter must not be empty in delimiter mode"};
+    }
+
     std::filesystem::remove(this->file);
 
-    this->server = std::make_shared<limhamn::socket_impl::uds_server>(this->ctx, this->file, this->callback, this->read_delimiter);
+    if (this->settings.max_in_flight == 0) {
+        this->settings.max_in_flight = 1;
+    }
+
+    this->server = std::make_shared<limhamn::socket_impl::uds_server>(this->ctx, this->file, this->callback, this->settings);
     if (!server) {
         throw std::runtime_error{"failed to create uds_server object."};
     }
@@ -177,8 +1061,53 @@ inline void limhamn::socket::uds_server::run() {
         throw std::runtime_error{"server already running"};
     }
 
+    std::size_t thread_count = this->settings.threads > 0 ? static_cast<std::size_t>(this->settings.threads) : std::thread::hardware_concurrency();
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+
     this->running = true;
-    ctx.run();
+
+    // a handler that throws stops every thread, and the first exception is rethrown once they are joined
+    std::exception_ptr error{};
+    std::mutex error_mutex{};
+    const auto work = [this, &error, &error_mutex]() {
+        try {
+            ctx.run();
+        } catch (...) {
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            ctx.stop();
+        }
+    };
+
+    std::vector<std::thread> threads{};
+    try {
+        for (std::size_t i{1}; i < thread_count; ++i) {
+            threads.emplace_back(work);
+        }
+    } catch (...) {
+        ctx.stop();
+        for (auto& it : threads) {
+            it.join();
+        }
+        this->running = false;
+        throw;
+    }
+    work();
+
+    for (auto& it : threads) {
+        it.join();
+    }
+
+    if (error) {
+        this->running = false;
+        std::rethrow_exception(error);
+    }
 }
 
 inline void limhamn::socket::uds_server::stop() {
@@ -198,4 +1127,31 @@ inline limhamn::socket::uds_server::~uds_server() {
         this->stop();
     } catch (const std::exception&) {}
 }
+
+inline limhamn::socket::uds_client::uds_client(const std::string& file, const uds_server_settings& settings)
+    : client(std::make_shared<limhamn::socket_impl::uds_client>(file, settings)) {
+}
+
+inline limhamn::socket::uds_client::~uds_client() = default;
+
+inline bool limhamn::socket::uds_client::enable_shared_memory(const std::size_t ring_size) {
+    return this->client->enable_shared_memory(ring_size);
+}
+
+inline void limhamn::socket::uds_client::send(const std::string& data) {
+    this->client->send(data);
+}
+
+inline void limhamn::socket::uds_client::flush() {
+    this->client->flush();
+}
+
+inline std::string limhamn::socket::uds_client::receive() {
+    return this->client->receive();
+}
+
+inline std::string limhamn::socket::uds_client::request(const std::string& data) {
+    this->client->send(data);
+    return this->client->receive();
+}
 #endif
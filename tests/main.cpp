@@ -3,6 +3,21 @@
 //
 
 #include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <thread>
+#include <functional>
+#include <cctype>
+#include <random>
+#include <array>
+#include <algorithm>
+#include <optional>
+#include <tuple>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #define LIMHAMN_ARGUMENT_MANAGER_IMPL
 #define LIMHAMN_DATABASE_SQLITE3
@@ -24,9 +39,1102 @@
 #include <limhamn/ini/ini_parser.hpp>
 #include <limhamn/logger/logger.hpp>
 #include <limhamn/smtp/smtp_client.hpp>
+#ifdef LIMHAMN_TEST_PRIMITIVE
+#define LIMHAMN_PRIMITIVE_IMPL
+#include <limhamn/primitive/primitive.hpp>
+#endif
+#ifdef LIMHAMN_TEST_UDS
+#define LIMHAMN_SOCKET_UDS_IMPL
+#include <limhamn/socket/socket_uds.hpp>
+#endif
 
 #include "macros.hpp"
 
+// a port per test, so that one test's connections in TIME_WAIT do not get in the way of the next
+static int test_port(const int offset) {
+    return 20000 + static_cast<int>(::getpid() % 20000) + offset;
+}
+
+/**
+ * @brief Sends raw bytes to 127.0.0.1:port and reads until the server closes the connection
+ * @return std::string, the response or an empty string if the connection failed
+ */
+static std::string raw_request(const int port, const std::string& data) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return {};
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    timeval timeout{5, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string ret{};
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+        std::size_t sent{0};
+        while (sent < data.size()) {
+            const ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                break;
+            }
+            sent += static_cast<std::size_t>(n);
+        }
+
+        char buffer[4096];
+        for (;;) {
+            const ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+            if (n <= 0) {
+                break;
+            }
+            ret.append(buffer, static_cast<std::size_t>(n));
+        }
+    }
+
+    ::close(fd);
+    return ret;
+}
+
+static int response_status(const std::string& response) {
+    return response.size() > 12 ? std::atoi(response.c_str() + 9) : 0;
+}
+
+/**
+ * @brief Runs a limhamn::http::server on a background thread for as long as it exists
+ */
+class test_server {
+    std::thread thread{};
+public:
+    test_server(const int port, const std::function<void()>& run) {
+        thread = std::thread([run]() {
+            try {
+                run();
+            } catch (const std::exception& e) {
+                std::cerr << "test_server: " << e.what() << std::endl;
+            }
+        });
+
+        // the server can only be stopped once it accepts
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while (raw_request(port, "GET / HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n").empty()
+            && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    ~test_server() {
+        limhamn::http::server::server::stop();
+        thread.join();
+    }
+    test_server(const test_server&) = delete;
+    test_server& operator=(const test_server&) = delete;
+};
+
+static limhamn::http::server::server_settings test_server_settings(const int port) {
+    limhamn::http::server::server_settings settings{};
+    settings.port = port;
+    settings.enable_session = false;
+    settings.session_directory = std::filesystem::temp_directory_path().string();
+    settings.default_rate_limit = -1;
+    return settings;
+}
+
+static void test_ini_table_get() {
+    const limhamn::ini::ini_table table{
+        "[server]\n"
+        "port = 8080\n"
+        "mask = 0x1F\n"
+        "offset = -12\n"
+        "ratio = 0.75\n"
+        "enabled = Yes\n"
+        "disabled = off\n"
+        "name = \"limhamn\"\n"
+        "timeout = 250ms\n"
+        "interval = 1.5h\n"
+        "bare = 30\n"
+        "ports = 80, 443 ,8443\n"
+        "broken = 12abc\n"
+    };
+
+    REQUIRE(table.get<int>("server", "port") == 8080);
+    REQUIRE(table.get<unsigned int>("server", "mask") == 31);
+    REQUIRE(table.get<int64_t>("server", "offset") == -12);
+    REQUIRE(table.get<double>("server", "ratio") == 0.75);
+    REQUIRE(table.get<bool>("server", "enabled"));
+    REQUIRE(!table.get<bool>("server", "disabled"));
+    REQUIRE(table.get<std::string>("server", "name") == "limhamn");
+    REQUIRE(table.get<std::string_view>("server", "name") == "limhamn");
+    REQUIRE(table.get<std::chrono::milliseconds>("server", "timeout") == std::chrono::milliseconds(250));
+    REQUIRE(table.get<std::chrono::minutes>("server", "interval") == std::chrono::minutes(90));
+    REQUIRE(table.get<std::chrono::seconds>("server", "bare") == std::chrono::seconds(30));
+    REQUIRE((table.get<std::vector<int>>("server", "ports") == std::vector<int>{80, 443, 8443}));
+
+    bool thrown{false};
+    try {
+        static_cast<void>(table.get<int>("server", "broken"));
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    REQUIRE(thrown);
+    thrown = false;
+    try {
+        static_cast<void>(table.get<int>("server", "missing"));
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    REQUIRE(thrown);
+
+    REQUIRE(table.get_or<int>("server", "broken", 7) == 7);
+    REQUIRE(table.get_or<int>("missing", "port", 9) == 9);
+    REQUIRE(table.get_or<int>("server", "port", 9) == 8080);
+}
+
+static void test_ini_table_parse() {
+    const std::string data{
+        "; leading comment\n"
+        "[text]\n"
+        "spaced =   hello   world  \n"
+        "quoted = \" a ; b # c \" ; comment\n"
+        "escaped = a \\; b\n"
+        "semicolon = value ; comment\n"
+        "hash = value # comment\n"
+        "[  other  ]\n"
+        "y = 2\n"
+        "[text]\n"
+        "z = 3\n"
+        "spaced = last\n"
+    };
+
+    const auto check = [](const limhamn::ini::ini_table& table) {
+        REQUIRE(table.get("text", "quoted") == " a ; b # c ");
+        REQUIRE(table.get("text", "escaped") == "a \\; b");
+        REQUIRE(table.get("text", "semicolon") == "value");
+        REQUIRE(table.get("text", "hash") == "value");
+        REQUIRE(table.get("other", "y") == "2");
+
+        // the last value wins, in the position of the first
+        REQUIRE(table.get("text", "spaced") == "last");
+        REQUIRE(table.size() == 7);
+
+        // a repeated header continues the first one
+        const auto [first, last] = table.get_header("text");
+        std::vector<std::string_view> keys{};
+        for (auto it = first; it != last; ++it) {
+            keys.push_back(it->key);
+        }
+        REQUIRE((keys == std::vector<std::string_view>{"spaced", "quoted", "escaped", "semicolon", "hash", "z"}));
+    };
+
+    check(limhamn::ini::ini_table{data});
+    REQUIRE(limhamn::ini::ini_table{"[a]\nvalue =   inner   space  \n"}.get("a", "value") == "inner   space");
+
+    // a table read from a file owns its data, so truncating the file does not affect it
+    const auto path = (std::filesystem::temp_directory_path() / ("limhamn_test_table_" + std::to_string(::getpid()) + ".ini")).string();
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << data;
+    }
+    const limhamn::ini::ini_table table{path, true};
+    std::filesystem::resize_file(path, 0);
+    check(table);
+    std::filesystem::remove(path);
+}
+
+static void test_multipart_body_sink() {
+    using sink_type = limhamn::http::server::basic_body_sink<limhamn::http::utils::multipart_writer>;
+    const int port = test_port(0);
+    const auto directory = std::filesystem::temp_directory_path() / ("limhamn_test_upload_" + std::to_string(::getpid()));
+    std::filesystem::create_directories(directory);
+
+    auto settings = test_server_settings(port);
+    settings.body_streamer = [&directory](const limhamn::http::server::request_view& view) -> std::shared_ptr<limhamn::http::server::body_sink> {
+        const std::string boundary = limhamn::http::utils::multipart_parser::get_boundary(view.content_type());
+        if (boundary.empty()) {
+            return nullptr;
+        }
+        return std::make_shared<sink_type>(boundary, (directory / "%r").string(), 64, 16);
+    };
+
+    const test_server server{port, [&settings]() {
+        limhamn::http::server::server{settings, [](const limhamn::http::server::request& req) {
+            limhamn::http::server::response response{};
+            if (auto* sink = dynamic_cast<sink_type*>(req.sink.get())) {
+                const auto& fields = sink->get().get_fields();
+                const auto it = fields.find("name");
+                response.body = it == fields.end() ? "" : it->second;
+            }
+            return response;
+        }};
+    }};
+
+    const auto post = [port](const std::string& body) {
+        return raw_request(port, "POST /upload HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n"
+            "Content-Type: multipart/form-data; boundary=xyz\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body);
+    };
+
+    const std::string part = "--xyz\r\nContent-Disposition: form-data; name=\"name\"\r\n\r\nlimhamn";
+
+    const std::string complete = post(part + "\r\n--xyz--\r\n");
+    REQUIRE(response_status(complete) == 200);
+    REQUIRE(complete.substr(complete.size() - 7) == "limhamn");
+
+    // cut off inside a part, and a body that never reaches a boundary at all
+    REQUIRE(response_status(post(part)) == 400);
+    REQUIRE(response_status(post("no boundary in here")) == 400);
+    // the closing boundary is missing after a complete part
+    REQUIRE(response_status(post(part + "\r\n--xyz\r\n")) == 400);
+
+    // larger than max_field_size and max_file_size
+    REQUIRE(response_status(post("--xyz\r\nContent-Disposition: form-data; name=\"name\"\r\n\r\n" + std::string(17, 'a') + "\r\n--xyz--\r\n")) == 413);
+    REQUIRE(response_status(post("--xyz\r\nContent-Disposition: form-data; name=\"file\"; filename=\"a.txt\"\r\n\r\n" + std::string(65, 'a') + "\r\n--xyz--\r\n")) == 413);
+
+    std::filesystem::remove_all(directory);
+}
+
+/**
+ * @brief Listens on 127.0.0.1:port without ever accepting, so connections succeed but nothing is answered
+ * @return int, the socket
+ */
+static int stalled_listener(const int port) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    const int yes{1};
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    REQUIRE(::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+    REQUIRE(::listen(fd, 16) == 0);
+    return fd;
+}
+
+static void test_client_pool_timeouts() {
+    const int port = test_port(1);
+    const int listener = stalled_listener(port);
+
+    limhamn::http::client::request r{};
+    r.host = "127.0.0.1";
+    r.port = static_cast<unsigned int>(port);
+    r.endpoint = "/";
+    r.timeout = 200;
+
+    const auto start = std::chrono::steady_clock::now();
+    {
+        limhamn::http::client::client_pool pool{};
+        bool thrown{false};
+        try {
+            static_cast<void>(pool.make_request(r));
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        REQUIRE(thrown);
+        REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+    }
+
+    // without a timeout, destroying the pool stops the request instead of waiting for it forever
+    std::future<limhamn::http::client::response> pending{};
+    {
+        limhamn::http::client::client_pool pool{};
+        r.timeout = -1;
+        pending = pool.make_request_async(r);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    REQUIRE(pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+    bool thrown{false};
+    try {
+        static_cast<void>(pending.get());
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    REQUIRE(thrown);
+
+    ::close(listener);
+
+    // and a server that answers still does, over a reused connection the second time
+    const int answering = test_port(2);
+    const test_server server{answering, [answering]() {
+        auto settings = test_server_settings(answering);
+        limhamn::http::server::server{settings, [](const limhamn::http::server::request&) {
+            limhamn::http::server::response response{};
+            response.body = "pooled";
+            return response;
+        }};
+    }};
+    limhamn::http::client::client_pool pool{};
+    r.port = static_cast<unsigned int>(answering);
+    r.timeout = 5000;
+    REQUIRE(pool.make_request(r).body == "pooled");
+    REQUIRE(pool.make_request(r).body == "pooled");
+}
+
+static void test_memory_session_store_errors() {
+    const auto directory = std::filesystem::temp_directory_path() / ("limhamn_test_sessions_" + std::to_string(::getpid()));
+    std::filesystem::remove_all(directory);
+
+    limhamn::http::server::memory_session_store_settings settings{};
+    settings.persistence = limhamn::http::server::session_persistence::snapshot;
+    settings.persistence_path = directory.string();
+    settings.persistence_interval = 20;
+    limhamn::http::server::memory_session_store store{settings};
+    REQUIRE(store.last_error().empty());
+
+    const auto wait_for = [](const std::function<bool()>& condition) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!condition() && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return condition();
+    };
+
+    // without an error handler the failure is kept for the caller, and the session is retried once the directory exists
+    store.store("abc", {{"key", "value"}});
+    REQUIRE(wait_for([&store]() { return !store.last_error().empty(); }));
+    std::filesystem::create_directory(directory);
+    REQUIRE(wait_for([&store]() { return store.last_error().empty(); }));
+    REQUIRE(wait_for([&directory]() { return std::filesystem::exists(directory / "session_abc.txt"); }));
+
+    std::filesystem::remove_all(directory);
+}
+
+static void test_ini_reloader() {
+    const auto path = (std::filesystem::temp_directory_path() / ("limhamn_test_" + std::to_string(::getpid()) + ".ini")).string();
+    const auto write = [&path](const std::string& data) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file << data;
+    };
+
+    write("[a]\nvalue = 1\nname = first\n");
+
+    {
+        limhamn::ini::ini_reloader reloader{path};
+        limhamn::ini::ini_handle<int> handle{reloader, "a", "value", -1};
+        REQUIRE(*handle == 1);
+
+        const auto old = reloader.snapshot();
+        const uint64_t generation = reloader.generation();
+
+        // edited in place: the old snapshot owns its bytes, so it neither changes nor faults once the file is truncated
+        write("[a]\nvalue = 2\n");
+        REQUIRE(reloader.reload());
+        REQUIRE(reloader.generation() == generation + 1);
+        REQUIRE(old->get<int>("a", "value") == 1);
+        REQUIRE(old->get<std::string_view>("a", "name") == "first");
+        REQUIRE(*handle == 2);
+        REQUIRE(reloader.snapshot()->find("a", "name") == nullptr);
+
+        // a file that cannot be read keeps the current snapshot
+        std::filesystem::remove(path);
+        REQUIRE(!reloader.reload());
+        REQUIRE(*handle == 2);
+
+        reloader.watch();
+        const uint64_t watched = reloader.generation();
+        write("[a]\nvalue = 3\n");
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (*handle != 3 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        REQUIRE(*handle == 3);
+        REQUIRE(reloader.generation() > watched);
+    }
+
+    std::filesystem::remove(path);
+}
+
+static void test_router_dispatch() {
+    const int port = test_port(3);
+    limhamn::http::server::router routes{};
+    const auto reply = [](const std::string& body) {
+        return [body](const limhamn::http::server::request_view&, const limhamn::http::server::route_params& params) {
+            limhamn::http::server::response response{};
+            response.content_type = "text/plain";
+            response.body = body + ":" + std::string(params.get("id"));
+            return response;
+        };
+    };
+    routes.get("/users/me", reply("me"));
+    routes.post("/users/{id}", reply("user"));
+
+    const test_server server{port, [port, &routes]() {
+        limhamn::http::server::server{test_server_settings(port), routes};
+    }};
+
+    const auto request = [port](const std::string& method, const std::string& target) {
+        return raw_request(port, method + " " + target + " HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    };
+
+    std::string response = request("GET", "/users/me");
+    REQUIRE(response_status(response) == 200);
+    REQUIRE(response.find("me:") != std::string::npos);
+
+    // the static segment has no POST route, so the parameter sibling takes it
+    response = request("POST", "/users/me");
+    REQUIRE(response_status(response) == 200);
+    REQUIRE(response.find("user:me") != std::string::npos);
+
+    response = request("DELETE", "/users/me");
+    REQUIRE(response_status(response) == 405);
+    REQUIRE(response.find("Allow: GET") != std::string::npos);
+
+    REQUIRE(response_status(request("GET", "/nothing")) == 404);
+}
+
+/**
+ * @brief Checks that text is one complete JSON value, without a full parser
+ */
+class json_checker {
+    std::string_view text{};
+    std::size_t pos{0};
+
+    void skip() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+            ++pos;
+        }
+    }
+    bool literal(const std::string_view word) {
+        if (text.substr(pos, word.size()) != word) {
+            return false;
+        }
+        pos += word.size();
+        return true;
+    }
+    bool string() {
+        if (pos >= text.size() || text[pos] != '"') {
+            return false;
+        }
+        for (++pos; pos < text.size(); ++pos) {
+            const auto c = static_cast<unsigned char>(text[pos]);
+            if (c == '"') {
+                ++pos;
+                return true;
+            }
+            if (c < 0x20) {
+                return false;
+            }
+            if (c == '\\') {
+                if (++pos >= text.size()) {
+                    return false;
+                }
+                if (text[pos] == 'u') {
+                    for (int i = 0; i < 4; ++i) {
+                        if (++pos >= text.size() || !std::isxdigit(static_cast<unsigned char>(text[pos]))) {
+                            return false;
+                        }
+                    }
+                } else if (std::string_view{"\"\\/bfnrt"}.find(text[pos]) == std::string_view::npos) {
+                    return false;
+                }
+            }
+        }
+        return false;
+    }
+    bool number() {
+        const std::size_t start = pos;
+        if (pos < text.size() && text[pos] == '-') {
+            ++pos;
+        }
+        while (pos < text.size() && (std::isdigit(static_cast<unsigned char>(text[pos])) || std::string_view{".eE+-"}.find(text[pos]) != std::string_view::npos)) {
+            ++pos;
+        }
+        return pos > start && std::isdigit(static_cast<unsigned char>(text[pos - 1]));
+    }
+    bool members(const char close, const bool keyed) {
+        ++pos;
+        skip();
+        if (pos < text.size() && text[pos] == close) {
+            ++pos;
+            return true;
+        }
+        while (true) {
+            skip();
+            if (keyed) {
+                if (!string()) {
+                    return false;
+                }
+                skip();
+                if (pos >= text.size() || text[pos++] != ':') {
+                    return false;
+                }
+            }
+            if (!value()) {
+                return false;
+            }
+            skip();
+            if (pos < text.size() && text[pos] == ',') {
+                ++pos;
+                continue;
+            }
+            return pos < text.size() && text[pos++] == close;
+        }
+    }
+    bool value() {
+        skip();
+        if (pos >= text.size()) {
+            return false;
+        }
+        switch (text[pos]) {
+            case '{': return members('}', true);
+            case '[': return members(']', false);
+            case '"': return string();
+            case 't': return literal("true");
+            case 'f': return literal("false");
+            case 'n': return literal("null");
+            default: return number();
+        }
+    }
+public:
+    static bool valid(const std::string_view text) {
+        json_checker checker{};
+        checker.text = text;
+        if (!checker.value()) {
+            return false;
+        }
+        checker.skip();
+        return checker.pos == text.size();
+    }
+};
+
+static void test_logger_json_fields() {
+    const auto path = (std::filesystem::temp_directory_path() / ("limhamn_test_" + std::to_string(::getpid()) + ".log")).string();
+
+    limhamn::logger::logger_properties properties{};
+    properties.output_to_std = false;
+    properties.log_date = false;
+    properties.notice_log_file = path;
+    properties.format = limhamn::logger::output_format::json;
+
+    {
+        const limhamn::logger::logger logger{properties};
+        logger.log(limhamn::logger::type::notice, "char {}", 'm',
+            limhamn::logger::field{"c", 'x'},
+            limhamn::logger::field{"quote", '"'},
+            limhamn::logger::field{"text", std::string{"a\tb"}},
+            limhamn::logger::field{"count", 3},
+            limhamn::logger::field{"ratio", 0.5},
+            limhamn::logger::field{"ok", true});
+    }
+
+    std::ifstream file(path);
+    std::string line{};
+    REQUIRE(std::getline(file, line));
+    REQUIRE(json_checker::valid(line));
+    REQUIRE(line.find("\"message\":\"char m\"") != std::string::npos);
+    REQUIRE(line.find("\"c\":\"x\"") != std::string::npos);
+    REQUIRE(line.find("\"quote\":\"\\\"\"") != std::string::npos);
+    REQUIRE(line.find("\"count\":3") != std::string::npos);
+    REQUIRE(!std::getline(file, line));
+
+    std::filesystem::remove(path);
+}
+
+static void test_string_kernel_parity() {
+    namespace impl = _limhamn_http_utils_impl;
+    std::mt19937 random{20250307};
+    // mostly bytes that need no work, so the first hit lands anywhere in a vector or in the tail
+    const std::string_view common{"abcXYZ019-_.~ "};
+    const std::string_view special{"<>&\"'\\%/+\x80\xff"};
+    std::array<char, 160> buffer{};
+
+    const auto check = [&buffer](const std::size_t offset, const std::size_t length) {
+        const char* data = buffer.data() + offset;
+        REQUIRE(impl::find_html_special(data, length) == impl::scan(impl::html_special, data, length, 0));
+        REQUIRE(impl::find_url_reserved(data, length) == impl::scan(impl::url_reserved, data, length, 0));
+    };
+
+    for (int round = 0; round < 20000; ++round) {
+        // every length up to and across two AVX2 vectors, at every misalignment of a 16 byte load
+        const std::size_t length = static_cast<std::size_t>(round) % 97;
+        const std::size_t offset = static_cast<std::size_t>(round / 97) % 16;
+        for (std::size_t i = 0; i < offset + length; ++i) {
+            buffer[i] = common[random() % common.size()];
+        }
+        if (length != 0 && random() % 4 != 0) {
+            buffer[offset + random() % length] = special[random() % special.size()];
+        }
+        check(offset, length);
+    }
+
+    // a hit in every single position, including the last byte of each vector and the first of the tail
+    for (std::size_t length = 1; length <= 96; ++length) {
+        for (std::size_t at = 0; at < length; ++at) {
+            std::fill(buffer.begin(), buffer.begin() + static_cast<std::ptrdiff_t>(length + 1), 'a');
+            buffer[1 + at] = '<';
+            check(1, length);
+            buffer[1 + at] = '%';
+            check(1, length);
+        }
+    }
+
+    std::string text{};
+    for (int i = 0; i < 200; ++i) {
+        text += static_cast<char>(random() % 256);
+        REQUIRE(limhamn::http::utils::urldecode(limhamn::http::utils::urlencode(text)) == text);
+    }
+}
+
+static std::string sqlite_count(const limhamn::database::sqlite3_database& db, const std::string& table) {
+    const auto rows = db.query("SELECT COUNT(*) AS n FROM " + table + ";");
+    return rows.empty() ? std::string{} : rows.front().at("n");
+}
+
+static void test_sqlite_statement_cache() {
+    limhamn::database::sqlite3_database db{":memory:"};
+    REQUIRE(db.good());
+    REQUIRE(db.exec("CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT);"));
+    for (int i = 1; i <= 5; ++i) {
+        REQUIRE(db.exec("INSERT INTO t (id, name) VALUES (?, ?);", i, "name" + std::to_string(i)));
+    }
+
+    // the open cursor's statement must survive the queries that push it out of a one entry cache
+    db.set_statement_cache_size(1);
+    {
+        auto cursor = db.cursor("SELECT id FROM t ORDER BY id;");
+        REQUIRE(cursor.next());
+        REQUIRE(cursor.row().get<int>(0) == 1);
+        for (int i = 2; i <= 4; ++i) {
+            const auto rows = db.query("SELECT name FROM t WHERE id = ?;", i);
+            REQUIRE(rows.size() == 1);
+            REQUIRE(rows.front().at("name") == "name" + std::to_string(i));
+            REQUIRE(db.query("SELECT COUNT(*) AS n FROM t WHERE id > ?;", i).front().at("n") == std::to_string(5 - i));
+        }
+        for (int i = 2; i <= 5; ++i) {
+            REQUIRE(cursor.next());
+            REQUIRE(cursor.row().get<int>(0) == i);
+        }
+        REQUIRE(!cursor.next());
+    }
+    REQUIRE(db.for_each("SELECT id FROM t ORDER BY id;", [](const limhamn::database::sqlite3_row&) {}) == 5);
+
+    // the same query while a cursor over it is open gets its own statement, and stepping one leaves the other alone
+    db.set_statement_cache_size(64);
+    {
+        const std::string query{"SELECT id, name FROM t WHERE id >= ? ORDER BY id;"};
+        auto cursor = db.cursor(query, 1);
+        REQUIRE(cursor.next());
+        REQUIRE(cursor.row().get<int>("id") == 1);
+        const auto rows = db.query(query, 3);
+        REQUIRE(rows.size() == 3);
+        REQUIRE(rows.front().at("id") == "3");
+        REQUIRE(cursor.next());
+        REQUIRE(cursor.row().get<int>("id") == 2);
+        REQUIRE(cursor.row().get<std::string>("name") == "name2");
+
+        auto moved = std::move(cursor);
+        REQUIRE(!cursor.next());
+        REQUIRE(moved.next());
+        REQUIRE(moved.row().get<int>("id") == 3);
+    }
+    REQUIRE(db.query("SELECT id, name FROM t WHERE id >= ? ORDER BY id;", 5).size() == 1);
+
+    // a cached statement is prepared again after the schema changes
+    const std::string select{"SELECT * FROM t WHERE id = ?;"};
+    REQUIRE(db.query(select, 1).front().size() == 2);
+    REQUIRE(db.exec("ALTER TABLE t ADD COLUMN extra TEXT DEFAULT 'x';"));
+    const auto altered = db.query(select, 1);
+    REQUIRE(altered.size() == 1);
+    REQUIRE(altered.front().size() == 3);
+    REQUIRE(altered.front().at("extra") == "x");
+
+    REQUIRE(db.exec("DROP TABLE t;"));
+    REQUIRE(db.exec("CREATE TABLE t (id INTEGER PRIMARY KEY, other TEXT);"));
+    REQUIRE(db.exec("INSERT INTO t (id, other) VALUES (?, ?);", 1, "replaced"));
+    const auto recreated = db.query(select, 1);
+    REQUIRE(recreated.size() == 1);
+    REQUIRE(recreated.front().size() == 2);
+    REQUIRE(recreated.front().at("other") == "replaced");
+
+    db.set_statement_cache_size(0);
+    REQUIRE(db.query(select, 1).front().at("other") == "replaced");
+}
+
+static void test_sqlite_transactions() {
+    using transaction = limhamn::database::transaction<limhamn::database::sqlite3_database>;
+
+    limhamn::database::sqlite3_database db{":memory:"};
+    REQUIRE(db.good());
+    REQUIRE(db.exec("CREATE TABLE t (id INTEGER PRIMARY KEY, name TEXT, score REAL);"));
+
+    {
+        transaction tx{db};
+        REQUIRE(db.exec("INSERT INTO t (id, name) VALUES (?, ?);", 1, "rolled back"));
+        REQUIRE(sqlite_count(db, "t") == "1");
+        tx.rollback();
+    }
+    REQUIRE(sqlite_count(db, "t") == "0");
+    {
+        const transaction tx{db};
+        REQUIRE(db.exec("INSERT INTO t (id, name) VALUES (?, ?);", 1, "destroyed"));
+    }
+    REQUIRE(sqlite_count(db, "t") == "0");
+    {
+        transaction tx{db};
+        REQUIRE(db.exec("INSERT INTO t (id, name) VALUES (?, ?);", 1, "committed"));
+        tx.commit();
+    }
+    REQUIRE(sqlite_count(db, "t") == "1");
+
+    const std::vector<std::string> columns{"id", "name", "score"};
+    const std::vector<std::tuple<int, std::optional<std::string>, double>> rows{{2, "two", 2.5}, {3, std::nullopt, 3.5}};
+    REQUIRE(db.bulk_insert("t", columns, rows) == 2);
+    const std::vector<std::vector<std::string>> text_rows{{"4", "four", "4.5"}};
+    REQUIRE(db.bulk_insert("t", columns, text_rows) == 1);
+    REQUIRE(sqlite_count(db, "t") == "4");
+
+    std::size_t nulls{0};
+    REQUIRE(db.for_each("SELECT name, score FROM t WHERE id > ? ORDER BY id;", [&nulls](const limhamn::database::sqlite3_row& row) {
+        nulls += row.is_null(0);
+        REQUIRE(row.get<double>(1) > 2.0);
+    }, 1) == 3);
+    REQUIRE(nulls == 1);
+
+    // a failing row undoes the whole implicit transaction
+    const std::vector<std::tuple<int, std::string, std::nullptr_t>> duplicate{{5, "five", nullptr}, {2, "again", nullptr}};
+    bool thrown{false};
+    try {
+        static_cast<void>(db.bulk_insert("t", columns, duplicate));
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    REQUIRE(thrown);
+    REQUIRE(sqlite_count(db, "t") == "4");
+
+    // inside the caller's transaction the rows are the caller's to keep or discard
+    {
+        const transaction tx{db};
+        const std::vector<std::tuple<int, std::string, double>> more{{5, "five", 5.5}, {6, "six", 6.5}};
+        REQUIRE(db.bulk_insert("t", columns, more) == 2);
+        REQUIRE(sqlite_count(db, "t") == "6");
+    }
+    REQUIRE(sqlite_count(db, "t") == "4");
+
+    thrown = false;
+    try {
+        static_cast<void>(db.bulk_insert("t", {}, rows));
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    REQUIRE(thrown);
+}
+
+static void test_logger_async() {
+    const auto path = (std::filesystem::temp_directory_path() / ("limhamn_test_async_" + std::to_string(::getpid()) + ".log")).string();
+    constexpr int total{5000};
+
+    limhamn::logger::logger_properties properties{};
+    properties.output_to_std = false;
+    properties.log_date = false;
+    properties.notice_log_file = path;
+    properties.async = true;
+    properties.async_queue_size = 4;
+
+    const auto read_lines = [&path]() {
+        std::vector<std::string> ret{};
+        std::ifstream file(path);
+        for (std::string line{}; std::getline(file, line);) {
+            ret.push_back(std::move(line));
+        }
+        return ret;
+    };
+
+    // block: a full queue makes the caller wait, and everything is written once the logger is gone
+    {
+        const limhamn::logger::logger logger{properties};
+        for (int i = 0; i < total; ++i) {
+            logger.log(limhamn::logger::type::notice, "line {}", i);
+        }
+        REQUIRE(logger.dropped() == 0);
+    }
+    auto lines = read_lines();
+    REQUIRE(lines.size() == static_cast<std::size_t>(total));
+    for (int i = 0; i < total; ++i) {
+        REQUIRE(lines[i] == "[NOTICE]: line " + std::to_string(i));
+    }
+    std::filesystem::remove(path);
+
+    // flush() waits for the queue without stopping the logger
+    {
+        const limhamn::logger::logger logger{properties};
+        logger.log(limhamn::logger::type::notice, "first");
+        logger.flush();
+        REQUIRE(read_lines() == std::vector<std::string>{"[NOTICE]: first"});
+        logger.log(limhamn::logger::type::notice, "second");
+    }
+    REQUIRE(read_lines().size() == 2);
+    std::filesystem::remove(path);
+
+    // count: what does not fit is dropped, and the notes add up to dropped()
+    properties.async_overflow = limhamn::logger::overflow::count;
+    std::size_t dropped{0};
+    {
+        const limhamn::logger::logger logger{properties};
+        for (int i = 0; i < total; ++i) {
+            logger.log(limhamn::logger::type::notice, "line {}", i);
+        }
+        dropped = logger.dropped();
+    }
+    const std::string note{" log messages dropped because the queue was full"};
+    std::size_t written{0};
+    std::size_t noted{0};
+    int last{-1};
+    for (const auto& it : read_lines()) {
+        const std::string prefix{"[NOTICE]: line "};
+        if (it.compare(0, prefix.size(), prefix) == 0) {
+            const int number = std::stoi(it.substr(prefix.size()));
+            REQUIRE(number > last);
+            last = number;
+            ++written;
+        } else {
+            REQUIRE(it.size() > note.size() && it.compare(it.size() - note.size(), note.size(), note) == 0);
+            noted += std::stoul(it.substr(10));
+        }
+    }
+    REQUIRE(written + dropped == static_cast<std::size_t>(total));
+    REQUIRE(noted == dropped);
+    std::filesystem::remove(path);
+}
+
+static void test_smtp_encoding() {
+    namespace impl = _limhamn_smtp_client_impl;
+    std::mt19937 random{20250307};
+
+    for (std::size_t size : {0, 1, 2, 3, 56, 57, 58, 113, 114, 115, 1000}) {
+        std::string data(size, '\0');
+        for (auto& it : data) {
+            it = static_cast<char>(random() % 256);
+        }
+
+        std::string lines{};
+        impl::base64_lines::append(reinterpret_cast<const unsigned char*>(data.data()), data.size(), lines);
+
+        // whole line_input pieces encode to the same lines as one call
+        std::string pieces{};
+        for (std::size_t pos = 0; pos < size; pos += 2 * impl::base64_lines::line_input) {
+            const std::size_t length = (std::min)(size - pos, 2 * impl::base64_lines::line_input);
+            impl::base64_lines::append(reinterpret_cast<const unsigned char*>(data.data()) + pos, length, pieces);
+        }
+        REQUIRE(pieces == lines);
+
+        std::string joined{};
+        std::size_t pos{0};
+        while (pos < lines.size()) {
+            const std::size_t end = lines.find("\r\n", pos);
+            REQUIRE(end != std::string::npos);
+            REQUIRE(end - pos <= 76);
+            if (end + 2 < lines.size()) {
+                REQUIRE(end - pos == 76);
+            }
+            joined.append(lines, pos, end - pos);
+            pos = end + 2;
+        }
+        REQUIRE(joined == impl::base64_encode(data));
+    }
+
+    const std::string body{".start\r\nmiddle.\r\n.\r\n..two\r\nend."};
+    const std::string stuffed{"..start\r\nmiddle.\r\n..\r\n...two\r\nend."};
+    for (std::size_t split = 0; split <= body.size(); ++split) {
+        impl::dot_stuffer stuffer{};
+        std::string out{};
+        stuffer.append(body.substr(0, split), out);
+        stuffer.append(body.substr(split), out);
+        REQUIRE(out == stuffed);
+    }
+}
+
+#ifdef LIMHAMN_TEST_UDS
+static void test_uds_framing() {
+    const auto path = (std::filesystem::temp_directory_path() / ("limhamn_test_" + std::to_string(::getpid()) + ".sock")).string();
+    const auto echo = [](const std::string& request) {
+        return "re:" + request;
+    };
+
+    limhamn::socket::uds_server_settings settings{};
+    settings.read_delimiter = "";
+    bool thrown{false};
+    try {
+        limhamn::socket::uds_server server{path, echo, settings};
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    REQUIRE(thrown);
+
+    for (const auto framing : {limhamn::socket::uds_framing::delimiter, limhamn::socket::uds_framing::length_prefixed}) {
+        settings.framing = framing;
+        settings.read_delimiter = "\r\n";
+        // few requests may be in flight, so the server has to stop reading and resume as replies are written
+        settings.max_in_flight = 4;
+        settings.threads = 2;
+
+        limhamn::socket::uds_server server{path, [&echo, framing](const std::string& request) {
+            // delimiter mode replies are written as they are, so the reply carries its own delimiter
+            return framing == limhamn::socket::uds_framing::delimiter ? echo(request) + "\r\n" : echo(request);
+        }, settings};
+        std::thread thread{[&server]() {
+            server.run();
+        }};
+
+        {
+            limhamn::socket::uds_client client{path, settings};
+            REQUIRE(client.request("ping") == "re:ping");
+
+            // pipelined requests, some larger than one read, and a delimiter split across two reads
+            std::vector<std::string> requests{};
+            for (std::size_t i = 0; i < 300; ++i) {
+                requests.push_back(std::to_string(i) + std::string(i % 50 == 0 ? 70000 : i, 'x'));
+            }
+            if (framing == limhamn::socket::uds_framing::length_prefixed) {
+                requests.push_back(std::string{"binary\0\r\n\xff", 10});
+            }
+            for (const auto& it : requests) {
+                client.send(it);
+            }
+            for (const auto& it : requests) {
+                REQUIRE(client.receive() == "re:" + it);
+            }
+        }
+
+        server.stop();
+        thread.join();
+    }
+
+    settings.framing = limhamn::socket::uds_framing::delimiter;
+    settings.read_delimiter = "";
+    thrown = false;
+    try {
+        limhamn::socket::uds_client client{path, settings};
+    } catch (const std::invalid_argument&) {
+        thrown = true;
+    }
+    REQUIRE(thrown);
+
+    std::filesystem::remove(path);
+}
+#endif
+
+#ifdef LIMHAMN_TEST_PRIMITIVE
+static void test_primitive_damage() {
+    constexpr int width{200};
+    constexpr int height{100};
+    std::vector<uint32_t> canvas(width * height, 0);
+    limhamn::primitive::draw_manager manager{canvas.data(), width, height};
+
+    // everything is damaged until the first map
+    REQUIRE(manager.get_damage().size() == 1);
+    REQUIRE(manager.get_damage().front().w == width);
+    manager.map();
+    REQUIRE(manager.get_damage().empty());
+
+    const limhamn::primitive::draw_properties red{"#ff0000", "#ff0000"};
+    const auto same = [](const limhamn::primitive::draw_position& a, const limhamn::primitive::draw_position& b) {
+        return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+    };
+
+    // rectangles grow by a pixel for antialiasing, and overlapping ones merge
+    manager.draw_rect({10, 10, 20, 20}, red);
+    REQUIRE(manager.get_damage().size() == 1);
+    REQUIRE(same(manager.get_damage().front(), {9, 9, 22, 22}));
+    manager.draw_rect({25, 10, 20, 20}, red);
+    REQUIRE(manager.get_damage().size() == 1);
+    REQUIRE(same(manager.get_damage().front(), {9, 9, 37, 22}));
+
+    // clipped to the drawing area, and kept apart from what it does not touch
+    manager.draw_rect({-5, -5, 8, 8}, red);
+    manager.draw_rect({190, 90, 20, 20}, red);
+    const auto damage = manager.get_damage();
+    REQUIRE(damage.size() == 3);
+    REQUIRE(std::any_of(damage.begin(), damage.end(), [&same](const auto& it) { return same(it, {0, 0, 4, 4}); }));
+    REQUIRE(std::any_of(damage.begin(), damage.end(), [&same](const auto& it) { return same(it, {189, 89, 11, 11}); }));
+
+    manager.invalidate();
+    REQUIRE(same(manager.get_damage().front(), {0, 0, width, height}));
+    manager.map();
+    REQUIRE(manager.get_damage().empty());
+
+    // batching rectangles of one color must not change what ends up on top
+    limhamn::primitive::draw_frame frame{};
+    const uint32_t r = limhamn::primitive::draw_frame::pack_color("#ff0000");
+    const uint32_t b = limhamn::primitive::draw_frame::pack_color("#0000ff");
+    frame.draw_rect({0, 0, 50, 50}, r);
+    frame.draw_rect({25, 25, 50, 50}, b);
+    frame.draw_rect({100, 0, 20, 20}, r);
+    frame.draw_rect({40, 40, 10, 10}, r);
+    frame.draw_rect({110, 10, 20, 20}, b);
+    manager.submit(frame);
+    manager.map();
+
+    const auto pixel = [&canvas](const int x, const int y) {
+        return canvas[static_cast<std::size_t>(y * width + x)];
+    };
+    REQUIRE(pixel(5, 5) == 0xFFFF0000U);
+    REQUIRE(pixel(30, 30) == 0xFF0000FFU);
+    REQUIRE(pixel(45, 45) == 0xFFFF0000U);
+    REQUIRE(pixel(70, 70) == 0xFF0000FFU);
+    REQUIRE(pixel(105, 5) == 0xFFFF0000U);
+    REQUIRE(pixel(115, 15) == 0xFF0000FFU);
+}
+
+static void test_primitive_text() {
+    limhamn::primitive::font_manager font{"Sans 12"};
+    const std::string text{"\xc3\xa5\xc3\xa4\xc3\xb6 \xe2\x82\xac\xe2\x82\xac caf\xc3\xa9 \xf0\x9f\x98\x80 na\xc3\xafve"};
+    const int full = font.estimate_length(text, -1, false).first;
+    REQUIRE(full > 0);
+
+    // by default plain ASCII is laid out like anything else, so kerning is accounted for
+    const std::string kerned{"AVAVA To Ty WAVE"};
+    pango_layout_set_text(&font.get_layout(), kerned.c_str(), -1);
+    PangoRectangle logical{};
+    pango_layout_get_extents(&font.get_layout(), nullptr, &logical);
+    REQUIRE(font.estimate_length(kerned, -1, false).first == logical.width / PANGO_SCALE);
+
+    const auto boundary = [&text](const int length) {
+        return length == static_cast<int>(text.size()) || (static_cast<unsigned char>(text[static_cast<std::size_t>(length)]) & 0xC0) != 0x80;
+    };
+
+    REQUIRE(font.fit_length(text, full, false) == static_cast<int>(text.size()));
+    for (int width = 0; width < full; width += 3) {
+        const int length = font.fit_length(text, width, false);
+        REQUIRE(length < static_cast<int>(text.size()));
+        REQUIRE(boundary(length));
+        REQUIRE(length == 0 || font.estimate_length(text, length, false).first <= width);
+    }
+
+    // the ellipsis replaces whole characters, so what is shown is still valid UTF-8
+    std::vector<uint32_t> canvas(200 * 40, 0);
+    limhamn::primitive::draw_manager manager{canvas.data(), 200, 40};
+    manager.initialize_font("Sans 12");
+    for (int width = full / 4; width < full; width += 5) {
+        static_cast<void>(manager.draw_text({0, 0, width, 40}, 0, text, false, {"#ffffff", "#000000"}));
+        const std::string shown{pango_layout_get_text(&manager.get_font_manager().get_layout())};
+        REQUIRE(shown.size() >= 3 && shown.compare(shown.size() - 3, 3, "...") == 0);
+        REQUIRE(text.compare(0, shown.size() - 3, shown, 0, shown.size() - 3) == 0);
+        REQUIRE(boundary(static_cast<int>(shown.size()) - 3));
+    }
+}
+#endif
+
 int main() {
     REQUIRE(1==1); // just to test the REQUIRE macro
+
+    test_ini_table_get();
+    test_ini_table_parse();
+    test_ini_reloader();
+    test_multipart_body_sink();
+    test_client_pool_timeouts();
+    test_router_dispatch();
+    test_memory_session_store_errors();
+    test_logger_json_fields();
+    test_string_kernel_parity();
+    test_sqlite_statement_cache();
+    test_sqlite_transactions();
+    test_logger_async();
+    test_smtp_encoding();
+#ifdef LIMHAMN_TEST_UDS
+    test_uds_framing();
+#endif
+#ifdef LIMHAMN_TEST_PRIMITIVE
+    test_primitive_damage();
+    test_primitive_text();
+#endif
 }
\ No newline at end of file